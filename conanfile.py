@@ -58,7 +58,7 @@ class Recipe(ConanFile):
         "rapidhash/1.0",
         "spdlog/1.15.1",
     ]
-    test_requires = ["boost-ext-ut/1.1.9"]
+    test_requires = ["boost-ext-ut/1.1.9", "benchmark/1.9.1"]
     default_options = BOOST_DEFAULT_OPTIONS
 
     def layout(self):
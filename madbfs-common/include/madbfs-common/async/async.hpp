@@ -68,7 +68,8 @@ namespace madbfs::async
     using Executor  = Context::executor_type;
     using WorkGuard = asio::executor_work_guard<Executor>;
 
-    using Timer = Token::as_default_on_t<asio::steady_timer>;
+    using Timer     = Token::as_default_on_t<asio::steady_timer>;
+    using SignalSet = Token::as_default_on_t<asio::signal_set>;
 
     template <typename T>
     using Channel = Token::as_default_on_t<asio::experimental::channel<void(error_code, T)>>;
@@ -231,6 +232,15 @@ namespace madbfs::async
         using Socket   = Token::as_default_on_t<Proto::socket>;
     }
 
+    // stream socket of any family, tcp and unix sockets can be moved into it
+    namespace generic
+    {
+        using Proto    = asio::generic::stream_protocol;
+        using Endpoint = Proto::endpoint;
+        using Acceptor = Token::as_default_on_t<Proto::acceptor>;
+        using Socket   = Token::as_default_on_t<Proto::socket>;
+    }
+
     namespace pipe
     {
         using Write = Token::as_default_on_t<asio::writable_pipe>;
@@ -0,0 +1,103 @@
+#pragma once
+
+#include "madbfs-common/aliases.hpp"
+#include "madbfs-common/async/async.hpp"
+
+#include <chrono>
+#include <random>
+
+namespace madbfs::link
+{
+    using Clock    = std::chrono::steady_clock;
+    using Duration = std::chrono::microseconds;
+
+    /**
+     * @class Profile
+     * @brief Characteristic of an emulated link.
+     *
+     * Each value applies to one direction independently, i.e. a round trip pays the latency twice.
+     */
+    struct Profile
+    {
+        Duration latency        = {};    // one-way latency
+        Duration jitter         = {};    // latency is randomized uniformly in [latency - jitter, latency + jitter]
+        u64      bandwidth      = 0;     // in bytes per second, 0 means unlimited
+        usize    frame_overhead = 0;     // extra bytes accounted for each frame (e.g. adb/usb packet header)
+        u64      seed           = 0;     // seed of the jitter, the same seed gives the same latencies
+
+        bool operator==(const Profile&) const = default;
+    };
+
+    enum class Direction : u8
+    {
+        Uplink,      // client -> server
+        Downlink,    // server -> client
+    };
+
+    /**
+     * @brief Parse link profile from a string.
+     *
+     * @param spec Comma separated key-value list, optionally starting with a preset name.
+     *
+     * The presets are `usb2`, `usb3`, and `wifi`. The key-value list accepts `lat` (ms), `jitter` (ms),
+     * `bw` (KiB/s), `overhead` (bytes), and `seed`, e.g. `lat=5,jitter=1,bw=4096,overhead=64`. The keys
+     * override the preset (e.g. `wifi,seed=7`); without a preset, unspecified keys are set to zero.
+     */
+    Opt<Profile> parse_profile(Str spec);
+
+    /**
+     * @class Emulator
+     * @brief Emulate a link with limited bandwidth and non-zero latency.
+     *
+     * Frames on the same direction are serialized: a frame can't start transmitting until the previous one
+     * finishes, and frames are delivered in the order they are sent (like TCP). The emulator doesn't touch
+     * the data, it only computes and waits for the time at which a frame would be sent and delivered.
+     */
+    class Emulator
+    {
+    public:
+        struct Schedule
+        {
+            Clock::time_point sent;         // the time last byte of the frame leaves the sender
+            Clock::time_point delivered;    // the time last byte of the frame arrives at the receiver
+        };
+
+        Emulator(Profile profile)
+            : m_profile{ profile }
+            , m_rng{ profile.seed }
+        {
+        }
+
+        /**
+         * @brief Compute the schedule of a frame.
+         *
+         * @param dir Direction of the frame.
+         * @param size Size of the frame in bytes (without overhead).
+         * @param now The time the frame is ready to be sent.
+         *
+         * This function updates internal state of the link so it must be called exactly once per frame.
+         */
+        Schedule schedule(Direction dir, usize size, Clock::time_point now);
+
+        /**
+         * @brief Wait until the given time point.
+         *
+         * @param time Time point to wait for.
+         */
+        static Await<void> wait_until(Clock::time_point time);
+
+        const Profile& profile() const { return m_profile; }
+
+    private:
+        struct State
+        {
+            Clock::time_point busy_until     = {};
+            Clock::time_point last_delivered = {};
+        };
+
+        Profile         m_profile;
+        std::mt19937_64 m_rng;
+        State           m_uplink;
+        State           m_downlink;
+    };
+}
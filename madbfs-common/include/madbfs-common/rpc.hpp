@@ -2,6 +2,8 @@
 
 #include "madbfs-common/aliases.hpp"
 #include "madbfs-common/async/async.hpp"
+#include "madbfs-common/link.hpp"
+#include "madbfs-common/stats.hpp"
 #include "madbfs-common/util/var_wrapper.hpp"
 
 #include <saf.hpp>
@@ -11,7 +13,56 @@
 
 namespace madbfs::rpc
 {
-    using Socket = async::tcp::Socket;
+    using Socket = async::generic::Socket;
+
+    /**
+     * @class Address
+     * @brief Socket an RPC server listens on, written in the notation of `adb forward`.
+     *
+     * `tcp:<port>` is a TCP port on localhost, `localabstract:<name>` is a Unix socket in the abstract
+     * namespace, and `localfilesystem:<path>` is a Unix socket bound to a path. Unix sockets bypass the TCP
+     * loopback stack of the device, and abstract names don't collide with ports used by anything else.
+     */
+    struct Address
+    {
+        enum class Kind
+        {
+            Tcp,
+            Abstract,
+            Filesystem,
+        };
+
+        // sun_path minus the terminating null byte, which asio also requires for abstract names on top of
+        // the leading null byte
+        static constexpr usize max_name_len = 106;
+
+        Kind   kind = Kind::Tcp;
+        u16    port = 0;     // tcp only
+        String name = {};    // abstract name or path, unix socket only
+
+        /**
+         * @brief Parse address from `tcp:<port>`, `localabstract:<name>`, or `localfilesystem:<path>`.
+         */
+        static Opt<Address> parse(Str str);
+
+        static Address tcp(u16 port) { return { .kind = Kind::Tcp, .port = port }; }
+        static Address abstract(Str name) { return { .kind = Kind::Abstract, .name = String{ name } }; }
+
+        /**
+         * @brief Format the address back into the notation accepted by `parse` and `adb forward`.
+         */
+        String to_string() const;
+
+        /**
+         * @brief Endpoint to connect to, tcp address resolves to localhost.
+         */
+        async::generic::Endpoint endpoint() const;
+
+        bool operator==(const Address&) const = default;
+    };
+
+    // abstract socket name the server listens on by default when launched through adb
+    static constexpr Str default_socket_name = "madbfs";
 
     // NOTE: if you decided to add/remove one or more entries, do update domain check in read_procedure
     enum class Procedure : u8
@@ -29,6 +80,11 @@ namespace madbfs::rpc
         Write,
         Utimens,
         CopyFileRange,
+        ReadMany,
+        WriteMany,
+        Fallocate,
+        Lseek,
+        ServerStats,
     };
 
     enum class Status : u8
@@ -41,6 +97,9 @@ namespace madbfs::rpc
         IsADirectory          = EISDIR,
         InvalidArgument       = EINVAL,    // generic error
         DirectoryNotEmpty     = ENOTEMPTY,
+        NoSpaceLeftOnDevice   = ENOSPC,
+        NoSuchDeviceOrAddress = ENXIO,    // lseek past the last data or hole
+        OperationNotSupported = EOPNOTSUPP,
     };
 
     class Id
@@ -84,7 +143,36 @@ namespace madbfs::rpc
         struct Write         { Str path; off_t offset; Span<const u8> in; };
         struct Utimens       { Str path; timespec atime; timespec mtime; };
         struct CopyFileRange { Str in_path; off_t in_offset; Str out_path; off_t out_offset; usize size; };
+        struct Fallocate     { Str path; i32 mode; off_t offset; off_t length; };
+        struct Lseek         { Str path; off_t offset; i32 whence; };
         // clang-format on
+
+        // read the start of many files at once, each up to its own size
+        struct ReadMany
+        {
+            Vec<Pair<Str, usize>> files;
+        };
+
+        // create (or replace), write, set times, and close each file as a single operation
+        struct WriteMany
+        {
+            struct Entry
+            {
+                Str            path;
+                mode_t         mode;
+                Span<const u8> in;
+                timespec       atime;    // UTIME_OMIT to leave as is
+                timespec       mtime;    // UTIME_OMIT to leave as is
+            };
+
+            Vec<Entry> files;
+        };
+
+        // timings of the requests handled by the server so far, optionally starting over after this one
+        struct ServerStats
+        {
+            bool reset;
+        };
     }
 
     struct Request    //
@@ -101,7 +189,12 @@ namespace madbfs::rpc
               req::Read,
               req::Write,
               req::Utimens,
-              req::CopyFileRange>
+              req::CopyFileRange,
+              req::ReadMany,
+              req::WriteMany,
+              req::Fallocate,
+              req::Lseek,
+              req::ServerStats>
     {
         // make the base constructor visible
         using VarWrapper::VarWrapper;
@@ -113,11 +206,6 @@ namespace madbfs::rpc
     {
         struct Stat;
 
-        struct Listdir
-        {
-            Vec<Pair<Str, Stat>> entries;
-        };
-
         struct Stat
         {
             off_t    size;
@@ -130,19 +218,85 @@ namespace madbfs::rpc
             gid_t    gid;
         };
 
+        struct Listdir
+        {
+            struct Entry
+            {
+                Str  name;
+                Stat stat;
+                Str  target;    // target of symlink as is, empty for other file types
+            };
+
+            Vec<Entry> entries;
+        };
+
+        // NOTE: mutations carry the stat of the file after the operation (the destination for rename) so the
+        //       client doesn't need another round trip for it, empty if the server failed to get it
         // clang-format off
         struct Readlink         { Str target; };
-        struct Mkdir            { };
-        struct Mknod            { };
+        struct Mkdir            { Opt<Stat> stat; };
+        struct Mknod            { Opt<Stat> stat; };
         struct Unlink           { };
         struct Rmdir            { };
-        struct Rename           { };
-        struct Truncate         { };
+        struct Rename           { Opt<Stat> stat; };
+        struct Truncate         { Opt<Stat> stat; };
         struct Read             { Span<const u8> read; };
         struct Write            { usize size; };
-        struct Utimens          { };
+        struct Utimens          { Opt<Stat> stat; };
         struct CopyFileRange    { usize size; };
+        struct Fallocate        { Opt<Stat> stat; };
+        struct Lseek            { off_t offset; };
         // clang-format on
+
+        // entries are in the same order as the files in the request, failure of one file doesn't fail the
+        // whole request
+        struct ReadMany
+        {
+            struct Entry
+            {
+                Status         status;
+                Span<const u8> read;    // empty if status is not Success
+            };
+
+            Vec<Entry> entries;
+        };
+
+        struct WriteMany
+        {
+            struct Entry
+            {
+                Status    status;
+                Opt<Stat> stat;    // stat after the operation, see NOTE on mutations above
+            };
+
+            Vec<Entry> entries;
+        };
+
+        // only procedures that have been handled are listed, durations are in ns
+        struct ServerStats
+        {
+            struct Timing
+            {
+                u64 sum;
+                u64 p50;
+                u64 p99;
+                u64 max;
+            };
+
+            struct Entry
+            {
+                Procedure proc;
+                u64       count;
+                u64       errors;
+                u64       bytes;     // request payload and response frame
+                Timing    queue;     // payload received until handler starts
+                Timing    handle;    // handler, mostly syscalls
+                Timing    encode;    // building response frame
+                Timing    send;      // writing response frame to socket
+            };
+
+            Vec<Entry> entries;
+        };
     }
 
     struct Response    //
@@ -159,7 +313,12 @@ namespace madbfs::rpc
               resp::Read,
               resp::Write,
               resp::Utimens,
-              resp::CopyFileRange>
+              resp::CopyFileRange,
+              resp::ReadMany,
+              resp::WriteMany,
+              resp::Fallocate,
+              resp::Lseek,
+              resp::ServerStats>
     {
         // make the base constructor visible
         using VarWrapper::VarWrapper;
@@ -223,6 +382,7 @@ namespace madbfs::rpc
         Client(Socket socket)
             : m_socket{ std::move(socket) }
             , m_channel{ socket.get_executor(), 4096 }
+            , m_meters{ meters_of(stats::registry()) }
         {
         }
 
@@ -233,25 +393,115 @@ namespace madbfs::rpc
         AExpect<Response> send_req(Vec<u8>& buffer, Request req);
         void              stop();
 
+        /**
+         * @brief Emulate a link with given profile on top of the socket.
+         *
+         * @param profile Link profile, std::nullopt to disable emulation.
+         *
+         * Outgoing frames are held until the emulated link is free and responses are only delivered to
+         * their caller after the emulated latency has elapsed. Useful for benchmarking on loopback.
+         */
+        void emulate_link(Opt<link::Profile> profile);
+
+        /**
+         * @brief Record the stats of this client into given registry instead of the process-wide one.
+         *
+         * Must be called before the client is started, otherwise in-flight gauges are left unbalanced.
+         */
+        void report_to(stats::Registry& registry);
+
     private:
+        using RespPromise = saf::promise<Expect<Response>>;
+
+        struct Meters
+        {
+            stats::Registry* registry;
+            stats::Gauge*    in_flight;
+            stats::Gauge*    in_flight_bytes;
+            stats::Counter*  sent_bytes;
+            stats::Counter*  received_bytes;
+        };
+
+        static Meters meters_of(stats::Registry& registry);
+
+        /**
+         * @brief Get the metric of a procedure, looked up once and cached so recording is lock-free.
+         */
+        stats::Metric& metric_of(Procedure proc);
+
         struct Promise
         {
-            Vec<u8>&                       buffer;
-            saf::promise<Expect<Response>> promise;
+            Vec<u8>&    buffer;
+            RespPromise promise;
         };
 
         using Inflight = std::unordered_map<Id, Promise, Id::Hash>;
+        using Arrivals = std::unordered_map<Id, link::Clock::time_point, Id::Hash>;
         using Channel  = async::Channel<std::tuple<Id, Span<const u8>>>;
 
         AExpect<void> receive();
         AExpect<void> send();
 
+        /**
+         * @brief Fulfill the promise of a request, delayed by the emulated link if enabled.
+         */
+        void resolve(Id id, RespPromise promise, Expect<Response> response, usize size);
+
         Socket  m_socket;
         Channel m_channel;
 
         Inflight  m_requests;
         Id::Inner m_counter = 0;
         bool      m_running = false;
+
+        Opt<link::Emulator> m_link;
+        Arrivals            m_arrivals;    // emulated arrival time of requests on the server
+
+        Meters                     m_meters;
+        Array<stats::Metric*, 256> m_metrics = {};    // indexed by procedure
+    };
+
+    /**
+     * @class BufferSource
+     * @brief Source of buffers used by Server for request payloads and response frames.
+     */
+    class BufferSource
+    {
+    public:
+        virtual ~BufferSource() = default;
+
+        /**
+         * @brief Get a buffer with the given size, its content is unspecified.
+         */
+        virtual Vec<u8> acquire(usize size) = 0;
+
+        /**
+         * @brief Give back a buffer once it's no longer used.
+         */
+        virtual void release(Vec<u8> buffer) = 0;
+    };
+
+    /**
+     * @class ServerProbe
+     * @brief Receiver of the timings of each request measured by Server.
+     */
+    class ServerProbe
+    {
+    public:
+        struct Sample
+        {
+            Procedure                proc;
+            Status                   status;
+            u64                      bytes;
+            std::chrono::nanoseconds queue;
+            std::chrono::nanoseconds handle;
+            std::chrono::nanoseconds encode;
+            std::chrono::nanoseconds send;
+        };
+
+        virtual ~ServerProbe() = default;
+
+        virtual void record(const Sample& sample) = 0;
     };
 
     class Server
@@ -260,24 +510,74 @@ namespace madbfs::rpc
         using HandlerSig = Await<Var<Status, Response>>(Vec<u8>& buffer, Request request);
         using Handler    = std::function<HandlerSig>;
 
-        Server(Socket socket)
+        /**
+         * @brief Construct a server on a connected socket.
+         *
+         * @param socket Connected socket.
+         * @param buffers Source of buffers, plain allocation if nullptr.
+         * @param probe Receiver of request timings, not measured if nullptr.
+         */
+        Server(Socket socket, BufferSource* buffers = nullptr, ServerProbe* probe = nullptr)
             : m_socket{ std::move(socket) }
+            , m_buffers{ buffers }
+            , m_probe{ probe }
+            , m_drained{ m_socket.get_executor() }
         {
         }
 
         Socket& sock() noexcept { return m_socket; }
 
+        /**
+         * @brief Receive requests and handle each of them concurrently until the connection ends.
+         *
+         * Returns only after every request that was being handled is done, so the server and the handler
+         * can be destroyed right after.
+         */
         AExpect<void> listen(Handler handler);
         void          stop();
 
     private:
-        AExpect<void> send_resp(Id id, Procedure proc, Var<Status, Response> response);
-
-        Socket m_socket;
-        bool   m_running;
+        AExpect<void> receive(Handler& handler);
+
+        AExpect<void> send_resp(
+            Id                       id,
+            Procedure                proc,
+            Var<Status, Response>    response,
+            usize                    hint   = 0,
+            Opt<ServerProbe::Sample> sample = std::nullopt
+        );
+        AExpect<void> discard(usize size);
+
+        Vec<u8> acquire(usize size);
+        void    release(Vec<u8> buffer);
+
+        Socket        m_socket;
+        BufferSource* m_buffers = nullptr;
+        ServerProbe*  m_probe   = nullptr;
+        bool          m_running;
+
+        usize        m_in_flight = 0;    // requests being handled
+        async::Timer m_drained;          // cancelled once the last request in flight is done
     };
 
-    static constexpr Str server_ready_string = "SERVER_IS_READY";
+    // carries the protocol version, bumped on every change to the frame layout or the set of procedures so a
+    // client never talks to a server it would misparse (e.g. an older one still running on the device):
+    //   V2: Listdir entries carry the symlink target
+    //   V3: mutation responses carry the stat after the operation
+    //   V4: ReadMany
+    //   V5: WriteMany
+    //   V6: Fallocate and Lseek
+    //   V7: ServerStats
+    static constexpr Str server_ready_string = "SERVER_IS_READY_V7";
+
+    // frame header: id, procedure, [status (response only)], payload size
+    static constexpr usize request_header_len  = sizeof(Id) + sizeof(Procedure) + sizeof(u64);
+    static constexpr usize response_header_len = sizeof(Id) + sizeof(Procedure) + sizeof(Status) + sizeof(u64);
+
+    // Read and Write larger than this are split by the client into multiple requests, the server clamps Read
+    // to this size. Frames with payload larger than max_payload_len are discarded by the server.
+    static constexpr usize max_io_len      = 1024 * 1024;
+    static constexpr usize max_payload_len = 64 * 1024 * 1024;
 
     /**
      * @brief Return string representation of enum Procedure.
@@ -300,10 +600,65 @@ namespace madbfs::rpc
      */
     Str to_string(Response response);
 
+    /**
+     * @brief Get the primary path and the payload size of a request.
+     *
+     * The path is the source path for two-path procedures and the first path for ReadMany and WriteMany. The
+     * size is the number of bytes requested or carried for read, write, and copy operations, 0 otherwise.
+     * Used for tracing and stats.
+     */
+    Pair<Str, u64> describe(const Request& request);
+
+    /**
+     * @brief Encode a request into a frame.
+     *
+     * @param buffer Buffer to write the frame into (will be cleared).
+     * @param id Request id.
+     * @param request The request.
+     *
+     * @return View to the encoded frame (header included) backed by `buffer`.
+     */
+    Span<const u8> build_request(Vec<u8>& buffer, Id id, Request request);
+
+    /**
+     * @brief Encode a response into a frame.
+     *
+     * @param buffer Buffer to write the frame into (will be cleared).
+     * @param id Id of the request this response is for.
+     * @param proc Procedure of the request.
+     * @param response The response or error status.
+     *
+     * @return View to the encoded frame (header included) backed by `buffer`, or error if the procedure of
+     * the response doesn't match `proc`.
+     */
+    Expect<Span<const u8>> build_response(
+        Vec<u8>&              buffer,
+        Id                    id,
+        Procedure             proc,
+        Var<Status, Response> response
+    );
+
+    /**
+     * @brief Decode a request payload (without header).
+     *
+     * @param buffer The payload; the returned request may point into it.
+     * @param proc Procedure read from the header.
+     */
+    Opt<Request> parse_request(Span<const u8> buffer, Procedure proc);
+
+    /**
+     * @brief Decode a response payload (without header).
+     *
+     * @param buffer The payload; the returned response may point into it.
+     * @param proc Procedure read from the header.
+     */
+    Opt<Response> parse_response(Span<const u8> buffer, Procedure proc);
+
     /**
      * @brief Do a handshake with remote connection.
      *
-     * Set client to true if you are client, set client to false if you are server.
+     * Set client to true if you are client, set client to false if you are server. Fails with `bad_message`
+     * if the peer speaks another protocol version.
      */
     AExpect<void> handshake(Socket& sock, bool client);
 }
@@ -0,0 +1,311 @@
+#pragma once
+
+#include "madbfs-common/aliases.hpp"
+#include "madbfs-common/trace.hpp"
+
+#include <atomic>
+#include <chrono>
+#include <map>
+#include <mutex>
+
+namespace madbfs::stats
+{
+    using Clock    = std::chrono::steady_clock;
+    using Duration = std::chrono::nanoseconds;
+
+    /**
+     * @class Histogram
+     * @brief Log-linear (HDR-style) latency histogram with lock-free recording.
+     *
+     * Values are bucketed by their power of two and each power of two is split into `sub_bucket_count`
+     * linear sub-buckets, so the relative error of a reported percentile is bounded by 1/16 regardless of
+     * the magnitude, from nanoseconds up to hours. Recording is a handful of relaxed atomic operations.
+     */
+    class Histogram
+    {
+    public:
+        static constexpr usize sub_bucket_bits  = 4;
+        static constexpr usize sub_bucket_count = 1uz << sub_bucket_bits;
+        static constexpr usize bucket_count     = (64 - sub_bucket_bits + 1) * sub_bucket_count;
+
+        struct Summary
+        {
+            // all values except count are in ns
+            u64 count;
+            u64 sum;
+            u64 min;
+            u64 max;
+            u64 p50;
+            u64 p90;
+            u64 p99;
+            u64 p999;
+        };
+
+        void record(Duration duration) noexcept;
+        void reset() noexcept;
+
+        /**
+         * @brief Take a consistent-enough snapshot of the histogram.
+         *
+         * Concurrent recording may make the count and the buckets slightly off from each other, which is
+         * fine for reporting.
+         */
+        Summary summary() const noexcept;
+
+        static usize bucket_of(u64 value) noexcept;
+        static u64   upper_bound_of(usize bucket) noexcept;
+
+    private:
+        Array<std::atomic<u64>, bucket_count> m_buckets = {};
+
+        std::atomic<u64> m_count = 0;
+        std::atomic<u64> m_sum   = 0;
+        std::atomic<u64> m_min   = std::numeric_limits<u64>::max();
+        std::atomic<u64> m_max   = 0;
+    };
+
+    class Metric;
+
+    /**
+     * @class FlightRecorder
+     * @brief Fixed-size lock-free ring buffer of the last operations.
+     *
+     * Any number of threads may record concurrently. Each slot is guarded by a sequence number (seqlock) so
+     * a reader never blocks writers, it just skips slots that are being written.
+     */
+    class FlightRecorder
+    {
+    public:
+        static constexpr usize capacity = 1024;
+        static constexpr usize path_len = 96;    // longer path is truncated (the tail is kept)
+
+        struct Event
+        {
+            u64           seq;
+            i64           timestamp;    // system clock, in us since epoch
+            const Metric* metric;
+            String        path;
+            u64           size;
+            Duration      duration;
+            Errc          error;
+        };
+
+        void record(const Metric& metric, Str path, u64 size, Duration duration, Errc error) noexcept;
+
+        /**
+         * @brief Get recorded events, oldest first.
+         */
+        Vec<Event> events() const;
+
+    private:
+        static constexpr usize path_words = path_len / sizeof(u64);
+
+        struct Slot
+        {
+            std::atomic<u64>                    seq = 0;    // odd while being written
+            std::atomic<i64>                    timestamp;
+            std::atomic<const Metric*>          metric;
+            Array<std::atomic<u64>, path_words> path;
+            std::atomic<u64>                    size;
+            std::atomic<i64>                    duration;
+            std::atomic<i32>                    error;
+        };
+
+        Array<Slot, capacity> m_slots;
+        std::atomic<u64>      m_head = 0;
+    };
+
+    /**
+     * @class Metric
+     * @brief A named operation with its latency histogram.
+     *
+     * Recording an operation also adds it to the flight recorder (if any) and, if tracing is running, to the
+     * trace.
+     */
+    class Metric
+    {
+    public:
+        /**
+         * @param recorder Flight recorder that gets every recorded operation, may be null.
+         */
+        Metric(Str group, Str name, FlightRecorder* recorder = nullptr);
+
+        void record(Duration duration, Str path = {}, u64 size = 0, Errc error = {}) noexcept;
+
+        Str group() const { return m_group; }
+        Str name() const { return m_name; }
+
+        Histogram&       histogram() { return m_histogram; }
+        const Histogram& histogram() const { return m_histogram; }
+
+    private:
+        String          m_group;
+        String          m_name;
+        Histogram       m_histogram;
+        FlightRecorder* m_recorder;
+        u16             m_trace_op;
+    };
+
+    /**
+     * @class Counter
+     * @brief Monotonically increasing count of something (events, bytes, etc.).
+     */
+    class Counter
+    {
+    public:
+        Counter(Str group, Str name)
+            : m_group{ group }
+            , m_name{ name }
+        {
+        }
+
+        void add(u64 n = 1) noexcept { m_value.fetch_add(n, std::memory_order::relaxed); }
+        u64  value() const noexcept { return m_value.load(std::memory_order::relaxed); }
+
+        Str group() const { return m_group; }
+        Str name() const { return m_name; }
+
+    private:
+        String           m_group;
+        String           m_name;
+        std::atomic<u64> m_value = 0;
+    };
+
+    /**
+     * @class Gauge
+     * @brief Current value of something that can go up and down (in-flight requests, etc.).
+     */
+    class Gauge
+    {
+    public:
+        Gauge(Str group, Str name)
+            : m_group{ group }
+            , m_name{ name }
+        {
+        }
+
+        void add(i64 n) noexcept { m_value.fetch_add(n, std::memory_order::relaxed); }
+        void set(i64 n) noexcept { m_value.store(n, std::memory_order::relaxed); }
+        i64  value() const noexcept { return m_value.load(std::memory_order::relaxed); }
+
+        Str group() const { return m_group; }
+        Str name() const { return m_name; }
+
+    private:
+        String           m_group;
+        String           m_name;
+        std::atomic<i64> m_value = 0;
+    };
+
+    /**
+     * @class Sample
+     * @brief A single value computed at render time, for values that are owned elsewhere.
+     */
+    struct Sample
+    {
+        enum class Kind
+        {
+            Counter,
+            Gauge,
+        };
+
+        Str  name;    // full metric name without the `madbfs_` prefix
+        Str  help;
+        Kind kind;
+        f64  value;
+    };
+
+    /**
+     * @class Registry
+     * @brief Owner of all metrics, counters, gauges, and the flight recorder.
+     *
+     * Metrics, counters, and gauges are created on first use and never destroyed, so the returned reference
+     * can be cached by the user and recorded to without touching the registry again. Metrics record into the
+     * flight recorder of the registry that created them.
+     *
+     * Each mounted device owns a registry so the stats of one device never show up in another.
+     */
+    class Registry
+    {
+    public:
+        Metric&  metric(Str group, Str name);
+        Counter& counter(Str group, Str name);
+        Gauge&   gauge(Str group, Str name);
+
+        /**
+         * @brief Get all metrics ordered by group then name.
+         */
+        Vec<const Metric*> metrics() const;
+
+        /**
+         * @brief Get all counters ordered by group then name.
+         */
+        Vec<const Counter*> counters() const;
+
+        /**
+         * @brief Get all gauges ordered by group then name.
+         */
+        Vec<const Gauge*> gauges() const;
+
+        FlightRecorder&       recorder() { return m_recorder; }
+        const FlightRecorder& recorder() const { return m_recorder; }
+
+        /**
+         * @brief Reset all histograms.
+         *
+         * Counters and gauges are left untouched since counters must be monotonic for the scraper.
+         */
+        void reset();
+
+        /**
+         * @brief Human readable table of all non-empty histograms followed by the last recorded operations.
+         *
+         * @param max_events Maximum number of operations from the flight recorder to include.
+         */
+        String dump(usize max_events) const;
+
+        /**
+         * @brief Render everything in OpenMetrics text format.
+         *
+         * @param samples Additional values to include.
+         * @param labels Labels attached to every sample, already formatted (`serial="abc"`), may be empty.
+         *
+         * Histograms are rendered as summaries named `madbfs_<group>_latency_seconds` with the operation as
+         * the `op` label, counters as `madbfs_<group>_<name>_total`, and gauges as `madbfs_<group>_<name>`.
+         */
+        String openmetrics(Span<const Sample> samples, Str labels) const;
+
+    private:
+        template <typename T>
+        using Map = std::map<String, Uniq<T>, std::less<>>;    // keyed by "<group>.<name>"
+
+        mutable std::mutex m_mutex;
+        Map<Metric>        m_metrics;
+        Map<Counter>       m_counters;
+        Map<Gauge>         m_gauges;
+        FlightRecorder     m_recorder;
+    };
+
+    /**
+     * @brief Get the process-wide registry, used by whoever is not given a registry of its own.
+     */
+    Registry& registry();
+
+    /**
+     * @class Stopwatch
+     * @brief Measure time since construction.
+     */
+    class Stopwatch
+    {
+    public:
+        Stopwatch()
+            : m_start{ Clock::now() }
+        {
+        }
+
+        Duration elapsed() const { return Clock::now() - m_start; }
+
+    private:
+        Clock::time_point m_start;
+    };
+}
@@ -0,0 +1,135 @@
+#pragma once
+
+#ifndef MADBFS_TRACE_ENABLED
+#    define MADBFS_TRACE_ENABLED 1
+#endif
+
+#include "madbfs-common/aliases.hpp"
+
+#include <atomic>
+#include <chrono>
+
+/**
+ * Binary tracing.
+ *
+ * Each traced operation is written as a fixed-size `Record` into a ring buffer owned by the calling thread,
+ * no formatting and no lock involved. A background thread periodically drains the ring buffers into the trace
+ * file. Records are dropped (and counted) if a ring buffer is full when the writer can't keep up.
+ *
+ * Tracing can be compiled out entirely by defining `MADBFS_TRACE_ENABLED` to 0, in which case `start()`
+ * always fails and `record()` compiles to nothing. Otherwise it is disabled until `start()` is called, the
+ * cost of a disabled trace point is a single relaxed atomic load.
+ *
+ * File format (native byte order, little-endian on every supported platform):
+ * - header: `magic` (8 bytes), version (u32), record size (u32)
+ * - followed by chunks of: kind (u32), payload length in bytes (u32), payload
+ *   - `Chunk::Op`: op code (u16) followed by the op name (the rest of the payload)
+ *   - `Chunk::Records`: array of `Record`
+ *   - `Chunk::Dropped`: number of records dropped since the last such chunk (u64)
+ *
+ * See `madbfs/tools/trace_decode.py` for the decoder.
+ */
+namespace madbfs::trace
+{
+    using Duration = std::chrono::nanoseconds;
+
+    constexpr auto magic   = Array<char, 8>{ 'M', 'A', 'D', 'B', 'F', 'S', 'T', 'R' };
+    constexpr u32  version = 1;
+
+    enum class Chunk : u32
+    {
+        Op      = 1,
+        Records = 2,
+        Dropped = 3,
+    };
+
+    struct Record
+    {
+        u64 timestamp;    // completion time, system clock in ns since epoch
+        u64 latency;      // in ns
+        u64 size;         // transferred bytes or other op-specific size
+        u32 id;           // hash of the path (see `id_of`)
+        u16 op;           // see `register_op`
+        u16 error;        // errno value, 0 on success
+    };
+
+    static_assert(sizeof(Record) == 32);
+
+    namespace detail
+    {
+        extern std::atomic<bool> g_enabled;
+
+        void emit(u16 op, u32 id, u64 size, Duration latency, Errc error) noexcept;
+    }
+
+    /**
+     * @brief Check whether tracing is currently running.
+     */
+    inline bool enabled() noexcept
+    {
+        if constexpr (MADBFS_TRACE_ENABLED) {
+            return detail::g_enabled.load(std::memory_order::relaxed);
+        } else {
+            return false;
+        }
+    }
+
+    /**
+     * @brief Identifier of a path in a trace.
+     *
+     * FNV-1a hash of the path, so the same path has the same id on both the client and the server.
+     */
+    constexpr u32 id_of(Str path) noexcept
+    {
+        auto hash = 2166136261_u32;
+        for (auto ch : path) {
+            hash ^= static_cast<u32>(static_cast<u8>(ch));
+            hash *= 16777619_u32;
+        }
+        return hash;
+    }
+
+    /**
+     * @brief Register an operation name.
+     *
+     * @param name Name of the operation.
+     *
+     * @return Op code to be used in `record()`, the same name always gets the same code.
+     */
+    u16 register_op(Str name);
+
+    /**
+     * @brief Start tracing into a file.
+     *
+     * @param file Path to the trace file, truncated if exists.
+     *
+     * Fails with `Errc::operation_not_supported` if tracing is compiled out or with
+     * `Errc::device_or_resource_busy` if tracing is already running.
+     */
+    Expect<void> start(Str file);
+
+    /**
+     * @brief Stop tracing, drain remaining records and close the trace file.
+     *
+     * Does nothing if tracing is not running.
+     */
+    void stop();
+
+    /**
+     * @brief Record an operation if tracing is running.
+     *
+     * @param op Op code from `register_op()`.
+     * @param id Path id from `id_of()`.
+     * @param size Transferred bytes or other op-specific size.
+     * @param latency Time taken by the operation.
+     * @param error Error of the operation, `Errc{}` on success.
+     */
+    inline void record(u16 op, u32 id, u64 size, Duration latency, Errc error) noexcept
+    {
+        if constexpr (MADBFS_TRACE_ENABLED) {
+            if (enabled()) {
+                detail::emit(op, id, size, latency, error);
+            }
+        }
+    }
+}
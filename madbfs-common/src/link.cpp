@@ -0,0 +1,116 @@
+#include "madbfs-common/link.hpp"
+#include "madbfs-common/util/split.hpp"
+
+#include <charconv>
+#include <utility>
+
+namespace
+{
+    using namespace madbfs::aliases;
+    using madbfs::link::Duration;
+    using madbfs::link::Profile;
+
+    using std::chrono::milliseconds;
+
+    // clang-format off
+    constexpr auto presets = Array<std::pair<Str, Profile>, 3>{ {
+        { "usb2", { .latency = milliseconds{ 1 },  .jitter = Duration{ 200 },    .bandwidth = 35  * 1024 * 1024, .frame_overhead = 64 } },
+        { "usb3", { .latency = Duration{ 250 },    .jitter = Duration{ 50 },     .bandwidth = 300 * 1024 * 1024, .frame_overhead = 64 } },
+        { "wifi", { .latency = milliseconds{ 10 }, .jitter = milliseconds{ 5 },  .bandwidth = 5   * 1024 * 1024, .frame_overhead = 96 } },
+    } };
+    // clang-format on
+
+    Opt<u64> parse_num(Str str)
+    {
+        auto num = u64{};
+        auto [ptr, ec] = std::from_chars(str.data(), str.data() + str.size(), num);
+        if (ec != std::errc{} or ptr != str.data() + str.size()) {
+            return std::nullopt;
+        }
+        return num;
+    }
+}
+
+namespace madbfs::link
+{
+    Opt<Profile> parse_profile(Str spec)
+    {
+        auto profile  = Profile{};
+        auto splitter = util::StringSplitter{ spec, ',' };
+        auto first    = true;
+
+        while (auto kv = splitter.next()) {
+            auto eq = kv->find('=');
+            if (std::exchange(first, false) and eq == Str::npos) {
+                auto found = sr::find(presets, *kv, &std::pair<Str, Profile>::first);
+                if (found == presets.end()) {
+                    return std::nullopt;
+                }
+                profile = found->second;
+                continue;
+            }
+            if (eq == Str::npos) {
+                return std::nullopt;
+            }
+
+            auto key   = kv->substr(0, eq);
+            auto value = parse_num(kv->substr(eq + 1));
+            if (not value) {
+                return std::nullopt;
+            }
+
+            if (key == "lat") {
+                profile.latency = milliseconds{ *value };
+            } else if (key == "jitter") {
+                profile.jitter = milliseconds{ *value };
+            } else if (key == "bw") {
+                profile.bandwidth = *value * 1024;
+            } else if (key == "overhead") {
+                profile.frame_overhead = *value;
+            } else if (key == "seed") {
+                profile.seed = *value;
+            } else {
+                return std::nullopt;
+            }
+        }
+
+        return profile;
+    }
+
+    Emulator::Schedule Emulator::schedule(Direction dir, usize size, Clock::time_point now)
+    {
+        auto& state = dir == Direction::Uplink ? m_uplink : m_downlink;
+
+        auto start = std::max(now, state.busy_until);
+        auto sent  = start;
+        if (m_profile.bandwidth > 0) {
+            auto bytes = static_cast<u64>(size + m_profile.frame_overhead);
+            sent      += std::chrono::nanoseconds{ bytes * 1'000'000'000 / m_profile.bandwidth };
+        }
+        state.busy_until = sent;
+
+        auto latency = m_profile.latency;
+        if (m_profile.jitter.count() > 0) {
+            auto jitter = m_profile.jitter.count();
+            auto dist   = std::uniform_int_distribution<Duration::rep>{ -jitter, jitter };
+            latency     = std::max(Duration{ 0 }, latency + Duration{ dist(m_rng) });
+        }
+
+        // frames can't overtake each other
+        auto delivered       = std::max(sent + latency, state.last_delivered);
+        state.last_delivered = delivered;
+
+        return { .sent = sent, .delivered = delivered };
+    }
+
+    Await<void> Emulator::wait_until(Clock::time_point time)
+    {
+        if (time <= Clock::now()) {
+            co_return;
+        }
+
+        auto timer = async::Timer{ co_await async::current_executor() };
+        timer.expires_at(time);
+        std::ignore = co_await timer.async_wait();
+    }
+}
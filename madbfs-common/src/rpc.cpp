@@ -1,8 +1,11 @@
 #include "madbfs-common/rpc.hpp"
 #include "madbfs-common/async/async.hpp"
 #include "madbfs-common/log.hpp"
+#include "madbfs-common/stats.hpp"
 #include "madbfs-common/util/overload.hpp"
 
+#include <charconv>
+
 #define HANDLE_ERROR(Res, Want, Msg)                                                                         \
     if (not(Res)) {                                                                                          \
         madbfs::log_e("{}: " Msg ": {}", __func__, Res.error().message());                                   \
@@ -109,6 +112,34 @@ namespace madbfs::rpc
             return std::forward<Self>(self);
         }
 
+        template <typename Self>
+        Self&& write_stat(this Self&& self, const resp::Stat& stat)
+        {
+            self.template write_int<i64>(stat.size);
+            self.template write_int<u64>(stat.links);
+            self.template write_int<i64>(stat.mtime.tv_sec);
+            self.template write_int<i64>(stat.mtime.tv_nsec);
+            self.template write_int<i64>(stat.atime.tv_sec);
+            self.template write_int<i64>(stat.atime.tv_nsec);
+            self.template write_int<i64>(stat.ctime.tv_sec);
+            self.template write_int<i64>(stat.ctime.tv_nsec);
+            self.template write_int<u32>(stat.mode);
+            self.template write_int<u32>(stat.uid);
+            self.template write_int<u32>(stat.gid);
+            return std::forward<Self>(self);
+        }
+
+        // optional stat is prefixed by a presence byte
+        template <typename Self>
+        Self&& write_opt_stat(this Self&& self, const Opt<resp::Stat>& stat)
+        {
+            self.template write_int<u8>(stat.has_value());
+            if (stat) {
+                self.write_stat(*stat);
+            }
+            return std::forward<Self>(self);
+        }
+
     protected:
         Vec<u8>& m_buffer;
     };
@@ -152,7 +183,12 @@ namespace madbfs::rpc
                 case Procedure::Read:
                 case Procedure::Write:
                 case Procedure::Utimens:
-                case Procedure::CopyFileRange: return proc;
+                case Procedure::CopyFileRange:
+                case Procedure::ReadMany:
+                case Procedure::WriteMany:
+                case Procedure::Fallocate:
+                case Procedure::Lseek:
+                case Procedure::ServerStats: return proc;
                 }
                 return std::nullopt;
             });
@@ -168,10 +204,25 @@ namespace madbfs::rpc
             return read_int<Id::Inner>().transform([](Id::Inner v) { return Id{ v }; });
         }
 
+        /**
+         * @brief Read the number of entries that follow, each taking at least `min_len` bytes.
+         *
+         * Fails if the rest of the payload can't hold that many, so the count can be trusted for allocation.
+         */
+        Opt<usize> read_count(usize min_len)
+        {
+            return read_int<u64>().and_then([&](u64 count) -> Opt<usize> {
+                if (count > remaining() / min_len) {
+                    return std::nullopt;
+                }
+                return static_cast<usize>(count);
+            });
+        }
+
         Opt<Span<const u8>> read_bytes()
         {
             return read_int<u64>().and_then([&](u64 size) -> Opt<Span<const u8>> {
-                if (m_index + size - 1 >= m_buffer.size()) {
+                if (size > remaining()) {
                     return std::nullopt;
                 }
                 auto span  = m_buffer.subspan(m_index, size);
@@ -183,7 +234,7 @@ namespace madbfs::rpc
         Opt<Str> read_path()
         {
             return read_int<u64>().and_then([&](u64 size) -> Opt<Str> {
-                if (m_index + size - 1 >= m_buffer.size()) {
+                if (size == 0 or size > remaining()) {
                     return std::nullopt;
                 }
                 auto span  = m_buffer.subspan(m_index, size - 1);    // without null terminator
@@ -192,6 +243,44 @@ namespace madbfs::rpc
             });
         }
 
+        Opt<resp::Stat> read_stat()
+        {
+            TRY(size, read_int<i64>());
+            TRY(links, read_int<u64>());
+            TRY(mtime_sec, read_int<i64>());
+            TRY(mtime_nsec, read_int<i64>());
+            TRY(atime_sec, read_int<i64>());
+            TRY(atime_nsec, read_int<i64>());
+            TRY(ctime_sec, read_int<i64>());
+            TRY(ctime_nsec, read_int<i64>());
+            TRY(mode, read_int<u32>());
+            TRY(uid, read_int<u32>());
+            TRY(gid, read_int<u32>());
+
+            return resp::Stat{
+                .size  = static_cast<off_t>(*size),
+                .links = static_cast<nlink_t>(*links),
+                .mtime = to_timespec(*mtime_sec, *mtime_nsec),
+                .atime = to_timespec(*atime_sec, *atime_nsec),
+                .ctime = to_timespec(*ctime_sec, *ctime_nsec),
+                .mode  = static_cast<mode_t>(*mode),
+                .uid   = static_cast<uid_t>(*uid),
+                .gid   = static_cast<uid_t>(*gid),
+            };
+        }
+
+        // outer optional is empty on malformed payload, inner one is empty if the stat is not sent
+        Opt<Opt<resp::Stat>> read_opt_stat()
+        {
+            TRY(present, read_int<u8>());
+            if (*present == 0) {
+                return Opt<resp::Stat>{};
+            }
+            return read_stat().transform([](resp::Stat stat) { return Opt<resp::Stat>{ stat }; });
+        }
+
+        usize remaining() const { return m_buffer.size() - m_index; }
+
     private:
         usize          m_index = 0;
         Span<const u8> m_buffer;
@@ -213,7 +302,7 @@ namespace madbfs::rpc
 
         Span<const u8> build()
         {
-            constexpr auto header_len = sizeof(Id) + sizeof(Procedure) + sizeof(u64);
+            constexpr auto header_len = request_header_len;
 
             auto& buf  = m_buffer;
             auto  size = buf.size() - header_len;
@@ -243,7 +332,7 @@ namespace madbfs::rpc
 
         Span<const u8> build()
         {
-            constexpr auto header_len = sizeof(Id) + sizeof(Procedure) + sizeof(Status) + sizeof(u64);
+            constexpr auto header_len = response_header_len;
 
             auto& buf  = m_buffer;
             auto  size = buf.size() - header_len;
@@ -268,7 +357,7 @@ namespace madbfs::rpc
         case Procedure::Listdir: {
             TRY(size, reader.read_int<u64>());
 
-            auto entries = Vec<Pair<Str, resp::Stat>>{};
+            auto entries = Vec<resp::Listdir::Entry>{};
             entries.reserve(*size);
 
             for (auto _ : sv::iota(0uz, *size)) {
@@ -284,10 +373,11 @@ namespace madbfs::rpc
                 TRY(mode, reader.read_int<u32>());
                 TRY(uid, reader.read_int<u32>());
                 TRY(gid, reader.read_int<u32>());
+                TRY(target, reader.read_path());
 
-                entries.emplace_back(
-                    *path,
-                    resp::Stat{
+                entries.push_back({
+                    .name = *path,
+                    .stat = {
                         .size  = static_cast<off_t>(*size),
                         .links = static_cast<nlink_t>(*links),
                         .mtime = to_timespec(*mtime_sec, *mtime_nsec),
@@ -296,36 +386,17 @@ namespace madbfs::rpc
                         .mode  = static_cast<mode_t>(*mode),
                         .uid   = static_cast<uid_t>(*uid),
                         .gid   = static_cast<uid_t>(*gid),
-                    }
-                );
+                    },
+                    .target = *target,
+                });
             }
 
             return resp::Listdir{ .entries = std::move(entries) };
         } break;
 
         case Procedure::Stat: {
-            TRY(size, reader.read_int<i64>());
-            TRY(links, reader.read_int<u64>());
-            TRY(mtime_sec, reader.read_int<i64>());
-            TRY(mtime_nsec, reader.read_int<i64>());
-            TRY(atime_sec, reader.read_int<i64>());
-            TRY(atime_nsec, reader.read_int<i64>());
-            TRY(ctime_sec, reader.read_int<i64>());
-            TRY(ctime_nsec, reader.read_int<i64>());
-            TRY(mode, reader.read_int<u32>());
-            TRY(uid, reader.read_int<u32>());
-            TRY(gid, reader.read_int<u32>());
-
-            return resp::Stat{
-                .size  = static_cast<off_t>(*size),
-                .links = static_cast<nlink_t>(*links),
-                .mtime = to_timespec(*mtime_sec, *mtime_nsec),
-                .atime = to_timespec(*atime_sec, *atime_nsec),
-                .ctime = to_timespec(*ctime_sec, *ctime_nsec),
-                .mode  = static_cast<mode_t>(*mode),
-                .uid   = static_cast<uid_t>(*uid),
-                .gid   = static_cast<uid_t>(*gid),
-            };
+            TRY(stat, reader.read_stat());
+            return *stat;
         } break;
 
         case Procedure::Readlink: {
@@ -333,12 +404,28 @@ namespace madbfs::rpc
             return resp::Readlink{ .target = *path };
         } break;
 
-        case Procedure::Mknod: return resp::Mknod{};
-        case Procedure::Mkdir: return resp::Mkdir{};
+        case Procedure::Mknod: {
+            TRY(stat, reader.read_opt_stat());
+            return resp::Mknod{ .stat = *stat };
+        } break;
+
+        case Procedure::Mkdir: {
+            TRY(stat, reader.read_opt_stat());
+            return resp::Mkdir{ .stat = *stat };
+        } break;
+
         case Procedure::Unlink: return resp::Unlink{};
         case Procedure::Rmdir: return resp::Rmdir{};
-        case Procedure::Rename: return resp::Rename{};
-        case Procedure::Truncate: return resp::Truncate{};
+
+        case Procedure::Rename: {
+            TRY(stat, reader.read_opt_stat());
+            return resp::Rename{ .stat = *stat };
+        } break;
+
+        case Procedure::Truncate: {
+            TRY(stat, reader.read_opt_stat());
+            return resp::Truncate{ .stat = *stat };
+        } break;
 
         case Procedure::Read: {
             TRY(bytes, reader.read_bytes());
@@ -350,12 +437,98 @@ namespace madbfs::rpc
             return resp::Write{ .size = static_cast<usize>(*size) };
         } break;
 
-        case Procedure::Utimens: return resp::Utimens{};
+        case Procedure::Utimens: {
+            TRY(stat, reader.read_opt_stat());
+            return resp::Utimens{ .stat = *stat };
+        } break;
 
         case Procedure::CopyFileRange: {
             TRY(size, reader.read_int<u64>());
             return resp::CopyFileRange{ .size = static_cast<usize>(*size) };
         } break;
+
+        case Procedure::ReadMany: {
+            constexpr auto min_entry_len = sizeof(Status) + sizeof(u64);    // status, data
+
+            TRY(size, reader.read_count(min_entry_len));
+
+            auto entries = Vec<resp::ReadMany::Entry>{};
+            entries.reserve(*size);
+
+            for (auto _ : sv::iota(0uz, *size)) {
+                TRY(status, reader.read_status());
+                TRY(bytes, reader.read_bytes());
+                entries.push_back({ .status = *status, .read = *bytes });
+            }
+
+            return resp::ReadMany{ .entries = std::move(entries) };
+        } break;
+
+        case Procedure::WriteMany: {
+            constexpr auto min_entry_len = sizeof(Status) + sizeof(u8);    // status, stat presence
+
+            TRY(size, reader.read_count(min_entry_len));
+
+            auto entries = Vec<resp::WriteMany::Entry>{};
+            entries.reserve(*size);
+
+            for (auto _ : sv::iota(0uz, *size)) {
+                TRY(status, reader.read_status());
+                TRY(stat, reader.read_opt_stat());
+                entries.push_back({ .status = *status, .stat = *stat });
+            }
+
+            return resp::WriteMany{ .entries = std::move(entries) };
+        } break;
+
+        case Procedure::Fallocate: {
+            TRY(stat, reader.read_opt_stat());
+            return resp::Fallocate{ .stat = *stat };
+        } break;
+
+        case Procedure::Lseek: {
+            TRY(offset, reader.read_int<i64>());
+            return resp::Lseek{ .offset = static_cast<off_t>(*offset) };
+        } break;
+
+        case Procedure::ServerStats: {
+            TRY(size, reader.read_int<u64>());
+
+            auto entries = Vec<resp::ServerStats::Entry>{};
+            entries.reserve(*size);
+
+            auto read_timing = [&] -> Opt<resp::ServerStats::Timing> {
+                TRY(sum, reader.read_int<u64>());
+                TRY(p50, reader.read_int<u64>());
+                TRY(p99, reader.read_int<u64>());
+                TRY(max, reader.read_int<u64>());
+                return resp::ServerStats::Timing{ .sum = *sum, .p50 = *p50, .p99 = *p99, .max = *max };
+            };
+
+            for (auto _ : sv::iota(0uz, *size)) {
+                TRY(proc, reader.read_procedure());
+                TRY(count, reader.read_int<u64>());
+                TRY(errors, reader.read_int<u64>());
+                TRY(bytes, reader.read_int<u64>());
+                TRY(queue, read_timing());
+                TRY(handle, read_timing());
+                TRY(encode, read_timing());
+                TRY(send, read_timing());
+
+                entries.push_back({
+                    .proc   = *proc,
+                    .count  = *count,
+                    .errors = *errors,
+                    .bytes  = *bytes,
+                    .queue  = *queue,
+                    .handle = *handle,
+                    .encode = *encode,
+                    .send   = *send,
+                });
+            }
+
+            return resp::ServerStats{ .entries = std::move(entries) };
+        } break;
         }
 
         return std::nullopt;
@@ -388,6 +561,7 @@ namespace madbfs::rpc
             }
 
             m_requests.clear();
+            m_arrivals.clear();
         });
 
         async::spawn(exec, send(), [&](std::exception_ptr e, Expect<void> res) {
@@ -411,7 +585,7 @@ namespace madbfs::rpc
     AExpect<void> Client::receive()
     {
         while (m_running) {
-            constexpr auto header_len = sizeof(Id) + sizeof(Procedure) + sizeof(Status) + sizeof(u64);
+            constexpr auto header_len = response_header_len;
 
             auto header = Array<u8, header_len>{};
             auto n      = co_await async::read_exact<u8>(m_socket, header);
@@ -423,6 +597,8 @@ namespace madbfs::rpc
             auto status = reader.read_status().value();
             auto size   = reader.read_int<u64>().value();
 
+            m_meters.received_bytes->add(header_len + size);
+
             if (not proc) {
                 log_d("{}: RESP RECV  {} [invalid procedure]", __func__, id.inner());
                 auto buffer = Vec<u8>(size);
@@ -442,7 +618,7 @@ namespace madbfs::rpc
 
             auto& [buffer, promise] = req.mapped();
             if (status != Status::Success) {
-                promise.set_value(Unexpect{ static_cast<Errc>(status) });
+                resolve(id, std::move(promise), Unexpect{ static_cast<Errc>(status) }, header_len);
                 continue;
             }
 
@@ -453,11 +629,11 @@ namespace madbfs::rpc
             auto response = parse_response(buffer, *proc);
             if (not response) {
                 log_e("{}: [{}] failed to parse response", __func__, id.inner());
-                promise.set_value(Unexpect{ Errc::bad_message });
+                resolve(id, std::move(promise), Unexpect{ Errc::bad_message }, header_len + size);
                 continue;
             }
 
-            promise.set_value(std::move(response).value());
+            resolve(id, std::move(promise), std::move(response).value(), header_len + size);
         }
         co_return Expect<void>{};
     }
@@ -473,16 +649,83 @@ namespace madbfs::rpc
 
             auto [id, payload] = std::move(*id_payload);
 
+            if (m_link) {
+                auto sched = m_link->schedule(link::Direction::Uplink, payload.size(), link::Clock::now());
+                co_await link::Emulator::wait_until(sched.sent);
+                m_arrivals.emplace(id, sched.delivered);
+            }
+
             auto n = co_await async::write_exact(m_socket, payload);
             HANDLE_ERROR_ELSE(n, payload.size(), "failed to send request payload", {
                 m_requests.erase(id);
+                m_arrivals.erase(id);
                 continue;
             });
+
+            m_meters.sent_bytes->add(payload.size());
         }
 
         co_return Expect<void>{};
     }
 
+    void Client::report_to(stats::Registry& registry)
+    {
+        m_meters  = meters_of(registry);
+        m_metrics = {};
+    }
+
+    Client::Meters Client::meters_of(stats::Registry& registry)
+    {
+        return {
+            .registry        = &registry,
+            .in_flight       = &registry.gauge("rpc", "in_flight"),
+            .in_flight_bytes = &registry.gauge("rpc", "in_flight_bytes"),
+            .sent_bytes      = &registry.counter("rpc", "sent_bytes"),
+            .received_bytes  = &registry.counter("rpc", "received_bytes"),
+        };
+    }
+
+    stats::Metric& Client::metric_of(Procedure proc)
+    {
+        auto& slot = m_metrics[static_cast<u8>(proc)];
+        if (slot == nullptr) {
+            slot = &m_meters.registry->metric("rpc", to_string(proc));
+        }
+        return *slot;
+    }
+
+    void Client::emulate_link(Opt<link::Profile> profile)
+    {
+        if (profile) {
+            m_link.emplace(*profile);
+        } else {
+            m_link.reset();
+        }
+        m_arrivals.clear();
+    }
+
+    void Client::resolve(Id id, RespPromise promise, Expect<Response> response, usize size)
+    {
+        auto arrival = m_arrivals.extract(id);
+        if (not m_link) {
+            promise.set_value(std::move(response));
+            return;
+        }
+
+        auto now   = link::Clock::now();
+        auto ready = arrival.empty() ? now : std::max(now, arrival.mapped());
+        auto sched = m_link->schedule(link::Direction::Downlink, size, ready);
+
+        auto deliver = [](RespPromise promise, Expect<Response> response, link::Clock::time_point time
+                       ) -> Await<void> {
+            co_await link::Emulator::wait_until(time);
+            promise.set_value(std::move(response));
+        };
+
+        auto exec = m_socket.get_executor();
+        async::spawn(exec, deliver(std::move(promise), std::move(response), sched.delivered), async::detached);
+    }
+
     void Client::stop()
     {
         m_running = false;
@@ -496,13 +739,49 @@ namespace madbfs::rpc
             co_return Unexpect{ Errc::not_connected };
         }
 
-        buffer.clear();
+        auto watch        = stats::Stopwatch{};
+        auto [path, size] = describe(req);
 
         auto id      = Id{ ++m_counter };
         auto proc    = req.proc();
-        auto builder = RequestBuilder{ buffer, id, proc };
+        auto payload = build_request(buffer, id, std::move(req));
+
+        if (auto res = co_await m_channel.async_send({}, { id, payload }); not res) {
+            log_e("{}: failed to send payload to channel: {}", __func__, res.error().message());
+            co_return Unexpect{ async::to_generic_err(res.error(), Errc::broken_pipe) };
+        }
+
+        auto promise = saf::promise<Expect<Response>>{ co_await async::current_executor() };
+        auto future  = promise.get_future();
+
+        m_requests.emplace(id, Promise{ buffer, std::move(promise) });
+        log_d("{}: REQ QUEUED {} [{}]", __func__, id.inner(), to_string(proc));
+
+        auto payload_size = static_cast<i64>(payload.size());
+
+        m_meters.in_flight->add(1);
+        m_meters.in_flight_bytes->add(payload_size);
 
-        auto payload = std::move(req).visit(util::Overload{
+        auto response = co_await future.async_extract();
+        auto error    = response.has_value() ? Errc{} : response.error();
+
+        m_meters.in_flight->add(-1);
+        m_meters.in_flight_bytes->add(-payload_size);
+
+        metric_of(proc).record(watch.elapsed(), path, size, error);
+        co_return response;
+    }
+}
+
+namespace madbfs::rpc
+{
+    Span<const u8> build_request(Vec<u8>& buffer, Id id, Request request)
+    {
+        buffer.clear();
+
+        auto builder = RequestBuilder{ buffer, id, request.proc() };
+
+        return std::move(request).visit(util::Overload{
             [&](req::Mknod&& req) {
                 auto [path, mode, dev] = req;
                 return builder    //
@@ -533,6 +812,23 @@ namespace madbfs::rpc
                     .write_int<i64>(size)
                     .build();
             },
+            [&](req::Fallocate&& req) {
+                auto [path, mode, offset, length] = req;
+                return builder    //
+                    .write_path(path)
+                    .write_int<i32>(mode)
+                    .write_int<i64>(offset)
+                    .write_int<i64>(length)
+                    .build();
+            },
+            [&](req::Lseek&& req) {
+                auto [path, offset, whence] = req;
+                return builder    //
+                    .write_path(path)
+                    .write_int<i64>(offset)
+                    .write_int<i32>(whence)
+                    .build();
+            },
             [&](req::Read&& req) {
                 auto [path, offset, size] = req;
                 return builder    //
@@ -569,29 +865,139 @@ namespace madbfs::rpc
                     .write_int<u64>(size)
                     .build();
             },
+            [&](req::ReadMany&& req) {
+                builder.write_int<u64>(req.files.size());
+                for (auto [path, size] : req.files) {
+                    builder.write_path(path).write_int<u64>(size);
+                }
+                return builder.build();
+            },
+            [&](req::WriteMany&& req) {
+                builder.write_int<u64>(req.files.size());
+                for (auto [path, mode, in, atime, mtime] : req.files) {
+                    builder    //
+                        .write_path(path)
+                        .write_int<u32>(mode)
+                        .write_bytes(in)
+                        .write_int<i64>(atime.tv_sec)
+                        .write_int<i64>(atime.tv_nsec)
+                        .write_int<i64>(mtime.tv_sec)
+                        .write_int<i64>(mtime.tv_nsec);
+                }
+                return builder.build();
+            },
+            [&](req::ServerStats&& req) { return builder.write_int<u8>(req.reset ? 1 : 0).build(); },
             [&](auto&& req) {
                 auto [path] = req;
                 return builder.write_path(path).build();
             },
         });
+    }
 
-        if (auto res = co_await m_channel.async_send({}, { id, payload }); not res) {
-            log_e("{}: failed to send payload to channel: {}", __func__, res.error().message());
-            co_return Unexpect{ async::to_generic_err(res.error(), Errc::broken_pipe) };
+    Expect<Span<const u8>> build_response(
+        Vec<u8>&              buffer,
+        Id                    id,
+        Procedure             proc,
+        Var<Status, Response> response
+    )
+    {
+        auto status = Status::Success;
+        if (auto err = std::get_if<Status>(&response); err) {
+            status = *err;
         }
 
-        auto promise = saf::promise<Expect<Response>>{ co_await async::current_executor() };
-        auto future  = promise.get_future();
+        buffer.clear();
 
-        m_requests.emplace(id, Promise{ buffer, std::move(promise) });
-        log_d("{}: REQ QUEUED {} [{}]", __func__, id.inner(), to_string(proc));
+        auto builder = ResponseBuilder{ buffer, id, proc, status };
+
+        if (status != Status::Success) {
+            return builder.build();
+        }
 
-        co_return co_await future.async_extract();
+        auto resp = std::get<Response>(std::move(response));
+        if (auto actual = resp.proc(); actual != proc) {
+            log_e("{}: mismatched procedure: [{} vs {}]", __func__, to_string(actual), to_string(proc));
+            return Unexpect{ Errc::bad_message };
+        }
+
+        return std::move(resp).visit(util::Overload{
+            [&](resp::Listdir&& resp) {
+                builder.write_int<u64>(resp.entries.size());
+                for (const auto& [name, stat, target] : resp.entries) {
+                    builder    //
+                        .write_path(name)
+                        .write_int<i64>(stat.size)
+                        .write_int<u64>(stat.links)
+                        .write_int<i64>(stat.mtime.tv_sec)
+                        .write_int<i64>(stat.mtime.tv_nsec)
+                        .write_int<i64>(stat.atime.tv_sec)
+                        .write_int<i64>(stat.atime.tv_nsec)
+                        .write_int<i64>(stat.ctime.tv_sec)
+                        .write_int<i64>(stat.ctime.tv_nsec)
+                        .write_int<u32>(stat.mode)
+                        .write_int<u32>(stat.uid)
+                        .write_int<u32>(stat.gid)
+                        .write_path(target);
+                }
+                return builder.build();
+            },
+            // clang-format off
+            [&](resp::Stat&&          resp) { return builder.write_stat    (resp).build();        },
+            [&](resp::Readlink&&      resp) { return builder.write_path    (resp.target).build(); },
+            [&](resp::Mknod&&         resp) { return builder.write_opt_stat(resp.stat).build();   },
+            [&](resp::Mkdir&&         resp) { return builder.write_opt_stat(resp.stat).build();   },
+            [&](resp::Unlink&&            ) { return builder.build();                             },
+            [&](resp::Rmdir&&             ) { return builder.build();                             },
+            [&](resp::Rename&&        resp) { return builder.write_opt_stat(resp.stat).build();   },
+            [&](resp::Truncate&&      resp) { return builder.write_opt_stat(resp.stat).build();   },
+            [&](resp::Read&&          resp) { return builder.write_bytes   (resp.read).build();   },
+            [&](resp::Write&&         resp) { return builder.write_int<u64>(resp.size).build();   },
+            [&](resp::Utimens&&       resp) { return builder.write_opt_stat(resp.stat).build();   },
+            [&](resp::CopyFileRange&& resp) { return builder.write_int<u64>(resp.size).build();   },
+            [&](resp::Fallocate&&     resp) { return builder.write_opt_stat(resp.stat).build();   },
+            [&](resp::Lseek&&         resp) { return builder.write_int<i64>(resp.offset).build(); },
+            // clang-format on
+            [&](resp::ReadMany&& resp) {
+                builder.write_int<u64>(resp.entries.size());
+                for (auto [status, read] : resp.entries) {
+                    builder.write_status(status).write_bytes(read);
+                }
+                return builder.build();
+            },
+            [&](resp::WriteMany&& resp) {
+                builder.write_int<u64>(resp.entries.size());
+                for (const auto& [status, stat] : resp.entries) {
+                    builder.write_status(status).write_opt_stat(stat);
+                }
+                return builder.build();
+            },
+            [&](resp::ServerStats&& resp) {
+                auto write_timing = [&](const resp::ServerStats::Timing& timing) {
+                    builder    //
+                        .write_int<u64>(timing.sum)
+                        .write_int<u64>(timing.p50)
+                        .write_int<u64>(timing.p99)
+                        .write_int<u64>(timing.max);
+                };
+
+                builder.write_int<u64>(resp.entries.size());
+                for (const auto& entry : resp.entries) {
+                    builder    //
+                        .write_procedure(entry.proc)
+                        .write_int<u64>(entry.count)
+                        .write_int<u64>(entry.errors)
+                        .write_int<u64>(entry.bytes);
+
+                    write_timing(entry.queue);
+                    write_timing(entry.handle);
+                    write_timing(entry.encode);
+                    write_timing(entry.send);
+                }
+                return builder.build();
+            },
+        });
     }
-}
 
-namespace madbfs::rpc
-{
     Opt<Request> parse_request(Span<const u8> buffer, Procedure proc)
     {
         auto reader = PayloadReader{ buffer };
@@ -652,6 +1058,26 @@ namespace madbfs::rpc
             return req::Truncate{ .path = *path, .size = static_cast<off_t>(*size) };
         }
 
+        case Procedure::Fallocate: {
+            TRY(path, reader.read_path());
+            TRY(mode, reader.read_int<i32>());
+            TRY(offset, reader.read_int<i64>());
+            TRY(length, reader.read_int<i64>());
+            return req::Fallocate{
+                .path   = *path,
+                .mode   = *mode,
+                .offset = static_cast<off_t>(*offset),
+                .length = static_cast<off_t>(*length),
+            };
+        }
+
+        case Procedure::Lseek: {
+            TRY(path, reader.read_path());
+            TRY(offset, reader.read_int<i64>());
+            TRY(whence, reader.read_int<i32>());
+            return req::Lseek{ .path = *path, .offset = static_cast<off_t>(*offset), .whence = *whence };
+        }
+
         case Procedure::Read: {
             TRY(path, reader.read_path());
             TRY(offset, reader.read_int<i64>());
@@ -697,17 +1123,83 @@ namespace madbfs::rpc
                 .size       = static_cast<usize>(*size),
             };
         } break;
+
+        case Procedure::ReadMany: {
+            constexpr auto min_entry_len = sizeof(u64) + 1 + sizeof(u64);    // path with terminator, size
+
+            TRY(count, reader.read_count(min_entry_len));
+
+            auto files = Vec<Pair<Str, usize>>{};
+            files.reserve(*count);
+
+            for (auto _ : sv::iota(0uz, *count)) {
+                TRY(path, reader.read_path());
+                TRY(size, reader.read_int<u64>());
+                files.emplace_back(*path, static_cast<usize>(*size));
+            }
+
+            return req::ReadMany{ .files = std::move(files) };
+        } break;
+
+        case Procedure::WriteMany: {
+            // path with terminator, mode, data, times
+            constexpr auto min_entry_len = sizeof(u64) + 1 + sizeof(u32) + sizeof(u64) + 4 * sizeof(i64);
+
+            TRY(count, reader.read_count(min_entry_len));
+
+            auto files = Vec<req::WriteMany::Entry>{};
+            files.reserve(*count);
+
+            for (auto _ : sv::iota(0uz, *count)) {
+                TRY(path, reader.read_path());
+                TRY(mode, reader.read_int<u32>());
+                TRY(bytes, reader.read_bytes());
+                TRY(atime_sec, reader.read_int<i64>());
+                TRY(atime_nsec, reader.read_int<i64>());
+                TRY(mtime_sec, reader.read_int<i64>());
+                TRY(mtime_nsec, reader.read_int<i64>());
+
+                files.push_back({
+                    .path  = *path,
+                    .mode  = static_cast<mode_t>(*mode),
+                    .in    = *bytes,
+                    .atime = to_timespec(*atime_sec, *atime_nsec),
+                    .mtime = to_timespec(*mtime_sec, *mtime_nsec),
+                });
+            }
+
+            return req::WriteMany{ .files = std::move(files) };
+        } break;
+
+        case Procedure::ServerStats: {
+            TRY(reset, reader.read_int<u8>());
+            return req::ServerStats{ .reset = *reset != 0 };
+        } break;
         }
 
         return std::nullopt;
     }
 
     AExpect<void> Server::listen(Handler handler)
+    {
+        auto res = co_await receive(handler);
+
+        // requests still being handled refer to this server and to the handler, wait for them before the
+        // caller gets to destroy either
+        while (m_in_flight > 0) {
+            m_drained.expires_at(async::Timer::time_point::max());
+            std::ignore = co_await m_drained.async_wait();
+        }
+
+        co_return res;
+    }
+
+    AExpect<void> Server::receive(Handler& handler)
     {
         m_running = true;
 
         while (m_running) {
-            constexpr auto header_len = sizeof(Id) + sizeof(Procedure) + sizeof(u64);
+            constexpr auto header_len = request_header_len;
 
             auto header = Array<u8, header_len>{};
             auto n      = co_await async::read_exact<u8>(m_socket, header);
@@ -723,14 +1215,25 @@ namespace madbfs::rpc
 
             if (not proc) {
                 log_d("{}: recv req: id={} | proc=[invalid] | size={}", __func__, id.inner(), size);
-                auto buffer = Vec<u8>(size);
-                std::ignore = co_await async::read_exact<u8>(m_socket, buffer);
+                if (auto res = co_await discard(size); not res) {
+                    co_return Unexpect{ res.error() };
+                }
                 continue;
             }
 
             log_d("{}: recv req id={} | proc={} | size={}", __func__, id.inner(), to_string(*proc), size);
 
-            auto buffer = Vec<u8>(size);
+            // a payload this large is not something the client would send, don't let it take the memory
+            if (size > max_payload_len) {
+                log_e("{}: [{}] request payload too large: {}", __func__, id.inner(), size);
+                if (auto res = co_await discard(size); not res) {
+                    co_return Unexpect{ res.error() };
+                }
+                std::ignore = co_await send_resp(id, *proc, Status::InvalidArgument);
+                continue;
+            }
+
+            auto buffer = acquire(size);
             auto n1     = co_await async::read_exact<u8>(m_socket, buffer);
             HANDLE_ERROR(n1, buffer.size(), "failed to read request payload");
 
@@ -740,98 +1243,106 @@ namespace madbfs::rpc
             auto request = parse_request(buffer, *proc);
             if (not request) {
                 log_e("{}: [{}] failed to parse request", __func__, id.inner());
+                release(std::move(buffer));
                 continue;
             }
 
             auto exec = co_await async::current_executor();
-            auto coro = [&, id, proc, r = std::move(request), b = std::move(buffer)] mutable -> Await<void> {
+            auto recv = std::chrono::steady_clock::now();
+
+            auto coro = [&, id, recv, r = std::move(request), b = std::move(buffer)] mutable -> Await<void> {
+                auto start    = std::chrono::steady_clock::now();
+                auto proc     = r->proc();
+                auto bytes    = b.size();
                 auto response = co_await handler(b, std::move(r).value());
-                std::ignore   = co_await send_resp(id, *proc, std::move(response));
+
+                auto sample = Opt<ServerProbe::Sample>{};
+                if (m_probe != nullptr) {
+                    auto status = std::get_if<Status>(&response);
+                    sample.emplace(ServerProbe::Sample{
+                        .proc   = proc,
+                        .status = status ? *status : Status::Success,
+                        .bytes  = bytes,
+                        .queue  = start - recv,
+                        .handle = std::chrono::steady_clock::now() - start,
+                        .encode = {},
+                        .send   = {},
+                    });
+                }
+
+                std::ignore = co_await send_resp(id, proc, std::move(response), b.size(), std::move(sample));
+                release(std::move(b));
+
+                if (--m_in_flight == 0) {
+                    m_drained.cancel();
+                }
             };
 
+            ++m_in_flight;
             async::spawn(exec, coro(), async::detached);
         }
 
         co_return Expect<void>{};
     }
 
-    AExpect<void> Server::send_resp(Id id, Procedure proc, Var<Status, Response> response)
+    AExpect<void> Server::send_resp(
+        Id                       id,
+        Procedure                proc,
+        Var<Status, Response>    response,
+        usize                    hint,
+        Opt<ServerProbe::Sample> sample
+    )
     {
-        auto status = Status::Success;
-        if (auto err = std::get_if<Status>(&response); err) {
-            status = *err;
+        // response data usually lives in the request buffer, the frame is about as large as that
+        auto buffer = acquire(response_header_len + hint);
+
+        auto start   = std::chrono::steady_clock::now();
+        auto payload = build_response(buffer, id, proc, std::move(response));
+        if (not payload) {
+            release(std::move(buffer));
+            co_return Unexpect{ payload.error() };
         }
 
-        auto buffer  = Vec<u8>{};
-        auto builder = ResponseBuilder{ buffer, id, proc, status };
+        auto encoded = std::chrono::steady_clock::now();
+        auto n       = co_await async::write_exact(m_socket, *payload);
+        auto size    = payload->size();
+        release(std::move(buffer));
 
-        if (status != Status::Success) {
-            auto payload = builder.build();
-            auto n       = co_await async::write_exact(m_socket, payload);
-            HANDLE_ERROR(n, payload.size(), "failed to send response payload");
-            co_return Expect<void>{};
-        }
+        HANDLE_ERROR(n, size, "failed to send response payload");
 
-        auto resp = std::get<Response>(std::move(response));
-        if (auto actual = resp.proc(); actual != proc) {
-            log_e("{}: mismatched procedure: [{} vs {}]", __func__, to_string(actual), to_string(proc));
-            co_return Unexpect{ Errc::bad_message };
+        if (sample and m_probe != nullptr) {
+            sample->bytes  += size;
+            sample->encode  = encoded - start;
+            sample->send    = std::chrono::steady_clock::now() - encoded;
+            m_probe->record(*sample);
         }
 
-        auto payload = std::move(resp).visit(util::Overload{
-            [&](resp::Listdir&& resp) {
-                builder.write_int<u64>(resp.entries.size());
-                for (const auto& [name, stat] : resp.entries) {
-                    builder    //
-                        .write_path(name)
-                        .write_int<i64>(stat.size)
-                        .write_int<u64>(stat.links)
-                        .write_int<i64>(stat.mtime.tv_sec)
-                        .write_int<i64>(stat.mtime.tv_nsec)
-                        .write_int<i64>(stat.atime.tv_sec)
-                        .write_int<i64>(stat.atime.tv_nsec)
-                        .write_int<i64>(stat.ctime.tv_sec)
-                        .write_int<i64>(stat.ctime.tv_nsec)
-                        .write_int<u32>(stat.mode)
-                        .write_int<u32>(stat.uid)
-                        .write_int<u32>(stat.gid);
-                }
-                return builder.build();
-            },
-            [&](resp::Stat&& resp) {
-                return builder    //
-                    .write_int<i64>(resp.size)
-                    .write_int<u64>(resp.links)
-                    .write_int<i64>(resp.mtime.tv_sec)
-                    .write_int<i64>(resp.mtime.tv_nsec)
-                    .write_int<i64>(resp.atime.tv_sec)
-                    .write_int<i64>(resp.atime.tv_nsec)
-                    .write_int<i64>(resp.ctime.tv_sec)
-                    .write_int<i64>(resp.ctime.tv_nsec)
-                    .write_int<u32>(resp.mode)
-                    .write_int<u32>(resp.uid)
-                    .write_int<u32>(resp.gid)
-                    .build();
-            },
-            // clang-format off
-            [&](resp::Readlink&&      resp) { return builder.write_path(resp.target).build();   },
-            [&](resp::Mknod&&             ) { return builder.build();                           },
-            [&](resp::Mkdir&&             ) { return builder.build();                           },
-            [&](resp::Unlink&&            ) { return builder.build();                           },
-            [&](resp::Rmdir&&             ) { return builder.build();                           },
-            [&](resp::Rename&&            ) { return builder.build();                           },
-            [&](resp::Truncate&&          ) { return builder.build();                           },
-            [&](resp::Read&&          resp) { return builder.write_bytes   (resp.read).build(); },
-            [&](resp::Write&&         resp) { return builder.write_int<u64>(resp.size).build(); },
-            [&](resp::Utimens&&           ) { return builder.build();                           },
-            [&](resp::CopyFileRange&& resp) { return builder.write_int<u64>(resp.size).build(); },
-            // clang-format on
-        });
+        co_return Expect<void>{};
+    }
 
-        auto n = co_await async::write_exact(m_socket, payload);
-        HANDLE_ERROR(n, payload.size(), "failed to send response payload");
+    AExpect<void> Server::discard(usize size)
+    {
+        auto chunk = Array<u8, 64 * 1024>{};
+        while (size > 0) {
+            auto len = std::min(size, chunk.size());
+            auto n   = co_await async::read_exact<u8>(m_socket, Span{ chunk.data(), len });
+            HANDLE_ERROR(n, len, "failed to discard request payload");
+            size -= len;
+        }
         co_return Expect<void>{};
     }
+
+    Vec<u8> Server::acquire(usize size)
+    {
+        return m_buffers ? m_buffers->acquire(size) : Vec<u8>(size);
+    }
+
+    void Server::release(Vec<u8> buffer)
+    {
+        if (m_buffers) {
+            m_buffers->release(std::move(buffer));
+        }
+    }
 }
 
 namespace madbfs::rpc
@@ -852,6 +1363,11 @@ namespace madbfs::rpc
         case Procedure::Write: return "Write";
         case Procedure::Utimens: return "Utimens";
         case Procedure::CopyFileRange: return "CopyFileRange";
+        case Procedure::ReadMany: return "ReadMany";
+        case Procedure::WriteMany: return "WriteMany";
+        case Procedure::Fallocate: return "Fallocate";
+        case Procedure::Lseek: return "Lseek";
+        case Procedure::ServerStats: return "ServerStats";
         }
 
         return "Unknown";
@@ -867,6 +1383,95 @@ namespace madbfs::rpc
         return to_string(response.proc());
     }
 
+    Pair<Str, u64> describe(const Request& request)
+    {
+        return request.visit(util::Overload{
+            [](const req::Rename& req) -> Pair<Str, u64> { return { req.from, 0 }; },
+            [](const req::Read& req) -> Pair<Str, u64> { return { req.path, req.size }; },
+            [](const req::Write& req) -> Pair<Str, u64> { return { req.path, req.in.size() }; },
+            [](const req::CopyFileRange& req) -> Pair<Str, u64> { return { req.in_path, req.size }; },
+            [](const req::ServerStats&) -> Pair<Str, u64> { return { {}, 0 }; },
+            [](const req::ReadMany& req) -> Pair<Str, u64> {
+                auto size = 0_u64;
+                for (auto [_, file_size] : req.files) {
+                    size += file_size;
+                }
+                return { req.files.empty() ? Str{} : req.files.front().first, size };
+            },
+            [](const req::WriteMany& req) -> Pair<Str, u64> {
+                auto size = 0_u64;
+                for (const auto& file : req.files) {
+                    size += file.in.size();
+                }
+                return { req.files.empty() ? Str{} : req.files.front().path, size };
+            },
+            [](const auto& req) -> Pair<Str, u64> { return { req.path, 0 }; },
+        });
+    }
+
+    Opt<Address> Address::parse(Str str)
+    {
+        auto split = [&](Str prefix) -> Opt<Str> {
+            if (not str.starts_with(prefix)) {
+                return std::nullopt;
+            }
+            return str.substr(prefix.size());
+        };
+
+        if (auto port_str = split("tcp:"); port_str) {
+            auto port      = u16{};
+            auto [ptr, ec] = std::from_chars(port_str->data(), port_str->data() + port_str->size(), port);
+            if (ec != std::errc{} or ptr != port_str->data() + port_str->size()) {
+                return std::nullopt;
+            }
+            return Address::tcp(port);
+        }
+
+        auto name = Opt<Str>{};
+        auto kind = Kind::Tcp;
+
+        if (name = split("localabstract:"); name) {
+            kind = Kind::Abstract;
+        } else if (name = split("localfilesystem:"); name) {
+            kind = Kind::Filesystem;
+        } else {
+            return std::nullopt;
+        }
+
+        if (name->empty() or name->size() > max_name_len) {
+            return std::nullopt;
+        }
+
+        return Address{ .kind = kind, .name = String{ *name } };
+    }
+
+    String Address::to_string() const
+    {
+        switch (kind) {
+        case Kind::Tcp: return fmt::format("tcp:{}", port);
+        case Kind::Abstract: return fmt::format("localabstract:{}", name);
+        case Kind::Filesystem: return fmt::format("localfilesystem:{}", name);
+        }
+        return {};
+    }
+
+    async::generic::Endpoint Address::endpoint() const
+    {
+        switch (kind) {
+        case Kind::Tcp: {
+            auto localhost = asio::ip::address_v4::loopback();
+            return async::tcp::Endpoint{ localhost, port };
+        }
+        case Kind::Abstract: {
+            // asio puts a name starting with a null byte into the abstract namespace
+            auto path = String(1, '\0') + name;
+            return async::unix_socket::Endpoint{ path };
+        }
+        case Kind::Filesystem: return async::unix_socket::Endpoint{ name };
+        }
+        return {};
+    }
+
     AExpect<void> handshake(Socket& sock, bool client)
     {
         if (client) {
@@ -878,6 +1483,7 @@ namespace madbfs::rpc
             HANDLE_ERROR(n1, buffer.size(), "failed to read handshake from server");
 
             if (buffer != server_ready_string) {
+                log_e("{}: server speaks another protocol version: {:?}", __func__, buffer);
                 co_return Unexpect{ Errc::bad_message };
             }
         } else {
@@ -886,6 +1492,7 @@ namespace madbfs::rpc
             HANDLE_ERROR(n1, buffer.size(), "failed to read handshake from client");
 
             if (buffer != server_ready_string) {
+                log_e("{}: client speaks another protocol version: {:?}", __func__, buffer);
                 co_return Unexpect{ Errc::bad_message };
             }
 
@@ -0,0 +1,451 @@
+#include "madbfs-common/stats.hpp"
+
+#include <fmt/chrono.h>
+#include <fmt/format.h>
+
+#include <algorithm>
+#include <bit>
+#include <cmath>
+#include <cstring>
+
+namespace
+{
+    using namespace madbfs::aliases;
+
+    String pretty_ns(u64 ns)
+    {
+        if (ns < 1'000) {
+            return fmt::format("{}ns", ns);
+        } else if (ns < 1'000'000) {
+            return fmt::format("{:.1f}us", static_cast<double>(ns) / 1e3);
+        } else if (ns < 1'000'000'000) {
+            return fmt::format("{:.2f}ms", static_cast<double>(ns) / 1e6);
+        }
+        return fmt::format("{:.2f}s", static_cast<double>(ns) / 1e9);
+    }
+
+    template <typename Map, typename... Args>
+    auto& get_or_create(std::mutex& mutex, Map& map, Str group, Str name, Args&&... args)
+    {
+        using T = Map::mapped_type::element_type;
+
+        auto key = String{ group };
+        key += '.';
+        key += name;
+
+        auto lock = std::scoped_lock{ mutex };
+        if (auto found = map.find(key); found != map.end()) {
+            return *found->second;
+        }
+
+        auto value   = std::make_unique<T>(group, name, std::forward<Args>(args)...);
+        auto [it, _] = map.emplace(std::move(key), std::move(value));
+        return *it->second;
+    }
+
+    template <typename Map>
+    auto collect(std::mutex& mutex, const Map& map)
+    {
+        using T = Map::mapped_type::element_type;
+
+        auto lock = std::scoped_lock{ mutex };
+        return map | sv::values | sv::transform([](const auto& v) -> const T* { return v.get(); })
+             | sr::to<Vec<const T*>>();
+    }
+}
+
+namespace madbfs::stats
+{
+    void Histogram::record(Duration duration) noexcept
+    {
+        auto value = static_cast<u64>(std::max(duration.count(), Duration::rep{ 0 }));
+
+        m_buckets[bucket_of(value)].fetch_add(1, std::memory_order::relaxed);
+        m_count.fetch_add(1, std::memory_order::relaxed);
+        m_sum.fetch_add(value, std::memory_order::relaxed);
+
+        auto min = m_min.load(std::memory_order::relaxed);
+        while (value < min and not m_min.compare_exchange_weak(min, value, std::memory_order::relaxed)) { }
+
+        auto max = m_max.load(std::memory_order::relaxed);
+        while (value > max and not m_max.compare_exchange_weak(max, value, std::memory_order::relaxed)) { }
+    }
+
+    void Histogram::reset() noexcept
+    {
+        for (auto& bucket : m_buckets) {
+            bucket.store(0, std::memory_order::relaxed);
+        }
+        m_count.store(0, std::memory_order::relaxed);
+        m_sum.store(0, std::memory_order::relaxed);
+        m_min.store(std::numeric_limits<u64>::max(), std::memory_order::relaxed);
+        m_max.store(0, std::memory_order::relaxed);
+    }
+
+    Histogram::Summary Histogram::summary() const noexcept
+    {
+        auto buckets = Array<u64, bucket_count>{};
+        auto total   = 0_u64;
+        for (auto i : sv::iota(0uz, bucket_count)) {
+            buckets[i]  = m_buckets[i].load(std::memory_order::relaxed);
+            total      += buckets[i];
+        }
+
+        auto summary = Summary{
+            .count = total,
+            .sum   = m_sum.load(std::memory_order::relaxed),
+            .min   = total == 0 ? 0 : m_min.load(std::memory_order::relaxed),
+            .max   = m_max.load(std::memory_order::relaxed),
+            .p50   = 0,
+            .p90   = 0,
+            .p99   = 0,
+            .p999  = 0,
+        };
+
+        auto percentile = [&](double p) -> u64 {
+            if (total == 0) {
+                return 0;
+            }
+
+            auto rank       = std::max(static_cast<u64>(std::ceil(p * static_cast<double>(total))), 1_u64);
+            auto cumulative = 0_u64;
+            for (auto i : sv::iota(0uz, bucket_count)) {
+                cumulative += buckets[i];
+                if (cumulative >= rank) {
+                    return std::min(upper_bound_of(i), summary.max);
+                }
+            }
+            return summary.max;
+        };
+
+        summary.p50  = percentile(0.5);
+        summary.p90  = percentile(0.9);
+        summary.p99  = percentile(0.99);
+        summary.p999 = percentile(0.999);
+
+        return summary;
+    }
+
+    usize Histogram::bucket_of(u64 value) noexcept
+    {
+        if (value < sub_bucket_count) {
+            return static_cast<usize>(value);
+        }
+
+        auto magnitude = static_cast<usize>(std::bit_width(value)) - 1;    // >= sub_bucket_bits
+        auto shift     = magnitude - sub_bucket_bits;
+        auto sub       = static_cast<usize>(value >> shift) - sub_bucket_count;
+
+        return (shift + 1) * sub_bucket_count + sub;
+    }
+
+    u64 Histogram::upper_bound_of(usize bucket) noexcept
+    {
+        if (bucket < sub_bucket_count) {
+            return bucket;
+        }
+
+        auto shift = bucket / sub_bucket_count - 1;
+        auto sub   = bucket % sub_bucket_count;
+        auto lower = static_cast<u64>(sub_bucket_count + sub) << shift;
+
+        return lower + ((1_u64 << shift) - 1);
+    }
+}
+
+namespace madbfs::stats
+{
+    void FlightRecorder::record(
+        const Metric& metric,
+        Str           path,
+        u64           size,
+        Duration      duration,
+        Errc          error
+    ) noexcept
+    {
+        using namespace std::chrono;
+
+        auto  idx  = m_head.fetch_add(1, std::memory_order::relaxed);
+        auto& slot = m_slots[idx % capacity];
+
+        // NOTE: a writer lapping another writer on the same slot (1024 operations apart while the first is
+        // still writing) can leave the slot torn; the seq check on read only guards against readers
+        slot.seq.store(2 * idx + 1, std::memory_order::relaxed);
+        std::atomic_thread_fence(std::memory_order::release);
+
+        if (path.size() > path_len) {
+            path = path.substr(path.size() - path_len);
+        }
+
+        auto buf = Array<char, path_len>{};
+        std::memcpy(buf.data(), path.data(), path.size());
+
+        for (auto i : sv::iota(0uz, path_words)) {
+            auto word = u64{};
+            std::memcpy(&word, buf.data() + i * sizeof(u64), sizeof(u64));
+            slot.path[i].store(word, std::memory_order::relaxed);
+        }
+
+        auto now = duration_cast<microseconds>(system_clock::now().time_since_epoch()).count();
+
+        slot.timestamp.store(now, std::memory_order::relaxed);
+        slot.metric.store(&metric, std::memory_order::relaxed);
+        slot.size.store(size, std::memory_order::relaxed);
+        slot.duration.store(duration.count(), std::memory_order::relaxed);
+        slot.error.store(static_cast<i32>(error), std::memory_order::relaxed);
+
+        slot.seq.store(2 * idx + 2, std::memory_order::release);
+    }
+
+    Vec<FlightRecorder::Event> FlightRecorder::events() const
+    {
+        auto head  = m_head.load(std::memory_order::acquire);
+        auto first = head > capacity ? head - capacity : 0;
+
+        auto events = Vec<Event>{};
+        events.reserve(static_cast<usize>(head - first));
+
+        for (auto idx : sv::iota(first, head)) {
+            const auto& slot = m_slots[idx % capacity];
+
+            auto seq = slot.seq.load(std::memory_order::acquire);
+            if (seq != 2 * idx + 2) {
+                continue;    // being written or already overwritten
+            }
+
+            auto buf = Array<char, path_len>{};
+            for (auto i : sv::iota(0uz, path_words)) {
+                auto word = slot.path[i].load(std::memory_order::relaxed);
+                std::memcpy(buf.data() + i * sizeof(u64), &word, sizeof(u64));
+            }
+
+            auto event = Event{
+                .seq       = idx,
+                .timestamp = slot.timestamp.load(std::memory_order::relaxed),
+                .metric    = slot.metric.load(std::memory_order::relaxed),
+                .path      = String{ buf.data(), ::strnlen(buf.data(), path_len) },
+                .size      = slot.size.load(std::memory_order::relaxed),
+                .duration  = Duration{ slot.duration.load(std::memory_order::relaxed) },
+                .error     = static_cast<Errc>(slot.error.load(std::memory_order::relaxed)),
+            };
+
+            std::atomic_thread_fence(std::memory_order::acquire);
+            if (slot.seq.load(std::memory_order::relaxed) != seq) {
+                continue;
+            }
+
+            events.push_back(std::move(event));
+        }
+
+        return events;
+    }
+
+    Metric::Metric(Str group, Str name, FlightRecorder* recorder)
+        : m_group{ group }
+        , m_name{ name }
+        , m_recorder{ recorder }
+        , m_trace_op{ trace::register_op(fmt::format("{}.{}", group, name)) }
+    {
+    }
+
+    void Metric::record(Duration duration, Str path, u64 size, Errc error) noexcept
+    {
+        m_histogram.record(duration);
+        if (m_recorder != nullptr) {
+            m_recorder->record(*this, path, size, duration, error);
+        }
+        trace::record(m_trace_op, trace::id_of(path), size, duration, error);
+    }
+
+    Metric& Registry::metric(Str group, Str name)
+    {
+        return get_or_create(m_mutex, m_metrics, group, name, &m_recorder);
+    }
+
+    Counter& Registry::counter(Str group, Str name)
+    {
+        return get_or_create(m_mutex, m_counters, group, name);
+    }
+
+    Gauge& Registry::gauge(Str group, Str name)
+    {
+        return get_or_create(m_mutex, m_gauges, group, name);
+    }
+
+    Vec<const Metric*> Registry::metrics() const
+    {
+        return collect(m_mutex, m_metrics);
+    }
+
+    Vec<const Counter*> Registry::counters() const
+    {
+        return collect(m_mutex, m_counters);
+    }
+
+    Vec<const Gauge*> Registry::gauges() const
+    {
+        return collect(m_mutex, m_gauges);
+    }
+
+    void Registry::reset()
+    {
+        auto lock = std::scoped_lock{ m_mutex };
+        for (auto& metric : m_metrics | sv::values) {
+            metric->histogram().reset();
+        }
+    }
+
+    String Registry::dump(usize max_events) const
+    {
+        auto out = fmt::memory_buffer{};
+        auto it  = std::back_inserter(out);
+
+        fmt::format_to(
+            it,
+            "{:<28} {:>10} {:>10} {:>10} {:>10} {:>10} {:>10} {:>10}\n",
+            "operation",
+            "count",
+            "mean",
+            "p50",
+            "p90",
+            "p99",
+            "p99.9",
+            "max"
+        );
+
+        for (const auto* metric : metrics()) {
+            auto sum = metric->histogram().summary();
+            if (sum.count == 0) {
+                continue;
+            }
+
+            fmt::format_to(
+                it,
+                "{:<28} {:>10} {:>10} {:>10} {:>10} {:>10} {:>10} {:>10}\n",
+                fmt::format("{}.{}", metric->group(), metric->name()),
+                sum.count,
+                pretty_ns(sum.sum / sum.count),
+                pretty_ns(sum.p50),
+                pretty_ns(sum.p90),
+                pretty_ns(sum.p99),
+                pretty_ns(sum.p999),
+                pretty_ns(sum.max)
+            );
+        }
+
+        auto events = m_recorder.events();
+        if (events.size() > max_events) {
+            events.erase(events.begin(), events.end() - static_cast<isize>(max_events));
+        }
+
+        fmt::format_to(it, "\nlast {} operations (oldest first):\n", events.size());
+        for (const auto& event : events) {
+            auto time = std::chrono::sys_time<std::chrono::microseconds>{
+                std::chrono::microseconds{ event.timestamp },
+            };
+            auto metric = event.metric;
+            auto name   = metric ? fmt::format("{}.{}", metric->group(), metric->name()) : String{ "?" };
+            auto error  = event.error;
+            auto err    = error == Errc{} ? String{ "ok" } : std::make_error_code(error).message();
+
+            fmt::format_to(
+                it,
+                "{:%T} {:<28} {:>10} size={:<8} {} {:?}\n",
+                time,
+                name,
+                pretty_ns(static_cast<u64>(event.duration.count())),
+                event.size,
+                err,
+                event.path
+            );
+        }
+
+        return fmt::to_string(out);
+    }
+
+    String Registry::openmetrics(Span<const Sample> samples, Str labels) const
+    {
+        auto out = fmt::memory_buffer{};
+        auto it  = std::back_inserter(out);
+
+        // joins the common labels with the sample specific ones
+        auto with = [&](Str extra) -> String {
+            if (labels.empty() and extra.empty()) {
+                return {};
+            }
+            auto sep = labels.empty() or extra.empty() ? "" : ",";
+            return fmt::format("{{{}{}{}}}", labels, sep, extra);
+        };
+
+        auto family = [&](Str name, Str type, Str help) {
+            fmt::format_to(it, "# TYPE madbfs_{} {}\n# HELP madbfs_{} {}\n", name, type, name, help);
+        };
+
+        auto seconds = [](u64 ns) { return static_cast<f64>(ns) / 1e9; };
+
+        // e.g. "rpc in flight bytes"
+        auto describe = [](Str group, Str name) {
+            auto help = fmt::format("{} {}", group, name);
+            sr::replace(help, '_', ' ');
+            return help;
+        };
+
+        // metrics are ordered by group, so each family is contiguous
+        auto current = String{};
+        for (const auto* metric : metrics()) {
+            auto name = fmt::format("{}_latency_seconds", metric->group());
+            if (name != current) {
+                current = name;
+                family(name, "summary", fmt::format("{} operation latency", metric->group()));
+            }
+
+            auto sum = metric->histogram().summary();
+            auto op  = fmt::format("op=\"{}\"", metric->name());
+
+            auto quantiles = Array<Pair<Str, u64>, 4>{ {
+                { "0.5", sum.p50 },
+                { "0.9", sum.p90 },
+                { "0.99", sum.p99 },
+                { "0.999", sum.p999 },
+            } };
+
+            for (auto [q, value] : quantiles) {
+                auto lbl = with(fmt::format("{},quantile=\"{}\"", op, q));
+                fmt::format_to(it, "madbfs_{}{} {}\n", name, lbl, seconds(value));
+            }
+            fmt::format_to(it, "madbfs_{}_count{} {}\n", name, with(op), sum.count);
+            fmt::format_to(it, "madbfs_{}_sum{} {}\n", name, with(op), seconds(sum.sum));
+        }
+
+        for (const auto* counter : counters()) {
+            auto name = fmt::format("{}_{}", counter->group(), counter->name());
+            family(name, "counter", describe(counter->group(), counter->name()));
+            fmt::format_to(it, "madbfs_{}_total{} {}\n", name, with(""), counter->value());
+        }
+
+        for (const auto* gauge : gauges()) {
+            auto name = fmt::format("{}_{}", gauge->group(), gauge->name());
+            family(name, "gauge", describe(gauge->group(), gauge->name()));
+            fmt::format_to(it, "madbfs_{}{} {}\n", name, with(""), gauge->value());
+        }
+
+        for (const auto& sample : samples) {
+            if (sample.kind == Sample::Kind::Counter) {
+                family(sample.name, "counter", sample.help);
+                fmt::format_to(it, "madbfs_{}_total{} {}\n", sample.name, with(""), sample.value);
+            } else {
+                family(sample.name, "gauge", sample.help);
+                fmt::format_to(it, "madbfs_{}{} {}\n", sample.name, with(""), sample.value);
+            }
+        }
+
+        fmt::format_to(it, "# EOF\n");
+        return fmt::to_string(out);
+    }
+
+    Registry& registry()
+    {
+        static Registry instance;
+        return instance;
+    }
+}
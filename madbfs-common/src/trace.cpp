@@ -0,0 +1,267 @@
+#include "madbfs-common/trace.hpp"
+#include "madbfs-common/log.hpp"
+
+#include <algorithm>
+#include <condition_variable>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+namespace
+{
+    using namespace madbfs::aliases;
+    using madbfs::trace::Chunk;
+    using madbfs::trace::Record;
+
+    /**
+     * @class Ring
+     * @brief Single producer single consumer ring buffer of records.
+     *
+     * The producer is the thread owning the ring, the consumer is the writer thread.
+     */
+    struct Ring
+    {
+        static constexpr usize capacity = 4096;    // must be a power of 2
+
+        bool push(const Record& record) noexcept
+        {
+            auto head = m_head.load(std::memory_order::relaxed);
+            if (head - m_tail.load(std::memory_order::acquire) == capacity) {
+                m_dropped.fetch_add(1, std::memory_order::relaxed);
+                return false;
+            }
+
+            m_records[head & (capacity - 1)] = record;
+            m_head.store(head + 1, std::memory_order::release);
+            return true;
+        }
+
+        template <typename Fn>
+        void drain(Fn&& fn)
+        {
+            auto tail = m_tail.load(std::memory_order::relaxed);
+            auto head = m_head.load(std::memory_order::acquire);
+            if (tail == head) {
+                return;
+            }
+
+            // at most two contiguous spans because of wrap around
+            auto first = tail & (capacity - 1);
+            auto count = static_cast<usize>(head - tail);
+            auto split = std::min(count, capacity - first);
+
+            fn(Span<const Record>{ m_records.data() + first, split });
+            if (split < count) {
+                fn(Span<const Record>{ m_records.data(), count - split });
+            }
+
+            m_tail.store(head, std::memory_order::release);
+        }
+
+        u64 take_dropped() noexcept { return m_dropped.exchange(0, std::memory_order::relaxed); }
+
+        bool empty() const noexcept
+        {
+            return m_head.load(std::memory_order::acquire) == m_tail.load(std::memory_order::acquire);
+        }
+
+    private:
+        Array<Record, capacity> m_records;
+        std::atomic<u64>        m_head    = 0;
+        std::atomic<u64>        m_tail    = 0;
+        std::atomic<u64>        m_dropped = 0;
+    };
+
+    /**
+     * @class Tracer
+     * @brief Owner of the ring buffers, the op names, and the writer thread.
+     */
+    class Tracer
+    {
+    public:
+        static constexpr auto flush_interval = std::chrono::milliseconds{ 100 };
+
+        u16 register_op(Str name)
+        {
+            auto lock = std::scoped_lock{ m_mutex };
+            if (auto found = sr::find(m_ops, name); found != m_ops.end()) {
+                return static_cast<u16>(found - m_ops.begin());
+            }
+            m_ops.emplace_back(name);
+            return static_cast<u16>(m_ops.size() - 1);
+        }
+
+        Ring& ring()
+        {
+            thread_local auto ring = [this] {
+                auto ring = std::make_shared<Ring>();
+                auto lock = std::scoped_lock{ m_mutex };
+                m_rings.push_back(ring);
+                return ring;
+            }();
+            return *ring;
+        }
+
+        madbfs::Expect<void> start(Str file)
+        {
+            auto lock = std::scoped_lock{ m_mutex };
+            if (m_file != nullptr) {
+                return madbfs::Unexpect{ madbfs::Errc::device_or_resource_busy };
+            }
+
+            auto path = String{ file };
+            auto fp   = std::fopen(path.c_str(), "wb");
+            if (fp == nullptr) {
+                return madbfs::Unexpect{ static_cast<madbfs::Errc>(errno) };
+            }
+
+            auto header = Array<u32, 2>{ madbfs::trace::version, sizeof(Record) };
+            std::fwrite(madbfs::trace::magic.data(), 1, madbfs::trace::magic.size(), fp);
+            std::fwrite(header.data(), sizeof(u32), header.size(), fp);
+
+            m_file        = fp;
+            m_ops_written = 0;
+            m_writer      = std::jthread{ [this](std::stop_token st) { writer_loop(st); } };
+
+            madbfs::trace::detail::g_enabled.store(true, std::memory_order::relaxed);
+            return {};
+        }
+
+        void stop()
+        {
+            auto writer = std::jthread{};
+            {
+                auto lock = std::scoped_lock{ m_mutex };
+                if (m_file == nullptr) {
+                    return;
+                }
+                madbfs::trace::detail::g_enabled.store(false, std::memory_order::relaxed);
+                writer = std::move(m_writer);
+            }
+
+            writer.request_stop();
+            writer.join();    // final drain happens at the end of the writer loop
+
+            auto lock = std::scoped_lock{ m_mutex };
+            std::fclose(m_file);
+            m_file = nullptr;
+        }
+
+        ~Tracer() { stop(); }
+
+    private:
+        void write_chunk(Chunk kind, const void* data, usize len)
+        {
+            auto header = Array<u32, 2>{ static_cast<u32>(kind), static_cast<u32>(len) };
+            std::fwrite(header.data(), sizeof(u32), header.size(), m_file);
+            std::fwrite(data, 1, len, m_file);
+        }
+
+        void drain()
+        {
+            auto lock = std::scoped_lock{ m_mutex };
+
+            for (; m_ops_written < m_ops.size(); ++m_ops_written) {
+                const auto& name = m_ops[m_ops_written];
+                auto        buf  = Vec<char>(sizeof(u16) + name.size());
+                auto        op   = static_cast<u16>(m_ops_written);
+
+                std::memcpy(buf.data(), &op, sizeof(u16));
+                std::memcpy(buf.data() + sizeof(u16), name.data(), name.size());
+                write_chunk(Chunk::Op, buf.data(), buf.size());
+            }
+
+            auto dropped = u64{ 0 };
+            for (auto& ring : m_rings) {
+                ring->drain([&](Span<const Record> records) {
+                    write_chunk(Chunk::Records, records.data(), records.size_bytes());
+                });
+                dropped += ring->take_dropped();
+            }
+
+            if (dropped > 0) {
+                write_chunk(Chunk::Dropped, &dropped, sizeof(dropped));
+            }
+
+            // rings of exited threads are only referenced here
+            std::erase_if(m_rings, [](const auto& ring) { return ring.use_count() == 1 and ring->empty(); });
+
+            std::fflush(m_file);
+        }
+
+        void writer_loop(std::stop_token st)
+        {
+            auto mutex = std::mutex{};
+            auto cv    = std::condition_variable_any{};
+
+            while (not st.stop_requested()) {
+                auto lock = std::unique_lock{ mutex };
+                cv.wait_for(lock, st, flush_interval, [] { return false; });    // woken up on stop request
+                drain();
+            }
+            drain();
+        }
+
+        std::mutex                 m_mutex;
+        Vec<String>                m_ops;
+        Vec<std::shared_ptr<Ring>> m_rings;
+        std::FILE*                 m_file        = nullptr;
+        usize                      m_ops_written = 0;
+        std::jthread               m_writer;
+    };
+
+    Tracer& tracer()
+    {
+        static Tracer instance;
+        return instance;
+    }
+}
+
+namespace madbfs::trace
+{
+    std::atomic<bool> detail::g_enabled = false;
+
+    void detail::emit(u16 op, u32 id, u64 size, Duration latency, Errc error) noexcept
+    {
+        using namespace std::chrono;
+
+        auto now = duration_cast<nanoseconds>(system_clock::now().time_since_epoch()).count();
+
+        tracer().ring().push({
+            .timestamp = static_cast<u64>(now),
+            .latency   = static_cast<u64>(std::max(latency.count(), Duration::rep{ 0 })),
+            .size      = size,
+            .id        = id,
+            .op        = op,
+            .error     = static_cast<u16>(error),
+        });
+    }
+
+    u16 register_op(Str name)
+    {
+        return tracer().register_op(name);
+    }
+
+    Expect<void> start(Str file)
+    {
+        if constexpr (not MADBFS_TRACE_ENABLED) {
+            log_w("{}: tracing is disabled at compile time", __func__);
+            return Unexpect{ Errc::operation_not_supported };
+        }
+
+        auto res = tracer().start(file);
+        if (res) {
+            log_i("{}: tracing into {:?}", __func__, file);
+        } else {
+            log_e("{}: failed to start tracing: {}", __func__, std::make_error_code(res.error()).message());
+        }
+        return res;
+    }
+
+    void stop()
+    {
+        tracer().stop();
+    }
+}
@@ -0,0 +1,87 @@
+#pragma once
+
+#include <madbfs-common/aliases.hpp>
+#include <madbfs-common/rpc.hpp>
+
+#include <bit>
+
+namespace madbfs::server
+{
+    /**
+     * @class BufferPool
+     * @brief Size-classed pool of buffers with a cap on the total bytes kept around.
+     *
+     * Buffers are grouped by power of two capacity from `min_class` to `max_class`. Buffers larger than
+     * `max_class` are never kept, and released buffers that would push the total above the cap are freed.
+     */
+    class BufferPool : public rpc::BufferSource
+    {
+    public:
+        static constexpr usize min_class   = 4 * 1024;
+        static constexpr usize max_class   = 4 * 1024 * 1024;
+        static constexpr usize num_classes = std::countr_zero(max_class / min_class) + 1;
+
+        /**
+         * @brief Construct a pool.
+         *
+         * @param cap Maximum total capacity of buffers kept in the pool.
+         */
+        BufferPool(usize cap)
+            : m_cap{ cap }
+        {
+        }
+
+        Vec<u8> acquire(usize size) override;
+        void    release(Vec<u8> buffer) override;
+
+        /**
+         * @brief Free all the buffers kept in the pool.
+         *
+         * @return Number of bytes freed.
+         */
+        usize trim();
+
+        usize cached() const { return m_cached; }
+        usize cap() const { return m_cap; }
+
+    private:
+        Array<Vec<Vec<u8>>, num_classes> m_free;
+
+        usize m_cap    = 0;
+        usize m_cached = 0;
+    };
+
+    /**
+     * @class MemoryWatch
+     * @brief Reacts to the memory usage of the server process, similar to Android's `onTrimMemory`.
+     *
+     * The resident set size is read from `/proc/self/status` every `interval` calls of `check()`. Above the
+     * soft limit the buffer pool is emptied, above the hard limit the freed memory is also given back to the
+     * system by the allocator.
+     */
+    class MemoryWatch
+    {
+    public:
+        static constexpr usize interval = 64;
+
+        MemoryWatch(BufferPool& pool, usize soft_limit, usize hard_limit)
+            : m_pool{ pool }
+            , m_soft_limit{ soft_limit }
+            , m_hard_limit{ hard_limit }
+        {
+        }
+
+        void check();
+
+    private:
+        BufferPool& m_pool;
+        usize       m_soft_limit = 0;
+        usize       m_hard_limit = 0;
+        usize       m_counter    = 0;
+    };
+
+    /**
+     * @brief Get resident set size of the current process in bytes.
+     */
+    Opt<usize> resident_memory();
+}
@@ -0,0 +1,38 @@
+#pragma once
+
+#include <madbfs-common/aliases.hpp>
+#include <madbfs-common/rpc.hpp>
+#include <madbfs-common/stats.hpp>
+
+namespace madbfs::server
+{
+    /**
+     * @class Instrument
+     * @brief Aggregates the timings of requests per procedure, reported through `ServerStats` procedure.
+     *
+     * The aggregates of a procedure are only allocated once it's handled for the first time.
+     */
+    class Instrument : public rpc::ServerProbe
+    {
+    public:
+        void record(const Sample& sample) override;
+
+        rpc::resp::ServerStats snapshot() const;
+        void                   reset();
+
+    private:
+        struct Entry
+        {
+            u64 count  = 0;
+            u64 errors = 0;
+            u64 bytes  = 0;
+
+            stats::Histogram queue;
+            stats::Histogram handle;
+            stats::Histogram encode;
+            stats::Histogram send;
+        };
+
+        Array<Uniq<Entry>, 256> m_entries;
+    };
+}
@@ -0,0 +1,87 @@
+#pragma once
+
+#include <madbfs-common/aliases.hpp>
+
+#include <sys/types.h>
+
+namespace madbfs::server
+{
+    /**
+     * @class Readahead
+     * @brief Tracks access pattern of files across read requests and advises the kernel accordingly.
+     *
+     * Each request opens the file anew, so the kernel readahead state of the fd starts fresh every time and
+     * never ramps up. This class keeps that state across requests instead: files read sequentially get their
+     * next window read ahead into the page cache with a window that grows as the stream goes on, while files
+     * read randomly have kernel readahead disabled so it won't waste flash bandwidth.
+     */
+    class Readahead
+    {
+    public:
+        static constexpr usize max_streams   = 32;
+        static constexpr usize min_window    = 256 * 1024;
+        static constexpr usize max_window    = 8 * 1024 * 1024;
+        static constexpr usize seq_threshold = 2;
+
+        /**
+         * @brief A single `posix_fadvise` call.
+         */
+        struct Advice
+        {
+            i32   advice;
+            off_t offset;
+            off_t length;
+        };
+
+        /**
+         * @brief Advices to be applied on the fd of a read, in order.
+         */
+        struct Plan
+        {
+            Array<Advice, 3> advices;
+            usize            count = 0;
+
+            Span<const Advice> span() const { return { advices.data(), count }; }
+        };
+
+        /**
+         * @brief Record a read and get the advices to apply before reading.
+         *
+         * @param path Path of the file.
+         * @param offset Offset of the read.
+         * @param size Size of the read.
+         */
+        Plan on_read(Str path, off_t offset, usize size);
+
+        /**
+         * @brief Apply the advices on a freshly opened fd.
+         *
+         * The advices are only hints, failure of any of them doesn't affect the read itself.
+         */
+        static void apply(int fd, const Plan& plan);
+
+        /**
+         * @brief Forget the access pattern of a file, e.g. after it's removed or renamed.
+         *
+         * @param path Path of the file.
+         */
+        void forget(Str path);
+
+    private:
+        struct Stream
+        {
+            String path;
+            off_t  next     = 0;    // expected offset of the next sequential read
+            off_t  ahead    = 0;    // end of the range already read ahead
+            off_t  dropped  = 0;    // start of the range not yet dropped from page cache
+            usize  window   = 0;    // current readahead window, grows while sequential
+            usize  streak   = 0;    // number of consecutive sequential reads
+            u64    last_use = 0;
+        };
+
+        Stream& stream_of(Str path);
+
+        Vec<Stream> m_streams;
+        u64         m_counter = 0;
+    };
+}
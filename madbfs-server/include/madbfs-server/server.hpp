@@ -1,3 +1,8 @@
+#include "madbfs-server/buffer_pool.hpp"
+#include "madbfs-server/instrument.hpp"
+#include "madbfs-server/readahead.hpp"
+#include "madbfs-server/uring.hpp"
+
 #include <madbfs-common/aliases.hpp>
 #include <madbfs-common/async/async.hpp>
 #include <madbfs-common/rpc.hpp>
@@ -9,8 +14,10 @@ namespace madbfs::server
     public:
         using Response = Var<rpc::Status, rpc::Response>;
 
-        RequestHandler(Vec<u8>& buffer)
+        RequestHandler(Vec<u8>& buffer, Readahead& readahead, Instrument& instrument)
             : m_buffer{ buffer }
+            , m_readahead{ readahead }
+            , m_instrument{ instrument }
         {
         }
 
@@ -27,15 +34,49 @@ namespace madbfs::server
         Response handle_req(rpc::req::Write req);
         Response handle_req(rpc::req::Utimens req);
         Response handle_req(rpc::req::CopyFileRange req);
+        Response handle_req(rpc::req::ReadMany req);
+        Response handle_req(rpc::req::WriteMany req);
+        Response handle_req(rpc::req::Fallocate req);
+        Response handle_req(rpc::req::Lseek req);
+        Response handle_req(rpc::req::ServerStats req);
+
+        Await<Response> handle_req(rpc::req::Read req, Uring& uring);
+        Await<Response> handle_req(rpc::req::Write req, Uring& uring);
 
     private:
-        Vec<u8>& m_buffer;
+        Vec<u8>&    m_buffer;
+        Readahead&  m_readahead;
+        Instrument& m_instrument;
+    };
+
+    /**
+     * @brief How the server does file I/O.
+     */
+    enum class Backend
+    {
+        Auto,     // io_uring when the kernel allows it, blocking syscalls otherwise
+        Uring,    // io_uring only, fail if not available
+        Sync,     // blocking syscalls only
     };
 
     class Server
     {
     public:
-        Server(async::Context& context, u16 port) noexcept(false);
+        /**
+         * @brief Construct a server listening on an address.
+         *
+         * @param context Async context.
+         * @param address TCP port or Unix socket to listen on.
+         * @param memory_limit Resident memory the server should stay under, buffers are capped at a quarter
+         *                     of it and released when the limit is approached.
+         * @param backend Backend for reads and writes, throws if io_uring is requested but not available.
+         */
+        Server(
+            async::Context& context,
+            rpc::Address    address,
+            usize           memory_limit = default_memory_limit,
+            Backend         backend      = Backend::Auto
+        ) noexcept(false);
         ~Server();
 
         Server(Server&&)            = delete;
@@ -44,13 +85,21 @@ namespace madbfs::server
         Server(const Server&)            = delete;
         Server& operator=(const Server&) = delete;
 
+        static constexpr usize default_memory_limit = 64 * 1024 * 1024;
+
         AExpect<void> run();
         void          stop();
 
     private:
-        AExpect<void> handle_connection(async::tcp::Socket sock);
+        AExpect<void> handle_connection(rpc::Socket sock);
 
-        async::tcp::Acceptor m_acceptor;
-        std::atomic<bool>    m_running;
+        rpc::Address             m_address;
+        async::generic::Acceptor m_acceptor;
+        BufferPool               m_buffers;
+        MemoryWatch              m_memory_watch;
+        Readahead                m_readahead;
+        Instrument               m_instrument;
+        Uniq<Uring>              m_uring;
+        std::atomic<bool>        m_running;
     };
 }
@@ -0,0 +1,165 @@
+#pragma once
+
+#include "madbfs-server/readahead.hpp"
+
+#include <madbfs-common/aliases.hpp>
+#include <madbfs-common/async/async.hpp>
+
+#include <saf.hpp>
+
+#include <linux/io_uring.h>
+
+namespace madbfs::server
+{
+    /**
+     * @class Uring
+     * @brief Minimal io_uring driver that runs whole file requests without blocking the server thread.
+     *
+     * A request is queued as a chain of linked operations (openat -> [fadvise...] -> read/write -> close)
+     * using direct descriptors, so the file never gets a slot in the process fd table. Chains queued within
+     * the same turn of the event loop are submitted with a single `io_uring_enter`, and completions are
+     * reaped when the ring fd becomes readable.
+     *
+     * The ring is driven with raw syscalls, liburing is not required. Direct descriptors are available since
+     * Linux 5.15, but only later kernels resolve them for operations linked in the same chain; `create()`
+     * tests for exactly that and fails on older kernels, or where io_uring is blocked by seccomp/SELinux
+     * (e.g. most Android devices), in which case the server should keep using blocking syscalls.
+     */
+    class Uring
+    {
+    public:
+        static constexpr u32   default_entries = 256;
+        static constexpr u32   num_slots       = 64;
+        static constexpr usize max_chain_len   = 3 + std::tuple_size_v<decltype(Readahead::Plan::advices)>;
+
+        /**
+         * @brief Set up a ring and check that every operation needed is supported.
+         *
+         * @param context Async context the completions are delivered on.
+         * @param entries Number of submission queue entries.
+         *
+         * @return The ring, or the reason io_uring can't be used.
+         */
+        static Expect<Uniq<Uring>> create(async::Context& context, u32 entries = default_entries);
+
+        ~Uring();
+
+        Uring(Uring&&)            = delete;
+        Uring& operator=(Uring&&) = delete;
+
+        Uring(const Uring&)            = delete;
+        Uring& operator=(const Uring&) = delete;
+
+        /**
+         * @brief Check whether a chain can be queued right now.
+         *
+         * All descriptor slots may be taken or the submission queue may be full; requests should then take
+         * the blocking path instead. The check stays valid until the caller suspends.
+         */
+        bool can_queue() const;
+
+        /**
+         * @brief Read from a file.
+         *
+         * @param path Path of the file.
+         * @param offset Offset to read from.
+         * @param out Destination buffer.
+         * @param plan Advices to apply on the file before reading.
+         *
+         * @return Number of bytes read.
+         */
+        AExpect<usize> read(String path, off_t offset, Span<u8> out, const Readahead::Plan& plan);
+
+        /**
+         * @brief Write to a file.
+         *
+         * @param path Path of the file.
+         * @param offset Offset to write to.
+         * @param in Data to be written.
+         *
+         * @return Number of bytes written.
+         */
+        AExpect<usize> write(String path, off_t offset, Span<const u8> in);
+
+        /**
+         * @brief Cancel the chains in flight and stop reaping once they are done so the async context can run
+         * out of work.
+         *
+         * No chain can be queued afterwards.
+         */
+        void stop();
+
+    private:
+        using Poll = async::Token::as_default_on_t<asio::posix::stream_descriptor>;
+
+        // CQEs of a chain carry the address of the chain with the op index stored in the low bits
+        struct alignas(8) Chain
+        {
+            String             path;
+            saf::promise<Errc> done;
+            u32                slot    = 0;
+            u8                 pending = 0;    // number of CQEs not yet reaped
+            u8                 main    = 0;    // index of the read/write op
+            i32                opened  = 0;    // result of openat
+            i32                result  = 0;    // result of the read/write op
+        };
+
+        struct Ring
+        {
+            void* ptr  = nullptr;
+            usize size = 0;
+        };
+
+        Uring(async::Context& context, int fd, int poll_fd);
+
+        Expect<void> setup(const io_uring_params& params);
+        Expect<void> probe();
+        Expect<void> smoke_test();
+
+        io_uring_sqe*  next_sqe(Chain* chain, u8 index);
+        AExpect<usize> run(Chain& chain);
+
+        void schedule_flush();
+        void flush();
+        void reap();
+        void complete(u64 user_data, i32 res);
+
+        /**
+         * @brief Take back the SQEs the kernel hasn't consumed and complete them with given result.
+         */
+        void fail_unsubmitted(i32 res);
+
+        /**
+         * @brief Ask the kernel to cancel every request in flight, best effort.
+         */
+        void cancel_all();
+
+        Await<void> reaper();
+
+        int  m_fd;
+        Poll m_poll;
+
+        Ring m_sq_ring;
+        Ring m_cq_ring;
+        Ring m_sqes_ring;
+
+        // kernel-shared ring fields
+        u32*          m_sq_khead  = nullptr;
+        u32*          m_sq_ktail  = nullptr;
+        u32*          m_sq_array  = nullptr;
+        u32*          m_cq_khead  = nullptr;
+        u32*          m_cq_ktail  = nullptr;
+        io_uring_sqe* m_sqes      = nullptr;
+        io_uring_cqe* m_cqes      = nullptr;
+        u32           m_sq_mask   = 0;
+        u32           m_cq_mask   = 0;
+        u32           m_sq_size   = 0;
+        u32           m_sq_tail   = 0;    // local tail, published on flush
+        u32           m_submitted = 0;    // tail already consumed by the kernel
+
+        Vec<u32> m_free_slots;
+        u32      m_in_flight       = 0;    // chains queued and not yet completed
+        bool     m_flush_scheduled = false;
+        bool     m_stopping        = false;
+    };
+}
@@ -0,0 +1,112 @@
+#include "madbfs-server/buffer_pool.hpp"
+
+#include <madbfs-common/log.hpp>
+
+#include <malloc.h>
+
+#include <algorithm>
+#include <cstdio>
+#include <utility>
+
+namespace madbfs::server
+{
+    Vec<u8> BufferPool::acquire(usize size)
+    {
+        if (size > max_class) {
+            return Vec<u8>(size);
+        }
+
+        // smallest class that fits the size
+        auto  index = static_cast<usize>(std::bit_width((std::max(size, min_class) - 1) / min_class));
+        auto& list  = m_free[index];
+
+        if (list.empty()) {
+            auto buffer = Vec<u8>{};
+            buffer.reserve(min_class << index);
+            buffer.resize(size);
+            return buffer;
+        }
+
+        auto buffer = std::move(list.back());
+        list.pop_back();
+        m_cached -= buffer.capacity();
+
+        buffer.resize(size);
+        return buffer;
+    }
+
+    void BufferPool::release(Vec<u8> buffer)
+    {
+        auto capacity = buffer.capacity();
+        if (capacity < min_class or m_cached + capacity > m_cap) {
+            return;
+        }
+
+        // largest class the capacity satisfies, buffers grown past the largest class are not kept
+        auto index = static_cast<usize>(std::bit_width(capacity / min_class)) - 1;
+        if (index >= num_classes) {
+            return;
+        }
+
+        buffer.clear();
+        m_free[index].push_back(std::move(buffer));
+        m_cached += capacity;
+    }
+
+    usize BufferPool::trim()
+    {
+        for (auto& list : m_free) {
+            list = {};
+        }
+        return std::exchange(m_cached, 0uz);
+    }
+
+    void MemoryWatch::check()
+    {
+        if (++m_counter % interval != 0) {
+            return;
+        }
+
+        auto rss = resident_memory();
+        if (not rss or *rss <= m_soft_limit) {
+            return;
+        }
+
+        auto freed = m_pool.trim();
+        log_i("{}: memory {} KiB over soft limit, freed {} KiB", __func__, *rss / 1024, freed / 1024);
+
+        if (*rss <= m_hard_limit) {
+            return;
+        }
+
+        // give freed memory back to the system, otherwise the allocator may hold onto it
+#if defined(__GLIBC__)
+        ::malloc_trim(0);
+#elif defined(M_PURGE)
+        ::mallopt(M_PURGE, 0);
+#endif
+        log_w("{}: resident memory {} KiB over hard limit, purged allocator", __func__, *rss / 1024);
+    }
+
+    Opt<usize> resident_memory()
+    {
+        auto file = std::fopen("/proc/self/status", "r");
+        if (file == nullptr) {
+            return std::nullopt;
+        }
+
+        auto line   = Array<char, 256>{};
+        auto result = Opt<usize>{};
+
+        while (std::fgets(line.data(), static_cast<int>(line.size()), file) != nullptr) {
+            auto kib = 0ul;
+            if (std::sscanf(line.data(), "VmRSS: %lu kB", &kib) == 1) {
+                result = kib * 1024;
+                break;
+            }
+        }
+
+        std::fclose(file);
+        return result;
+    }
+}
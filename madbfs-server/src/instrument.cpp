@@ -0,0 +1,62 @@
+#include "madbfs-server/instrument.hpp"
+
+namespace madbfs::server
+{
+    void Instrument::record(const Sample& sample)
+    {
+        auto& entry = m_entries[static_cast<u8>(sample.proc)];
+        if (entry == nullptr) {
+            entry = std::make_unique<Entry>();
+        }
+
+        entry->count  += 1;
+        entry->errors += sample.status != rpc::Status::Success;
+        entry->bytes  += sample.bytes;
+
+        entry->queue.record(sample.queue);
+        entry->handle.record(sample.handle);
+        entry->encode.record(sample.encode);
+        entry->send.record(sample.send);
+    }
+
+    rpc::resp::ServerStats Instrument::snapshot() const
+    {
+        auto timing = [](const stats::Histogram& histogram) {
+            auto summary = histogram.summary();
+            return rpc::resp::ServerStats::Timing{
+                .sum = summary.sum,
+                .p50 = summary.p50,
+                .p99 = summary.p99,
+                .max = summary.max,
+            };
+        };
+
+        auto entries = Vec<rpc::resp::ServerStats::Entry>{};
+        for (auto i : sv::iota(0uz, m_entries.size())) {
+            const auto& entry = m_entries[i];
+            if (entry == nullptr or entry->count == 0) {
+                continue;
+            }
+
+            entries.push_back({
+                .proc   = static_cast<rpc::Procedure>(i),
+                .count  = entry->count,
+                .errors = entry->errors,
+                .bytes  = entry->bytes,
+                .queue  = timing(entry->queue),
+                .handle = timing(entry->handle),
+                .encode = timing(entry->encode),
+                .send   = timing(entry->send),
+            });
+        }
+
+        return rpc::resp::ServerStats{ .entries = std::move(entries) };
+    }
+
+    void Instrument::reset()
+    {
+        for (auto& entry : m_entries) {
+            entry.reset();
+        }
+    }
+}
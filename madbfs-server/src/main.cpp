@@ -1,5 +1,6 @@
 #include "madbfs-common/log.hpp"
 #include "madbfs-common/rpc.hpp"
+#include "madbfs-common/trace.hpp"
 #include "madbfs-server/server.hpp"
 
 #include <atomic>
@@ -27,20 +28,66 @@ try {
 
     using Level = madbfs::log::Level;
 
-    auto log_level = Level::warn;
-    auto port      = madbfs::u16{ 12345 };
+    auto log_level  = Level::warn;
+    auto address    = madbfs::rpc::Address::tcp(12345);
+    auto trace_file = madbfs::Str{};
+    auto memory_mib = madbfs::server::Server::default_memory_limit / 1024 / 1024;
+    auto backend    = madbfs::server::Backend::Auto;
 
     for (auto i = 1; i < argc; ++i) {
         auto arg = madbfs::Str{ argv[i] };
         if (arg == "--help" or arg == "-h") {
-            fmt::println("{} [--port PORT] [--debug]\n", argv[0]);
-            fmt::println("  --port PORT       Port number the server listen on (default: 12345");
-            fmt::println("  --debug           Enable debug logging.");
+            fmt::print("{} [--port PORT | --listen ADDR] [--debug] [--trace FILE] ", argv[0]);
+            fmt::println("[--memory-limit MIB] [--backend BACKEND]\n");
+            fmt::println("  --port PORT         Port number the server listen on (default: 12345");
+            fmt::println("  --listen ADDR       Address to listen on instead of a port: tcp:PORT,");
+            fmt::println("                      localabstract:NAME, or localfilesystem:PATH");
+            fmt::println("  --debug             Enable debug logging.");
+            fmt::println("  --trace FILE        Write binary trace of each request into FILE.");
+            fmt::println("  --memory-limit MIB  Memory the server stays under (default: {})", memory_mib);
+            fmt::println("  --backend BACKEND   File I/O backend: auto, uring, or sync (default: auto)");
             return 0;
         } else if (arg == "--debug") {
             log_level = Level::debug;
         } else if (arg == "--verbose") {
             log_level = Level::info;
+        } else if (arg == "--trace") {
+            if (i + 1 >= argc) {
+                fmt::println(stderr, "expecting file path after '--trace' argument");
+                return 1;
+            }
+            trace_file = madbfs::Str{ argv[++i] };
+        } else if (arg == "--memory-limit") {
+            if (i + 1 >= argc) {
+                fmt::println(stderr, "expecting size in MiB after '--memory-limit' argument");
+                return 1;
+            }
+
+            arg = madbfs::Str{ argv[++i] };
+
+            auto [ptr, ec] = std::from_chars(arg.data(), arg.data() + arg.size(), memory_mib);
+            if (ec != std::errc{} or ptr != arg.data() + arg.size() or memory_mib == 0) {
+                fmt::println(stderr, "invalid memory limit '{}'", arg);
+                return 1;
+            }
+        } else if (arg == "--backend") {
+            if (i + 1 >= argc) {
+                fmt::println(stderr, "expecting backend name after '--backend' argument");
+                return 1;
+            }
+
+            arg = madbfs::Str{ argv[++i] };
+
+            if (arg == "auto") {
+                backend = madbfs::server::Backend::Auto;
+            } else if (arg == "uring") {
+                backend = madbfs::server::Backend::Uring;
+            } else if (arg == "sync") {
+                backend = madbfs::server::Backend::Sync;
+            } else {
+                fmt::println(stderr, "invalid backend '{}', expecting one of: auto, uring, sync", arg);
+                return 1;
+            }
         } else if (arg == "--port") {
             if (i + 1 >= argc) {
                 fmt::println(stderr, "expecting port number after '--port' argument");
@@ -49,6 +96,7 @@ try {
 
             arg = madbfs::Str{ argv[++i] };
 
+            auto port      = madbfs::u16{};
             auto [ptr, ec] = std::from_chars(arg.data(), arg.data() + arg.size(), port);
             if (ec != std::errc{}) {
                 auto msg = std::make_error_code(ec).message();
@@ -58,6 +106,22 @@ try {
                 fmt::println(stderr, "failed to parse port number '{}': invalid trailing characters", arg);
                 return 1;
             }
+
+            address = madbfs::rpc::Address::tcp(port);
+        } else if (arg == "--listen") {
+            if (i + 1 >= argc) {
+                fmt::println(stderr, "expecting address after '--listen' argument");
+                return 1;
+            }
+
+            arg = madbfs::Str{ argv[++i] };
+
+            auto parsed = madbfs::rpc::Address::parse(arg);
+            if (not parsed) {
+                fmt::println(stderr, "invalid address '{}'", arg);
+                return 1;
+            }
+            address = std::move(*parsed);
         } else {
             fmt::println(stderr, "unknown argument: {}", arg);
             return 1;
@@ -66,8 +130,13 @@ try {
 
     madbfs::log::init(log_level, "-");
 
+    if (not trace_file.empty() and not madbfs::trace::start(trace_file)) {
+        return 1;
+    }
+
     auto context = madbfs::async::Context{};
-    auto server  = madbfs::server::Server{ context, port };    // may throw
+    auto limit   = memory_mib * 1024 * 1024;
+    auto server  = madbfs::server::Server{ context, address, limit, backend };    // may throw
 
     madbfs::async::spawn(context, server.run(), madbfs::async::detached);
     auto thread = std::thread{ [&] { context.run(); } };
@@ -80,6 +149,8 @@ try {
     server.stop();
     thread.join();
 
+    madbfs::trace::stop();
+
     madbfs::log_i("server exited normally");
 
     return 0;
@@ -0,0 +1,98 @@
+#include "madbfs-server/readahead.hpp"
+
+#include <madbfs-common/log.hpp>
+
+#include <fcntl.h>
+
+#include <algorithm>
+
+namespace madbfs::server
+{
+    Readahead::Plan Readahead::on_read(Str path, off_t offset, usize size)
+    {
+        auto& stream = stream_of(path);
+        auto  fresh  = stream.last_use == 0;
+        auto  plan   = Plan{};
+
+        stream.last_use = ++m_counter;
+
+        // pipelined reads may skip one request ahead, still counted as sequential
+        auto end        = offset + static_cast<off_t>(size);
+        auto sequential = offset >= stream.next and offset - stream.next <= static_cast<off_t>(size);
+
+        if (sequential) {
+            ++stream.streak;
+        } else {
+            stream.streak  = 0;
+            stream.window  = 0;
+            stream.ahead   = 0;
+            stream.dropped = offset;
+        }
+        stream.next = end;
+
+        if (stream.streak < seq_threshold) {
+            if (not fresh and stream.streak == 0) {
+                plan.advices[plan.count++] = { POSIX_FADV_RANDOM, 0, 0 };
+            }
+            return plan;
+        }
+
+        plan.advices[plan.count++] = { POSIX_FADV_SEQUENTIAL, 0, 0 };
+
+        // keep at least half of the window read ahead of the stream
+        if (end + static_cast<off_t>(stream.window / 2) > stream.ahead) {
+            stream.window = stream.window == 0 ? std::clamp(size * 4, min_window, max_window)
+                                               : std::min(stream.window * 2, max_window);
+
+            auto start  = std::max(stream.ahead, end);
+            auto window = static_cast<off_t>(stream.window);
+            log_d("{}: [path={:?}|start={}|window={}]", __func__, path, start, window);
+
+            plan.advices[plan.count++] = { POSIX_FADV_WILLNEED, start, window };
+            stream.ahead               = start + window;
+        }
+
+        // a long stream would evict everything else on the device, pages far behind it are not coming back
+        auto behind = offset - static_cast<off_t>(2 * max_window);
+        if (behind > stream.dropped) {
+            plan.advices[plan.count++] = { POSIX_FADV_DONTNEED, stream.dropped, behind - stream.dropped };
+            stream.dropped             = behind;
+        }
+
+        return plan;
+    }
+
+    void Readahead::apply(int fd, const Plan& plan)
+    {
+        for (auto [advice, offset, length] : plan.span()) {
+            if (advice == POSIX_FADV_WILLNEED) {
+                // only initiates the read, the pages will be there by the time the next requests arrive
+                ::readahead(fd, offset, static_cast<usize>(length));
+            } else {
+                ::posix_fadvise(fd, offset, length, advice);
+            }
+        }
+    }
+
+    void Readahead::forget(Str path)
+    {
+        std::erase_if(m_streams, [&](const Stream& stream) { return stream.path == path; });
+    }
+
+    Readahead::Stream& Readahead::stream_of(Str path)
+    {
+        auto found = sr::find(m_streams, path, &Stream::path);
+        if (found != m_streams.end()) {
+            return *found;
+        }
+
+        if (m_streams.size() < max_streams) {
+            return m_streams.emplace_back(Stream{ .path = String{ path } });
+        }
+
+        // replace the least recently used one
+        auto& oldest = *sr::min_element(m_streams, std::less{}, &Stream::last_use);
+        oldest       = Stream{ .path = String{ path } };
+        return oldest;
+    }
+}
@@ -3,14 +3,18 @@
 
 #include <madbfs-common/log.hpp>
 #include <madbfs-common/rpc.hpp>
+#include <madbfs-common/trace.hpp>
 #include <madbfs-common/util/overload.hpp>
 
 #include <dirent.h>
+#include <fcntl.h>
 #include <linux/fs.h>
 #include <sys/stat.h>
 #include <sys/syscall.h>
 #include <unistd.h>
 
+#include <stdexcept>
+
 namespace
 {
     std::string err_msg(madbfs::Errc errc)
@@ -40,12 +44,74 @@ namespace
         case madbfs::rpc::Status::NotADirectory:
         case madbfs::rpc::Status::IsADirectory:
         case madbfs::rpc::Status::InvalidArgument:
-        case madbfs::rpc::Status::DirectoryNotEmpty: return status;
+        case madbfs::rpc::Status::DirectoryNotEmpty:
+        case madbfs::rpc::Status::NoSpaceLeftOnDevice:
+        case madbfs::rpc::Status::NoSuchDeviceOrAddress:
+        case madbfs::rpc::Status::OperationNotSupported: return status;
         }
 
         // revert to InvalidArgument as default
         return madbfs::rpc::Status::InvalidArgument;
     }
+
+    madbfs::rpc::resp::Stat to_stat(const struct stat& filestat)
+    {
+        return {
+            .size  = static_cast<off_t>(filestat.st_size),
+            .links = static_cast<nlink_t>(filestat.st_nlink),
+            .mtime = filestat.st_mtim,
+            .atime = filestat.st_atim,
+            .ctime = filestat.st_ctim,
+            .mode  = static_cast<mode_t>(filestat.st_mode),
+            .uid   = filestat.st_uid,
+            .gid   = filestat.st_gid,
+        };
+    }
+
+    // stat after a successful mutation; failure here is not an error for the mutation itself, the client
+    // will just stat the file on its own
+    madbfs::Opt<madbfs::rpc::resp::Stat> stat_after(madbfs::Str path)
+    {
+        struct stat filestat = {};
+        if (::lstat(path.data(), &filestat) < 0) {
+            return std::nullopt;
+        }
+        return to_stat(filestat);
+    }
+
+    // create a file that doesn't exist yet in the directory of path, to be renamed over path later; returns
+    // -1 with errno set on failure
+    madbfs::Pair<int, std::string> create_temporary_near(madbfs::Str path, mode_t mode)
+    {
+        static auto counter = madbfs::u64{ 0 };
+
+        auto dir = path.substr(0, path.rfind('/') + 1);    // path is absolute
+        auto pid = ::getpid();
+
+        // a leftover of a crashed server may take the name, just move on to the next one
+        for (auto _ : madbfs::sv::iota(0, 8)) {
+            auto temp = fmt::format("{}.madbfs-{}-{}", dir, pid, counter++);
+            auto fd   = ::open(temp.c_str(), O_WRONLY | O_CREAT | O_EXCL, mode);
+            if (fd >= 0 or errno != EEXIST) {
+                return { fd, std::move(temp) };
+            }
+        }
+
+        return { -1, {} };
+    }
+
+    madbfs::u16 trace_op_of(madbfs::rpc::Procedure proc)
+    {
+        static const auto ops = [] {
+            auto ops = madbfs::Array<madbfs::u16, 256>{};
+            for (auto i : madbfs::sv::iota(0uz, ops.size())) {
+                auto name = madbfs::rpc::to_string(static_cast<madbfs::rpc::Procedure>(i));
+                ops[i]    = madbfs::trace::register_op(fmt::format("server.{}", name));
+            }
+            return ops;
+        }();
+        return ops[static_cast<madbfs::u8>(proc)];
+    }
 }
 
 namespace madbfs::server
@@ -76,7 +142,10 @@ namespace madbfs::server
         auto& buf = m_buffer;
         buf.clear();
 
-        auto slices = Vec<Pair<Slice, rpc::resp::Stat>>{};
+        // target of symlinks are sent along so the client doesn't need to readlink each of them
+        thread_local static auto link_buf = Array<char, PATH_MAX>{};
+
+        auto slices = Vec<Tup<Slice, rpc::resp::Stat, Slice>>{};
         auto dirfd  = ::dirfd(dir);
 
         while (auto entry = ::readdir(dir)) {
@@ -96,27 +165,31 @@ namespace madbfs::server
 
             buf.insert(buf.end(), name_u8, name_u8 + name.size());
 
-            auto slice = Slice{ static_cast<isize>(off), name.size() };
-            auto stat  = rpc::resp::Stat{
-                 .size  = static_cast<off_t>(filestat.st_size),
-                 .links = static_cast<nlink_t>(filestat.st_nlink),
-                 .mtime = filestat.st_mtim,
-                 .atime = filestat.st_atim,
-                 .ctime = filestat.st_ctim,
-                 .mode  = static_cast<mode_t>(filestat.st_mode),
-                 .uid   = filestat.st_uid,
-                 .gid   = filestat.st_gid,
-            };
+            auto slice  = Slice{ static_cast<isize>(off), name.size() };
+            auto target = Slice{ static_cast<isize>(buf.size()), 0 };
+
+            if (S_ISLNK(filestat.st_mode)) {
+                auto len = ::readlinkat(dirfd, entry->d_name, link_buf.data(), link_buf.size());
+                if (len < 0) {
+                    status_from_errno(__func__, name, "failed to readlink");
+                } else {
+                    auto target_u8 = reinterpret_cast<const u8*>(link_buf.data());
+                    buf.insert(buf.end(), target_u8, target_u8 + len);
+                    target.size = static_cast<usize>(len);
+                }
+            }
 
-            slices.emplace_back(std::move(slice), std::move(stat));
+            slices.emplace_back(std::move(slice), to_stat(filestat), std::move(target));
         }
 
-        auto entries = Vec<Pair<Str, rpc::resp::Stat>>{};
+        auto entries = Vec<rpc::resp::Listdir::Entry>{};
         entries.reserve(slices.size());
 
-        for (auto&& [slice, stat] : slices) {
-            auto name = Str{ reinterpret_cast<const char*>(buf.data()) + slice.offset, slice.size };
-            entries.emplace_back(std::move(name), std::move(stat));
+        auto to_str = [&](Slice slice) {
+            return Str{ reinterpret_cast<const char*>(buf.data()) + slice.offset, slice.size };
+        };
+        for (auto&& [slice, stat, target] : slices) {
+            entries.push_back({ .name = to_str(slice), .stat = std::move(stat), .target = to_str(target) });
         }
 
         return rpc::resp::Listdir{ .entries = std::move(entries) };
@@ -132,16 +205,7 @@ namespace madbfs::server
             return status_from_errno(__func__, path, "failed to stat file");
         }
 
-        return rpc::resp::Stat{
-            .size  = static_cast<off_t>(filestat.st_size),
-            .links = static_cast<nlink_t>(filestat.st_nlink),
-            .mtime = filestat.st_mtim,
-            .atime = filestat.st_atim,
-            .ctime = filestat.st_ctim,
-            .mode  = static_cast<mode_t>(filestat.st_mode),
-            .uid   = filestat.st_uid,
-            .gid   = filestat.st_gid,
-        };
+        return to_stat(filestat);
     }
 
     RequestHandler::Response RequestHandler::handle_req(rpc::req::Readlink req)
@@ -170,7 +234,7 @@ namespace madbfs::server
             return status_from_errno(__func__, path, "failed to create file");
         }
 
-        return rpc::resp::Mknod{};
+        return rpc::resp::Mknod{ .stat = stat_after(path) };
     }
 
     RequestHandler::Response RequestHandler::handle_req(rpc::req::Mkdir req)
@@ -182,7 +246,7 @@ namespace madbfs::server
             return status_from_errno(__func__, path, "failed to create directory");
         }
 
-        return rpc::resp::Mkdir{};
+        return rpc::resp::Mkdir{ .stat = stat_after(path) };
     }
 
     RequestHandler::Response RequestHandler::handle_req(rpc::req::Unlink req)
@@ -193,6 +257,7 @@ namespace madbfs::server
         if (::unlink(path.data()) < 0) {
             return status_from_errno(__func__, path, "failed to remove file");
         }
+        m_readahead.forget(path);
 
         return rpc::resp::Unlink{};
     }
@@ -226,8 +291,10 @@ namespace madbfs::server
         if (syscall(SYS_renameat2, 0, from.data(), 0, to.data(), flags) < 0) {
             return status_from_errno(__func__, from, "failed to rename file");
         }
+        m_readahead.forget(from);
+        m_readahead.forget(to);
 
-        return rpc::resp::Rename{};
+        return rpc::resp::Rename{ .stat = stat_after(to) };
     }
 
     RequestHandler::Response RequestHandler::handle_req(rpc::req::Truncate req)
@@ -239,13 +306,16 @@ namespace madbfs::server
             return status_from_errno(__func__, path, "failed to truncate file");
         }
 
-        return rpc::resp::Truncate{};
+        return rpc::resp::Truncate{ .stat = stat_after(path) };
     }
 
     RequestHandler::Response RequestHandler::handle_req(rpc::req::Read req)
     {
-        const auto& [path, offset, size] = req;
-        log_d("read: path={:?} offset={} size={}", path.data(), offset, size);
+        const auto& [path, offset, req_size] = req;
+        log_d("read: path={:?} offset={} size={}", path.data(), offset, req_size);
+
+        // larger reads are split by the client, a short read here is still a valid response
+        auto size = std::min(req_size, rpc::max_io_len);
 
         auto fd = ::open(path.data(), O_RDONLY);
         if (fd < 0) {
@@ -262,6 +332,9 @@ namespace madbfs::server
             return status_from_errno(__func__, path, "failed to seek file");
         }
 
+        // must be done before the buffer is touched, path is invalidated after that
+        Readahead::apply(fd, m_readahead.on_read(path, offset, size));
+
         // WARN: invalidates strings and spans from argument
         auto& buf = m_buffer;
         buf.resize(size);
@@ -302,6 +375,42 @@ namespace madbfs::server
         return rpc::resp::Write{ .size = static_cast<usize>(len) };
     }
 
+    Await<RequestHandler::Response> RequestHandler::handle_req(rpc::req::Read req, Uring& uring)
+    {
+        const auto& [path, offset, req_size] = req;
+        log_d("read: path={:?} offset={} size={} [uring]", path.data(), offset, req_size);
+
+        auto size = std::min(req_size, rpc::max_io_len);
+        auto plan = m_readahead.on_read(path, offset, size);
+        auto name = String{ path };    // path is invalidated once the buffer is touched
+
+        // WARN: invalidates strings and spans from argument
+        auto& buf = m_buffer;
+        buf.resize(size);
+
+        auto len = co_await uring.read(name, offset, buf, plan);
+        if (not len) {
+            errno = static_cast<int>(len.error());
+            co_return status_from_errno(__func__, name, "failed to read file");
+        }
+
+        co_return rpc::resp::Read{ .read = Span{ buf.begin(), *len } };
+    }
+
+    Await<RequestHandler::Response> RequestHandler::handle_req(rpc::req::Write req, Uring& uring)
+    {
+        const auto& [path, offset, in] = req;
+        log_d("write: path={:?} offset={}, size={} [uring]", path.data(), offset, in.size());
+
+        auto len = co_await uring.write(String{ path }, offset, in);
+        if (not len) {
+            errno = static_cast<int>(len.error());
+            co_return status_from_errno(__func__, path, "failed to write file");
+        }
+
+        co_return rpc::resp::Write{ .size = *len };
+    }
+
     RequestHandler::Response RequestHandler::handle_req(rpc::req::Utimens req)
     {
         const auto& [path, atime, mtime] = req;
@@ -313,7 +422,7 @@ namespace madbfs::server
             return status_from_errno(__func__, path, "failed to utimens file");
         }
 
-        return rpc::resp::Utimens{};
+        return rpc::resp::Utimens{ .stat = stat_after(path) };
     }
 
     RequestHandler::Response RequestHandler::handle_req(rpc::req::CopyFileRange req)
@@ -335,6 +444,9 @@ namespace madbfs::server
             return status_from_errno(__func__, in, "failed to seek file");
         }
 
+        // the file is read to the end in one go, let the kernel read ahead aggressively
+        ::posix_fadvise(in_fd, in_off, 0, POSIX_FADV_SEQUENTIAL);
+
         auto out_fd = ::open(out.data(), O_WRONLY);
         if (out_fd < 0) {
             return status_from_errno(__func__, out, "failed to open file");
@@ -373,15 +485,260 @@ namespace madbfs::server
 
         return rpc::resp::CopyFileRange{ .size = static_cast<usize>(copied) };
     }
+
+    RequestHandler::Response RequestHandler::handle_req(rpc::req::ReadMany req)
+    {
+        log_d("read_many: files={}", req.files.size());
+
+        // NOTE: paths point into the buffer which is reused for the response, copy them first
+        auto files = Vec<Pair<String, usize>>{};
+        files.reserve(req.files.size());
+        for (auto [path, size] : req.files) {
+            files.emplace_back(path, size);
+        }
+
+        struct Slice
+        {
+            isize offset;
+            usize size;
+        };
+
+        // WARN: invalidates strings and spans from argument
+        auto& buf = m_buffer;
+        buf.clear();
+
+        auto slices = Vec<Pair<rpc::Status, Slice>>{};
+        slices.reserve(files.size());
+
+        // like Read, the response is bounded: each file is clamped and the files that don't fit anymore fail
+        auto total = 0uz;
+
+        for (const auto& [path, wanted] : files) {
+            auto size = std::min(wanted, rpc::max_io_len);
+            if (size > rpc::max_io_len - total) {
+                log_w("{}: response is full, not reading {:?}", __func__, path);
+                slices.emplace_back(rpc::Status::InvalidArgument, Slice{ 0, 0 });
+                continue;
+            }
+            total += size;
+
+            auto fd = ::open(path.data(), O_RDONLY);
+            if (fd < 0) {
+                slices.emplace_back(status_from_errno(__func__, path, "failed to open file"), Slice{ 0, 0 });
+                continue;
+            }
+
+            DEFER {
+                if (::close(fd) < 0) {
+                    status_from_errno(__func__, path, "failed to close file");
+                }
+            };
+
+            auto off = buf.size();
+            buf.resize(off + size);
+
+            auto len = ::read(fd, buf.data() + off, size);
+            if (len < 0) {
+                buf.resize(off);
+                slices.emplace_back(status_from_errno(__func__, path, "failed to read file"), Slice{ 0, 0 });
+                continue;
+            }
+
+            auto slice = Slice{ static_cast<isize>(off), static_cast<usize>(len) };
+            buf.resize(off + slice.size);
+            slices.emplace_back(rpc::Status::Success, slice);
+        }
+
+        auto entries = Vec<rpc::resp::ReadMany::Entry>{};
+        entries.reserve(slices.size());
+
+        for (auto [status, slice] : slices) {
+            entries.push_back({ .status = status, .read = Span{ buf.begin() + slice.offset, slice.size } });
+        }
+
+        return rpc::resp::ReadMany{ .entries = std::move(entries) };
+    }
+
+    RequestHandler::Response RequestHandler::handle_req(rpc::req::WriteMany req)
+    {
+        log_d("write_many: files={}", req.files.size());
+
+        auto entries = Vec<rpc::resp::WriteMany::Entry>{};
+        entries.reserve(req.files.size());
+
+        auto failed = [&, name = __func__](Str path, Str msg) {
+            entries.push_back({ .status = status_from_errno(name, path, msg), .stat = {} });
+        };
+
+        // each file is written under a temporary name and then renamed over the target, so the device ends up
+        // with either the old file untouched or the new one complete
+        for (const auto& [path, mode, in, atime, mtime] : req.files) {
+            auto created = create_temporary_near(path, mode & 07777);
+            auto fd      = created.first;
+            auto temp    = std::move(created.second);
+            if (fd < 0) {
+                failed(path, "failed to create temporary file for");
+                continue;
+            }
+
+            auto renamed = false;
+
+            DEFER {
+                if (::close(fd) < 0) {
+                    status_from_errno(__func__, temp, "failed to close file");
+                }
+                if (not renamed and ::unlink(temp.c_str()) < 0) {
+                    status_from_errno(__func__, temp, "failed to unlink temporary file");
+                }
+            };
+
+            auto written = 0uz;
+            auto len     = 0_i64;
+
+            while (written < in.size()) {
+                if (len = ::write(fd, in.data() + written, in.size() - written); len < 0) {
+                    break;
+                }
+                written += static_cast<usize>(len);
+            }
+
+            if (len < 0) {
+                failed(path, "failed to write file");
+                continue;
+            }
+
+            auto times = Array{ atime, mtime };
+            if (::futimens(fd, times.data()) < 0) {
+                failed(path, "failed to utimens file");
+                continue;
+            }
+
+            if (::rename(temp.c_str(), path.data()) < 0) {
+                failed(path, "failed to rename temporary file to");
+                continue;
+            }
+            renamed = true;
+            m_readahead.forget(path);
+
+            struct stat filestat = {};
+            auto        stat     = ::fstat(fd, &filestat) < 0 ? Opt<rpc::resp::Stat>{} : to_stat(filestat);
+
+            entries.push_back({ .status = rpc::Status::Success, .stat = stat });
+        }
+
+        return rpc::resp::WriteMany{ .entries = std::move(entries) };
+    }
+
+    RequestHandler::Response RequestHandler::handle_req(rpc::req::Fallocate req)
+    {
+        const auto& [path, mode, offset, length] = req;
+        log_d("fallocate: path={:?} mode={:#x} offset={} length={}", path.data(), mode, offset, length);
+
+        auto fd = ::open(path.data(), O_WRONLY);
+        if (fd < 0) {
+            return status_from_errno(__func__, path, "failed to open file");
+        }
+
+        DEFER {
+            if (::close(fd) < 0) {
+                status_from_errno(__func__, path, "failed to close file");
+            }
+        };
+
+        if (::fallocate(fd, mode, offset, length) < 0) {
+            return status_from_errno(__func__, path, "failed to fallocate file");
+        }
+
+        struct stat filestat = {};
+        if (::fstat(fd, &filestat) < 0) {
+            return rpc::resp::Fallocate{ .stat = std::nullopt };
+        }
+        return rpc::resp::Fallocate{ .stat = to_stat(filestat) };
+    }
+
+    RequestHandler::Response RequestHandler::handle_req(rpc::req::Lseek req)
+    {
+        const auto& [path, offset, whence] = req;
+        log_d("lseek: path={:?} offset={} whence={}", path.data(), offset, whence);
+
+        auto fd = ::open(path.data(), O_RDONLY);
+        if (fd < 0) {
+            return status_from_errno(__func__, path, "failed to open file");
+        }
+
+        DEFER {
+            if (::close(fd) < 0) {
+                status_from_errno(__func__, path, "failed to close file");
+            }
+        };
+
+        auto pos = ::lseek(fd, offset, whence);
+        if (pos < 0 and errno == ENXIO) {
+            return rpc::Status::NoSuchDeviceOrAddress;    // nothing to seek to past offset, not worth a log
+        } else if (pos < 0) {
+            return status_from_errno(__func__, path, "failed to seek file");
+        }
+
+        return rpc::resp::Lseek{ .offset = pos };
+    }
+
+    RequestHandler::Response RequestHandler::handle_req(rpc::req::ServerStats req)
+    {
+        log_d("server_stats: reset={}", req.reset);
+
+        auto stats = m_instrument.snapshot();
+        if (req.reset) {
+            m_instrument.reset();
+        }
+
+        return stats;
+    }
 }
 
 namespace madbfs::server
 {
-    Server::Server(async::Context& context, u16 port) noexcept(false)
-        : m_acceptor{ context, async::tcp::Endpoint{ async::tcp::Proto::v4(), port } }
+    Server::Server(
+        async::Context& context,
+        rpc::Address    address,
+        usize           memory_limit,
+        Backend         backend
+    ) noexcept(false)
+        : m_address{ std::move(address) }
+        , m_acceptor{ context }
+        , m_buffers{ memory_limit / 4 }
+        , m_memory_watch{ m_buffers, memory_limit * 3 / 4, memory_limit }
     {
-        m_acceptor.set_option(async::tcp::Acceptor::reuse_address(true));
+        using Kind = rpc::Address::Kind;
+
+        // tcp keeps listening on all interfaces as it always did, not only on localhost
+        auto endpoint = m_address.endpoint();
+        if (m_address.kind == Kind::Tcp) {
+            endpoint = async::tcp::Endpoint{ async::tcp::Proto::v4(), m_address.port };
+        }
+
+        m_acceptor.open(endpoint.protocol());
+        if (m_address.kind == Kind::Tcp) {
+            m_acceptor.set_option(async::generic::Acceptor::reuse_address(true));
+        } else if (m_address.kind == Kind::Filesystem) {
+            ::unlink(m_address.name.c_str());    // left behind by a previous run that didn't exit cleanly
+        }
+        m_acceptor.bind(endpoint);
         m_acceptor.listen(1);
+
+        if (backend == Backend::Sync) {
+            return;
+        }
+
+        // io_uring is commonly blocked by seccomp or SELinux on Android, not having it is not an error
+        if (auto uring = Uring::create(context); uring) {
+            log_i("{}: using io_uring backend", __func__);
+            m_uring = std::move(*uring);
+        } else if (backend == Backend::Uring) {
+            throw std::runtime_error{ fmt::format("io_uring is not available: {}", err_msg(uring.error())) };
+        } else {
+            auto msg = err_msg(uring.error());
+            log_i("{}: io_uring is not available, using blocking syscalls: {}", __func__, msg);
+        }
     }
 
     Server::~Server()
@@ -389,11 +746,14 @@ namespace madbfs::server
         if (m_running) {
             stop();
         }
+        if (m_address.kind == rpc::Address::Kind::Filesystem) {
+            ::unlink(m_address.name.c_str());
+        }
     }
 
     AExpect<void> Server::run()
     {
-        log_i("{}: launching tcp server on port: {}", __func__, m_acceptor.local_endpoint().port());
+        log_i("{}: launching server on {}", __func__, m_address.to_string());
         m_running = true;
 
         while (m_running) {
@@ -408,12 +768,42 @@ namespace madbfs::server
             }
 
             auto handler = [&](Vec<u8>& buf, rpc::Request req) -> Await<Var<rpc::Status, rpc::Response>> {
-                auto handler  = RequestHandler{ buf };
+                m_memory_watch.check();
+
+                auto handler  = RequestHandler{ buf, m_readahead, m_instrument };
                 auto overload = [&](rpc::IsRequest auto&& req) { return handler.handle_req(std::move(req)); };
-                co_return std::visit(std::move(overload), std::move(req));
+
+                // only reads and writes go through the ring, other requests rarely wait on the storage
+                auto dispatch = [&](rpc::Request req) -> Await<RequestHandler::Response> {
+                    if (m_uring and m_uring->can_queue()) {
+                        if (auto read = std::get_if<rpc::req::Read>(&req.as_var())) {
+                            co_return co_await handler.handle_req(*read, *m_uring);
+                        } else if (auto write = std::get_if<rpc::req::Write>(&req.as_var())) {
+                            co_return co_await handler.handle_req(*write, *m_uring);
+                        }
+                    }
+                    co_return std::visit(std::move(overload), std::move(req));
+                };
+
+                if (not trace::enabled()) {
+                    co_return co_await dispatch(std::move(req));
+                }
+
+                auto start        = std::chrono::steady_clock::now();
+                auto proc         = req.proc();
+                auto [path, size] = rpc::describe(req);
+                auto id           = trace::id_of(path);
+
+                auto res      = co_await dispatch(std::move(req));
+                auto status   = std::get_if<rpc::Status>(&res);
+                auto error    = status ? static_cast<Errc>(*status) : Errc{};
+                auto duration = std::chrono::steady_clock::now() - start;
+
+                trace::record(trace_op_of(proc), id, size, duration, error);
+                co_return res;
             };
 
-            auto rpc = rpc::Server{ std::move(*sock) };
+            auto rpc = rpc::Server{ std::move(*sock), &m_buffers, &m_instrument };
             auto res = co_await rpc.listen(handler);
             if (not res) {
                 log_e("{}: rpc::Server::listen return with an error: {}", __func__, err_msg(res.error()));
@@ -428,5 +818,9 @@ namespace madbfs::server
         m_running = false;
         m_acceptor.cancel();
         m_acceptor.close();
+
+        if (m_uring) {
+            m_uring->stop();
+        }
     }
 }
@@ -0,0 +1,543 @@
+#include "madbfs-server/uring.hpp"
+
+#include <madbfs-common/log.hpp>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <limits>
+#include <utility>
+
+namespace
+{
+    using madbfs::i32;
+    using madbfs::u32;
+    using madbfs::u64;
+    using madbfs::u8;
+    using madbfs::usize;
+
+    int io_uring_setup(u32 entries, io_uring_params* params)
+    {
+        return static_cast<int>(::syscall(__NR_io_uring_setup, entries, params));
+    }
+
+    int io_uring_enter(int fd, u32 to_submit, u32 min_complete, u32 flags)
+    {
+        auto res = ::syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, nullptr, 0);
+        return static_cast<int>(res);
+    }
+
+    int io_uring_register(int fd, u32 opcode, void* arg, u32 nr_args)
+    {
+        return static_cast<int>(::syscall(__NR_io_uring_register, fd, opcode, arg, nr_args));
+    }
+
+    // syscalls return -1 and set errno
+    madbfs::Errc last_errc()
+    {
+        return static_cast<madbfs::Errc>(errno);
+    }
+
+    // completions carry negated errno as the result
+    madbfs::Errc errc_of(i32 res)
+    {
+        return static_cast<madbfs::Errc>(-res);
+    }
+
+    u32 load_acquire(u32* ptr)
+    {
+        return std::atomic_ref{ *ptr }.load(std::memory_order::acquire);
+    }
+
+    void store_release(u32* ptr, u32 value)
+    {
+        std::atomic_ref{ *ptr }.store(value, std::memory_order::release);
+    }
+
+    void prep_openat(io_uring_sqe* sqe, const char* path, int flags, u32 slot)
+    {
+        sqe->opcode     = IORING_OP_OPENAT;
+        sqe->fd         = AT_FDCWD;
+        sqe->addr       = reinterpret_cast<u64>(path);
+        sqe->open_flags = static_cast<u32>(flags);    // O_CLOEXEC is rejected for direct descriptors
+        sqe->file_index = slot + 1;                   // 0 means not a direct descriptor
+    }
+
+    void prep_rw(io_uring_sqe* sqe, u8 opcode, u32 slot, const void* buf, usize len, off_t offset)
+    {
+        sqe->opcode = opcode;
+        sqe->flags |= IOSQE_FIXED_FILE;
+        sqe->fd   = static_cast<i32>(slot);
+        sqe->addr = reinterpret_cast<u64>(buf);
+        sqe->len  = static_cast<u32>(len);
+        sqe->off  = static_cast<u64>(offset);
+    }
+
+    void prep_fadvise(io_uring_sqe* sqe, u32 slot, madbfs::server::Readahead::Advice advice)
+    {
+        constexpr auto max_len = static_cast<off_t>(std::numeric_limits<u32>::max());
+
+        sqe->opcode = IORING_OP_FADVISE;
+        sqe->flags |= IOSQE_FIXED_FILE;
+        sqe->fd             = static_cast<i32>(slot);
+        sqe->off            = static_cast<u64>(advice.offset);
+        sqe->len            = static_cast<u32>(std::min(advice.length, max_len));
+        sqe->fadvise_advice = static_cast<u32>(advice.advice);
+    }
+
+    void prep_close(io_uring_sqe* sqe, u32 slot)
+    {
+        sqe->opcode     = IORING_OP_CLOSE;
+        sqe->fd         = 0;    // must be zero when closing a direct descriptor
+        sqe->file_index = slot + 1;
+    }
+}
+
+namespace madbfs::server
+{
+    // the CQ is twice the size of the SQ, every chain in flight must fit in it so it never overflows
+    static_assert(Uring::num_slots * Uring::max_chain_len <= 2 * Uring::default_entries);
+
+    Expect<Uniq<Uring>> Uring::create(async::Context& context, u32 entries)
+    {
+        auto params  = io_uring_params{};
+        params.flags = IORING_SETUP_CLAMP;
+
+        auto fd = io_uring_setup(entries, &params);
+        if (fd < 0) {
+            return Unexpect{ last_errc() };
+        }
+
+        // completions are waited on through a duplicate so the ring fd itself is not owned by asio
+        auto poll_fd = ::dup(fd);
+        if (poll_fd < 0) {
+            auto errc = last_errc();
+            ::close(fd);
+            return Unexpect{ errc };
+        }
+
+        auto uring = Uniq<Uring>{ new Uring{ context, fd, poll_fd } };
+
+        if (auto res = uring->setup(params); not res) {
+            return Unexpect{ res.error() };
+        }
+        if (auto res = uring->probe(); not res) {
+            return Unexpect{ res.error() };
+        }
+        if (auto res = uring->smoke_test(); not res) {
+            return Unexpect{ res.error() };
+        }
+
+        async::spawn(context, uring->reaper(), async::detached);
+        return uring;
+    }
+
+    Uring::Uring(async::Context& context, int fd, int poll_fd)
+        : m_fd{ fd }
+        , m_poll{ context, poll_fd }
+    {
+    }
+
+    Uring::~Uring()
+    {
+        // the kernel still holds pointers into the chains in flight (and their buffers), they must be done
+        // before the frames holding them go away
+        if (m_in_flight > 0) {
+            log_w("{}: waiting for {} chains still in flight", __func__, m_in_flight);
+            m_flush_scheduled = true;    // nothing may be posted from here on
+            cancel_all();
+            while (m_in_flight > 0) {
+                if (io_uring_enter(m_fd, 0, 1, IORING_ENTER_GETEVENTS) < 0 and errno != EINTR) {
+                    log_c("{}: failed to wait for completions: {}", __func__, strerror(errno));
+                    break;
+                }
+                reap();
+            }
+        }
+
+        for (auto ring : { m_sqes_ring, m_cq_ring, m_sq_ring }) {
+            if (ring.size > 0) {
+                ::munmap(ring.ptr, ring.size);
+            }
+        }
+        ::close(m_fd);
+    }
+
+    bool Uring::can_queue() const
+    {
+        auto used = m_sq_tail - load_acquire(m_sq_khead);
+        return not m_stopping and not m_free_slots.empty() and m_sq_size - used >= max_chain_len;
+    }
+
+    AExpect<usize> Uring::read(String path, off_t offset, Span<u8> out, const Readahead::Plan& plan)
+    {
+        auto chain = Chain{
+            .path = std::move(path),
+            .done = saf::promise<Errc>{ co_await async::current_executor() },
+            .slot = m_free_slots.back(),
+        };
+        m_free_slots.pop_back();
+        ++m_in_flight;
+
+        auto index = u8{ 0 };
+
+        auto open = next_sqe(&chain, index++);
+        prep_openat(open, chain.path.c_str(), O_RDONLY, chain.slot);
+        open->flags |= IOSQE_IO_LINK;
+
+        // the advices are only hints, hard links keep the chain going even if they fail
+        for (auto advice : plan.span()) {
+            auto sqe = next_sqe(&chain, index++);
+            prep_fadvise(sqe, chain.slot, advice);
+            sqe->flags |= IOSQE_IO_HARDLINK;
+        }
+
+        // a short read breaks a normal link, the file still needs to be closed after it
+        chain.main = index;
+        auto read  = next_sqe(&chain, index++);
+        prep_rw(read, IORING_OP_READ, chain.slot, out.data(), out.size(), offset);
+        read->flags |= IOSQE_IO_HARDLINK;
+
+        prep_close(next_sqe(&chain, index++), chain.slot);
+        chain.pending = index;
+
+        co_return co_await run(chain);
+    }
+
+    AExpect<usize> Uring::write(String path, off_t offset, Span<const u8> in)
+    {
+        auto chain = Chain{
+            .path = std::move(path),
+            .done = saf::promise<Errc>{ co_await async::current_executor() },
+            .slot = m_free_slots.back(),
+        };
+        m_free_slots.pop_back();
+        ++m_in_flight;
+
+        auto index = u8{ 0 };
+
+        auto open = next_sqe(&chain, index++);
+        prep_openat(open, chain.path.c_str(), O_WRONLY, chain.slot);
+        open->flags |= IOSQE_IO_LINK;
+
+        chain.main = index;
+        auto write = next_sqe(&chain, index++);
+        prep_rw(write, IORING_OP_WRITE, chain.slot, in.data(), in.size(), offset);
+        write->flags |= IOSQE_IO_HARDLINK;
+
+        prep_close(next_sqe(&chain, index++), chain.slot);
+        chain.pending = index;
+
+        co_return co_await run(chain);
+    }
+
+    void Uring::stop()
+    {
+        asio::post(m_poll.get_executor(), [this] {
+            m_stopping = true;
+            if (m_in_flight == 0) {
+                m_poll.cancel();
+            } else {
+                cancel_all();    // the reaper stops by itself once the last chain is done
+            }
+        });
+    }
+
+    Expect<void> Uring::setup(const io_uring_params& params)
+    {
+        auto map = [&](usize size, off_t offset) -> Expect<Ring> {
+            auto ptr = ::mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_fd, offset);
+            if (ptr == MAP_FAILED) {
+                return Unexpect{ last_errc() };
+            }
+            return Ring{ ptr, size };
+        };
+
+        auto sq_size = params.sq_off.array + params.sq_entries * sizeof(u32);
+        auto cq_size = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+        auto single  = (params.features & IORING_FEAT_SINGLE_MMAP) != 0;
+
+        if (single) {
+            sq_size = cq_size = std::max(sq_size, cq_size);
+        }
+
+        auto sq_ring = map(sq_size, IORING_OFF_SQ_RING);
+        if (not sq_ring) {
+            return Unexpect{ sq_ring.error() };
+        }
+        m_sq_ring = *sq_ring;
+
+        if (single) {
+            m_cq_ring = Ring{ m_sq_ring.ptr, 0 };    // shared with the SQ ring, not unmapped on its own
+        } else {
+            auto cq_ring = map(cq_size, IORING_OFF_CQ_RING);
+            if (not cq_ring) {
+                return Unexpect{ cq_ring.error() };
+            }
+            m_cq_ring = *cq_ring;
+        }
+
+        auto sqes_ring = map(params.sq_entries * sizeof(io_uring_sqe), IORING_OFF_SQES);
+        if (not sqes_ring) {
+            return Unexpect{ sqes_ring.error() };
+        }
+        m_sqes_ring = *sqes_ring;
+
+        auto sq = static_cast<u8*>(m_sq_ring.ptr);
+        auto cq = static_cast<u8*>(m_cq_ring.ptr);
+
+        m_sq_khead = reinterpret_cast<u32*>(sq + params.sq_off.head);
+        m_sq_ktail = reinterpret_cast<u32*>(sq + params.sq_off.tail);
+        m_sq_array = reinterpret_cast<u32*>(sq + params.sq_off.array);
+        m_sq_mask  = *reinterpret_cast<u32*>(sq + params.sq_off.ring_mask);
+        m_sq_size  = params.sq_entries;
+        m_sq_tail  = *m_sq_ktail;
+        m_cq_khead = reinterpret_cast<u32*>(cq + params.cq_off.head);
+        m_cq_ktail = reinterpret_cast<u32*>(cq + params.cq_off.tail);
+        m_cq_mask  = *reinterpret_cast<u32*>(cq + params.cq_off.ring_mask);
+        m_cqes     = reinterpret_cast<io_uring_cqe*>(cq + params.cq_off.cqes);
+        m_sqes     = static_cast<io_uring_sqe*>(m_sqes_ring.ptr);
+
+        m_submitted = m_sq_tail;
+
+        // sparse table, the slots are filled by openat and emptied by close
+        auto files = Array<i32, num_slots>{};
+        files.fill(-1);
+        if (io_uring_register(m_fd, IORING_REGISTER_FILES, files.data(), num_slots) < 0) {
+            return Unexpect{ last_errc() };
+        }
+
+        m_free_slots.reserve(num_slots);
+        for (auto slot = num_slots; slot > 0; --slot) {
+            m_free_slots.push_back(slot - 1);
+        }
+
+        return {};
+    }
+
+    Expect<void> Uring::probe()
+    {
+        constexpr auto num_ops = 256u;
+
+        auto storage = Vec<u8>(sizeof(io_uring_probe) + num_ops * sizeof(io_uring_probe_op));
+        auto probe   = reinterpret_cast<io_uring_probe*>(storage.data());
+
+        if (io_uring_register(m_fd, IORING_REGISTER_PROBE, probe, num_ops) < 0) {
+            return Unexpect{ last_errc() };
+        }
+
+        auto required = Array<u8, 5>{
+            IORING_OP_OPENAT, IORING_OP_READ, IORING_OP_WRITE, IORING_OP_CLOSE, IORING_OP_FADVISE,
+        };
+
+        for (auto op : required) {
+            if (op > probe->last_op or (probe->ops[op].flags & IO_URING_OP_SUPPORTED) == 0) {
+                log_w("{}: io_uring op {} is not supported", __func__, op);
+                return Unexpect{ Errc::operation_not_supported };
+            }
+        }
+
+        return {};
+    }
+
+    Expect<void> Uring::smoke_test()
+    {
+        auto submit_and_wait = [&](u32 count) -> Expect<Array<i32, 3>> {
+            store_release(m_sq_ktail, m_sq_tail);
+            if (io_uring_enter(m_fd, count, count, IORING_ENTER_GETEVENTS) < 0) {
+                return Unexpect{ last_errc() };
+            }
+            m_submitted = m_sq_tail;
+
+            auto results = Array<i32, 3>{ -ECANCELED, -ECANCELED, -ECANCELED };
+            auto head    = *m_cq_khead;
+            auto tail    = load_acquire(m_cq_ktail);
+
+            for (; head != tail; ++head) {
+                const auto& cqe = m_cqes[head & m_cq_mask];
+                results[cqe.user_data % results.size()] = cqe.res;
+            }
+
+            store_release(m_cq_khead, head);
+            return results;
+        };
+
+        // older kernels ignore the slot and open into the fd table instead, the open is submitted on its own
+        // so the close below, which would then close fd 0, is never sent to them
+        prep_openat(next_sqe(nullptr, 0), "/", O_RDONLY | O_DIRECTORY, 0);
+
+        auto opened = submit_and_wait(1);
+        if (not opened) {
+            return Unexpect{ opened.error() };
+        } else if (auto fd = (*opened)[0]; fd > 0) {
+            ::close(fd);
+            return Unexpect{ Errc::operation_not_supported };
+        } else if (fd < 0) {
+            return Unexpect{ errc_of(fd) };
+        }
+
+        // an op linked to the one that fills the slot must see the file, EBADF means the slot was resolved
+        // before it was filled (the slot is already filled by the open above, openat replaces it)
+        auto open = next_sqe(nullptr, 0);
+        prep_openat(open, "/", O_RDONLY | O_DIRECTORY, 0);
+        open->flags |= IOSQE_IO_LINK;
+
+        auto read = next_sqe(nullptr, 1);
+        prep_rw(read, IORING_OP_READ, 0, nullptr, 0, 0);
+        read->flags |= IOSQE_IO_HARDLINK;
+
+        prep_close(next_sqe(nullptr, 2), 0);
+
+        auto linked = submit_and_wait(3);
+        if (not linked) {
+            return Unexpect{ linked.error() };
+        } else if ((*linked)[1] == -EBADF) {
+            return Unexpect{ Errc::operation_not_supported };
+        }
+
+        return {};
+    }
+
+    io_uring_sqe* Uring::next_sqe(Chain* chain, u8 index)
+    {
+        auto idx = m_sq_tail++ & m_sq_mask;
+        auto sqe = &m_sqes[idx];
+
+        std::memset(sqe, 0, sizeof(io_uring_sqe));
+        sqe->user_data  = reinterpret_cast<u64>(chain) | index;
+        m_sq_array[idx] = idx;
+
+        return sqe;
+    }
+
+    AExpect<usize> Uring::run(Chain& chain)
+    {
+        auto future = chain.done.get_future();
+        schedule_flush();
+
+        std::ignore = co_await future.async_extract();
+
+        if (chain.opened < 0) {
+            co_return Unexpect{ errc_of(chain.opened) };
+        } else if (chain.result < 0) {
+            co_return Unexpect{ errc_of(chain.result) };
+        }
+
+        co_return static_cast<usize>(chain.result);
+    }
+
+    void Uring::schedule_flush()
+    {
+        // chains queued before the flush runs are submitted together
+        if (not std::exchange(m_flush_scheduled, true)) {
+            asio::post(m_poll.get_executor(), [this] { flush(); });
+        }
+    }
+
+    void Uring::flush()
+    {
+        m_flush_scheduled = false;
+        store_release(m_sq_ktail, m_sq_tail);
+
+        while (m_submitted != m_sq_tail) {
+            auto res = io_uring_enter(m_fd, m_sq_tail - m_submitted, 0, 0);
+            if (res > 0) {
+                m_submitted += static_cast<u32>(res);
+            } else if (res == 0 or errno == EAGAIN or errno == EBUSY) {
+                // the kernel is short on resources, try again on the next turn
+                schedule_flush();
+                return;
+            } else if (errno != EINTR) {
+                auto err = errno;
+                log_c("{}: failed to submit to io_uring: {}", __func__, strerror(err));
+                fail_unsubmitted(-err);
+                return;
+            }
+        }
+    }
+
+    void Uring::fail_unsubmitted(i32 res)
+    {
+        // the submitted part of a chain cut in the middle is cancelled by the kernel, the rest completes here
+        for (auto tail = m_submitted; tail != m_sq_tail; ++tail) {
+            complete(m_sqes[tail & m_sq_mask].user_data, res);
+        }
+
+        m_sq_tail = m_submitted;
+        store_release(m_sq_ktail, m_sq_tail);
+    }
+
+    void Uring::cancel_all()
+    {
+        auto used = m_sq_tail - load_acquire(m_sq_khead);
+        if (used == m_sq_size) {
+            return;    // the chains just complete on their own
+        }
+
+        // not supported before Linux 5.19, the chains then complete on their own as well
+        auto sqe          = next_sqe(nullptr, 0);
+        sqe->opcode       = IORING_OP_ASYNC_CANCEL;
+        sqe->fd           = -1;
+        sqe->cancel_flags = IORING_ASYNC_CANCEL_ANY;
+
+        flush();
+    }
+
+    void Uring::reap()
+    {
+        auto head = *m_cq_khead;
+        auto tail = load_acquire(m_cq_ktail);
+
+        for (; head != tail; ++head) {
+            const auto& cqe = m_cqes[head & m_cq_mask];
+            complete(cqe.user_data, cqe.res);
+        }
+
+        store_release(m_cq_khead, head);
+    }
+
+    void Uring::complete(u64 user_data, i32 res)
+    {
+        auto chain = reinterpret_cast<Chain*>(user_data & ~u64{ 7 });
+        auto index = static_cast<u8>(user_data & 7);
+
+        if (chain == nullptr) {
+            return;    // not part of a chain (cancellation)
+        }
+
+        if (index == 0) {
+            chain->opened = res;
+        } else if (index == chain->main) {
+            chain->result = res;
+        } else if (index > chain->main and res < 0 and chain->opened == 0) {
+            log_w("{}: failed to close {:?}: {}", __func__, chain->path, strerror(-res));
+        }
+
+        if (--chain->pending == 0) {
+            m_free_slots.push_back(chain->slot);
+            --m_in_flight;
+            chain->done.set_value(Errc{});
+        }
+    }
+
+    Await<void> Uring::reaper()
+    {
+        while (true) {
+            reap();
+            if (m_stopping and m_in_flight == 0) {
+                break;
+            }
+            if (auto res = co_await m_poll.async_wait(Poll::wait_read); not res) {
+                if (res.error() != asio::error::operation_aborted) {
+                    log_e("{}: failed to wait for completions: {}", __func__, res.error().message());
+                }
+                break;
+            }
+        }
+    }
+}
@@ -0,0 +1,119 @@
+#include "fake_connection.hpp"
+#include "test_util.hpp"
+
+#include "madbfs/data/cache.hpp"
+
+#include <benchmark/benchmark.h>
+#include <spdlog/spdlog.h>
+
+using namespace madbfs::aliases;
+
+namespace
+{
+    constexpr auto page_size = 128 * 1024uz;
+    constexpr auto file_size = 64 * 1024 * 1024uz;
+
+    struct Fixture
+    {
+        Fixture(usize max_pages)
+            : cache{ fake, page_size, max_pages }
+        {
+            fake.add_file("/file", Vec<char>(file_size, 'x'));
+        }
+
+        madbfs::async::Context io;
+        mock::FakeConnection   fake;
+        madbfs::data::Cache    cache;
+        madbfs::data::Id       id   = madbfs::data::Stat{}.id;
+        madbfs::path::Path     path = madbfs::path::create("/file").value();
+    };
+}
+
+// every read hits the same already cached page
+static void cache_read_hit(benchmark::State& state)
+{
+    auto fix = Fixture{ 1024 };
+    auto buf = Vec<char>(static_cast<usize>(state.range(0)));
+
+    if (not mock::run(fix.io, fix.cache.read(fix.id, fix.path, buf, 0))) {
+        state.SkipWithError("failed to prime the cache");
+        return;
+    }
+
+    for (auto _ : state) {
+        auto res = mock::run(fix.io, fix.cache.read(fix.id, fix.path, buf, 0));
+        benchmark::DoNotOptimize(res);
+    }
+
+    state.SetBytesProcessed(static_cast<i64>(state.iterations() * buf.size()));
+}
+
+// sequential read over a file much larger than the cache, every page is a miss and causes eviction
+static void cache_read_miss(benchmark::State& state)
+{
+    auto fix    = Fixture{ 16 };
+    auto buf    = Vec<char>(static_cast<usize>(state.range(0)));
+    auto offset = 0uz;
+
+    for (auto _ : state) {
+        auto res = mock::run(fix.io, fix.cache.read(fix.id, fix.path, buf, static_cast<off_t>(offset)));
+        benchmark::DoNotOptimize(res);
+        offset = (offset + page_size) % file_size;
+    }
+
+    state.SetBytesProcessed(static_cast<i64>(state.iterations() * buf.size()));
+    state.counters["device_reads"] = static_cast<double>(fix.fake.num_reads());
+}
+
+// writes into the same cached page, only marks it dirty
+static void cache_write_hit(benchmark::State& state)
+{
+    auto fix = Fixture{ 1024 };
+    auto buf = Vec<char>(static_cast<usize>(state.range(0)), 'y');
+
+    if (not mock::run(fix.io, fix.cache.write(fix.id, fix.path, buf, 0))) {
+        state.SkipWithError("failed to prime the cache");
+        return;
+    }
+
+    for (auto _ : state) {
+        auto res = mock::run(fix.io, fix.cache.write(fix.id, fix.path, buf, 0));
+        benchmark::DoNotOptimize(res);
+    }
+
+    state.SetBytesProcessed(static_cast<i64>(state.iterations() * buf.size()));
+}
+
+// sequential write over a file much larger than the cache, every page evicts a dirty page
+static void cache_write_evict(benchmark::State& state)
+{
+    auto fix    = Fixture{ 16 };
+    auto buf    = Vec<char>(page_size, 'y');
+    auto offset = 0uz;
+
+    for (auto _ : state) {
+        auto res = mock::run(fix.io, fix.cache.write(fix.id, fix.path, buf, static_cast<off_t>(offset)));
+        benchmark::DoNotOptimize(res);
+        offset = (offset + page_size) % file_size;
+    }
+
+    mock::run(fix.io, fix.cache.flush(fix.id));
+
+    state.SetBytesProcessed(static_cast<i64>(state.iterations() * buf.size()));
+    state.counters["device_writes"] = static_cast<double>(fix.fake.num_writes());
+}
+
+BENCHMARK(cache_read_hit)->RangeMultiplier(4)->Range(4 * 1024, 128 * 1024);
+BENCHMARK(cache_read_miss)->RangeMultiplier(4)->Range(4 * 1024, 128 * 1024);
+BENCHMARK(cache_write_hit)->RangeMultiplier(4)->Range(4 * 1024, 128 * 1024);
+BENCHMARK(cache_write_evict);
+
+int main(int argc, char** argv)
+{
+    // cache and tree log on every miss, keep it out of the measurement
+    spdlog::set_level(spdlog::level::off);
+
+    benchmark::Initialize(&argc, argv);
+    benchmark::RunSpecifiedBenchmarks();
+    benchmark::Shutdown();
+}
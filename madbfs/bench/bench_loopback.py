@@ -0,0 +1,447 @@
+#!/usr/bin/env python3
+
+"""
+end-to-end benchmark of madbfs over loopback.
+
+the server is launched on the host against a temporary directory and madbfs mounts it through a direct TCP
+or Unix socket connection (--loopback), so no device or adb is involved. this makes the numbers reproducible
+and isolates the client/server/protocol overhead from the USB link.
+
+usage:
+    ./bench_loopback.py [--madbfs PATH] [--server PATH] [--size MIB] [--link PROFILE] [--output FILE]
+"""
+
+import json
+import os
+import random
+import selectors
+import shutil
+import signal
+import struct
+import sys
+import tempfile
+import time
+from argparse import ArgumentParser
+from dataclasses import asdict, dataclass, field
+from pathlib import Path
+from socket import AF_UNIX, SOCK_STREAM, socket
+from subprocess import DEVNULL, PIPE, Popen, TimeoutExpired, run
+
+CURRENT_DIR = Path(os.path.dirname(__file__))
+PROJECT_ROOT = CURRENT_DIR / "../.."
+BINARY_PATH = PROJECT_ROOT / "build/Release/madbfs/madbfs"
+SERVER_PATH = PROJECT_ROOT / "madbfs-server/build/linux-x86_64-release/madbfs-server"
+
+SERVER_READY_STRING = b"SERVER_IS_READY_V7"  # must match rpc::server_ready_string
+SERIAL = "loopback"
+
+KiB = 1024
+MiB = 1024 * KiB
+
+
+@dataclass
+class Result:
+    name: str
+    ops: int = 0
+    bytes: int = 0
+    seconds: float = 0.0
+    latencies_us: list[float] = field(default_factory=list)
+
+    def summary(self) -> dict:
+        lat = sorted(self.latencies_us)
+
+        def pct(p: float) -> float:
+            if not lat:
+                return 0.0
+            return lat[min(len(lat) - 1, int(p / 100 * len(lat)))]
+
+        return {
+            "name": self.name,
+            "ops": self.ops,
+            "bytes": self.bytes,
+            "seconds": self.seconds,
+            "mib_per_sec": self.bytes / MiB / self.seconds if self.seconds > 0 else 0.0,
+            "ops_per_sec": self.ops / self.seconds if self.seconds > 0 else 0.0,
+            "latency_us": {
+                "min": lat[0] if lat else 0.0,
+                "p50": pct(50),
+                "p90": pct(90),
+                "p99": pct(99),
+                "max": lat[-1] if lat else 0.0,
+            },
+        }
+
+
+@dataclass
+class Config:
+    madbfs: Path
+    server: Path
+    port: int
+    size_mib: int
+    block_kib: int
+    rand_ops: int
+    small_files: int
+    small_size: int
+    tree_depth: int
+    tree_fanout: int
+    files_per_dir: int
+    seed: int
+    link: str | None
+    backend: str
+    transport: str
+
+    def address(self) -> str:
+        if self.transport == "unix":
+            return f"localabstract:madbfs-bench-{self.port}"
+        return f"tcp:{self.port}"
+
+
+def eprint(*args, **kwargs):
+    print(*args, file=sys.stderr, **kwargs)
+
+
+def ipc_invalidate_cache():
+    """drop madbfs page cache so that the next phase starts cold"""
+
+    runtime = os.environ.get("XDG_RUNTIME_DIR", f"/run/user/{os.getuid()}")
+    sock = socket(AF_UNIX, SOCK_STREAM)
+    try:
+        sock.connect(f"{runtime}/madbfs@{SERIAL}.sock")
+        msg = json.dumps({"op": "invalidate_cache"}).encode()
+        sock.sendall(struct.pack(">I", len(msg)))
+        sock.sendall(msg)
+        size = struct.unpack(">I", sock.recv(4))[0]
+        while size > 0:
+            size -= len(sock.recv(size))
+    except OSError as e:
+        eprint(f"warning: failed to invalidate cache through ipc: {e}")
+    finally:
+        sock.close()
+
+
+def drop_kernel_cache(path: Path):
+    """madbfs is mounted without kernel caching for most paths but be explicit anyway"""
+
+    try:
+        fd = os.open(path, os.O_RDONLY)
+        os.posix_fadvise(fd, 0, 0, os.POSIX_FADV_DONTNEED)
+        os.close(fd)
+    except OSError:
+        pass
+
+
+def timed(result: Result, nbytes: int, fn):
+    start = time.perf_counter_ns()
+    fn()
+    elapsed = time.perf_counter_ns() - start
+    result.ops += 1
+    result.bytes += nbytes
+    result.latencies_us.append(elapsed / 1000)
+
+
+def bench_seq_write(cfg: Config, file: Path) -> Result:
+    res = Result("seq_write")
+    block = random.randbytes(cfg.block_kib * KiB)
+    count = cfg.size_mib * MiB // len(block)
+
+    start = time.perf_counter()
+    fd = os.open(file, os.O_WRONLY | os.O_CREAT | os.O_TRUNC, 0o644)
+    for _ in range(count):
+        timed(res, len(block), lambda: os.write(fd, block))
+    os.fsync(fd)
+    os.close(fd)
+    res.seconds = time.perf_counter() - start
+    return res
+
+
+def bench_seq_read(cfg: Config, file: Path) -> Result:
+    res = Result("seq_read")
+    block = cfg.block_kib * KiB
+
+    start = time.perf_counter()
+    fd = os.open(file, os.O_RDONLY)
+    while True:
+        data = b""
+
+        def read():
+            nonlocal data
+            data = os.read(fd, block)
+
+        timed(res, 0, read)
+        if not data:
+            res.ops -= 1
+            res.latencies_us.pop()
+            break
+        res.bytes += len(data)
+    os.close(fd)
+    res.seconds = time.perf_counter() - start
+    return res
+
+
+def bench_rand_read(cfg: Config, file: Path) -> Result:
+    res = Result("rand_read")
+    block = cfg.block_kib * KiB
+    blocks = cfg.size_mib * MiB // block
+
+    start = time.perf_counter()
+    fd = os.open(file, os.O_RDONLY)
+    for _ in range(cfg.rand_ops):
+        off = random.randrange(blocks) * block
+        timed(res, block, lambda: os.pread(fd, block, off))
+    os.close(fd)
+    res.seconds = time.perf_counter() - start
+    return res
+
+
+def bench_rand_write(cfg: Config, file: Path) -> Result:
+    res = Result("rand_write")
+    data = random.randbytes(cfg.block_kib * KiB)
+    blocks = cfg.size_mib * MiB // len(data)
+
+    start = time.perf_counter()
+    fd = os.open(file, os.O_WRONLY)
+    for _ in range(cfg.rand_ops):
+        off = random.randrange(blocks) * len(data)
+        timed(res, len(data), lambda: os.pwrite(fd, data, off))
+    os.fsync(fd)
+    os.close(fd)
+    res.seconds = time.perf_counter() - start
+    return res
+
+
+def bench_small_create(cfg: Config, dir: Path) -> Result:
+    res = Result("small_create")
+    data = random.randbytes(cfg.small_size)
+    dir.mkdir()
+
+    def create(path: Path):
+        fd = os.open(path, os.O_WRONLY | os.O_CREAT | os.O_TRUNC, 0o644)
+        os.write(fd, data)
+        os.close(fd)
+
+    start = time.perf_counter()
+    for i in range(cfg.small_files):
+        path = dir / f"file-{i:06}"
+        timed(res, len(data), lambda: create(path))
+    res.seconds = time.perf_counter() - start
+    return res
+
+
+def populate_tree(cfg: Config, root: Path):
+    """create the deep tree directly on the backing directory so that madbfs sees it cold"""
+
+    def rec(dir: Path, depth: int):
+        dir.mkdir()
+        for i in range(cfg.files_per_dir):
+            (dir / f"file-{i}").write_bytes(b"")
+        if depth < cfg.tree_depth:
+            for i in range(cfg.tree_fanout):
+                rec(dir / f"dir-{i}", depth + 1)
+
+    rec(root, 1)
+
+
+def bench_deep_readdir(cfg: Config, dir: Path) -> Result:
+    res = Result("deep_readdir")
+
+    start = time.perf_counter()
+    stack = [dir]
+    while stack:
+        current = stack.pop()
+        entries = []
+
+        def scan():
+            nonlocal entries
+            entries = list(os.scandir(current))
+
+        timed(res, 0, scan)
+        for entry in entries:
+            if entry.is_dir(follow_symlinks=False):
+                stack.append(Path(entry.path))
+            else:
+                entry.stat(follow_symlinks=False)
+    res.seconds = time.perf_counter() - start
+    return res
+
+
+def wait_server(proc: Popen, timeout: float) -> bool:
+    assert proc.stdout is not None
+    deadline = time.monotonic() + timeout
+    fd = proc.stdout.fileno()
+    buf = b""
+
+    # a server that hangs without printing must not hang the harness, so never read without data available
+    with selectors.DefaultSelector() as sel:
+        sel.register(fd, selectors.EVENT_READ)
+        while len(buf) < len(SERVER_READY_STRING):
+            remaining = deadline - time.monotonic()
+            if remaining <= 0 or not sel.select(remaining):
+                return False
+            chunk = os.read(fd, len(SERVER_READY_STRING) - len(buf))
+            if not chunk:
+                break
+            buf += chunk
+    return buf == SERVER_READY_STRING
+
+
+def wait_mount(mount: Path, timeout: float) -> bool:
+    deadline = time.monotonic() + timeout
+    while time.monotonic() < deadline:
+        if os.path.ismount(mount):
+            return True
+        time.sleep(0.1)
+    return False
+
+
+def unmount(mount: Path, proc: Popen):
+    run(["fusermount3", "-u", str(mount)], stdout=DEVNULL, stderr=DEVNULL)
+    try:
+        proc.wait(timeout=10)
+    except TimeoutExpired:
+        proc.kill()
+
+
+def run_benchmarks(cfg: Config) -> list[dict]:
+    random.seed(cfg.seed)
+
+    workdir = Path(tempfile.mkdtemp(prefix="madbfs-bench-"))
+    backing = workdir / "backing"
+    mount = workdir / "mount"
+    backing.mkdir()
+    mount.mkdir()
+
+    populate_tree(cfg, backing / "tree")
+
+    server = Popen(
+        [str(cfg.server), "--listen", cfg.address(), "--backend", cfg.backend],
+        stdout=PIPE,
+        stderr=DEVNULL,
+    )
+    client = None
+
+    try:
+        if not wait_server(server, 5):
+            raise RuntimeError("server failed to start")
+
+        cmd = [
+            str(cfg.madbfs),
+            "-f",
+            "--loopback",
+            f"--serial={SERIAL}",
+            f"--socket={cfg.address()}",
+            "--log-level=off",
+        ]
+        if cfg.link is not None:
+            cmd.append(f"--emulate-link={cfg.link}")
+
+        client = Popen(cmd + [str(mount)], stdout=DEVNULL, stderr=DEVNULL)
+        if not wait_mount(mount, 10):
+            raise RuntimeError("madbfs failed to mount")
+
+        # the server serves the host root, so the backing dir is visible at the same path under the mount
+        root = mount / backing.relative_to("/")
+        file = root / "seq.bin"
+
+        results = []
+
+        def phase(fn, *args):
+            ipc_invalidate_cache()
+            res = fn(cfg, *args)
+            eprint(f"{res.name:>14}: {res.bytes / MiB:8.2f} MiB  {res.ops:6} ops  {res.seconds:7.3f} s")
+            results.append(res.summary())
+
+        phase(bench_seq_write, file)
+        drop_kernel_cache(file)
+        phase(bench_seq_read, file)
+        phase(bench_rand_read, file)
+        phase(bench_rand_write, file)
+        phase(bench_small_create, root / "small")
+        phase(bench_deep_readdir, root / "tree")
+
+        return results
+    finally:
+        if client is not None:
+            unmount(mount, client)
+        server.send_signal(signal.SIGINT)
+        try:
+            server.wait(timeout=5)
+        except TimeoutExpired:
+            server.kill()
+        shutil.rmtree(workdir, ignore_errors=True)
+
+
+def main() -> int:
+    parser = ArgumentParser(description="madbfs end-to-end loopback benchmark")
+    parser.add_argument("--madbfs", type=Path, default=BINARY_PATH, help="madbfs binary")
+    parser.add_argument("--server", type=Path, default=SERVER_PATH, help="host madbfs-server binary")
+    parser.add_argument("--port", type=int, default=23456, help="port for the server")
+    parser.add_argument("--size", type=int, default=64, help="sequential file size in MiB")
+    parser.add_argument("--block", type=int, default=128, help="block size in KiB")
+    parser.add_argument("--rand-ops", type=int, default=1024, help="number of random ops")
+    parser.add_argument("--small-files", type=int, default=1000, help="number of small files")
+    parser.add_argument("--small-size", type=int, default=4096, help="size of each small file")
+    parser.add_argument("--tree-depth", type=int, default=5, help="depth of readdir tree")
+    parser.add_argument("--tree-fanout", type=int, default=4, help="subdirs per dir in readdir tree")
+    parser.add_argument("--files-per-dir", type=int, default=16, help="files per dir in readdir tree")
+    parser.add_argument("--seed", type=int, default=42, help="random seed")
+    parser.add_argument(
+        "--link",
+        type=str,
+        default=None,
+        help="emulated link profile (usb2, usb3, wifi, or 'lat=<ms>,jitter=<ms>,bw=<KiB/s>,overhead=<B>'),"
+        " a preset can be followed by keys, e.g. 'wifi,seed=7' to reseed the jitter",
+    )
+    parser.add_argument(
+        "--backend",
+        choices=["auto", "uring", "sync"],
+        default="auto",
+        help="file I/O backend of the server",
+    )
+    parser.add_argument(
+        "--transport",
+        choices=["tcp", "unix"],
+        default="tcp",
+        help="socket between madbfs and the server (unix uses an abstract socket)",
+    )
+    parser.add_argument("--output", type=Path, default=None, help="write json result to file")
+
+    args = parser.parse_args()
+
+    for path in (args.madbfs, args.server):
+        if not path.exists():
+            eprint(f"error: '{path}' doesn't exists. compile it first!")
+            return 1
+
+    cfg = Config(
+        madbfs=args.madbfs.resolve(),
+        server=args.server.resolve(),
+        port=args.port,
+        size_mib=args.size,
+        block_kib=args.block,
+        rand_ops=args.rand_ops,
+        small_files=args.small_files,
+        small_size=args.small_size,
+        tree_depth=args.tree_depth,
+        tree_fanout=args.tree_fanout,
+        files_per_dir=args.files_per_dir,
+        seed=args.seed,
+        link=args.link,
+        backend=args.backend,
+        transport=args.transport,
+    )
+
+    results = run_benchmarks(cfg)
+    config = asdict(cfg) | {"madbfs": str(cfg.madbfs), "server": str(cfg.server)}
+    out = json.dumps({"config": config, "results": results}, indent=2)
+
+    if args.output is not None:
+        args.output.write_text(out)
+    else:
+        print(out)
+
+    return 0
+
+
+if __name__ == "__main__":
+    ret = main()
+    exit(ret)
@@ -0,0 +1,93 @@
+#include "madbfs/path.hpp"
+
+#include <benchmark/benchmark.h>
+#include <fmt/format.h>
+
+using namespace madbfs::aliases;
+
+namespace
+{
+    String make_path(usize depth, usize name_len, usize extra_slashes)
+    {
+        auto buf  = String{};
+        auto name = String(name_len, 'a');
+        for (auto _ : sv::iota(0uz, depth)) {
+            buf += String(1 + extra_slashes, '/');
+            buf += name;
+        }
+        return buf;
+    }
+}
+
+static void path_create(benchmark::State& state)
+{
+    auto depth = static_cast<usize>(state.range(0));
+    auto str   = make_path(depth, 12, 0);
+
+    for (auto _ : state) {
+        auto path = madbfs::path::create(str);
+        benchmark::DoNotOptimize(path);
+    }
+
+    state.SetBytesProcessed(static_cast<i64>(state.iterations() * str.size()));
+}
+
+static void path_create_repeated_slashes(benchmark::State& state)
+{
+    auto depth = static_cast<usize>(state.range(0));
+    auto str   = make_path(depth, 12, 3);
+
+    for (auto _ : state) {
+        auto path = madbfs::path::create(str);
+        benchmark::DoNotOptimize(path);
+    }
+
+    state.SetBytesProcessed(static_cast<i64>(state.iterations() * str.size()));
+}
+
+static void path_iter(benchmark::State& state)
+{
+    auto depth = static_cast<usize>(state.range(0));
+    auto str   = make_path(depth, 12, 0);
+    auto path  = madbfs::path::create(str).value();
+
+    for (auto _ : state) {
+        for (auto name : path.iter()) {
+            benchmark::DoNotOptimize(name);
+        }
+    }
+}
+
+static void pathbuf_extend(benchmark::State& state)
+{
+    auto depth = static_cast<usize>(state.range(0));
+    auto names = sv::iota(0uz, depth) | sv::transform([](usize i) { return fmt::format("dir-{:04}", i); })
+               | sr::to<Vec<String>>();
+
+    for (auto _ : state) {
+        auto buf = madbfs::path::PathBuf::root();
+        for (const auto& name : names) {
+            buf.extend(name);
+        }
+        benchmark::DoNotOptimize(buf);
+    }
+}
+
+static void pathbuf_extend_copy(benchmark::State& state)
+{
+    auto depth = static_cast<usize>(state.range(0));
+    auto base  = madbfs::path::create_buf(make_path(depth, 12, 0)).value();
+
+    for (auto _ : state) {
+        auto buf = base.extend_copy("IMG_20250101_000000.jpg");
+        benchmark::DoNotOptimize(buf);
+    }
+}
+
+BENCHMARK(path_create)->RangeMultiplier(4)->Range(1, 64);
+BENCHMARK(path_create_repeated_slashes)->RangeMultiplier(4)->Range(1, 64);
+BENCHMARK(path_iter)->RangeMultiplier(4)->Range(1, 64);
+BENCHMARK(pathbuf_extend)->RangeMultiplier(4)->Range(1, 64);
+BENCHMARK(pathbuf_extend_copy)->RangeMultiplier(4)->Range(1, 64);
+
+BENCHMARK_MAIN();
@@ -0,0 +1,264 @@
+#include <madbfs-common/async/async.hpp>
+#include <madbfs-common/rpc.hpp>
+
+#include <benchmark/benchmark.h>
+#include <fmt/format.h>
+
+#include <thread>
+
+using namespace madbfs::aliases;
+namespace rpc   = madbfs::rpc;
+namespace async = madbfs::async;
+
+namespace
+{
+    constexpr auto sample_path = Str{ "/storage/emulated/0/DCIM/Camera/IMG_20250101_000000.jpg" };
+
+    const auto write_data = Vec<u8>(128 * 1024, 0x42);
+    const auto read_data  = Vec<u8>(128 * 1024, 0x24);
+
+    constexpr auto read_many_size = 32uz;
+
+    rpc::resp::Stat sample_stat()
+    {
+        return {
+            .size  = 4 * 1024 * 1024,
+            .links = 1,
+            .mtime = { 1'700'000'000, 123 },
+            .atime = { 1'700'000'000, 456 },
+            .ctime = { 1'700'000'000, 789 },
+            .mode  = 0100644,
+            .uid   = 1000,
+            .gid   = 1000,
+        };
+    }
+
+    // NOTE: indexed by rpc::Procedure
+    rpc::Request sample_request(rpc::Procedure proc)
+    {
+        using namespace rpc::req;
+        using rpc::Procedure;
+
+        switch (proc) {
+        case Procedure::Listdir: return Listdir{ sample_path };
+        case Procedure::Stat: return Stat{ sample_path };
+        case Procedure::Readlink: return Readlink{ sample_path };
+        case Procedure::Mknod: return Mknod{ sample_path, 0100644, 0 };
+        case Procedure::Mkdir: return Mkdir{ sample_path, 040755 };
+        case Procedure::Unlink: return Unlink{ sample_path };
+        case Procedure::Rmdir: return Rmdir{ sample_path };
+        case Procedure::Rename: return Rename{ sample_path, sample_path, 0 };
+        case Procedure::Truncate: return Truncate{ sample_path, 4096 };
+        case Procedure::Read: return Read{ sample_path, 0, 128 * 1024 };
+        case Procedure::Write: return Write{ sample_path, 0, write_data };
+        case Procedure::Utimens: return Utimens{ sample_path, { 1, 2 }, { 3, 4 } };
+        case Procedure::CopyFileRange: return CopyFileRange{ sample_path, 0, sample_path, 0, 4096 };
+        case Procedure::ReadMany: {
+            auto files = Vec<Pair<Str, usize>>(read_many_size, { sample_path, 4096 });
+            return ReadMany{ std::move(files) };
+        }
+        case Procedure::WriteMany: {
+            auto in    = Span{ write_data }.first(4096);
+            auto entry = WriteMany::Entry{ sample_path, 0100644, in, { 1, 2 }, { 3, 4 } };
+            auto files = Vec<WriteMany::Entry>(read_many_size, entry);
+            return WriteMany{ std::move(files) };
+        }
+        case Procedure::Fallocate: return Fallocate{ sample_path, 0, 0, 1024 * 1024 };
+        case Procedure::Lseek: return Lseek{ sample_path, 0, SEEK_DATA };
+        case Procedure::ServerStats: return ServerStats{ false };
+        }
+
+        std::unreachable();
+    }
+
+    rpc::Response sample_response(rpc::Procedure proc, const Vec<String>& names)
+    {
+        using namespace rpc::resp;
+        using rpc::Procedure;
+
+        switch (proc) {
+        case Procedure::Listdir: {
+            auto entries = Vec<Listdir::Entry>{};
+            for (const auto& name : names) {
+                entries.push_back({ .name = name, .stat = sample_stat(), .target = {} });
+            }
+            return Listdir{ std::move(entries) };
+        }
+        case Procedure::Stat: return sample_stat();
+        case Procedure::Readlink: return Readlink{ sample_path };
+        case Procedure::Mknod: return Mknod{};
+        case Procedure::Mkdir: return Mkdir{};
+        case Procedure::Unlink: return Unlink{};
+        case Procedure::Rmdir: return Rmdir{};
+        case Procedure::Rename: return Rename{};
+        case Procedure::Truncate: return Truncate{};
+        case Procedure::Read: return Read{ read_data };
+        case Procedure::Write: return Write{ 128 * 1024 };
+        case Procedure::Utimens: return Utimens{};
+        case Procedure::CopyFileRange: return CopyFileRange{ 4096 };
+        case Procedure::ReadMany: {
+            auto read    = Span{ read_data }.first(4096);
+            auto entries = Vec<ReadMany::Entry>(read_many_size, { rpc::Status::Success, read });
+            return ReadMany{ std::move(entries) };
+        }
+        case Procedure::WriteMany: {
+            auto entries = Vec<WriteMany::Entry>(read_many_size, { rpc::Status::Success, sample_stat() });
+            return WriteMany{ std::move(entries) };
+        }
+        case Procedure::Fallocate: return Fallocate{ sample_stat() };
+        case Procedure::Lseek: return Lseek{ 4096 };
+        case Procedure::ServerStats: {
+            auto timing  = ServerStats::Timing{ 1000, 100, 500, 900 };
+            auto entry   = ServerStats::Entry{ Procedure::Read, 10, 0, 4096, timing, timing, timing, timing };
+            auto entries = Vec<ServerStats::Entry>(16, entry);
+            return ServerStats{ std::move(entries) };
+        }
+        }
+
+        std::unreachable();
+    }
+
+    Vec<String> listdir_names(usize count)
+    {
+        auto names = Vec<String>{};
+        for (auto i : sv::iota(0uz, count)) {
+            names.push_back(fmt::format("IMG_20250101_{:06}.jpg", i));
+        }
+        return names;
+    }
+
+    struct SocketPair
+    {
+        rpc::Socket client;
+        rpc::Socket server;
+    };
+
+    SocketPair tcp_pair(async::Context& context)
+    {
+        auto acceptor = async::tcp::Acceptor{ context, { asio::ip::address_v4::loopback(), 0 } };
+        auto client   = async::tcp::Socket{ context };
+        client.connect(acceptor.local_endpoint());
+        auto server = acceptor.accept();
+        return { rpc::Socket{ std::move(client) }, rpc::Socket{ std::move(server) } };
+    }
+
+    SocketPair unix_pair(async::Context& context)
+    {
+        auto client = async::unix_socket::Socket{ context };
+        auto server = async::unix_socket::Socket{ context };
+        asio::local::connect_pair(client, server);
+        return { rpc::Socket{ std::move(client) }, rpc::Socket{ std::move(server) } };
+    }
+
+    constexpr auto num_procedures = static_cast<i64>(rpc::Procedure::ServerStats) + 1;
+    constexpr auto listdir_size   = 256uz;
+}
+
+static void encode_request(benchmark::State& state)
+{
+    auto proc   = static_cast<rpc::Procedure>(state.range(0));
+    auto buffer = Vec<u8>{};
+    auto bytes  = 0uz;
+
+    for (auto _ : state) {
+        auto frame = rpc::build_request(buffer, 1, sample_request(proc));
+        benchmark::DoNotOptimize(frame.data());
+        bytes += frame.size();
+    }
+
+    state.SetLabel(String{ rpc::to_string(proc) });
+    state.SetBytesProcessed(static_cast<i64>(bytes));
+}
+
+static void decode_request(benchmark::State& state)
+{
+    auto proc   = static_cast<rpc::Procedure>(state.range(0));
+    auto buffer = Vec<u8>{};
+    auto frame  = rpc::build_request(buffer, 1, sample_request(proc));
+    auto body   = frame.subspan(rpc::request_header_len);
+
+    for (auto _ : state) {
+        auto request = rpc::parse_request(body, proc);
+        benchmark::DoNotOptimize(request);
+    }
+
+    state.SetLabel(String{ rpc::to_string(proc) });
+    state.SetBytesProcessed(static_cast<i64>(state.iterations() * body.size()));
+}
+
+static void encode_response(benchmark::State& state)
+{
+    auto proc   = static_cast<rpc::Procedure>(state.range(0));
+    auto names  = listdir_names(listdir_size);
+    auto buffer = Vec<u8>{};
+    auto bytes  = 0uz;
+
+    for (auto _ : state) {
+        auto frame = rpc::build_response(buffer, 1, proc, sample_response(proc, names));
+        benchmark::DoNotOptimize(frame->data());
+        bytes += frame->size();
+    }
+
+    state.SetLabel(String{ rpc::to_string(proc) });
+    state.SetBytesProcessed(static_cast<i64>(bytes));
+}
+
+static void decode_response(benchmark::State& state)
+{
+    auto proc   = static_cast<rpc::Procedure>(state.range(0));
+    auto names  = listdir_names(listdir_size);
+    auto buffer = Vec<u8>{};
+    auto frame  = rpc::build_response(buffer, 1, proc, sample_response(proc, names)).value();
+    auto body   = frame.subspan(rpc::response_header_len);
+
+    for (auto _ : state) {
+        auto response = rpc::parse_response(body, proc);
+        benchmark::DoNotOptimize(response);
+    }
+
+    state.SetLabel(String{ rpc::to_string(proc) });
+    state.SetBytesProcessed(static_cast<i64>(state.iterations() * body.size()));
+}
+
+// per-request overhead of the transport: a Stat round trip through Client and Server with a trivial handler
+static void round_trip(benchmark::State& state)
+{
+    auto unix_socket = state.range(0) != 0;
+
+    auto context = async::Context{};
+    auto guard   = async::WorkGuard{ context.get_executor() };
+    auto thread  = std::thread{ [&] { context.run(); } };
+
+    auto [client_sock, server_sock] = unix_socket ? unix_pair(context) : tcp_pair(context);
+
+    auto client = rpc::Client{ std::move(client_sock) };
+    auto server = rpc::Server{ std::move(server_sock) };
+
+    auto handler = [](Vec<u8>&, rpc::Request) -> Await<Var<rpc::Status, rpc::Response>> {
+        co_return rpc::Response{ sample_stat() };
+    };
+
+    async::spawn(context, server.listen(handler), async::detached);
+    async::block(context, client.start());
+
+    auto buffer = Vec<u8>{};
+    for (auto _ : state) {
+        auto response = async::block(context, client.send_req(buffer, rpc::req::Stat{ sample_path }));
+        benchmark::DoNotOptimize(response);
+    }
+
+    // the server stops listening once the client end is closed
+    asio::post(context, [&] { client.stop(); });
+    guard.reset();
+    thread.join();
+
+    state.SetLabel(unix_socket ? "unix" : "tcp");
+}
+
+BENCHMARK(encode_request)->DenseRange(0, num_procedures - 1);
+BENCHMARK(decode_request)->DenseRange(0, num_procedures - 1);
+BENCHMARK(encode_response)->DenseRange(0, num_procedures - 1);
+BENCHMARK(decode_response)->DenseRange(0, num_procedures - 1);
+BENCHMARK(round_trip)->Arg(0)->Arg(1)->UseRealTime();
+
+BENCHMARK_MAIN();
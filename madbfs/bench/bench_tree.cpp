@@ -0,0 +1,133 @@
+#include "fake_connection.hpp"
+#include "test_util.hpp"
+
+#include "madbfs/data/cache.hpp"
+#include "madbfs/tree/file_tree.hpp"
+
+#include <benchmark/benchmark.h>
+#include <fmt/format.h>
+#include <spdlog/spdlog.h>
+
+using namespace madbfs::aliases;
+
+namespace
+{
+    /**
+     * @brief Populate a chain of directories of given depth with a file at the bottom.
+     *
+     * @return Path to the bottom file.
+     */
+    String populate_deep(mock::FakeConnection& fake, usize depth)
+    {
+        auto current = String{};
+        for (auto i : sv::iota(0uz, depth)) {
+            current += fmt::format("/dir-{}", i);
+            fake.add_dir(current);
+        }
+        current += "/file";
+        fake.add_file(current);
+        return current;
+    }
+
+    /**
+     * @brief Populate a directory with given number of files.
+     *
+     * @return Path to the directory.
+     */
+    String populate_wide(mock::FakeConnection& fake, usize width)
+    {
+        auto dir = String{ "/wide" };
+        fake.add_dir(dir);
+        for (auto i : sv::iota(0uz, width)) {
+            fake.add_file(fmt::format("{}/file-{:06}", dir, i));
+        }
+        return dir;
+    }
+
+    struct Fixture
+    {
+        madbfs::async::Context io;
+        mock::FakeConnection   fake;
+        madbfs::data::Cache    cache{ fake, 64 * 1024, 128 };
+        madbfs::tree::FileTree tree{ fake, cache };
+    };
+}
+
+static void tree_traverse_deep(benchmark::State& state)
+{
+    auto fix  = Fixture{};
+    auto file = populate_deep(fix.fake, static_cast<usize>(state.range(0)));
+    auto path = madbfs::path::create(file).value();
+
+    // build the nodes first
+    auto built = mock::run(fix.io, fix.tree.getattr(path));
+    if (not built) {
+        state.SkipWithError("failed to build tree");
+        return;
+    }
+
+    for (auto _ : state) {
+        auto node = fix.tree.traverse(path);
+        benchmark::DoNotOptimize(node);
+    }
+}
+
+static void tree_traverse_wide(benchmark::State& state)
+{
+    auto fix   = Fixture{};
+    auto width = static_cast<usize>(state.range(0));
+    auto dir   = populate_wide(fix.fake, width);
+
+    auto path  = madbfs::path::create(dir).value();
+    auto built = mock::run(fix.io, fix.tree.readdir(path, [](const char*) { }));
+    if (not built) {
+        state.SkipWithError("failed to build tree");
+        return;
+    }
+
+    // last inserted entry, worst case if children are stored in insertion order
+    auto file = fmt::format("{}/file-{:06}", dir, width - 1);
+    auto last = madbfs::path::create(file).value();
+
+    for (auto _ : state) {
+        auto node = fix.tree.traverse(last);
+        benchmark::DoNotOptimize(node);
+    }
+}
+
+static void tree_readdir_cold(benchmark::State& state)
+{
+    auto width = static_cast<usize>(state.range(0));
+
+    for (auto _ : state) {
+        state.PauseTiming();
+        auto fix  = std::make_unique<Fixture>();
+        auto dir  = populate_wide(fix->fake, width);
+        auto path = madbfs::path::create(dir).value();
+        state.ResumeTiming();
+
+        auto count = 0uz;
+        auto res   = mock::run(fix->io, fix->tree.readdir(path, [&](const char*) { ++count; }));
+        benchmark::DoNotOptimize(res);
+
+        state.PauseTiming();
+        fix.reset();
+        state.ResumeTiming();
+    }
+
+    state.SetItemsProcessed(static_cast<i64>(state.iterations() * width));
+}
+
+BENCHMARK(tree_traverse_deep)->RangeMultiplier(4)->Range(1, 256);
+BENCHMARK(tree_traverse_wide)->RangeMultiplier(8)->Range(8, 32768);
+BENCHMARK(tree_readdir_cold)->RangeMultiplier(8)->Range(8, 4096);
+
+int main(int argc, char** argv)
+{
+    // cache and tree log on every miss, keep it out of the measurement
+    spdlog::set_level(spdlog::level::off);
+
+    benchmark::Initialize(&argc, argv);
+    benchmark::RunSpecifiedBenchmarks();
+    benchmark::Shutdown();
+}
@@ -2,9 +2,12 @@
 
 #include "madbfs/cmd.hpp"
 
+#include "madbfs-common/link.hpp"
 #include "madbfs-common/log.hpp"
+#include "madbfs-common/rpc.hpp"
 #include "madbfs-common/util/split.hpp"
 #include "madbfs/connection/connection.hpp"
+#include "madbfs/data/policy.hpp"
 
 #define FUSE_USE_VERSION 31
 #include <fuse_lowlevel.h>
@@ -12,6 +15,7 @@
 #include <linr/read.hpp>
 
 #include <filesystem>
+#include <fstream>
 #include <limits>
 
 namespace madbfs::args
@@ -23,10 +27,17 @@ namespace madbfs::args
         const char* server     = nullptr;
         const char* log_level  = nullptr;
         const char* log_file   = nullptr;
+        const char* link       = nullptr;
+        const char* trace      = nullptr;
+        const char* rules      = nullptr;
+        const char* socket     = nullptr;
         int         cache_size = 256;    // in MiB
         int         page_size  = 128;    // in KiB
         int         port       = 12345;
         int         no_server  = false;
+        int         loopback   = false;
+        int         relaxed    = false;
+        int         read_only  = false;
 
         ~MadbfsOpt()
         {
@@ -34,18 +45,34 @@ namespace madbfs::args
             ::free((void*)server);
             ::free((void*)log_level);
             ::free((void*)log_file);
+            ::free((void*)link);
+            ::free((void*)trace);
+            ::free((void*)rules);
+            ::free((void*)socket);
         }
     };
 
-    struct ParsedOpt
+    struct Device
     {
         String                     serial;
         Opt<std::filesystem::path> server;
+    };
+
+    struct ParsedOpt
+    {
+        Vec<Device>                devices;    // more than one in multi-device mode
         log::Level                 log_level;
         String                     log_file;
         usize                      cachesize;
         usize                      pagesize;
         u16                        port;
+        rpc::Address               socket;    // address the server listens on
+        bool                       loopback;
+        Opt<link::Profile>         link;
+        String                     trace;    // empty if tracing is not requested
+        data::Rules                rules;
+        bool                       relaxed;
+        bool                       read_only;
     };
 
     struct ParseResult
@@ -68,16 +95,23 @@ namespace madbfs::args
         // clang-format on
     };
 
-    static constexpr auto madbfs_opt_spec = Array<fuse_opt, 12>{ {
+    static constexpr auto madbfs_opt_spec = Array<fuse_opt, 16>{ {
         // clang-format off
-        { "--serial=%s",     offsetof(MadbfsOpt, serial),     true },
-        { "--server=%s",     offsetof(MadbfsOpt, server),     true },
-        { "--log-level=%s",  offsetof(MadbfsOpt, log_level),  true },
-        { "--log-file=%s",   offsetof(MadbfsOpt, log_file),   true },
-        { "--port=%d",       offsetof(MadbfsOpt, port),       true },
-        { "--cache-size=%d", offsetof(MadbfsOpt, cache_size), true },
-        { "--page-size=%d",  offsetof(MadbfsOpt, page_size),  true },
-        { "--no-server",     offsetof(MadbfsOpt, no_server),  true },
+        { "--serial=%s",       offsetof(MadbfsOpt, serial),     true },
+        { "--server=%s",       offsetof(MadbfsOpt, server),     true },
+        { "--log-level=%s",    offsetof(MadbfsOpt, log_level),  true },
+        { "--log-file=%s",     offsetof(MadbfsOpt, log_file),   true },
+        { "--port=%d",         offsetof(MadbfsOpt, port),       true },
+        { "--socket=%s",       offsetof(MadbfsOpt, socket),     true },
+        { "--cache-size=%d",   offsetof(MadbfsOpt, cache_size), true },
+        { "--page-size=%d",    offsetof(MadbfsOpt, page_size),  true },
+        { "--no-server",       offsetof(MadbfsOpt, no_server),  true },
+        { "--loopback",        offsetof(MadbfsOpt, loopback),   true },
+        { "--emulate-link=%s", offsetof(MadbfsOpt, link),       true },
+        { "--trace=%s",        offsetof(MadbfsOpt, trace),      true },
+        { "--rules=%s",        offsetof(MadbfsOpt, rules),      true },
+        { "--relaxed",         offsetof(MadbfsOpt, relaxed),    true },
+        { "--read-only",       offsetof(MadbfsOpt, read_only),  true },
         // clang-format on
         FUSE_OPT_END,
     } };
@@ -92,6 +126,8 @@ namespace madbfs::args
             "    --serial=<s>           serial number of the device to mount\n"
             "                             (you can omit this [detection is similar to adb])\n"
             "                             (will prompt if more than one device exists)\n"
+            "                             (comma separated list mounts each at <mountpoint>/<serial>)\n"
+            "                             (all devices then share one process and one cache)\n"
             "    --server               path to server file\n"
             "                             (if omitted will search the file automatically)\n"
             "                             (must have the same arch as your phone)\n"
@@ -100,7 +136,7 @@ namespace madbfs::args
             "                             (values: trace, debug, info, warn, error, critical, off)\n"
             "    --log-file=<f>         log file to write to\n"
             "                             (default: '-' for stdout)\n"
-            "    --cache-size=<n>       maximum size of the cache in MiB\n"
+            "    --cache-size=<n>       maximum size of the cache in MiB (shared by all devices)\n"
             "                             (default: 256)\n"
             "                             (minimum: 128)\n"
             "                             (value will be rounded to the next power of 2)\n"
@@ -110,10 +146,38 @@ namespace madbfs::args
             "                             (value will be rounded to the next power of 2)\n"
             "    --port=<n>             set port the server listens on\n"
             "                             (default: 12345)\n"
+            "                             (incremented for each subsequent device)\n"
+            "    --socket=<a>           set address the server listens on\n"
+            "                             (default: 'localabstract:madbfs', or 'tcp:<port>' on loopback)\n"
+            "                             (values: tcp:<port>, localabstract:<name>, localfilesystem:<path>)\n"
+            "                             (unix sockets skip the tcp stack on the device, lowering latency)\n"
             "    --no-server            don't launch server\n"
             "                             (will still attempt to connect to specified port)\n"
             "                             (fall back to adb shell calls if connection failed)\n"
             "                             (useful for debugging the server)\n"
+            "    --loopback             connect to a server running on localhost without adb\n"
+            "                             (implies --no-server, serial defaults to 'loopback')\n"
+            "                             (useful for benchmarking with the server running on host)\n"
+            "    --emulate-link=<p>     emulate link latency and bandwidth on top of the server connection\n"
+            "                             (values: usb2, usb3, wifi, or 'lat=<ms>,jitter=<ms>,bw=<KiB/s>,overhead=<B>')\n"
+            "                             (a preset can be followed by keys, e.g. 'wifi,seed=7')\n"
+            "                             (jitter is seeded by 'seed=<n>', 0 by default, so runs repeat)\n"
+            "                             (useful for benchmarking on loopback)\n"
+            "    --trace=<f>            write binary trace of each operation into file\n"
+            "                             (decode with madbfs/tools/trace_decode.py)\n"
+            "                             (can also be started and stopped at runtime through IPC)\n"
+            "    --rules=<f>            file containing per-path cache policy rules\n"
+            "                             (one '<glob> <option>[,<option>...]' per line, first match wins)\n"
+            "                             (options: direct, cached, pin, write-through, write-back,\n"
+            "                                       readahead=<pages>)\n"
+            "    --relaxed              don't wait for the device on utimens, mkdir, and mknod\n"
+            "                             (errors are reported by the next operation on the path or fsync)\n"
+            "                             (speeds up bulk copies onto the device, similar to NFS async)\n"
+            "    --read-only            mount read-only, assuming the device doesn't change while mounted\n"
+            "                             (the kernel caches everything it has seen for as long as mounted)\n"
+            "                             (listed directories get their subdirectories and small files\n"
+            "                              prefetched in the background)\n"
+            "                             (for pulling files off the device as fast as the link allows)\n"
         );
 
         fmt::println(stdout, "\nOptions for libfuse:");
@@ -239,6 +303,53 @@ namespace madbfs::args
         return std::nullopt;
     }
 
+    /**
+     * @brief Resolve the server to push to a device.
+     *
+     * @param serial Serial of the device, its ABI picks the server build.
+     * @param opt Parsed options.
+     * @param argv0 Path of the executable, the server is searched around it.
+     *
+     * @return Path to the server, or `std::nullopt` if none is found or the server shouldn't be launched.
+     */
+    inline Await<Opt<std::filesystem::path>> find_server(Str serial, const MadbfsOpt& opt, const char* argv0)
+    {
+        if (opt.no_server) {
+            fmt::println("[madbfs] no-server flag specified, won't launch server on '{}'", serial);
+            co_return std::nullopt;
+        } else if (opt.server != nullptr) {
+            fmt::println("[madbfs] server path is set to {}", opt.server);
+            co_return std::filesystem::absolute(opt.server);
+        }
+
+        auto exe    = std::filesystem::path{ argv0 == nullptr ? "madbfs" : argv0 };
+        auto server = Opt<std::filesystem::path>{};
+        auto abi    = co_await cmd::adb(serial, { "shell", "getprop", "ro.product.cpu.abi" });
+
+        if (not abi) {
+            fmt::println("[madbfs] the Android ABI of '{}' can't be queried", serial);
+        } else {
+            fmt::println("[madbfs] '{}' is running with Android ABI '{}'", serial, util::strip(*abi));
+            auto server_name = fmt::format("madbfs-server-{}", util::strip(*abi));
+            fmt::println("[madbfs] server is not specified, attempting to search '{}'...", server_name);
+            server = get_server_path(exe, server_name);
+        }
+
+        if (not server) {
+            constexpr auto server_name = "madbfs-server";
+            fmt::println("[madbfs] trying to find 'madbfs-server'...");
+            server = get_server_path(exe, server_name);
+        }
+
+        if (not server) {
+            fmt::println("[madbfs] can't find server falling back to direct adb transport");
+        } else {
+            fmt::println("[madbfs] server is found: {}", server->c_str());
+        }
+
+        co_return server;
+    }
+
     /**
      * @brief Parse the command line arguments; show help message if needed.
      *
@@ -308,6 +419,115 @@ namespace madbfs::args
             co_return ParseResult{ 1 };
         }
 
+        auto log_level = parse_level_str(madbfs_opt.log_level);
+        if (not log_level.has_value()) {
+            fmt::println(stderr, "error: invalid log level '{}'", madbfs_opt.log_level);
+            fmt::println(stderr, "valid log levels: trace, debug, info, warn, error, critical, off");
+            ::fuse_opt_free_args(&args);
+            co_return ParseResult{ 1 };
+        }
+
+        auto link = Opt<link::Profile>{};
+        if (madbfs_opt.link != nullptr) {
+            link = link::parse_profile(madbfs_opt.link);
+            if (not link) {
+                fmt::println(stderr, "error: invalid link profile '{}'", madbfs_opt.link);
+                ::fuse_opt_free_args(&args);
+                co_return ParseResult{ 1 };
+            }
+            fmt::println("[madbfs] emulating link with profile '{}'", madbfs_opt.link);
+        }
+
+        // fuse changes working directory to root when daemonized
+        auto trace = String{};
+        if (madbfs_opt.trace != nullptr) {
+            trace = std::filesystem::absolute(madbfs_opt.trace);
+        }
+
+        auto rules = data::Rules{};
+        if (madbfs_opt.rules != nullptr) {
+            auto file = std::ifstream{ madbfs_opt.rules };
+            if (not file) {
+                fmt::println(stderr, "error: can't open rules file '{}'", madbfs_opt.rules);
+                ::fuse_opt_free_args(&args);
+                co_return ParseResult{ 1 };
+            }
+
+            auto text   = String{ std::istreambuf_iterator{ file }, std::istreambuf_iterator<char>{} };
+            auto parsed = data::Rules::parse(text);
+            if (not parsed) {
+                fmt::println(stderr, "error: invalid rules file '{}': {}", madbfs_opt.rules, parsed.error());
+                ::fuse_opt_free_args(&args);
+                co_return ParseResult{ 1 };
+            }
+
+            rules = std::move(*parsed);
+            fmt::println("[madbfs] loaded {} cache rules from '{}'", rules.rules().size(), madbfs_opt.rules);
+        }
+
+        if (madbfs_opt.read_only) {
+            if (madbfs_opt.relaxed) {
+                fmt::println(stderr, "error: relaxed mode has no effect on a read-only mount");
+                ::fuse_opt_free_args(&args);
+                co_return ParseResult{ 1 };
+            }
+
+            // let the kernel reject writes too, before they become requests
+            ::fuse_opt_add_arg(&args, "-oro");
+            fmt::println("[madbfs] read-only flag specified, the device must not change while mounted");
+        }
+
+        auto port = 12345_u16;
+        if (madbfs_opt.port > std::numeric_limits<u16>::max()) {
+            fmt::println("[madbfs] invalid port {}", madbfs_opt.port);
+            ::fuse_opt_free_args(&args);
+            co_return ParseResult{ 1 };
+        } else {
+            port = static_cast<u16>(madbfs_opt.port);
+        }
+
+        auto socket = madbfs_opt.loopback ? rpc::Address::tcp(port)
+                                          : rpc::Address::abstract(rpc::default_socket_name);
+        if (madbfs_opt.socket != nullptr) {
+            if (auto parsed = rpc::Address::parse(madbfs_opt.socket); parsed) {
+                socket = std::move(*parsed);
+            } else {
+                fmt::println(stderr, "error: invalid socket address '{}'", madbfs_opt.socket);
+                ::fuse_opt_free_args(&args);
+                co_return ParseResult{ 1 };
+            }
+        }
+
+        if (madbfs_opt.loopback) {
+            fmt::println("[madbfs] loopback flag specified, connecting to server on localhost without adb");
+            auto serial = Str{ madbfs_opt.serial == nullptr ? "loopback" : madbfs_opt.serial };
+            if (serial.contains(',')) {
+                fmt::println(stderr, "error: loopback can't be used with multiple devices");
+                ::fuse_opt_free_args(&args);
+                co_return ParseResult{ 1 };
+            }
+
+            co_return ParseResult::Opt{
+                .opt = {
+                    .devices   = { Device{ .serial = String{ serial }, .server = std::nullopt } },
+                    .log_level = log_level.value(),
+                    .log_file  = madbfs_opt.log_file,
+                    .cachesize = std::bit_ceil(std::max(static_cast<usize>(madbfs_opt.cache_size), 128uz)),
+                    .pagesize  = std::bit_ceil(std::max(static_cast<usize>(madbfs_opt.page_size), 64uz)),
+                    .port      = port,
+                    .socket    = std::move(socket),
+                    .loopback  = true,
+                    .link      = link,
+                    .trace     = trace,
+                    .rules     = std::move(rules),
+                    .relaxed   = static_cast<bool>(madbfs_opt.relaxed),
+                    .read_only = static_cast<bool>(madbfs_opt.read_only),
+                },
+                .args = args,
+                .mountpoint = mountpoint,
+            };
+        }
+
         fmt::println("[madbfs] checking adb availability...");
         if (auto status = co_await connection::start_connection(); not status.has_value()) {
             const auto msg = std::make_error_code(status.error()).message();
@@ -319,14 +539,6 @@ namespace madbfs::args
             co_return ParseResult{ 1 };
         }
 
-        auto log_level = parse_level_str(madbfs_opt.log_level);
-        if (not log_level.has_value()) {
-            fmt::println(stderr, "error: invalid log level '{}'", madbfs_opt.log_level);
-            fmt::println(stderr, "valid log levels: trace, debug, info, warn, error, critical, off");
-            ::fuse_opt_free_args(&args);
-            co_return ParseResult{ 1 };
-        }
-
         if (madbfs_opt.serial == nullptr) {
             if (auto serial = ::getenv("ANDROID_SERIAL"); serial != nullptr) {
                 fmt::println("[madbfs] using serial '{}' from env variable 'ANDROID_SERIAL'", serial);
@@ -340,68 +552,45 @@ namespace madbfs::args
             }
         }
 
-        if (auto dev = co_await check_serial(madbfs_opt.serial); dev != connection::DeviceStatus::Device) {
-            fmt::println(stderr, "error: serial '{} 'is not valid ({})", madbfs_opt.serial, to_string(dev));
-            ::fuse_opt_free_args(&args);
-            co_return ParseResult{ 1 };
-        }
-
-        auto server = Opt<std::filesystem::path>{};
-        if (madbfs_opt.no_server) {
-            if (madbfs_opt.server != nullptr) {
-                ::free((void*)madbfs_opt.server);
-                madbfs_opt.server = nullptr;
-            }
-            fmt::println("[madbfs] no-server flag specified, won't launch server");
-        } else if (madbfs_opt.server == nullptr) {
-            auto exe = std::filesystem::path{ argv[0] == nullptr ? "madbfs" : argv[0] };
-            auto abi = co_await cmd::exec(
-                { "adb", "-s", madbfs_opt.serial, "shell", "getprop", "ro.product.cpu.abi" }
-            );
-
-            if (not abi) {
-                fmt::println("[madbfs] the device's Android ABI can't be queried");
-            } else {
-                fmt::println("[madbfs] the device is running with Android ABI '{}'", util::strip(*abi));
-                auto server_name = fmt::format("madbfs-server-{}", util::strip(*abi));
-                fmt::println("[madbfs] server is not specified, attempting to search '{}'...", server_name);
-                server = get_server_path(exe, server_name);
+        auto devices = Vec<Device>{};
+        for (auto serial : util::split(madbfs_opt.serial, ',')) {
+            if (sr::contains(devices, serial, &Device::serial)) {
+                fmt::println(stderr, "error: serial '{}' is specified more than once", serial);
+                ::fuse_opt_free_args(&args);
+                co_return ParseResult{ 1 };
             }
 
-            if (not server) {
-                constexpr auto server_name = "madbfs-server";
-                fmt::println("[madbfs] trying to find 'madbfs-server'...");
-                server = get_server_path(exe, server_name);
+            if (auto dev = co_await check_serial(serial); dev != connection::DeviceStatus::Device) {
+                fmt::println(stderr, "error: serial '{}' is not valid ({})", serial, to_string(dev));
+                ::fuse_opt_free_args(&args);
+                co_return ParseResult{ 1 };
             }
 
-            if (not server) {
-                fmt::println("[madbfs] can't find server falling back to direct adb transport");
-            } else {
-                fmt::println("[madbfs] server is found: {}", server->c_str());
-            }
-        } else {
-            fmt::println("[madbfs] server path is set to {}", madbfs_opt.server);
-            server = std::filesystem::absolute(madbfs_opt.server);
+            auto server = co_await find_server(serial, madbfs_opt, argv[0]);
+            devices.push_back(Device{ .serial = String{ serial }, .server = std::move(server) });
         }
 
-        auto port = 12345_u16;
-        if (madbfs_opt.port > std::numeric_limits<u16>::max()) {
-            fmt::println("[madbfs] invalid port {}", madbfs_opt.port);
+        if (devices.empty()) {
+            fmt::println(stderr, "error: no serial specified");
             ::fuse_opt_free_args(&args);
             co_return ParseResult{ 1 };
-        } else {
-            port = static_cast<u16>(madbfs_opt.port);
         }
 
         co_return ParseResult::Opt{
             .opt = {
-                .serial    = madbfs_opt.serial,
-                .server    = server,
+                .devices   = std::move(devices),
                 .log_level = log_level.value(),
                 .log_file  = madbfs_opt.log_file,
                 .cachesize = std::bit_ceil(std::max(static_cast<usize>(madbfs_opt.cache_size), 128uz)),
                 .pagesize  = std::bit_ceil(std::max(static_cast<usize>(madbfs_opt.page_size), 64uz)),
                 .port      = port,
+                .socket    = std::move(socket),
+                .loopback  = false,
+                .link      = link,
+                .trace     = trace,
+                .rules     = std::move(rules),
+                .relaxed   = static_cast<bool>(madbfs_opt.relaxed),
+                .read_only = static_cast<bool>(madbfs_opt.read_only),
             },
             .args = args,
             .mountpoint = mountpoint,
@@ -29,4 +29,38 @@ namespace madbfs::cmd
         auto span = Span<const Str>{ cmd.begin(), cmd.size() };
         co_return co_await exec(span, in, check, merge_err);
     }
+
+    /**
+     * @brief Execute an adb command on a specific device.
+     *
+     * @param serial Serial of the device, adb picks the device itself if empty.
+     * @param args Arguments following `adb -s <serial>`.
+     * @param in Input data to be piped as stdin.
+     * @param check Check return value.
+     * @param merge_err Append stderr to stdout.
+     */
+    AExpect<String> adb(
+        Str             serial,
+        Span<const Str> args,
+        Str             in        = "",
+        bool            check     = true,
+        bool            merge_err = false
+    );
+
+    /**
+     * @brief Execute an adb command on a specific device.
+     *
+     * NOTE: this should be removed when std::initializer_list support conversion into std::span.
+     */
+    inline AExpect<String> adb(
+        Str       serial,
+        Init<Str> args,
+        Str       in        = "",
+        bool      check     = true,
+        bool      merge_err = false
+    )
+    {
+        auto span = Span<const Str>{ args.begin(), args.size() };
+        co_return co_await adb(serial, span, in, check, merge_err);
+    }
 }
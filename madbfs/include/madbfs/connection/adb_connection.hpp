@@ -7,24 +7,44 @@ namespace madbfs::connection
     class AdbConnection final : public Connection
     {
     public:
-        AdbConnection() = default;
+        /**
+         * @param serial Serial of the device, adb picks the device itself if empty.
+         */
+        AdbConnection(String serial)
+            : m_serial{ std::move(serial) }
+        {
+        }
 
         AExpect<Gen<ParsedStat>> statdir(path::Path path) override;
         AExpect<data::Stat>      stat(path::Path path) override;
         AExpect<path::PathBuf>   readlink(path::Path path) override;
 
-        AExpect<void> mknod(path::Path path, mode_t mode, dev_t dev) override;
-        AExpect<void> mkdir(path::Path path, mode_t mode) override;
-        AExpect<void> unlink(path::Path path) override;
-        AExpect<void> rmdir(path::Path path) override;
-        AExpect<void> rename(path::Path from, path::Path to, u32 flags) override;
+        AExpect<Opt<data::Stat>> mknod(path::Path path, mode_t mode, dev_t dev) override;
+        AExpect<Opt<data::Stat>> mkdir(path::Path path, mode_t mode) override;
+        AExpect<void>            unlink(path::Path path) override;
+        AExpect<void>            rmdir(path::Path path) override;
+        AExpect<Opt<data::Stat>> rename(path::Path from, path::Path to, u32 flags) override;
 
-        AExpect<void>  truncate(path::Path path, off_t size) override;
-        AExpect<usize> read(path::Path path, Span<char> out, off_t offset) override;
-        AExpect<usize> write(path::Path path, Span<const char> in, off_t offset) override;
-        AExpect<void>  utimens(path::Path path, timespec atime, timespec mtime) override;
+        AExpect<Opt<data::Stat>> truncate(path::Path path, off_t size) override;
+        AExpect<usize>           read(path::Path path, Span<char> out, off_t offset) override;
+        AExpect<usize>           write(path::Path path, Span<const char> in, off_t offset) override;
+        AExpect<Opt<data::Stat>> utimens(path::Path path, timespec atime, timespec mtime) override;
+        AExpect<Opt<data::Stat>> fallocate(path::Path path, i32 mode, off_t offset, off_t length) override;
+        AExpect<off_t>           lseek(path::Path path, off_t offset, i32 whence) override;
 
         AExpect<usize> copy_file_range(path::Path in, off_t in_off, path::Path out, off_t out_off, usize size)
             override;
+
+        AExpect<Vec<Expect<usize>>> read_many(Span<const path::Path> paths, Span<const Span<char>> outs)
+            override;
+        AExpect<Vec<Expect<Opt<data::Stat>>>> write_many(
+            Span<const path::Path> paths,
+            Span<const Upload>     files
+        ) override;
+
+        AExpect<Vec<ServerTiming>> server_stats(bool reset) override;
+
+    private:
+        String m_serial;
     };
 }
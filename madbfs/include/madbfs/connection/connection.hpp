@@ -16,8 +16,50 @@ namespace madbfs::connection
     {
         data::Stat stat;
         Str        path;
+        Str        target = {};    // symlink target as is, empty if not a symlink or not known
     };
 
+    /**
+     * @brief Content and metadata of a file to be created with `Connection::write_many`.
+     */
+    struct Upload
+    {
+        Span<const char> data;
+        mode_t           mode;
+        timespec         atime;    // UTIME_OMIT to leave as is
+        timespec         mtime;    // UTIME_OMIT to leave as is
+    };
+
+    /**
+     * @brief Timings of a procedure measured by the server on the device, durations are in ns.
+     */
+    struct ServerTiming
+    {
+        struct Phase
+        {
+            u64 sum;
+            u64 p50;
+            u64 p99;
+            u64 max;
+        };
+
+        Str   procedure;    // same as the name of the rpc metric, static lifetime
+        u64   count;
+        u64   errors;
+        u64   bytes;
+        Phase queue;     // received until handled
+        Phase handle;    // handling, mostly syscalls
+        Phase encode;    // building response
+        Phase send;      // writing response to the transport
+    };
+
+    /**
+     * @brief Interface to the device filesystem.
+     *
+     * Mutating operations return the stat of the affected file after the operation (the destination for
+     * rename) when the implementation gets it for free, nullopt otherwise in which case the caller is
+     * expected to stat the file itself if it needs it.
+     */
     class Connection
     {
     public:
@@ -54,14 +96,14 @@ namespace madbfs::connection
          *
          * @param path Path of the new file.
          */
-        virtual AExpect<void> mknod(path::Path path, mode_t mode, dev_t dev) = 0;
+        virtual AExpect<Opt<data::Stat>> mknod(path::Path path, mode_t mode, dev_t dev) = 0;
 
         /**
          * @brief Make a directory on the device.
          *
          * @param path Path to the directory.
          */
-        virtual AExpect<void> mkdir(path::Path path, mode_t mode) = 0;
+        virtual AExpect<Opt<data::Stat>> mkdir(path::Path path, mode_t mode) = 0;
 
         /**
          * @brief Remove a file on the device.
@@ -84,7 +126,7 @@ namespace madbfs::connection
          * @param from Target file.
          * @param to Destination file.
          */
-        virtual AExpect<void> rename(path::Path from, path::Path to, u32 flags) = 0;
+        virtual AExpect<Opt<data::Stat>> rename(path::Path from, path::Path to, u32 flags) = 0;
 
         // --------------------
 
@@ -97,7 +139,28 @@ namespace madbfs::connection
          * @param path Path to the file on the device.
          * @param size Size to truncate to.
          */
-        virtual AExpect<void> truncate(path::Path path, off_t size) = 0;
+        virtual AExpect<Opt<data::Stat>> truncate(path::Path path, off_t size) = 0;
+
+        /**
+         * @brief Manipulate allocated space of a file on the device.
+         *
+         * @param path Path to the file on the device.
+         * @param mode Mode as in fallocate(2), 0 to allocate and extend the file if needed.
+         * @param offset Start of the range.
+         * @param length Length of the range.
+         */
+        virtual AExpect<Opt<data::Stat>> fallocate(path::Path path, i32 mode, off_t offset, off_t length) = 0;
+
+        /**
+         * @brief Find the next data or hole of a file on the device.
+         *
+         * @param path Path to the file on the device.
+         * @param offset Offset to start from.
+         * @param whence Either SEEK_DATA or SEEK_HOLE.
+         *
+         * @return Offset of the found data or hole, `no_such_device_or_address` if there is none.
+         */
+        virtual AExpect<off_t> lseek(path::Path path, off_t offset, i32 whence) = 0;
 
         /**
          * @brief Read from a file on the device.
@@ -108,6 +171,20 @@ namespace madbfs::connection
          */
         virtual AExpect<usize> read(path::Path path, Span<char> out, off_t offset) = 0;
 
+        /**
+         * @brief Read the start of many files at once.
+         *
+         * @param paths Paths to the files on the device.
+         * @param outs Buffer for each file, a file is read from its beginning up to the size of its buffer.
+         *
+         * @return Number of bytes read of each file in the same order. A file that can't be read doesn't fail
+         * the others.
+         */
+        virtual AExpect<Vec<Expect<usize>>> read_many(
+            Span<const path::Path> paths,
+            Span<const Span<char>> outs
+        ) = 0;
+
         /**
          * @brief Write to a file on the device.
          *
@@ -117,6 +194,23 @@ namespace madbfs::connection
          */
         virtual AExpect<usize> write(path::Path path, Span<const char> in, off_t offset) = 0;
 
+        /**
+         * @brief Create many files along with their content at once.
+         *
+         * @param paths Paths to the files on the device.
+         * @param files Content, mode, and times of each file.
+         *
+         * Each file is created (or truncated if it exists), written, has its times set, and closed as a
+         * single operation.
+         *
+         * @return Stat of each file after the operation in the same order. A file that can't be written
+         * doesn't fail the others.
+         */
+        virtual AExpect<Vec<Expect<Opt<data::Stat>>>> write_many(
+            Span<const path::Path> paths,
+            Span<const Upload>     files
+        ) = 0;
+
         /**
          * @brief Update change time and modification time of a file
          *
@@ -124,7 +218,7 @@ namespace madbfs::connection
          * @param atime Access time.
          * @param mtime Modification time.
          */
-        virtual AExpect<void> utimens(path::Path path, timespec atime, timespec mtime) = 0;
+        virtual AExpect<Opt<data::Stat>> utimens(path::Path path, timespec atime, timespec mtime) = 0;
 
         /**
          * @brief Copy file server-side.
@@ -143,6 +237,18 @@ namespace madbfs::connection
             usize      size
         ) = 0;
 
+        // diagnostics
+        // -----------
+
+        /**
+         * @brief Get the timings of the requests handled on the device so far.
+         *
+         * @param reset Start over after this call.
+         *
+         * @return Timings per procedure, or operation_not_supported if there's no server on the device.
+         */
+        virtual AExpect<Vec<ServerTiming>> server_stats(bool reset) = 0;
+
         // ---------------
 
         virtual ~Connection() = default;
@@ -0,0 +1,87 @@
+#pragma once
+
+#include "madbfs/connection/connection.hpp"
+
+#include <madbfs-common/stats.hpp>
+
+namespace madbfs::connection
+{
+    /**
+     * @class MeteredConnection
+     * @brief Connection decorator that records latency and outcome of each operation.
+     *
+     * Every operation is forwarded to the wrapped connection and recorded into the given `stats` registry
+     * under the `connection` group (and into its flight recorder).
+     */
+    class MeteredConnection final : public Connection
+    {
+    public:
+        /**
+         * @param inner Connection to forward to.
+         * @param registry Registry to record into, must outlive the connection.
+         */
+        MeteredConnection(Uniq<Connection> inner, stats::Registry& registry);
+
+        Connection&       inner() { return *m_inner; }
+        const Connection& inner() const { return *m_inner; }
+
+        AExpect<Gen<ParsedStat>> statdir(path::Path path) override;
+        AExpect<data::Stat>      stat(path::Path path) override;
+        AExpect<path::PathBuf>   readlink(path::Path path) override;
+
+        AExpect<Opt<data::Stat>> mknod(path::Path path, mode_t mode, dev_t dev) override;
+        AExpect<Opt<data::Stat>> mkdir(path::Path path, mode_t mode) override;
+        AExpect<void>            unlink(path::Path path) override;
+        AExpect<void>            rmdir(path::Path path) override;
+        AExpect<Opt<data::Stat>> rename(path::Path from, path::Path to, u32 flags) override;
+
+        AExpect<Opt<data::Stat>> truncate(path::Path path, off_t size) override;
+        AExpect<usize>           read(path::Path path, Span<char> out, off_t offset) override;
+        AExpect<usize>           write(path::Path path, Span<const char> in, off_t offset) override;
+        AExpect<Opt<data::Stat>> utimens(path::Path path, timespec atime, timespec mtime) override;
+        AExpect<Opt<data::Stat>> fallocate(path::Path path, i32 mode, off_t offset, off_t length) override;
+        AExpect<off_t>           lseek(path::Path path, off_t offset, i32 whence) override;
+
+        AExpect<usize> copy_file_range(path::Path in, off_t in_off, path::Path out, off_t out_off, usize size)
+            override;
+
+        AExpect<Vec<Expect<usize>>> read_many(Span<const path::Path> paths, Span<const Span<char>> outs)
+            override;
+        AExpect<Vec<Expect<Opt<data::Stat>>>> write_many(
+            Span<const path::Path> paths,
+            Span<const Upload>     files
+        ) override;
+
+        AExpect<Vec<ServerTiming>> server_stats(bool reset) override;
+
+    private:
+        enum Op : usize
+        {
+            Statdir,
+            Stat,
+            Readlink,
+            Mknod,
+            Mkdir,
+            Unlink,
+            Rmdir,
+            Rename,
+            Truncate,
+            Read,
+            Write,
+            Utimens,
+            CopyFileRange,
+            ReadMany,
+            WriteMany,
+            Fallocate,
+            Lseek,
+
+            Count_,
+        };
+
+        template <typename T>
+        AExpect<T> timed(Op op, path::Path path, u64 size, AExpect<T> awaitable);
+
+        Uniq<Connection>              m_inner;
+        Array<stats::Metric*, Count_> m_metrics;
+    };
+}
@@ -17,14 +17,51 @@ namespace madbfs::connection
         /**
          * @brief Prepare the server connection and create the class.
          *
-         * @param port Port the server will be listening on.
+         * @param serial Serial of the device, adb picks the device itself if empty.
+         * @param server Server binary to push and launch, assume it's already running if not set.
+         * @param port Port on the host forwarded to the server.
+         * @param device Address the server listens on the device.
          *
          * The returned Uniq will never be nullptr.
          */
-        static AExpect<Uniq<ServerConnection>> prepare_and_create(Opt<path::Path> server, u16 port);
+        static AExpect<Uniq<ServerConnection>> prepare_and_create(
+            Str             serial,
+            Opt<path::Path> server,
+            u16             port,
+            rpc::Address    device
+        );
+
+        /**
+         * @brief Create the class by connecting directly to a server on localhost.
+         *
+         * @param address Address the server is listening on.
+         *
+         * No adb command is invoked; the server is assumed to be already running (e.g. on the host for
+         * benchmarking). If the connection can't be established yet, the returned instance will try to
+         * reconnect on the next request. The returned Uniq will never be nullptr.
+         */
+        static Await<Uniq<ServerConnection>> create_direct(rpc::Address address);
 
         ~ServerConnection();
 
+        /**
+         * @brief Emulate a link with given profile between the client and the server.
+         *
+         * @param profile Link profile, std::nullopt to disable emulation.
+         *
+         * The profile persists across reconnection.
+         */
+        void emulate_link(Opt<link::Profile> profile);
+
+        /**
+         * @brief Record the stats of the connection and its client into given registry.
+         *
+         * @param registry Registry of the device, must outlive the connection.
+         *
+         * The registry persists across reconnection.
+         */
+        void report_to(stats::Registry& registry);
+
         ServerConnection(ServerConnection&&)            = delete;
         ServerConnection& operator=(ServerConnection&&) = delete;
 
@@ -35,29 +72,40 @@ namespace madbfs::connection
         AExpect<data::Stat>      stat(path::Path path) override;
         AExpect<path::PathBuf>   readlink(path::Path path) override;
 
-        AExpect<void> mknod(path::Path path, mode_t mode, dev_t dev) override;
-        AExpect<void> mkdir(path::Path path, mode_t mode) override;
-        AExpect<void> unlink(path::Path path) override;
-        AExpect<void> rmdir(path::Path path) override;
-        AExpect<void> rename(path::Path from, path::Path to, u32 flags) override;
+        AExpect<Opt<data::Stat>> mknod(path::Path path, mode_t mode, dev_t dev) override;
+        AExpect<Opt<data::Stat>> mkdir(path::Path path, mode_t mode) override;
+        AExpect<void>            unlink(path::Path path) override;
+        AExpect<void>            rmdir(path::Path path) override;
+        AExpect<Opt<data::Stat>> rename(path::Path from, path::Path to, u32 flags) override;
 
-        AExpect<void>  truncate(path::Path path, off_t size) override;
-        AExpect<usize> read(path::Path path, Span<char> out, off_t offset) override;
-        AExpect<usize> write(path::Path path, Span<const char> in, off_t offset) override;
-        AExpect<void>  utimens(path::Path path, timespec atime, timespec mtime) override;
+        AExpect<Opt<data::Stat>> truncate(path::Path path, off_t size) override;
+        AExpect<usize>           read(path::Path path, Span<char> out, off_t offset) override;
+        AExpect<usize>           write(path::Path path, Span<const char> in, off_t offset) override;
+        AExpect<Opt<data::Stat>> utimens(path::Path path, timespec atime, timespec mtime) override;
+        AExpect<Opt<data::Stat>> fallocate(path::Path path, i32 mode, off_t offset, off_t length) override;
+        AExpect<off_t>           lseek(path::Path path, off_t offset, i32 whence) override;
 
         AExpect<usize> copy_file_range(path::Path in, off_t in_off, path::Path out, off_t out_off, usize size)
             override;
 
+        AExpect<Vec<Expect<usize>>> read_many(Span<const path::Path> paths, Span<const Span<char>> outs)
+            override;
+        AExpect<Vec<Expect<Opt<data::Stat>>>> write_many(
+            Span<const path::Path> paths,
+            Span<const Upload>     files
+        ) override;
+
+        AExpect<Vec<ServerTiming>> server_stats(bool reset) override;
+
     private:
-        ServerConnection(u16 port, Uniq<rpc::Client> client)
-            : m_port{ port }
+        ServerConnection(rpc::Address address, Uniq<rpc::Client> client)
+            : m_address{ std::move(address) }
             , m_client{ std::move(client) }
         {
         }
 
-        ServerConnection(u16 port, Uniq<rpc::Client> client, Process proc, Pipe out, Pipe err)
-            : m_port{ port }
+        ServerConnection(rpc::Address address, Uniq<rpc::Client> client, Process proc, Pipe out, Pipe err)
+            : m_address{ std::move(address) }
             , m_client{ std::move(client) }
             , m_server_proc{ std::move(proc) }
             , m_server_out{ std::move(out) }
@@ -68,9 +116,9 @@ namespace madbfs::connection
         /**
          * @brief Connect to the server and create an RPC client.
          *
-         * @param port The port to connect to.
+         * @param address The address to connect to.
          */
-        static AExpect<Uniq<rpc::Client>> make_client(u16 port);
+        static AExpect<Uniq<rpc::Client>> make_client(const rpc::Address& address);
 
         /**
          * @brief Send request through the RPC client.
@@ -82,6 +130,11 @@ namespace madbfs::connection
          */
         AExpect<rpc::Response> send(Vec<u8>& buf, rpc::Request req);
 
+        /**
+         * @brief Read the start of files that fit in a single ReadMany request.
+         */
+        AExpect<Vec<Expect<usize>>> read_many_once(Span<const path::Path> paths, Span<const Span<char>> outs);
+
         /**
          * @brief Request send wrapper.
          *
@@ -106,10 +159,13 @@ namespace madbfs::connection
             co_return Unexpect{ Errc::bad_message };
         }
 
-        u16               m_port        = 0;
+        rpc::Address      m_address     = {};         // address on the host the client connects to
         Uniq<rpc::Client> m_client      = nullptr;    // may be null (in the case of disconnection)
         Opt<Process>      m_server_proc = {};         // server process handle
         Opt<Pipe>         m_server_out  = {};         // server's stdout
         Opt<Pipe>         m_server_err  = {};         // server's stderr
+
+        Opt<link::Profile> m_link  = {};                    // emulated link profile
+        stats::Registry*   m_stats = &stats::registry();    // registry of the device
     };
 }
@@ -1,5 +1,6 @@
 #pragma once
 
+#include "madbfs/data/policy.hpp"
 #include "madbfs/data/stat.hpp"
 #include "madbfs/path.hpp"
 
@@ -7,7 +8,9 @@
 
 #include <saf.hpp>
 
+#include <algorithm>
 #include <cassert>
+#include <chrono>
 #include <list>
 #include <map>
 #include <unordered_map>
@@ -41,6 +44,7 @@ namespace madbfs::data
         usize truncate(usize size);
 
         usize size() const;
+        usize capacity() const { return m_page_size; }
 
         bool is_dirty() const;
         void set_dirty(bool set);
@@ -56,6 +60,100 @@ namespace madbfs::data
         bool         m_dirty = false;
     };
 
+    /**
+     * @class Throttle
+     *
+     * @brief Limit the average rate of a background transfer.
+     */
+    class Throttle
+    {
+    public:
+        using Clock = std::chrono::steady_clock;
+
+        /**
+         * @param rate Bandwidth cap in bytes per second, 0 means unlimited.
+         */
+        Throttle(usize rate)
+            : m_rate{ rate }
+            , m_start{ Clock::now() }
+        {
+        }
+
+        /**
+         * @brief Account transferred bytes, waiting until the average rate is back under the cap.
+         */
+        Await<void> consume(usize bytes);
+
+        usize bytes() const { return m_bytes; }
+
+    private:
+        usize             m_rate;
+        usize             m_bytes = 0;
+        Clock::time_point m_start;
+    };
+
+    class Cache;
+
+    /**
+     * @brief Page size class of a file, relative to the configured page size.
+     */
+    enum class PageClass : u8
+    {
+        Small,     // page size / 8, for small accesses at random offsets of a file larger than a page
+        Normal,    // the configured page size
+        Large,     // page size * 4, for large files
+    };
+
+    /**
+     * @class Budget
+     *
+     * @brief Memory limit shared by the caches of multiple devices.
+     *
+     * Each cache attached to the budget is entitled to an equal share of it. A cache may grow past its share
+     * while the others don't use theirs, but once the budget is full, room is made by evicting from the cache
+     * furthest above its share, so idle devices can't hoard memory that active ones need. All the attached
+     * caches must run on the same async context.
+     */
+    class Budget
+    {
+    public:
+        /**
+         * @param max_bytes Maximum total size of the pages in all attached caches.
+         */
+        Budget(usize max_bytes)
+            : m_max_bytes{ max_bytes }
+        {
+        }
+
+        void attach(Cache& cache);
+        void detach(Cache& cache);
+
+        /**
+         * @brief Make room for new pages before they are inserted into a cache.
+         *
+         * @param cache Cache the pages go into.
+         * @param bytes Size of the new pages.
+         *
+         * Pinned pages are never evicted, so the budget may be exceeded if too many pages are pinned.
+         */
+        Await<void> reserve(Cache& cache, usize bytes);
+
+        /**
+         * @brief Get total size of the pages in all attached caches.
+         */
+        usize used() const;
+
+        usize share() const { return m_max_bytes / std::max(m_caches.size(), 1uz); }
+        usize max_bytes() const { return m_max_bytes; }
+        usize num_caches() const { return m_caches.size(); }
+
+        void set_max_bytes(usize max_bytes) { m_max_bytes = max_bytes; }
+
+    private:
+        Vec<Cache*> m_caches;
+        usize       m_max_bytes = 0;
+    };
+
     /**
      * @class Cache
      *
@@ -64,6 +162,10 @@ namespace madbfs::data
      * The cache is implemented as an LRU cache in order to speed up repeated access to recently accessed
      * files. Each element in the LRU is a `Page` that represents a portion of a file being stored. This
      * pages are interleaved between files (cross-file).
+     *
+     * The pages of a file all have the same size, picked from `PageClass` by the size of the file and how
+     * it's accessed. The class of a file is switched only when none of its pages is dirty or in transfer and
+     * no read or write of it is in progress, its cached pages are dropped then.
      */
     class Cache
     {
@@ -74,38 +176,289 @@ namespace madbfs::data
         using Lookup = std::unordered_map<Id, LookupEntry>;
         using Queue  = std::unordered_map<PageKey, saf::shared_future<Errc>>;
 
+        // number of pages read or written sequentially before the rest of the transfer bypasses the cache
+        static constexpr usize stream_after_pages = 64;
+
+        // number of small files pulled by a single request in `prefetch_small`
+        static constexpr usize read_many_batch = 32;
+
+        // number of files sent by a single request in `upload`
+        static constexpr usize write_many_batch = 32;
+
+        // pages of the small class are never smaller than this
+        static constexpr usize min_page_size = 4 * 1024;
+
+        // number of consecutive small accesses at random offsets before a file moves to the small class
+        static constexpr usize small_after_accesses = 8;
+
+        // size of a file in pages of the configured size from which it's put in the large class
+        static constexpr usize large_after_pages = 64;
+
         struct LookupEntry
         {
             std::map<usize, Lru::iterator> pages;
             path::PathBuf                  path;
-            bool                           dirty = false;
+            Policy                         policy;
+            usize                          page_size   = 0;    // size of each page of the file
+            usize                          file_size   = 0;    // size of the file as far as the cache knows
+            usize                          next_offset = 0;    // end of last read or write
+            usize                          streak      = 0;    // sequentially accessed bytes before it
+            usize                          random      = 0;    // consecutive small accesses at random offsets
+            usize                          active      = 0;    // reads and writes in progress
+            PageClass                      page_class  = PageClass::Normal;
+            bool                           dirty       = false;
+            bool                           pinned      = false;
+            bool                           fresh       = false;    // not on the device yet, see `create`
+        };
+
+        struct Usage
+        {
+            usize pages;
+            usize bytes;
+            usize dirty_pages;
+            usize dirty_bytes;
+            usize pinned_pages;
+            usize files;
+            usize small_files;    // files in the small page size class
+            usize large_files;    // files in the large page size class
         };
 
-        Cache(connection::Connection& connection, usize page_size, usize max_pages);
+        /**
+         * @param connection Connection to the device.
+         * @param page_size Size of each page.
+         * @param max_pages Maximum number of pages in cache.
+         * @param rules Rules deciding the policy of each file, evaluated once when it enters the cache.
+         */
+        Cache(connection::Connection& connection, usize page_size, usize max_pages, Rules rules = {});
 
-        AExpect<usize> read(Id id, path::Path path, Span<char> out, off_t offset);
-        AExpect<usize> write(Id id, path::Path path, Span<const char> in, off_t offset);
-        AExpect<void>  flush(Id id);
-        AExpect<void>  truncate(Id id, usize old_size, usize new_size);
+        /**
+         * @param connection Connection to the device.
+         * @param page_size Size of each page.
+         * @param budget Memory limit shared with caches of other devices.
+         * @param rules Rules deciding the policy of each file, evaluated once when it enters the cache.
+         */
+        Cache(connection::Connection& connection, usize page_size, Budget& budget, Rules rules = {});
+
+        ~Cache();
+
+        Cache(Cache&&)            = delete;
+        Cache& operator=(Cache&&) = delete;
+
+        Cache(const Cache&)            = delete;
+        Cache& operator=(const Cache&) = delete;
+
+        /**
+         * @brief Read from a file through the cache.
+         *
+         * @param file_size Size of the file as known by the caller if any, used to pick its page size.
+         */
+        AExpect<usize> read(
+            Id         id,
+            path::Path path,
+            Span<char> out,
+            off_t      offset,
+            Opt<usize> file_size = std::nullopt
+        );
+
+        /**
+         * @brief Write to a file through the cache.
+         *
+         * @param file_size Size of the file before the write as known by the caller if any.
+         *
+         * Pages partially written are pulled from the device first so the rest of them isn't clobbered on
+         * flush, unless they start past `file_size` where the device has nothing.
+         */
+        AExpect<usize> write(
+            Id               id,
+            path::Path       path,
+            Span<const char> in,
+            off_t            offset,
+            Opt<usize>       file_size = std::nullopt
+        );
+
+        AExpect<void> flush(Id id);
+        AExpect<void> truncate(Id id, usize old_size, usize new_size);
+
+        /**
+         * @brief Read straight from the device, bypassing the cache.
+         *
+         * Cached pages in the range are flushed first so the device has the latest data. The read is split
+         * into page-sized requests that are sent all at once so the transfer is pipelined.
+         */
+        AExpect<usize> read_direct(Id id, path::Path path, Span<char> out, off_t offset);
+
+        /**
+         * @brief Write straight to the device, bypassing the cache.
+         *
+         * Cached pages in the range are flushed first and then updated in place so they stay coherent with
+         * the device. The write is pipelined the same way as `read_direct`.
+         */
+        AExpect<usize> write_direct(Id id, path::Path path, Span<const char> in, off_t offset);
+
+        /**
+         * @brief Start the entry of a file that only exists locally.
+         *
+         * The entry is pinned and its pages are neither pulled nor flushed until the file is sent with
+         * `upload`.
+         */
+        void create(Id id, path::Path path);
+
+        /**
+         * @brief Create a file started with `create` on the device along with its content.
+         *
+         * @param id File id.
+         * @param path Path to the file.
+         * @param mode Mode of the file.
+         * @param atime Access time, UTIME_OMIT to leave as is.
+         * @param mtime Modification time, UTIME_OMIT to leave as is.
+         *
+         * Files are sent in batches with `Connection::write_many` with at most one batch in flight, files
+         * queued in the meantime go with the next batch. The entry becomes an ordinary entry once the file is
+         * created and is dropped if it fails.
+         *
+         * @return Stat of the file after the operation if known.
+         */
+        AExpect<Opt<Stat>> upload(Id id, path::Path path, mode_t mode, timespec atime, timespec mtime);
+
+        /**
+         * @brief Change the times of a file queued by `upload` that is not sent yet.
+         *
+         * @return False if the file is not in the queue.
+         */
+        bool retime(Id id, timespec atime, timespec mtime);
 
         Await<void> rename(Id id, path::Path new_name);
         Await<void> invalidate_one(Id id, bool should_flush);
         Await<void> invalidate_all();
         Await<void> shutdown();
 
+        /**
+         * @brief Pull a whole file into the cache.
+         *
+         * @param id File id.
+         * @param path Path to the file.
+         * @param size Size of the file.
+         * @param throttle Bandwidth limiter, shared between files of the same prefetch request.
+         *
+         * Pages are pulled one at a time and only while no foreground read or write is in progress, so
+         * a prefetch delays user operations by at most a single page transfer. Pages already in cache are
+         * skipped.
+         *
+         * @return Number of bytes pulled from device.
+         */
+        AExpect<usize> prefetch(Id id, path::Path path, usize size, Throttle& throttle);
+
+        /**
+         * @brief Pull many small files into the cache, a batch of them per request.
+         *
+         * @param files Id and path of each file, meant for files that fit in a single page.
+         *
+         * Each file becomes the first page of its entry, pulled with `Connection::read_many`. Files already
+         * in cache, being pulled, or with direct policy are skipped. Readers of a file wait for its batch
+         * instead of pulling it on their own. A file that fails to be read is left to be pulled on demand.
+         *
+         * @return Number of bytes pulled from device.
+         */
+        AExpect<usize> prefetch_small(Vec<Pair<Id, path::PathBuf>> files);
+
+        /**
+         * @brief Exempt pages of a file from eviction.
+         *
+         * Pinned pages still count toward the maximum number of pages but only unpinned pages are evicted,
+         * so the cache may exceed its maximum if too many pages are pinned. Invalidation drops pinned pages
+         * as well, the pin itself is kept.
+         */
+        void pin(Id id, path::Path path);
+
+        /**
+         * @brief Make pages of a pinned file evictable again.
+         */
+        void unpin(Id id);
+
         Await<void> set_page_size(usize new_page_size);
+
+        /**
+         * @brief Change the maximum number of pages, of the whole budget if it's shared.
+         */
         Await<void> set_max_pages(usize new_max_pages);
 
+        /**
+         * @brief Evict least recently used pages that are not pinned.
+         *
+         * @param bytes Number of bytes to free, rounded up to whole pages.
+         *
+         * @return Number of bytes freed.
+         */
+        Await<usize> shrink(usize bytes);
+
+        /**
+         * @brief Get policy of a file according to the rules.
+         */
+        Policy policy(path::Path path) const { return m_rules.match(path.fullpath()); }
+
+        /**
+         * @brief Get size of pages of the given class.
+         */
+        usize page_size(PageClass page_class) const;
+
         usize page_size() const { return m_page_size; }
-        usize max_pages() const { return m_max_pages; }
+        usize max_pages() const { return m_budget.max_bytes() / m_page_size; }
+        usize used_bytes() const { return m_used_bytes; }
+        bool  evictable() const { return not m_lru.empty(); }
+
+        const Budget& budget() const { return m_budget; }
+
+        /**
+         * @brief Get current occupancy of the cache.
+         *
+         * Walks the whole LRU, so it's meant for occasional reporting only.
+         */
+        Usage usage() const;
 
     private:
+        struct QueuedUpload
+        {
+            Id                              id;
+            path::PathBuf                   path;
+            mode_t                          mode;
+            timespec                        atime;
+            timespec                        mtime;
+            saf::promise<Expect<Opt<Stat>>> promise;
+        };
+
         Opt<Ref<LookupEntry>> lookup(Id id, Opt<path::Path> path);
 
+        Lru& list_of(const LookupEntry& entry) { return entry.pinned ? m_pinned : m_lru; }
+        usize num_pages() const { return m_lru.size() + m_pinned.size(); }
+
+        /**
+         * @brief Check whether any page of a file is still being pulled or pushed.
+         */
+        bool has_pending(Id id) const;
+
         AExpect<usize> on_miss(Id id, Span<char> out, off_t offset);
         AExpect<usize> on_flush(Id id, Span<const char> in, off_t offset);
 
-        Await<void> evict(usize size);
+        /**
+         * @brief Evict least recently used pages until at least `bytes` bytes are freed.
+         *
+         * @return Number of bytes freed.
+         */
+        Await<usize> evict(usize bytes);
+
+        /**
+         * @brief Remove a page from the list of its entry.
+         */
+        void erase_page(const LookupEntry& entry, Lru::iterator page);
+
+        /**
+         * @brief Get page at given index, creating it on miss.
+         *
+         * @param pull Whether to pull the content from device on miss or start with an empty page.
+         *
+         * Concurrent calls on the same missing page wait on the first one.
+         */
+        AExpect<Lru::iterator> get_page(LookupEntry& entry, Id id, usize index, bool pull);
 
         AExpect<usize> read_at(
             LookupEntry& entry,
@@ -124,18 +477,75 @@ namespace madbfs::data
             usize            index,
             usize            first,
             usize            last,
-            off_t            offset
+            off_t            offset,
+            Opt<usize>       file_size
         );
 
-        AExpect<void> flush_at(Page& page, Id id);
+        AExpect<void> flush_at(Id id, usize index);
+
+        /**
+         * @brief Pull pages following a sequential read in the background.
+         *
+         * Stops at the end of the file, pages already in cache or being pulled are skipped.
+         */
+        Await<void> read_ahead(Id id, path::PathBuf path, usize first, usize count);
+
+        /**
+         * @brief Wait for pulls and pushes of pages overlapping bytes [start, end) to finish then flush dirty
+         * ones.
+         */
+        AExpect<void> settle(Id id, usize start, usize end);
+
+        /**
+         * @brief Update sequential access tracking of an entry.
+         *
+         * @return True if the access is part of a large sequential transfer that should bypass the cache.
+         */
+        bool is_streaming(LookupEntry& entry, usize size, off_t offset) const;
+
+        /**
+         * @brief Pick page size class of an entry from its size and access pattern.
+         */
+        PageClass classify(const LookupEntry& entry) const;
+
+        /**
+         * @brief Record an access to a file and switch its page size class if the chosen one has changed.
+         *
+         * @param sequential Whether the access continues the previous one.
+         * @param file_size Size of the file as known by the caller if any.
+         */
+        void reclassify(Id id, LookupEntry& entry, usize size, bool sequential, Opt<usize> file_size);
+
+        /**
+         * @brief Send files queued by `upload` a batch at a time until the queue is empty.
+         */
+        Await<void> send_uploads();
+
+        /**
+         * @brief Concatenate the pages of a file into its whole content, marking them clean.
+         */
+        Vec<char> snapshot(Id id);
 
         connection::Connection& m_connection;
 
-        Lru    m_lru;      // most recently used is at the front
-        Lookup m_table;    // lookup table for fast page access
-        Queue  m_queue;    // pages that are still pulling data, reader/writer should wait using this
+        Uniq<Budget> m_own_budget;    // only set when the budget is not shared
+        Budget&      m_budget;
+
+        Lru    m_lru;       // most recently used is at the front
+        Lru    m_pinned;    // pages of pinned files, never evicted
+        Lookup m_table;     // lookup table for fast page access
+        Queue  m_queue;     // pages that are still pulling data, reader/writer should wait using this
+
+        usize m_foreground = 0;    // number of reads and writes in progress, prefetch waits for these
+        usize m_used_bytes = 0;    // total capacity of the pages in both lists
+
+        std::unordered_map<Id, usize> m_flushing;    // number of pages of a file being written by `flush_at`
+
+        Vec<QueuedUpload> m_uploads;              // files waiting to be sent by `send_uploads`
+        bool              m_uploading = false;    // whether `send_uploads` is running
+
+        Rules m_rules;
 
         usize m_page_size = 0;
-        usize m_max_pages = 0;
     };
 };
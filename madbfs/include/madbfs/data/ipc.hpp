@@ -23,9 +23,33 @@ namespace madbfs::data
         struct GetPageSize     { };
         struct SetCacheSize    { usize mib; };
         struct GetCacheSize    { };
+        struct GetStats        { };
+        struct GetRecentOps    { usize count; };
+        struct ResetStats      { };
+        struct StartTrace      { String file; };
+        struct StopTrace       { };
+        struct GetMetrics      { };
+        struct Prefetch        { String path; bool recursive; usize rate_kib; };
+        struct Pin             { String path; bool recursive; };
+        struct Unpin           { String path; bool recursive; };
         // clang-format on
 
-        using Op = Var<Help, InvalidateCache, SetPageSize, GetPageSize, SetCacheSize, GetCacheSize>;
+        using Op = Var<
+            Help,
+            InvalidateCache,
+            SetPageSize,
+            GetPageSize,
+            SetCacheSize,
+            GetCacheSize,
+            GetStats,
+            GetRecentOps,
+            ResetStats,
+            StartTrace,
+            StopTrace,
+            GetMetrics,
+            Prefetch,
+            Pin,
+            Unpin>;
     }
 
     class Ipc
@@ -33,14 +57,16 @@ namespace madbfs::data
     public:
         using Acceptor = async::unix_socket::Acceptor;
         using Socket   = async::unix_socket::Socket;
-        using OnOp     = std::move_only_function<Await<boost::json::value>(ipc::Op op)>;
+        using Report   = std::move_only_function<Await<bool>(boost::json::value progress)>;
+        using OnOp     = std::move_only_function<Await<boost::json::value>(ipc::Op op, Report& report)>;
 
         /**
          * @brief Create IPC.
          *
          * @param context Async context.
+         * @param serial Serial of the device, the socket is named after it.
          */
-        static Expect<Ipc> create(async::Context& context);
+        static Expect<Ipc> create(async::Context& context, Str serial);
 
         ~Ipc();
 
@@ -54,6 +80,9 @@ namespace madbfs::data
          * @brief Lauch the IPC and listen for request.
          *
          * @param on_op Operation request handler.
+         *
+         * Peers are handled concurrently. A long running operation may send intermediate progress to its
+         * peer using the `report` parameter of the handler, which returns false if the peer is gone.
          */
         Await<void> launch(OnOp on_op);
 
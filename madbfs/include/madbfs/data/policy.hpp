@@ -0,0 +1,73 @@
+#pragma once
+
+#include <madbfs-common/aliases.hpp>
+
+#include <expected>
+
+namespace madbfs::data
+{
+    /**
+     * @class Policy
+     *
+     * @brief Cache behavior of a file.
+     */
+    struct Policy
+    {
+        bool  direct        = false;    // bypass the cache, read and write directly from/to device
+        bool  pin           = false;    // exempt pages from eviction
+        bool  write_through = false;    // push every write to device immediately instead of on flush
+        usize readahead     = 0;        // number of pages pulled ahead of a sequential read
+
+        bool operator==(const Policy&) const = default;
+    };
+
+    struct Rule
+    {
+        String glob;
+        Policy policy;
+    };
+
+    /**
+     * @brief Match a path against a glob pattern.
+     *
+     * `?` matches a single character and `*` matches any number of characters, both except '/'. `**` matches
+     * any number of characters including '/'. A `**` surrounded by '/' also matches a single '/', so it can
+     * stand for zero directories.
+     */
+    bool glob_match(Str pattern, Str path);
+
+    /**
+     * @class Rules
+     *
+     * @brief Ordered list of glob rules deciding the cache policy of each file.
+     */
+    class Rules
+    {
+    public:
+        /**
+         * @brief Parse rules from text.
+         *
+         * @param text Rules, one per line.
+         *
+         * Each line is an absolute glob followed by comma separated options, `#` starts a comment. Options
+         * are `direct`, `cached` (default), `pin`, `write-through`, `write-back` (default), and
+         * `readahead=<pages>`. See README for examples.
+         *
+         * @return The rules or an error message that mentions the offending line.
+         */
+        static std::expected<Rules, String> parse(Str text);
+
+        /**
+         * @brief Get policy of a path, the first matching rule wins.
+         *
+         * @return The policy of the matching rule or the default policy if no rule matches.
+         */
+        Policy match(Str path) const;
+
+        bool             empty() const { return m_rules.empty(); }
+        Span<const Rule> rules() const { return m_rules; }
+
+    private:
+        Vec<Rule> m_rules;
+    };
+}
@@ -4,10 +4,80 @@
 #include "madbfs/data/ipc.hpp"
 #include "madbfs/tree/file_tree.hpp"
 
+#include <madbfs-common/link.hpp>
+#include <madbfs-common/rpc.hpp>
+#include <madbfs-common/stats.hpp>
+
+#include <mutex>
 #include <thread>
 
 namespace madbfs
 {
+    /**
+     * @class Runtime
+     *
+     * @brief Async context, its worker thread, and the cache budget, shared by all mounted devices.
+     *
+     * Devices share a single worker thread since the work on it is mostly waiting on the devices, and since
+     * the caches and trees rely on being accessed from one thread only, eviction across caches included.
+     * SIGUSR1 is handled here too, so a single signal dumps the stats of every device exactly once.
+     */
+    class Runtime
+    {
+    public:
+        /**
+         * @param cache_size Maximum size of the caches of all devices combined in bytes.
+         */
+        Runtime(usize cache_size);
+        ~Runtime();
+
+        Runtime(Runtime&&)            = delete;
+        Runtime& operator=(Runtime&&) = delete;
+
+        Runtime(const Runtime&)            = delete;
+        Runtime& operator=(const Runtime&) = delete;
+
+        /**
+         * @brief Stop the async context and join the worker thread, unfinished work is abandoned.
+         *
+         * Calling it more than once is fine.
+         */
+        void stop();
+
+        /**
+         * @brief Include the stats of a device in the dump done on SIGUSR1.
+         *
+         * @param serial Serial of the device.
+         * @param registry Registry of the device, must stay alive until it is detached.
+         */
+        void attach_stats(Str serial, const stats::Registry& registry);
+
+        /**
+         * @brief Stop including the stats of a device in the dump done on SIGUSR1.
+         */
+        void detach_stats(const stats::Registry& registry);
+
+        async::Context& async_ctx() { return m_async_ctx; }
+        data::Budget&   budget() { return m_budget; }
+
+    private:
+        using Attached = Vec<Pair<String, const stats::Registry*>>;
+
+        /**
+         * @brief Dump the stats of each attached device into the log everytime SIGUSR1 is received.
+         */
+        Await<void> dump_stats_on_signal();
+
+        async::Context   m_async_ctx;
+        async::WorkGuard m_work_guard;    // to prevent `async::Context` from returning immediately
+        std::jthread     m_work_thread;
+        data::Budget     m_budget;
+        async::SignalSet m_signals;
+
+        std::mutex m_mutex;    // guards m_attached, attached from the mounting thread
+        Attached   m_attached;
+    };
+
     /**
      * @class Madbfs
      *
@@ -19,7 +89,25 @@ namespace madbfs
     class Madbfs
     {
     public:
-        Madbfs(Opt<path::Path> server, u16 port, usize max_pages, usize page_size);
+        /**
+         * @param runtime Runtime to run on, may be shared with the instances of other devices.
+         * @param serial Serial of the device.
+         *
+         * When the runtime is shared, its owner must call `shutdown()` on every instance and then stop the
+         * runtime before destroying them.
+         */
+        Madbfs(
+            Shared<Runtime>    runtime,
+            String             serial,
+            Opt<path::Path>    server,
+            u16                port,
+            rpc::Address       socket,
+            usize              page_size,
+            bool               loopback,
+            Opt<link::Profile> link,
+            data::Rules        rules,
+            tree::Mode         mode
+        );
         ~Madbfs();
 
         Madbfs(Madbfs&&)            = delete;
@@ -28,52 +116,70 @@ namespace madbfs
         Madbfs(const Madbfs&)            = delete;
         Madbfs& operator=(const Madbfs&) = delete;
 
+        /**
+         * @brief Send every pending change to the device, the instance is no longer usable afterwards.
+         *
+         * Calling it more than once is fine.
+         */
+        void shutdown();
+
         tree::FileTree&    tree() { return m_tree; }
-        async::Context&    async_ctx() { return m_async_ctx; }
+        async::Context&    async_ctx() { return m_runtime->async_ctx(); }
         const data::Cache& cache() const { return m_cache; }
+        Str                serial() const { return m_serial; }
+        stats::Registry&   stats() { return m_stats; }
 
     private:
         /**
          * @brief Prepare and create connection to device.
          *
          * @param ctx Async context.
+         * @param registry Registry the connection records its stats into.
+         * @param serial Serial of the device.
          * @param server Server binary path.
-         * @param port Port on which the server will be ran on.
+         * @param port Port on the host forwarded to the server.
+         * @param socket Address the server listens on, connected to directly in loopback mode.
+         * @param loopback Connect directly to a server on localhost without adb.
+         * @param link Emulated link profile (only applies to `ServerConnection`).
          *
          * If the server binary path is set, this function will attempt to create a `ServerConnection` and
          * then fall back to `AdbConnection` if the connection failed. If it is not set, it will immediately
-         * cerate `AdbConnection` instead. The returned value will never be null.
+         * cerate `AdbConnection` instead. In loopback mode, `ServerConnection` is always used since there is
+         * no device to fall back to. The returned value will never be null.
          */
         static Uniq<connection::Connection> prepare_connection(
-            async::Context& ctx,
-            Opt<path::Path> server,
-            u16             port
+            async::Context&    ctx,
+            stats::Registry&   registry,
+            Str                serial,
+            Opt<path::Path>    server,
+            u16                port,
+            rpc::Address       socket,
+            bool               loopback,
+            Opt<link::Profile> link
         );
 
         /**
          * @brief Create an IPC (Unix socket).
          *
          * @param ctx Async context.
+         * @param serial Serial of the device.
          */
-        static Opt<data::Ipc> create_ipc(async::Context& ctx);
-
-        /**
-         * @brief Function for work thread on which async context will run on.
-         */
-        static void work_thread_function(async::Context& ctx);
+        static Opt<data::Ipc> create_ipc(async::Context& ctx, Str serial);
 
         /**
          * @brief IPC operation handler.
          *
          * @param op Requested operation.
+         * @param report Progress reporter for long running operations.
          *
          * This function handles all requested operations from peers that comes from `m_ipc` instance.
          */
-        Await<boost::json::value> ipc_handler(data::ipc::Op op);
+        Await<boost::json::value> ipc_handler(data::ipc::Op op, data::Ipc::Report& report);
 
-        async::Context   m_async_ctx;
-        async::WorkGuard m_work_guard;    // to prevent `async::Context` from returning immediately
-        std::jthread     m_work_thread;
+        Shared<Runtime> m_runtime;
+        String          m_serial;
+        stats::Registry m_stats;    // stats of this device only
+        bool            m_shut_down = false;
 
         Uniq<connection::Connection> m_connection;
         data::Cache                  m_cache;
@@ -1,16 +1,42 @@
 #pragma once
 
 #include "madbfs-common/aliases.hpp"
+#include "madbfs-common/stats.hpp"
 
 #define FUSE_USE_VERSION 31
+#include <errno.h>
 #include <fcntl.h>
 #include <fuse.h>
 
+namespace madbfs
+{
+    class Madbfs;
+    class Runtime;
+}
+
+namespace madbfs::args
+{
+    struct ParsedOpt;
+}
+
 namespace madbfs::operations
 {
+    /**
+     * @brief Create the instance serving one of the devices in the parsed options.
+     *
+     * @param args Parsed options.
+     * @param index Index of the device in `args.devices`, also offsets the port.
+     * @param runtime Runtime the instance runs on.
+     */
+    Uniq<Madbfs> create(args::ParsedOpt& args, usize index, Shared<Runtime> runtime);
+
     void* init(fuse_conn_info*, fuse_config*) noexcept;
     void  destroy(void*) noexcept;
 
+    // for instances created before the mount and owned by the caller (multi-device mode)
+    void* init_shared(fuse_conn_info*, fuse_config*) noexcept;
+    void  destroy_shared(void*) noexcept;
+
     i32 getattr(const char*, struct stat*, fuse_file_info*) noexcept;
     i32 readlink(const char*, char*, usize) noexcept;
     i32 mknod(const char*, mode_t, dev_t) noexcept;
@@ -24,8 +50,10 @@ namespace madbfs::operations
     i32 write(const char*, const char*, usize, off_t, fuse_file_info*) noexcept;
     i32 flush(const char*, fuse_file_info*) noexcept;
     i32 release(const char*, fuse_file_info*) noexcept;
+    i32 fsync(const char*, i32, fuse_file_info*) noexcept;
     i32 readdir(const char*, void*, fuse_fill_dir_t, off_t, fuse_file_info*, fuse_readdir_flags) noexcept;
     i32 access(const char*, i32) noexcept;
+    i32 fsyncdir(const char*, i32, fuse_file_info*) noexcept;
     i32 utimens(const char*, const timespec tv[2], fuse_file_info*) noexcept;
 
     isize copy_file_range(
@@ -39,48 +67,151 @@ namespace madbfs::operations
         int                    flags
     ) noexcept;
 
+    i32   fallocate(const char*, i32, off_t, off_t, fuse_file_info*) noexcept;
+    off_t lseek(const char*, off_t, i32, fuse_file_info*) noexcept;
+
+    namespace detail
+    {
+        enum class Op
+        {
+            Getattr,
+            Readlink,
+            Mknod,
+            Mkdir,
+            Unlink,
+            Rmdir,
+            Rename,
+            Truncate,
+            Open,
+            Read,
+            Write,
+            Flush,
+            Release,
+            Fsync,
+            Readdir,
+            Fsyncdir,
+            Utimens,
+            CopyFileRange,
+            Fallocate,
+            Lseek,
+
+            Count_,
+        };
+
+        /**
+         * @brief Record latency of a FUSE operation into the `fuse` group of the registry of the device.
+         *
+         * @param ret Return value of the operation: negative errno on error, otherwise transferred size.
+         */
+        void record(Op op, const char* path, stats::Duration duration, i64 ret) noexcept;
+
+        template <auto Fn, Op O>
+        struct Timed;
+
+        /**
+         * @brief Wrap a FUSE operation so that its latency is recorded.
+         *
+         * All the wrapped operations take the path as their first parameter.
+         */
+        template <typename Ret, typename... Args, Ret (*Fn)(const char*, Args...) noexcept, Op O>
+        struct Timed<Fn, O>
+        {
+            static Ret call(const char* path, Args... args) noexcept
+            {
+                auto watch = stats::Stopwatch{};
+                auto ret   = Fn(path, args...);
+                record(O, path, watch.elapsed(), static_cast<i64>(ret));
+                return ret;
+            }
+        };
+
+        template <auto Fn>
+        struct Rejected;
+
+        /**
+         * @brief Replace a FUSE operation that changes the filesystem with one that fails with `EROFS`.
+         */
+        template <typename Ret, typename... Args, Ret (*Fn)(const char*, Args...) noexcept>
+        struct Rejected<Fn>
+        {
+            static Ret call(const char*, Args...) noexcept { return -EROFS; }
+        };
+    }
+
     static constexpr auto operations = fuse_operations{
-        .getattr         = madbfs::operations::getattr,
-        .readlink        = madbfs::operations::readlink,
-        .mknod           = madbfs::operations::mknod,
-        .mkdir           = madbfs::operations::mkdir,
-        .unlink          = madbfs::operations::unlink,
-        .rmdir           = madbfs::operations::rmdir,
+        .getattr         = detail::Timed<getattr, detail::Op::Getattr>::call,
+        .readlink        = detail::Timed<readlink, detail::Op::Readlink>::call,
+        .mknod           = detail::Timed<mknod, detail::Op::Mknod>::call,
+        .mkdir           = detail::Timed<mkdir, detail::Op::Mkdir>::call,
+        .unlink          = detail::Timed<unlink, detail::Op::Unlink>::call,
+        .rmdir           = detail::Timed<rmdir, detail::Op::Rmdir>::call,
         .symlink         = nullptr,
-        .rename          = madbfs::operations::rename,
+        .rename          = detail::Timed<rename, detail::Op::Rename>::call,
         .link            = nullptr,
         .chmod           = nullptr,
         .chown           = nullptr,
-        .truncate        = madbfs::operations::truncate,
-        .open            = madbfs::operations::open,
-        .read            = madbfs::operations::read,
-        .write           = madbfs::operations::write,
+        .truncate        = detail::Timed<truncate, detail::Op::Truncate>::call,
+        .open            = detail::Timed<open, detail::Op::Open>::call,
+        .read            = detail::Timed<read, detail::Op::Read>::call,
+        .write           = detail::Timed<write, detail::Op::Write>::call,
         .statfs          = nullptr,
-        .flush           = madbfs::operations::flush,
-        .release         = madbfs::operations::release,
-        .fsync           = nullptr,
+        .flush           = detail::Timed<flush, detail::Op::Flush>::call,
+        .release         = detail::Timed<release, detail::Op::Release>::call,
+        .fsync           = detail::Timed<fsync, detail::Op::Fsync>::call,
         .setxattr        = nullptr,
         .getxattr        = nullptr,
         .listxattr       = nullptr,
         .removexattr     = nullptr,
         .opendir         = nullptr,
-        .readdir         = madbfs::operations::readdir,
+        .readdir         = detail::Timed<readdir, detail::Op::Readdir>::call,
         .releasedir      = nullptr,
-        .fsyncdir        = nullptr,
+        .fsyncdir        = detail::Timed<fsyncdir, detail::Op::Fsyncdir>::call,
         .init            = madbfs::operations::init,       // entry point of fuse_main
         .destroy         = madbfs::operations::destroy,    // exit point of fuse_main
         .access          = madbfs::operations::access,
         .create          = nullptr,
         .lock            = nullptr,
-        .utimens         = madbfs::operations::utimens,
+        .utimens         = detail::Timed<utimens, detail::Op::Utimens>::call,
         .bmap            = nullptr,
         .ioctl           = nullptr,
         .poll            = nullptr,
         .write_buf       = nullptr,
         .read_buf        = nullptr,
         .flock           = nullptr,
-        .fallocate       = nullptr,
-        .copy_file_range = madbfs::operations::copy_file_range,
-        .lseek           = nullptr,
+        .fallocate       = detail::Timed<fallocate, detail::Op::Fallocate>::call,
+        .copy_file_range = detail::Timed<copy_file_range, detail::Op::CopyFileRange>::call,
+        .lseek           = detail::Timed<lseek, detail::Op::Lseek>::call,
     };
+
+    static constexpr auto shared_operations = [] {
+        auto ops    = operations;
+        ops.init    = madbfs::operations::init_shared;
+        ops.destroy = madbfs::operations::destroy_shared;
+        return ops;
+    }();
+
+    /**
+     * @brief Turn an operations table into one for a read-only mount.
+     *
+     * Operations that change the filesystem fail before reaching the tree. `flush` is dropped since nothing
+     * is ever dirty; the kernel stops sending it on close once it gets `ENOSYS`.
+     */
+    constexpr fuse_operations read_only(fuse_operations ops)
+    {
+        ops.mknod           = detail::Rejected<mknod>::call;
+        ops.mkdir           = detail::Rejected<mkdir>::call;
+        ops.unlink          = detail::Rejected<unlink>::call;
+        ops.rmdir           = detail::Rejected<rmdir>::call;
+        ops.rename          = detail::Rejected<rename>::call;
+        ops.truncate        = detail::Rejected<truncate>::call;
+        ops.write           = detail::Rejected<write>::call;
+        ops.flush           = nullptr;
+        ops.utimens         = detail::Rejected<utimens>::call;
+        ops.fallocate       = detail::Rejected<fallocate>::call;
+        ops.copy_file_range = detail::Rejected<copy_file_range>::call;
+        return ops;
+    }
+
+    static constexpr auto read_only_operations        = read_only(operations);
+    static constexpr auto read_only_shared_operations = read_only(shared_operations);
 }
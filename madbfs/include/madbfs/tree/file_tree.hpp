@@ -4,10 +4,127 @@
 #include "madbfs/path.hpp"
 #include "madbfs/tree/node.hpp"
 
+#include <saf.hpp>
+
 #include <functional>
+#include <list>
+#include <map>
+#include <set>
+#include <unordered_map>
 
 namespace madbfs::tree
 {
+    /**
+     * @class LinkCache
+     *
+     * @brief Bounded LRU of symlink resolutions, maps link target to the path it finally resolves to.
+     *
+     * Only paths are stored, an entry whose path no longer leads to a node is simply a miss.
+     */
+    class LinkCache
+    {
+    public:
+        LinkCache(usize capacity)
+            : m_capacity{ capacity }
+        {
+        }
+
+        Opt<path::Path> get(Str target);
+        void            put(Str target, path::PathBuf resolved);
+        void            erase(Str target);
+
+        usize size() const { return m_entries.size(); }
+
+    private:
+        struct Entry
+        {
+            String        target;
+            path::PathBuf resolved;
+        };
+
+        std::list<Entry>                                    m_entries;    // most recently used first
+        std::unordered_map<Str, std::list<Entry>::iterator> m_index;
+        usize                                               m_capacity;
+    };
+
+    /**
+     * @class Pipeline
+     *
+     * @brief Ordered queue of device operations deferred by relaxed mode.
+     *
+     * An operation starts only after the operations submitted before it on the same path, on its ancestors,
+     * and on its descendants have completed. A file is never created before its parent directory and the
+     * times set on a directory are not bumped by a creation inside it that was submitted earlier. Failures
+     * are kept per path until collected by `settle`.
+     */
+    class Pipeline
+    {
+    public:
+        using Operation = std::move_only_function<AExpect<void>()>;
+
+        /**
+         * @brief Queue an operation without waiting for it to run.
+         *
+         * @param path Path the operation works on.
+         * @param operation The deferred operation.
+         */
+        Await<void> submit(path::Path path, Operation operation);
+
+        /**
+         * @brief Wait for pending operations on a path and its ancestors then collect their failure.
+         *
+         * @param path Path to settle.
+         * @param descendants Whether to also settle everything below the path.
+         *
+         * @return The first recorded failure among the settled paths (ancestors first), which is forgotten.
+         */
+        AExpect<void> settle(path::Path path, bool descendants);
+
+        /**
+         * @brief Wait for pending operations on a path and its ancestors, leaving their failure recorded.
+         *
+         * @param path Path to wait for.
+         * @param descendants Whether to also wait for everything below the path.
+         */
+        Await<void> wait(path::Path path, bool descendants);
+
+        /**
+         * @brief Wait for every pending operation then collect all recorded failures.
+         */
+        Await<Vec<Pair<String, Errc>>> drain();
+
+        usize pending() const { return m_tails.size(); }
+
+    private:
+        struct Tail
+        {
+            saf::shared_future<Errc> done;
+            u64                      seq;
+        };
+
+        Await<void> run(
+            String                        path,
+            u64                           seq,
+            Vec<saf::shared_future<Errc>> deps,
+            saf::promise<Errc>            promise,
+            Operation                     operation
+        );
+
+        std::map<String, Tail, std::less<>> m_tails;     // last operation submitted on each path
+        std::map<String, Errc, std::less<>> m_errors;    // failures not yet collected
+        u64                                 m_seq = 0;
+    };
+
+    /**
+     * @brief How the tree treats operations that change the device.
+     */
+    enum class Mode
+    {
+        Strict,      // every operation waits for the device
+        Relaxed,     // `utimens`, `mkdir`, and `mknod` are applied locally and deferred to the device
+        ReadOnly,    // the device doesn't change while mounted, listings are prefetched ahead
+    };
+
     /**
      * @class FileTree
      * @brief A class representing a file tree structure.
@@ -17,9 +134,34 @@ namespace madbfs::tree
     class FileTree
     {
     public:
-        using Filler = std::move_only_function<void(const char* name)>;
+        using Filler  = std::move_only_function<void(const char* name)>;
+        using Visitor = std::move_only_function<AExpect<void>(path::Path path, const data::Stat& stat)>;
 
-        FileTree(connection::Connection& connection, data::Cache& cache);
+        struct NodeCount
+        {
+            usize regular;
+            usize directory;
+            usize link;
+            usize other;
+            usize error;
+        };
+
+        /**
+         * @brief Construct a new FileTree.
+         *
+         * @param connection Connection to the device.
+         * @param cache Page cache for file data.
+         * @param mode How operations that change the device are treated.
+         *
+         * In relaxed mode, the deferred operations run in order through a `Pipeline` and their failures are
+         * returned by the next operation that depends on the path, or by `fsync`. New regular files are kept
+         * in cache until released, then created along with their content in batches.
+         *
+         * In read-only mode, the tree doesn't reject changes by itself, that is left to the FUSE layer. Since
+         * nothing can go stale, each directory listed is followed by its small files and the listing of its
+         * subdirectories (and their small files) in the background.
+         */
+        FileTree(connection::Connection& connection, data::Cache& cache, Mode mode = Mode::Strict);
         ~FileTree() = default;
 
         FileTree(Node&& root)            = delete;
@@ -53,7 +195,11 @@ namespace madbfs::tree
         AExpect<usize> write(path::Path path, u64 fd, Str in, off_t offset);
         AExpect<void>  flush(path::Path path, u64 fd);
         AExpect<void>  release(path::Path path, u64 fd);
+        AExpect<void>  fsync(path::Path path, u64 fd);
+        AExpect<void>  fsyncdir(path::Path path);
         AExpect<void>  utimens(path::Path path, timespec atime, timespec mtime);
+        AExpect<void>  fallocate(path::Path path, u64 fd, i32 mode, off_t offset, off_t length);
+        AExpect<off_t> lseek(path::Path path, u64 fd, off_t offset, i32 whence);
 
         AExpect<usize> copy_file_range(
             path::Path in_path,
@@ -69,6 +215,25 @@ namespace madbfs::tree
         // this function only used to link already existing files, user can't and shouldn't use it
         Expect<void> symlink(path::Path path, path::Path target);
 
+        /**
+         * @brief Visit regular files in a directory, populating the tree along the way.
+         *
+         * @param path Path to a directory or a regular file (visited directly).
+         * @param recursive Whether to descend into subdirectories.
+         * @param visitor Function called on each regular file, an error stops the walk.
+         *
+         * Symbolic links are not followed. Entries that fail to be listed or stat-ed are skipped.
+         */
+        AExpect<void> walk(path::Path path, bool recursive, Visitor visitor);
+
+        /**
+         * @brief Send files created in relaxed mode that are still only in cache and wait for them.
+         *
+         * The cache holds the only copy of their content, so this must be done before it is reset. Failures
+         * are kept to be returned by the next operation on the files.
+         */
+        Await<void> send_unsent();
+
         /**
          * @brief Safely clean up and sync data.
          */
@@ -79,6 +244,15 @@ namespace madbfs::tree
          */
         const Node& root() const { return m_root; }
 
+        Mode mode() const { return m_mode; }
+
+        /**
+         * @brief Count nodes currently in the tree by their kind.
+         *
+         * Walks the whole tree, so it's meant for occasional reporting only.
+         */
+        NodeCount count_nodes() const;
+
     private:
         /**
          * @brief Traverse the node or build a new node.
@@ -87,6 +261,114 @@ namespace madbfs::tree
          */
         AExpect<Ref<Node>> traverse_or_build(path::Path path);
 
+        /**
+         * @brief List a directory, from the device if it's not yet synced.
+         *
+         * @param path Path to the directory.
+         * @param filler Function called on each entry.
+         */
+        AExpect<void> list(path::Path path, Filler filler);
+
+        /**
+         * @brief Follow symlinks until a node that is not a symlink, building the targets along the way.
+         *
+         * @param node Starting node, returned as is if not a symlink.
+         */
+        AExpect<Ref<Node>> resolve(Node& node);
+
+        using Deferred = std::move_only_function<AExpect<Opt<data::Stat>>(path::Path path)>;
+
+        /**
+         * @brief Create a node locally and defer its creation on the device (relaxed mode).
+         *
+         * @param parent Parent directory of the new node.
+         * @param path Path of the new node.
+         * @param mode Mode of the new node, the type is set according to file.
+         * @param file Kind of the new node.
+         * @param deferred Operation that creates the file on the device, left to the caller if empty.
+         */
+        AExpect<Ref<Node>> create_relaxed(
+            Node&      parent,
+            path::Path path,
+            mode_t     mode,
+            File       file,
+            Deferred   deferred
+        );
+
+        /**
+         * @brief Submit a device operation on a node to the pipeline.
+         *
+         * @param path Path of the node.
+         * @param id Id of the node, the result is not applied if the node is replaced in the meantime.
+         * @param created Whether the operation creates the node, a failure then removes it from the tree.
+         * @param deferred The device operation.
+         *
+         * On success, the stat returned by the operation is applied to the node. On failure, the node is
+         * removed if it was created by the operation, otherwise its stat is fetched again from the device.
+         */
+        Await<void> defer(path::Path path, data::Id id, bool created, Deferred deferred);
+
+        /**
+         * @brief Regular file created in relaxed mode whose content is still only in cache.
+         */
+        struct Unsent
+        {
+            data::Id id;
+            mode_t   mode;
+            timespec atime = { .tv_sec = 0, .tv_nsec = UTIME_OMIT };
+            timespec mtime = { .tv_sec = 0, .tv_nsec = UTIME_OMIT };
+        };
+
+        /**
+         * @brief Submit the creation of unsent files overlapping a path to the pipeline.
+         *
+         * @param path Path to send.
+         * @param descendants Whether to also send files below the path.
+         */
+        Await<void> send(path::Path path, bool descendants);
+
+        /**
+         * @brief Send unsent files overlapping a path then settle it in the pipeline.
+         */
+        AExpect<void> settle(path::Path path, bool descendants);
+
+        // number of files opened in a freshly listed directory before it is considered being scanned
+        static constexpr usize scan_after_opens = 2;
+
+        /**
+         * @brief Directory listed last and how many of its files are opened since.
+         */
+        struct Scan
+        {
+            path::PathBuf dir;
+            usize         opened     = 0;
+            bool          prefetched = false;
+        };
+
+        /**
+         * @brief Prefetch small files of the listed directory once enough of its files are opened.
+         *
+         * @param path Path of the opened file.
+         *
+         * Thumbnailers and recursive grep list a directory then open its entries one after another, each
+         * open costing at least one round trip. Pulling the rest in batches hides most of them.
+         */
+        Await<void> on_open(path::Path path);
+
+        /**
+         * @brief Pull regular files of a directory that fit in a single page into the cache.
+         */
+        Await<void> prefetch_small(path::PathBuf dir);
+
+        /**
+         * @brief Prefetch small files of a directory listed by the user, then list its subdirectories and
+         * prefetch theirs too (read-only mode).
+         *
+         * Only goes one level down, done once per directory; the listing of a subdirectory by the user goes
+         * further.
+         */
+        Await<void> prefetch_ahead(path::PathBuf dir);
+
         Node::Context make_context(const path::Path& path)
         {
             return {
@@ -97,10 +379,16 @@ namespace madbfs::tree
             };
         }
 
-        Node                    m_root;
-        connection::Connection& m_connection;
-        data::Cache&            m_cache;
-        std::atomic<u64>        m_fd_counter       = 0;
-        bool                    m_root_initialized = false;
+        Node                                  m_root;
+        connection::Connection&               m_connection;
+        data::Cache&                          m_cache;
+        LinkCache                             m_links{ 1024 };
+        Pipeline                              m_pipeline;
+        Opt<Scan>                             m_scan;
+        std::map<String, Unsent, std::less<>> m_unsent;
+        std::set<String, std::less<>>         m_expanded;    // directories already prefetched ahead
+        std::atomic<u64>                      m_fd_counter       = 0;
+        Mode                                  m_mode             = Mode::Strict;
+        bool                                  m_root_initialized = false;
     };
 }
@@ -10,6 +10,8 @@
 #include <functional>
 #include <unordered_set>
 
+#include <fcntl.h>
+
 namespace madbfs::tree
 {
     class Node;
@@ -73,6 +75,16 @@ namespace madbfs::tree::node
         }
 
         bool is_open(u64 fd) { return sr::find(m_open_fds, fd, &Entry::fd) != m_open_fds.end(); }
+
+        /**
+         * @brief Check whether `fd` is opened with `O_DIRECT`.
+         */
+        bool is_direct(u64 fd) const
+        {
+            auto found = sr::find(m_open_fds, fd, &Entry::fd);
+            return found != m_open_fds.end() and (found->flags & O_DIRECT) != 0;
+        }
+
         bool has_open_fds() const { return not m_open_fds.empty(); }
         bool is_dirty() const { return m_dirty; }
         void set_dirty(bool val) { m_dirty = val; }
@@ -164,24 +176,25 @@ namespace madbfs::tree::node
      *
      * @brief Represent a symbolic link.
      *
-     * This class is only used for preexisting symlink on the device. The behavior of the link is also not the
-     * same to that of POSIX since this class doesn't allow dangling symbolic link.
+     * This class is only used for preexisting symlink on the device. The link only stores the path it points
+     * to; the target node is looked up (and built if needed) on traversal, so a link never dangles into a
+     * removed node.
      */
     class Link
     {
     public:
-        Link(Node* target)
-            : m_target{ target }
+        Link(path::PathBuf target)
+            : m_target{ std::move(target) }
         {
         }
 
         /**
-         * @brief Get immediate target of the link.
+         * @brief Get path of immediate target of the link.
          */
-        Node& target() const { return *m_target; }
+        path::Path target() const { return m_target.as_path(); }
 
     private:
-        Node* m_target;    // how do I signal node not exist anymore?
+        path::PathBuf m_target;
     };
 
     /**
@@ -215,6 +228,9 @@ namespace madbfs::tree
 {
     using File = Var<node::Regular, node::Directory, node::Link, node::Other, node::Error>;
 
+    // maximum number of links followed when resolving a path, same as Linux's MAXSYMLINKS
+    constexpr usize max_link_hops = 40;
+
     class Node
     {
     public:
@@ -244,7 +260,7 @@ namespace madbfs::tree
 
         void set_name(Str name) { m_name = name; }
         void set_parent(Node* parent) { m_parent = parent; }
-        void set_stat(data::Stat stat) { m_stat = stat; }
+        void set_stat(data::Stat stat);
 
         Str         name() const { return m_name; }
         Node*       parent() const { return m_parent; }
@@ -467,6 +483,29 @@ namespace madbfs::tree
          */
         AExpect<void> utimens(Context context, timespec atime, timespec mtime);
 
+        /**
+         * @brief Manipulate allocated space of a file.
+         *
+         * @param context Context needed to communicate with device and local.
+         * @param fd File descriptor.
+         * @param mode Mode as in fallocate(2).
+         * @param offset Start of the range.
+         * @param length Length of the range.
+         */
+        AExpect<void> fallocate(Context context, u64 fd, i32 mode, off_t offset, off_t length);
+
+        /**
+         * @brief Find the next data or hole of a file.
+         *
+         * @param context Context needed to communicate with device and local.
+         * @param fd File descriptor.
+         * @param offset Offset to start from.
+         * @param whence Either SEEK_DATA or SEEK_HOLE.
+         *
+         * @return Offset of the found data or hole.
+         */
+        AExpect<off_t> lseek(Context context, u64 fd, off_t offset, i32 whence);
+
         // -------------------------
 
         // operations on Link
@@ -474,6 +513,8 @@ namespace madbfs::tree
 
         /**
          * @brief Read a link.
+         *
+         * Only follows links whose targets are already in the tree, see `FileTree::resolve`.
          */
         Expect<Ref<Node>> readlink();
 
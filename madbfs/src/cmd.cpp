@@ -31,13 +31,10 @@ namespace
         TryAgain,
     };
 
-    inline madbfs::Str get_no_dev_serial()
+    // "adb: device '<serial>' not found", the serial may belong to any of the mounted devices
+    inline bool is_no_dev_serial(madbfs::Str line)
     {
-        if (auto* serial = std::getenv("ANDROID_SERIAL"); serial != nullptr) {
-            static auto no_dev_serial = fmt::format("adb: device '{}' not found", serial);
-            return no_dev_serial;
-        }
-        return {};
+        return line.starts_with("adb: device '") and line.ends_with("' not found");
     }
 
     inline madbfs::Errc to_errc(AdbError err)
@@ -64,7 +61,7 @@ namespace
         while (auto line = splitter.next()) {
             if (*line == error::no_device or *line == error::device_offline) {
                 return Err::NoDev;
-            } else if (*line == get_no_dev_serial()) {
+            } else if (is_no_dev_serial(*line)) {
                 return Err::TryAgain;
             }
 
@@ -178,4 +175,15 @@ namespace madbfs::cmd
 
         co_return std::move(out);
     }
+
+    AExpect<String> adb(Str serial, Span<const Str> args, Str in, bool check, bool merge_err)
+    {
+        auto cmd = Vec<Str>{ "adb" };
+        if (not serial.empty()) {
+            cmd.insert(cmd.end(), { "-s", serial });
+        }
+        cmd.insert(cmd.end(), args.begin(), args.end());
+
+        co_return co_await exec(cmd, in, check, merge_err);
+    }
 }
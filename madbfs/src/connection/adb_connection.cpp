@@ -86,6 +86,9 @@ namespace
     {
         return fmt::format("\"{}\"", path.fullpath());
     }
+
+    // shell commands don't report anything back, the caller stats the file itself if it needs to
+    constexpr auto no_stat = [](auto&&) -> madbfs::Opt<madbfs::data::Stat> { return std::nullopt; };
 }
 
 namespace madbfs::connection
@@ -94,7 +97,6 @@ namespace madbfs::connection
     {
         const auto qpath = quote(path);
         const auto cmd   = std::to_array<Str>({
-            "adb",
             "shell",
             "find",
             qpath,
@@ -108,7 +110,7 @@ namespace madbfs::connection
             "+",
         });
 
-        auto res = co_await cmd::exec(cmd, "", false, false);
+        auto res = co_await cmd::adb(m_serial, cmd, "", false, false);
         if (not res.has_value()) {
             co_return Unexpect{ res.error() };
         }
@@ -130,8 +132,9 @@ namespace madbfs::connection
 
     AExpect<data::Stat> AdbConnection::stat(path::Path path)
     {
-        auto res = co_await cmd::exec(
-            { "adb", "shell", "stat", "-c", "'%f|%h|%s|%u|%g|%x|%y|%z|%n'", quote(path) }
+        auto res = co_await cmd::adb(
+            m_serial,
+            { "shell", "stat", "-c", "'%f|%h|%s|%u|%g|%x|%y|%z|%n'", quote(path) }
         );
 
         co_return res.and_then([&](Str out) {
@@ -146,58 +149,58 @@ namespace madbfs::connection
 
     AExpect<path::PathBuf> AdbConnection::readlink(path::Path path)
     {
-        auto res = co_await cmd::exec({ "adb", "shell", "readlink", quote(path) });
+        auto res = co_await cmd::adb(m_serial, { "shell", "readlink", quote(path) });
 
         co_return res.transform([&](Str target) {
             return path::resolve(path.parent_path(), util::strip(target));
         });
     }
 
-    AExpect<void> AdbConnection::mknod(path::Path path, mode_t /* mode */, dev_t /* dev */)
+    AExpect<Opt<data::Stat>> AdbConnection::mknod(path::Path path, mode_t /* mode */, dev_t /* dev */)
     {
-        auto res = co_await cmd::exec({ "adb", "shell", "touch", quote(path) });
-        co_return res.transform(sink_void);
+        auto res = co_await cmd::adb(m_serial, { "shell", "touch", quote(path) });
+        co_return res.transform(no_stat);
     }
 
-    AExpect<void> AdbConnection::mkdir(path::Path path, mode_t /* mode */)
+    AExpect<Opt<data::Stat>> AdbConnection::mkdir(path::Path path, mode_t /* mode */)
     {
-        auto res = co_await cmd::exec({ "adb", "shell", "mkdir", quote(path) });
-        co_return res.transform(sink_void);
+        auto res = co_await cmd::adb(m_serial, { "shell", "mkdir", quote(path) });
+        co_return res.transform(no_stat);
     }
 
     AExpect<void> AdbConnection::unlink(path::Path path)
     {
-        auto res = co_await cmd::exec({ "adb", "shell", "rm", quote(path) });
+        auto res = co_await cmd::adb(m_serial, { "shell", "rm", quote(path) });
         co_return res.transform(sink_void);
     }
 
     AExpect<void> AdbConnection::rmdir(path::Path path)
     {
-        auto res = co_await cmd::exec({ "adb", "shell", "rmdir", quote(path) });
+        auto res = co_await cmd::adb(m_serial, { "shell", "rmdir", quote(path) });
         co_return res.transform(sink_void);
     }
 
-    AExpect<void> AdbConnection::rename(path::Path from, path::Path to, u32 flags)
+    AExpect<Opt<data::Stat>> AdbConnection::rename(path::Path from, path::Path to, u32 flags)
     {
         if (flags == RENAME_EXCHANGE) {
             // NOTE: there is no --exchange flag on Android's mv
             // NOTE: renameat2 returns EINVAL when the fs doesn't support exchange operation see man rename(2)
             co_return Unexpect{ Errc::invalid_argument };
         } else if (flags == RENAME_NOREPLACE) {
-            auto res = co_await cmd::exec({ "adb", "shell", "mv", "-n", quote(from), quote(to) });
-            co_return res.transform(sink_void);
+            auto res = co_await cmd::adb(m_serial, { "shell", "mv", "-n", quote(from), quote(to) });
+            co_return res.transform(no_stat);
         } else {
-            auto res = co_await cmd::exec({ "adb", "shell", "mv", quote(from), quote(to) });
-            co_return res.transform(sink_void);
+            auto res = co_await cmd::adb(m_serial, { "shell", "mv", quote(from), quote(to) });
+            co_return res.transform(no_stat);
         }
     }
 
-    AExpect<void> AdbConnection::truncate(path::Path path, off_t size)
+    AExpect<Opt<data::Stat>> AdbConnection::truncate(path::Path path, off_t size)
     {
         const auto size_str = fmt::format("{}", size);
 
-        auto res = co_await cmd::exec({ "adb", "shell", "truncate", "-s", size_str, quote(path) });
-        co_return res.transform(sink_void);
+        auto res = co_await cmd::adb(m_serial, { "shell", "truncate", "-s", size_str, quote(path) });
+        co_return res.transform(no_stat);
     }
 
     AExpect<usize> AdbConnection::read(path::Path path, Span<char> out, off_t offset)
@@ -207,8 +210,9 @@ namespace madbfs::connection
         const auto ifile = fmt::format("if=\"{}\"", path.fullpath());
 
         // `bs` is skipped, relies on `count_bytes`: https://stackoverflow.com/a/40792605/16506263
-        auto res = co_await cmd::exec(
-            { "adb", "shell", "dd", "iflag=skip_bytes,count_bytes", skip, count, ifile }
+        auto res = co_await cmd::adb(
+            m_serial,
+            { "shell", "dd", "iflag=skip_bytes,count_bytes", skip, count, ifile }
         );
 
         co_return res.transform([&](Str str) {
@@ -226,20 +230,22 @@ namespace madbfs::connection
         auto in_str = Str{ in.data(), in.size() };
 
         // `notrunc` flag is necessary to prevent truncating file: https://unix.stackexchange.com/a/146923
-        auto res = co_await cmd::exec(
-            { "adb", "shell", "dd", "oflag=seek_bytes", "conv=notrunc", seek, ofile }, in_str
+        auto res = co_await cmd::adb(
+            m_serial,
+            { "shell", "dd", "oflag=seek_bytes", "conv=notrunc", seek, ofile },
+            in_str
         );
 
         // assume all the data is written to device on success
         co_return res.transform([&](auto&&) { return in_str.size(); });
     }
 
-    AExpect<void> AdbConnection::utimens(path::Path path, timespec atime, timespec mtime)
+    AExpect<Opt<data::Stat>> AdbConnection::utimens(path::Path path, timespec atime, timespec mtime)
     {
         for (auto [time, flag] : { Pair{ atime, "-a" }, Pair{ mtime, "-m" } }) {
             if (time.tv_nsec == UTIME_NOW) {
-                auto res = co_await cmd::exec({ "adb", "shell", "touch", "-c", flag, quote(path) });
-                co_return res.transform(sink_void);
+                auto res = co_await cmd::adb(m_serial, { "shell", "touch", "-c", flag, quote(path) });
+                co_return res.transform(no_stat);
             }
 
             if (auto sec = time.tv_nsec / 1'000'000'000; sec > 0) {
@@ -256,13 +262,46 @@ namespace madbfs::connection
             const auto str = fmt::format("{:%Y%m%d%H%M.%S}{}", *tm_info, time.tv_nsec);
             log_i("{}: utimens to {}", __func__, str);
 
-            auto res = co_await cmd::exec({ "adb", "shell", "touch", "-c", flag, "-t", str, quote(path) });
+            auto res = co_await cmd::adb(
+                m_serial,
+                { "shell", "touch", "-c", flag, "-t", str, quote(path) }
+            );
             if (not res) {
                 co_return Unexpect{ res.error() };
             }
         }
 
-        co_return Expect<void>{};
+        co_return Opt<data::Stat>{};
+    }
+
+    AExpect<Opt<data::Stat>> AdbConnection::fallocate(path::Path path, i32 mode, off_t offset, off_t length)
+    {
+        // toybox fallocate only knows the default mode
+        if (mode != 0) {
+            co_return Unexpect{ Errc::operation_not_supported };
+        }
+
+        const auto offset_str = fmt::format("{}", offset);
+        const auto length_str = fmt::format("{}", length);
+
+        auto res = co_await cmd::adb(
+            m_serial,
+            { "shell", "fallocate", "-o", offset_str, "-l", length_str, quote(path) }
+        );
+        co_return res.transform(no_stat);
+    }
+
+    AExpect<off_t> AdbConnection::lseek(path::Path path, off_t offset, i32 whence)
+    {
+        // holes can't be found from the shell, the whole file is data like on filesystems without holes
+        auto stat = co_await this->stat(path);
+        if (not stat) {
+            co_return Unexpect{ stat.error() };
+        } else if (offset >= stat->size) {
+            co_return Unexpect{ Errc::no_such_device_or_address };
+        }
+
+        co_return whence == SEEK_DATA ? offset : stat->size;
     }
 
     AExpect<usize> AdbConnection::copy_file_range(
@@ -282,7 +321,6 @@ namespace madbfs::connection
         // count_bytes: https://stackoverflow.com/a/40792605/16506263
         // notrunc    : https://unix.stackexchange.com/a/146923
         const auto cmd = std::to_array<Str>({
-            "adb",
             "shell",
             "dd",
             "iflag=skip_bytes,count_bytes",
@@ -295,7 +333,7 @@ namespace madbfs::connection
             ofile,
         });
 
-        auto res = co_await cmd::exec(cmd, "", true, true);
+        auto res = co_await cmd::adb(m_serial, cmd, "", true, true);
 
         // example output
         /*
@@ -313,4 +351,63 @@ namespace madbfs::connection
                 .value_or(0);
         });
     }
+
+    AExpect<Vec<Expect<usize>>> AdbConnection::read_many(
+        Span<const path::Path> paths,
+        Span<const Span<char>> outs
+    )
+    {
+        // no batching over adb shell, each file is a separate command anyway
+        auto result = Vec<Expect<usize>>{};
+        result.reserve(paths.size());
+
+        for (auto [path, out] : sv::zip(paths, outs)) {
+            result.push_back(co_await read(path, out, 0));
+        }
+
+        co_return result;
+    }
+
+    AExpect<Vec<Expect<Opt<data::Stat>>>> AdbConnection::write_many(
+        Span<const path::Path> paths,
+        Span<const Upload>     files
+    )
+    {
+        // no compound command over adb shell, do each step separately
+        auto result = Vec<Expect<Opt<data::Stat>>>{};
+        result.reserve(paths.size());
+
+        auto upload = [&](path::Path path, const Upload& file) -> AExpect<Opt<data::Stat>> {
+            auto created = co_await mknod(path, file.mode, 0);
+            if (not created and created.error() != Errc::file_exists) {
+                co_return Unexpect{ created.error() };
+            } else if (not created) {
+                if (auto res = co_await truncate(path, 0); not res) {
+                    co_return Unexpect{ res.error() };
+                }
+            }
+
+            if (not file.data.empty()) {
+                if (auto res = co_await write(path, file.data, 0); not res) {
+                    co_return Unexpect{ res.error() };
+                }
+            }
+
+            if (file.atime.tv_nsec == UTIME_OMIT and file.mtime.tv_nsec == UTIME_OMIT) {
+                co_return Opt<data::Stat>{};
+            }
+            co_return co_await utimens(path, file.atime, file.mtime);
+        };
+
+        for (auto [path, file] : sv::zip(paths, files)) {
+            result.push_back(co_await upload(path, file));
+        }
+
+        co_return result;
+    }
+
+    AExpect<Vec<ServerTiming>> AdbConnection::server_stats(bool)
+    {
+        co_return Unexpect{ Errc::operation_not_supported };    // no server, operations are shell commands
+    }
 }
@@ -0,0 +1,154 @@
+#include "madbfs/connection/metered_connection.hpp"
+
+#include "madbfs/path.hpp"
+
+namespace madbfs::connection
+{
+    MeteredConnection::MeteredConnection(Uniq<Connection> inner, stats::Registry& registry)
+        : m_inner{ std::move(inner) }
+    {
+        constexpr auto names = Array<Str, Count_>{
+            "statdir", "stat",     "readlink", "mknod", "mkdir",   "unlink",          "rmdir",
+            "rename",  "truncate", "read",     "write", "utimens", "copy_file_range", "read_many",
+            "write_many", "fallocate", "lseek",
+        };
+
+        for (auto i : sv::iota(0uz, names.size())) {
+            m_metrics[i] = &registry.metric("connection", names[i]);
+        }
+    }
+
+    template <typename T>
+    AExpect<T> MeteredConnection::timed(Op op, path::Path path, u64 size, AExpect<T> awaitable)
+    {
+        auto watch = stats::Stopwatch{};
+        auto res   = co_await std::move(awaitable);
+        auto err   = res.has_value() ? Errc{} : res.error();
+
+        m_metrics[op]->record(watch.elapsed(), path.fullpath(), size, err);
+        co_return res;
+    }
+
+    AExpect<Gen<ParsedStat>> MeteredConnection::statdir(path::Path path)
+    {
+        return timed(Statdir, path, 0, m_inner->statdir(path));
+    }
+
+    AExpect<data::Stat> MeteredConnection::stat(path::Path path)
+    {
+        return timed(Stat, path, 0, m_inner->stat(path));
+    }
+
+    AExpect<path::PathBuf> MeteredConnection::readlink(path::Path path)
+    {
+        return timed(Readlink, path, 0, m_inner->readlink(path));
+    }
+
+    AExpect<Opt<data::Stat>> MeteredConnection::mknod(path::Path path, mode_t mode, dev_t dev)
+    {
+        return timed(Mknod, path, 0, m_inner->mknod(path, mode, dev));
+    }
+
+    AExpect<Opt<data::Stat>> MeteredConnection::mkdir(path::Path path, mode_t mode)
+    {
+        return timed(Mkdir, path, 0, m_inner->mkdir(path, mode));
+    }
+
+    AExpect<void> MeteredConnection::unlink(path::Path path)
+    {
+        return timed(Unlink, path, 0, m_inner->unlink(path));
+    }
+
+    AExpect<void> MeteredConnection::rmdir(path::Path path)
+    {
+        return timed(Rmdir, path, 0, m_inner->rmdir(path));
+    }
+
+    AExpect<Opt<data::Stat>> MeteredConnection::rename(path::Path from, path::Path to, u32 flags)
+    {
+        return timed(Rename, from, 0, m_inner->rename(from, to, flags));
+    }
+
+    AExpect<Opt<data::Stat>> MeteredConnection::truncate(path::Path path, off_t size)
+    {
+        return timed(Truncate, path, static_cast<u64>(size), m_inner->truncate(path, size));
+    }
+
+    AExpect<usize> MeteredConnection::read(path::Path path, Span<char> out, off_t offset)
+    {
+        return timed(Read, path, out.size(), m_inner->read(path, out, offset));
+    }
+
+    AExpect<usize> MeteredConnection::write(path::Path path, Span<const char> in, off_t offset)
+    {
+        return timed(Write, path, in.size(), m_inner->write(path, in, offset));
+    }
+
+    AExpect<Opt<data::Stat>> MeteredConnection::utimens(path::Path path, timespec atime, timespec mtime)
+    {
+        return timed(Utimens, path, 0, m_inner->utimens(path, atime, mtime));
+    }
+
+    AExpect<Opt<data::Stat>> MeteredConnection::fallocate(
+        path::Path path,
+        i32        mode,
+        off_t      offset,
+        off_t      length
+    )
+    {
+        return timed(Fallocate, path, 0, m_inner->fallocate(path, mode, offset, length));
+    }
+
+    AExpect<off_t> MeteredConnection::lseek(path::Path path, off_t offset, i32 whence)
+    {
+        return timed(Lseek, path, 0, m_inner->lseek(path, offset, whence));
+    }
+
+    AExpect<usize> MeteredConnection::copy_file_range(
+        path::Path in,
+        off_t      in_off,
+        path::Path out,
+        off_t      out_off,
+        usize      size
+    )
+    {
+        return timed(CopyFileRange, in, size, m_inner->copy_file_range(in, in_off, out, out_off, size));
+    }
+
+    AExpect<Vec<Expect<usize>>> MeteredConnection::read_many(
+        Span<const path::Path> paths,
+        Span<const Span<char>> outs
+    )
+    {
+        if (paths.empty()) {
+            return m_inner->read_many(paths, outs);
+        }
+
+        auto size = 0_u64;
+        for (auto out : outs) {
+            size += out.size();
+        }
+        return timed(ReadMany, paths.front(), size, m_inner->read_many(paths, outs));
+    }
+
+    AExpect<Vec<Expect<Opt<data::Stat>>>> MeteredConnection::write_many(
+        Span<const path::Path> paths,
+        Span<const Upload>     files
+    )
+    {
+        if (paths.empty()) {
+            return m_inner->write_many(paths, files);
+        }
+
+        auto size = 0_u64;
+        for (const auto& file : files) {
+            size += file.data.size();
+        }
+        return timed(WriteMany, paths.front(), size, m_inner->write_many(paths, files));
+    }
+
+    AExpect<Vec<ServerTiming>> MeteredConnection::server_stats(bool reset)
+    {
+        return m_inner->server_stats(reset);    // diagnostics, not worth metering
+    }
+}
@@ -5,19 +5,39 @@
 
 #include <madbfs-common/log.hpp>
 #include <madbfs-common/rpc.hpp>
+#include <madbfs-common/stats.hpp>
+
+namespace
+{
+    madbfs::data::Stat to_data_stat(const madbfs::rpc::resp::Stat& stat)
+    {
+        return {
+            .links = stat.links,
+            .size  = stat.size,
+            .mtime = stat.mtime,
+            .atime = stat.atime,
+            .ctime = stat.ctime,
+            .mode  = stat.mode,
+            .uid   = stat.uid,
+            .gid   = stat.gid,
+        };
+    }
+
+    // mutation responses carry the stat of the file after the operation if the server managed to get it
+    constexpr auto post_stat = [](auto&& resp) -> madbfs::Opt<madbfs::data::Stat> {
+        return resp.stat.transform(to_data_stat);
+    };
+}
 
 namespace madbfs::connection
 {
-    AExpect<Uniq<rpc::Client>> ServerConnection::make_client(u16 port)
+    AExpect<Uniq<rpc::Client>> ServerConnection::make_client(const rpc::Address& address)
     {
         auto exec   = co_await async::current_executor();
-        auto socket = async::tcp::Socket{ exec };
-
-        auto address  = asio::ip::address_v4{ { 127, 0, 0, 1 } };    // localhost
-        auto endpoint = asio::ip::tcp::endpoint{ address, port };
+        auto socket = rpc::Socket{ exec };
 
-        if (auto res = co_await socket.async_connect(endpoint); not res) {
-            log_e("{}: failed to connect to server at port {}", __func__, port);
+        if (auto res = co_await socket.async_connect(address.endpoint()); not res) {
+            log_e("{}: failed to connect to server at {}", __func__, address.to_string());
             auto errc = async::to_generic_err(res.error(), Errc::not_connected);
             co_return Unexpect{ errc };
         }
@@ -33,13 +53,16 @@ namespace madbfs::connection
     {
         if (m_client == nullptr) {
             log_i("{}: client is not connected, trying to reestablish connection", __func__);
-            auto client = co_await make_client(m_port);
+            auto client = co_await make_client(m_address);
             if (not client) {
                 log_e("{}: reconnection failed", __func__);
                 co_return Unexpect{ client.error() };
             }
             m_client = std::move(*client);
+            m_client->emulate_link(m_link);
+            m_client->report_to(*m_stats);
             log_i("{}: reconnection successful", __func__);
+            m_stats->counter("connection", "reconnects").add();
         }
 
         if (not m_client->running()) {
@@ -50,6 +73,7 @@ namespace madbfs::connection
         if (not res) {
             if (res.error() == Errc::not_connected or res.error() == Errc::broken_pipe) {
                 log_e("{}: client is disconnected, releasing client", __func__);
+                m_stats->counter("connection", "disconnects").add();
                 m_client.reset();
             }
             co_return Unexpect{ res.error() };
@@ -58,43 +82,64 @@ namespace madbfs::connection
         co_return res;
     }
 
-    AExpect<Uniq<ServerConnection>> ServerConnection::prepare_and_create(Opt<path::Path> server, u16 port)
+    Await<Uniq<ServerConnection>> ServerConnection::create_direct(rpc::Address address)
+    {
+        auto addr   = address.to_string();
+        auto client = co_await make_client(address);
+        if (not client) {
+            auto msg = std::make_error_code(client.error()).message();
+            log_w("{}: failed to connect to server at {}: {}, will retry later", __func__, addr, msg);
+            co_return Uniq<ServerConnection>{ new ServerConnection{ std::move(address), nullptr } };
+        }
+
+        log_i("{}: connected to server at {}", __func__, addr);
+        co_return Uniq<ServerConnection>{ new ServerConnection{ std::move(address), std::move(*client) } };
+    }
+
+    AExpect<Uniq<ServerConnection>> ServerConnection::prepare_and_create(
+        Str             serial,
+        Opt<path::Path> server,
+        u16             port,
+        rpc::Address    device
+    )
     {
         namespace bp = boost::process::v2;
 
         auto exec      = co_await async::current_executor();
         auto serv_file = Str{ "/data/local/tmp/madbfs-server" };
+        auto host      = rpc::Address::tcp(port);
 
-        // enable port forwarding
-        auto forward = fmt::format("tcp:{}", port);
-        if (auto res = co_await cmd::exec({ "adb", "forward", forward, forward }); not res) {
+        // enable port forwarding, the device side can be a unix socket which skips the device's tcp stack
+        auto local  = host.to_string();
+        auto remote = device.to_string();
+        if (auto res = co_await cmd::adb(serial, { "forward", local, remote }); not res) {
             auto msg = std::make_error_code(res.error()).message();
-            log_e("{}: failed to enable port forwarding at port {}: {}", __func__, port, msg);
+            log_e("{}: failed to enable forwarding from {} to {}: {}", __func__, local, remote, msg);
             co_return Unexpect{ res.error() };
         }
 
         if (not server) {
             log_i("{}: server path not set, try connect", __func__);
-            auto client = co_await make_client(port);
+            auto client = co_await make_client(host);
             if (not client) {
                 co_return Unexpect{ client.error() };
             }
 
             log_i("{}: server is already running, continue normally", __func__);
-            co_return Uniq<ServerConnection>{ new ServerConnection{ port, std::move(*client) } };
+            co_return Uniq<ServerConnection>{ new ServerConnection{ host, std::move(*client) } };
         }
 
         log_i("{}: server path set to {}, pushing server normally", __func__, server->fullpath());
 
         // push server executable to device
-        if (auto res = co_await cmd::exec({ "adb", "push", server->fullpath(), serv_file }); not res) {
+        if (auto res = co_await cmd::adb(serial, { "push", server->fullpath(), serv_file }); not res) {
             auto msg = std::make_error_code(res.error()).message();
             log_e("{}: failed to push 'madbfs-server' to device: {}", __func__, msg);
             co_return Unexpect{ res.error() };
         }
 
         // update execute permission
-        if (auto res = co_await cmd::exec({ "adb", "shell", "chmod", "+x", serv_file }); not res) {
+        if (auto res = co_await cmd::adb(serial, { "shell", "chmod", "+x", serv_file }); not res) {
             auto msg = std::make_error_code(res.error()).message();
             log_e("{}: failed to update 'madbfs-server' permission: {}", __func__, msg);
             co_return Unexpect{ res.error() };
@@ -103,14 +148,20 @@ namespace madbfs::connection
         log_i("{}: trying to run server", __func__);
 
         // run server
-        auto cmd      = bp::environment::find_executable("adb");
-        auto port_str = fmt::format("{}", port);
-        auto args     = Array<boost::string_view, 4>{
-            "shell",
-            { serv_file.data(), serv_file.size() },
-            "--port",
-            port_str,
-        };
+        auto cmd  = bp::environment::find_executable("adb");
+        auto args = Vec<boost::string_view>{};
+        if (not serial.empty()) {
+            args.insert(args.end(), { "-s", { serial.data(), serial.size() } });
+        }
+        args.insert(
+            args.end(),
+            {
+                "shell",
+                { serv_file.data(), serv_file.size() },
+                "--listen",
+                { remote.data(), remote.size() },
+            }
+        );
 
         auto cmds = args | sv::transform([](auto s) { return Str{ s.data(), s.size() }; });
         log_d("{}: executing adb {}", __func__, cmds);
@@ -136,7 +187,7 @@ namespace madbfs::connection
             co_return Unexpect{ Errc::broken_pipe };
         }
 
-        auto client = co_await make_client(port);
+        auto client = co_await make_client(host);
         if (not client) {
             co_return Unexpect{ client.error() };
         }
@@ -144,7 +195,7 @@ namespace madbfs::connection
         log_i("{}: server is running and ready to be used", __func__);
 
         co_return Uniq<ServerConnection>{ new ServerConnection{
-            port,
+            host,
             std::move(*client),
             std::move(proc),
             std::move(out),
@@ -152,6 +203,22 @@ namespace madbfs::connection
         } };
     }
 
+    void ServerConnection::emulate_link(Opt<link::Profile> profile)
+    {
+        m_link = profile;
+        if (m_client) {
+            m_client->emulate_link(profile);
+        }
+    }
+
+    void ServerConnection::report_to(stats::Registry& registry)
+    {
+        m_stats = &registry;
+        if (m_client) {
+            m_client->report_to(registry);
+        }
+    }
+
     ServerConnection::~ServerConnection()
     {
         if (m_client) {
@@ -188,20 +255,12 @@ namespace madbfs::connection
             co_return Unexpect{ resp.error() };
         }
 
-        auto generator = [](Vec<u8> buf, Vec<Pair<Str, rpc::resp::Stat>> entries) -> Gen<ParsedStat> {
-            for (const auto& [name, stat] : entries) {
+        auto generator = [](Vec<u8> buf, Vec<rpc::resp::Listdir::Entry> entries) -> Gen<ParsedStat> {
+            for (const auto& [name, stat, target] : entries) {
                 co_yield ParsedStat{
-                    .stat = data::Stat {
-                        .links = stat.links,
-                        .size  = stat.size,
-                        .mtime = stat.mtime,
-                        .atime = stat.atime,
-                        .ctime = stat.ctime,
-                        .mode  = stat.mode,
-                        .uid   = stat.uid,
-                        .gid   = stat.gid,
-                    },
-                    .path = name,       // names are stored in buf
+                    .stat   = to_data_stat(stat),
+                    .path   = name,      // names and targets are stored in buf
+                    .target = target,
                 };
             }
         };
@@ -214,18 +273,7 @@ namespace madbfs::connection
         auto buf = Vec<u8>{};
         auto req = rpc::req::Stat{ .path = path.fullpath() };
 
-        co_return (co_await send_req(buf, req)).transform([](rpc::resp::Stat resp) {
-            return data::Stat{
-                .links = resp.links,
-                .size  = resp.size,
-                .mtime = resp.mtime,
-                .atime = resp.atime,
-                .ctime = resp.ctime,
-                .mode  = resp.mode,
-                .uid   = resp.uid,
-                .gid   = resp.gid,
-            };
-        });
+        co_return (co_await send_req(buf, req)).transform(to_data_stat);
     }
 
     AExpect<path::PathBuf> ServerConnection::readlink(path::Path path)
@@ -238,20 +286,20 @@ namespace madbfs::connection
         });
     }
 
-    AExpect<void> ServerConnection::mknod(path::Path path, mode_t mode, dev_t dev)
+    AExpect<Opt<data::Stat>> ServerConnection::mknod(path::Path path, mode_t mode, dev_t dev)
     {
         auto buf = Vec<u8>{};
         auto req = rpc::req::Mknod{ .path = path.fullpath(), .mode = mode, .dev = dev };
 
-        co_return (co_await send_req(buf, req)).transform(sink_void);
+        co_return (co_await send_req(buf, req)).transform(post_stat);
     }
 
-    AExpect<void> ServerConnection::mkdir(path::Path path, mode_t mode)
+    AExpect<Opt<data::Stat>> ServerConnection::mkdir(path::Path path, mode_t mode)
     {
         auto buf = Vec<u8>{};
         auto req = rpc::req::Mkdir{ .path = path.fullpath(), .mode = mode };
 
-        co_return (co_await send_req(buf, req)).transform(sink_void);
+        co_return (co_await send_req(buf, req)).transform(post_stat);
     }
 
     AExpect<void> ServerConnection::unlink(path::Path path)
@@ -270,49 +318,108 @@ namespace madbfs::connection
         co_return (co_await send_req(buf, req)).transform(sink_void);
     }
 
-    AExpect<void> ServerConnection::rename(path::Path from, path::Path to, u32 flags)
+    AExpect<Opt<data::Stat>> ServerConnection::rename(path::Path from, path::Path to, u32 flags)
     {
         auto buf = Vec<u8>{};
         auto req = rpc::req::Rename{ .from = from.fullpath(), .to = to.fullpath(), .flags = flags };
 
-        co_return (co_await send_req(buf, req)).transform(sink_void);
+        co_return (co_await send_req(buf, req)).transform(post_stat);
     }
 
-    AExpect<void> ServerConnection::truncate(path::Path path, off_t size)
+    AExpect<Opt<data::Stat>> ServerConnection::truncate(path::Path path, off_t size)
     {
         auto buf = Vec<u8>{};
         auto req = rpc::req::Truncate{ .path = path.fullpath(), .size = size };
 
-        co_return (co_await send_req(buf, req)).transform(sink_void);
+        co_return (co_await send_req(buf, req)).transform(post_stat);
     }
 
     AExpect<usize> ServerConnection::read(path::Path path, Span<char> out, off_t offset)
     {
-        auto buf = Vec<u8>{};
-        auto req = rpc::req::Read{ .path = path.fullpath(), .offset = offset, .size = out.size() };
+        auto buf   = Vec<u8>{};
+        auto total = 0uz;
+
+        // the server bounds its buffers, larger reads are split into multiple requests
+        while (total < out.size()) {
+            auto chunk = out.subspan(total, std::min(out.size() - total, rpc::max_io_len));
+            auto off   = offset + static_cast<off_t>(total);
+            auto req   = rpc::req::Read{ .path = path.fullpath(), .offset = off, .size = chunk.size() };
+
+            auto res = (co_await send_req(buf, req)).transform([&](rpc::resp::Read resp) {
+                auto size = std::min(resp.read.size(), chunk.size());
+                std::copy_n(resp.read.begin(), size, chunk.begin());
+                return size;
+            });
+            if (not res) {
+                co_return Unexpect{ res.error() };
+            }
 
-        co_return (co_await send_req(buf, req)).transform([&](rpc::resp::Read resp) {
-            auto size = std::min(resp.read.size(), out.size());
-            std::copy_n(resp.read.begin(), size, out.begin());
-            return size;
-        });
+            total += *res;
+            if (*res < chunk.size()) {
+                break;
+            }
+        }
+
+        co_return total;
     }
 
     AExpect<usize> ServerConnection::write(path::Path path, Span<const char> in, off_t offset)
     {
         auto buf   = Vec<u8>{};
-        auto bytes = Span{ reinterpret_cast<const u8*>(in.data()), in.size() };
-        auto req   = rpc::req::Write{ .path = path.fullpath(), .offset = offset, .in = bytes };
+        auto total = 0uz;
+
+        while (total < in.size()) {
+            auto chunk = in.subspan(total, std::min(in.size() - total, rpc::max_io_len));
+            auto bytes = Span{ reinterpret_cast<const u8*>(chunk.data()), chunk.size() };
+            auto off   = offset + static_cast<off_t>(total);
+            auto req   = rpc::req::Write{ .path = path.fullpath(), .offset = off, .in = bytes };
+
+            auto res = (co_await send_req(buf, req)).transform(proj(&rpc::resp::Write::size));
+            if (not res) {
+                co_return Unexpect{ res.error() };
+            }
 
-        co_return (co_await send_req(buf, req)).transform(proj(&rpc::resp::Write::size));
+            total += *res;
+            if (*res < chunk.size()) {
+                break;
+            }
+        }
+
+        co_return total;
     }
 
-    AExpect<void> ServerConnection::utimens(path::Path path, timespec atime, timespec mtime)
+    AExpect<Opt<data::Stat>> ServerConnection::utimens(path::Path path, timespec atime, timespec mtime)
     {
         auto buf = Vec<u8>{};
         auto req = rpc::req::Utimens{ .path = path.fullpath(), .atime = atime, .mtime = mtime };
 
-        co_return (co_await send_req(buf, req)).transform(sink_void);
+        co_return (co_await send_req(buf, req)).transform(post_stat);
+    }
+
+    AExpect<Opt<data::Stat>> ServerConnection::fallocate(
+        path::Path path,
+        i32        mode,
+        off_t      offset,
+        off_t      length
+    )
+    {
+        auto buf = Vec<u8>{};
+        auto req = rpc::req::Fallocate{
+            .path   = path.fullpath(),
+            .mode   = mode,
+            .offset = offset,
+            .length = length,
+        };
+
+        co_return (co_await send_req(buf, req)).transform(post_stat);
+    }
+
+    AExpect<off_t> ServerConnection::lseek(path::Path path, off_t offset, i32 whence)
+    {
+        auto buf = Vec<u8>{};
+        auto req = rpc::req::Lseek{ .path = path.fullpath(), .offset = offset, .whence = whence };
+
+        co_return (co_await send_req(buf, req)).transform(proj(&rpc::resp::Lseek::offset));
     }
 
     AExpect<usize> ServerConnection::copy_file_range(
@@ -334,4 +441,152 @@ namespace madbfs::connection
 
         co_return (co_await send_req(buf, req)).transform(proj(&rpc::resp::CopyFileRange::size));
     }
+
+    AExpect<Vec<Expect<usize>>> ServerConnection::read_many(
+        Span<const path::Path> paths,
+        Span<const Span<char>> outs
+    )
+    {
+        auto result = Vec<Expect<usize>>{};
+        result.reserve(paths.size());
+
+        // the server reads at most rpc::max_io_len per request in total, the files are split into as many
+        // requests as needed; a file that doesn't fit even on its own is read with Read instead
+        auto first = 0uz;
+        while (first < paths.size()) {
+            if (outs[first].size() > rpc::max_io_len) {
+                result.push_back(co_await read(paths[first], outs[first], 0));
+                ++first;
+                continue;
+            }
+
+            auto last  = first;
+            auto total = 0uz;
+            while (last < paths.size() and outs[last].size() <= rpc::max_io_len - total) {
+                total += outs[last++].size();
+            }
+
+            auto count = last - first;
+            auto res   = co_await read_many_once(paths.subspan(first, count), outs.subspan(first, count));
+            if (not res) {
+                co_return Unexpect{ res.error() };
+            }
+
+            sr::move(*res, std::back_inserter(result));
+            first = last;
+        }
+
+        co_return result;
+    }
+
+    AExpect<Vec<Expect<usize>>> ServerConnection::read_many_once(
+        Span<const path::Path> paths,
+        Span<const Span<char>> outs
+    )
+    {
+        auto buf = Vec<u8>{};
+        auto req = rpc::req::ReadMany{};
+
+        req.files.reserve(paths.size());
+        for (auto [path, out] : sv::zip(paths, outs)) {
+            req.files.emplace_back(path.fullpath(), out.size());
+        }
+
+        auto resp = co_await send_req(buf, std::move(req));
+        if (not resp) {
+            co_return Unexpect{ resp.error() };
+        } else if (resp->entries.size() != paths.size()) {
+            auto got = resp->entries.size();
+            log_e("{}: mismatched number of entries [{} vs {}]", __func__, got, paths.size());
+            co_return Unexpect{ Errc::bad_message };
+        }
+
+        auto result = Vec<Expect<usize>>{};
+        result.reserve(paths.size());
+
+        for (auto [entry, out] : sv::zip(resp->entries, outs)) {
+            if (entry.status != rpc::Status::Success) {
+                result.emplace_back(Unexpect{ static_cast<Errc>(entry.status) });
+                continue;
+            }
+            auto size = std::min(entry.read.size(), out.size());
+            std::copy_n(entry.read.begin(), size, out.begin());
+            result.emplace_back(size);
+        }
+
+        co_return result;
+    }
+
+    AExpect<Vec<Expect<Opt<data::Stat>>>> ServerConnection::write_many(
+        Span<const path::Path> paths,
+        Span<const Upload>     files
+    )
+    {
+        auto buf = Vec<u8>{};
+        auto req = rpc::req::WriteMany{};
+
+        req.files.reserve(paths.size());
+        for (auto [path, file] : sv::zip(paths, files)) {
+            req.files.push_back({
+                .path  = path.fullpath(),
+                .mode  = file.mode,
+                .in    = Span{ reinterpret_cast<const u8*>(file.data.data()), file.data.size() },
+                .atime = file.atime,
+                .mtime = file.mtime,
+            });
+        }
+
+        auto resp = co_await send_req(buf, std::move(req));
+        if (not resp) {
+            co_return Unexpect{ resp.error() };
+        } else if (resp->entries.size() != paths.size()) {
+            auto got = resp->entries.size();
+            log_e("{}: mismatched number of entries [{} vs {}]", __func__, got, paths.size());
+            co_return Unexpect{ Errc::bad_message };
+        }
+
+        auto result = Vec<Expect<Opt<data::Stat>>>{};
+        result.reserve(paths.size());
+
+        for (const auto& entry : resp->entries) {
+            if (entry.status != rpc::Status::Success) {
+                result.emplace_back(Unexpect{ static_cast<Errc>(entry.status) });
+                continue;
+            }
+            result.emplace_back(post_stat(entry));
+        }
+
+        co_return result;
+    }
+
+    AExpect<Vec<ServerTiming>> ServerConnection::server_stats(bool reset)
+    {
+        auto buf  = Vec<u8>{};
+        auto resp = co_await send_req(buf, rpc::req::ServerStats{ .reset = reset });
+        if (not resp) {
+            co_return Unexpect{ resp.error() };
+        }
+
+        auto phase = [](const rpc::resp::ServerStats::Timing& t) {
+            return ServerTiming::Phase{ .sum = t.sum, .p50 = t.p50, .p99 = t.p99, .max = t.max };
+        };
+
+        auto result = Vec<ServerTiming>{};
+        result.reserve(resp->entries.size());
+
+        for (const auto& entry : resp->entries) {
+            result.push_back({
+                .procedure = rpc::to_string(entry.proc),
+                .count     = entry.count,
+                .errors    = entry.errors,
+                .bytes     = entry.bytes,
+                .queue     = phase(entry.queue),
+                .handle    = phase(entry.handle),
+                .encode    = phase(entry.encode),
+                .send      = phase(entry.send),
+            });
+        }
+
+        co_return result;
+    }
 }
@@ -4,6 +4,39 @@
 
 #include <madbfs-common/log.hpp>
 
+namespace
+{
+    using namespace madbfs::aliases;
+
+    // interval of checking whether foreground operations have finished
+    constexpr auto idle_poll_interval = std::chrono::milliseconds{ 10 };
+
+    madbfs::Await<void> sleep_until(std::chrono::steady_clock::time_point time)
+    {
+        auto timer = madbfs::async::Timer{ co_await madbfs::async::current_executor() };
+        timer.expires_at(time);
+        std::ignore = co_await timer.async_wait();
+    }
+}
+
+namespace madbfs::data
+{
+    Await<void> Throttle::consume(usize bytes)
+    {
+        m_bytes += bytes;
+        if (m_rate == 0) {
+            co_return;
+        }
+
+        auto seconds = static_cast<f64>(m_bytes) / static_cast<f64>(m_rate);
+        auto elapsed = std::chrono::duration_cast<Clock::duration>(std::chrono::duration<f64>{ seconds });
+        auto due     = m_start + elapsed;
+        if (due > Clock::now()) {
+            co_await sleep_until(due);
+        }
+    }
+}
+
 namespace madbfs::data
 {
     Page::Page(PageKey key, Uniq<char[]> buf, u32 size, u32 page_size)
@@ -16,6 +49,10 @@ namespace madbfs::data
 
     usize Page::read(Span<char> out, usize offset)
     {
+        if (offset >= m_size) {
+            return 0;
+        }
+
         auto size = std::min(m_size - offset, out.size());
         std::copy_n(m_data.get() + offset, size, out.data());
         return size;
@@ -44,7 +81,12 @@ namespace madbfs::data
 
     usize Page::truncate(usize size)
     {
-        return m_size = std::min(static_cast<u32>(size), m_page_size);
+        // bytes past the old size may be stale from an earlier shrink, grown range must read as zeros
+        auto new_size = std::min(static_cast<u32>(size), m_page_size);
+        if (new_size > m_size) {
+            std::fill(m_data.get() + m_size, m_data.get() + new_size, '\0');
+        }
+        return m_size = new_size;
     }
 
     usize Page::size() const
@@ -65,24 +107,116 @@ namespace madbfs::data
 
 namespace madbfs::data
 {
-    Cache::Cache(connection::Connection& connection, usize page_size, usize max_pages)
+    void Budget::attach(Cache& cache)
+    {
+        m_caches.push_back(&cache);
+    }
+
+    void Budget::detach(Cache& cache)
+    {
+        std::erase(m_caches, &cache);
+    }
+
+    usize Budget::used() const
+    {
+        auto used = 0uz;
+        for (const auto* cache : m_caches) {
+            used += cache->used_bytes();
+        }
+        return used;
+    }
+
+    Await<void> Budget::reserve(Cache& cache, usize bytes)
+    {
+        // the new pages count toward the share of the cache they go into
+        auto excess = [&](const Cache* other) {
+            auto used = other->used_bytes() + (other == &cache ? bytes : 0);
+            return static_cast<isize>(used) - static_cast<isize>(share());
+        };
+
+        while (used() + bytes > m_max_bytes) {
+            auto victim = static_cast<Cache*>(nullptr);
+            for (auto* other : m_caches) {
+                if (other->evictable() and (victim == nullptr or excess(other) > excess(victim))) {
+                    victim = other;
+                }
+            }
+
+            if (victim == nullptr) {
+                log_w("{}: budget exceeded but all pages are pinned", __func__);
+                break;
+            }
+
+            // the victim is not taken below its share in one go, another cache may be further above by then
+            auto needed = used() + bytes - m_max_bytes;
+            if (auto over = excess(victim); over > 0) {
+                needed = std::min(needed, static_cast<usize>(over));
+            }
+
+            if (victim != &cache) {
+                log_d("{}: evicting {} bytes from another device's cache", __func__, needed);
+            }
+
+            if (co_await victim->shrink(needed) == 0) {
+                break;
+            }
+        }
+    }
+}
+
+namespace madbfs::data
+{
+    Cache::Cache(connection::Connection& connection, usize page_size, usize max_pages, Rules rules)
         : m_connection{ connection }
+        , m_own_budget{ std::make_unique<Budget>(max_pages * std::bit_ceil(page_size)) }
+        , m_budget{ *m_own_budget }
+        , m_rules{ std::move(rules) }
         , m_page_size{ std::bit_ceil(page_size) }
-        , m_max_pages{ max_pages }
     {
+        m_budget.attach(*this);
     }
 
-    AExpect<usize> Cache::read(Id id, path::Path path, Span<char> out, off_t offset)
+    Cache::Cache(connection::Connection& connection, usize page_size, Budget& budget, Rules rules)
+        : m_connection{ connection }
+        , m_budget{ budget }
+        , m_rules{ std::move(rules) }
+        , m_page_size{ std::bit_ceil(page_size) }
     {
-        auto first = static_cast<usize>(offset) / m_page_size;
-        auto last  = (static_cast<usize>(offset) + out.size() - 1) / m_page_size;
+        m_budget.attach(*this);
+    }
 
-        log_d("{}: start [id={}|idx={} - {}]", __func__, id.inner(), first, last);
+    Cache::~Cache()
+    {
+        m_budget.detach(*this);
+    }
+
+    AExpect<usize> Cache::read(Id id, path::Path path, Span<char> out, off_t offset, Opt<usize> file_size)
+    {
+        // files with direct policy never get an entry
+        if (not m_table.contains(id) and policy(path).direct) {
+            co_return co_await read_direct(id, path, out, offset);
+        }
 
         auto& entry = lookup(id, path)->get();
 
+        auto readahead  = entry.policy.readahead;
+        auto sequential = entry.next_offset == static_cast<usize>(offset);
+        if (is_streaming(entry, out.size(), offset)) {
+            co_return co_await read_direct(id, path, out, offset);
+        }
+        reclassify(id, entry, out.size(), sequential, file_size);
+
+        auto first = static_cast<usize>(offset) / entry.page_size;
+        auto last  = (static_cast<usize>(offset) + out.size() - 1) / entry.page_size;
+
+        log_d("{}: start [id={}|idx={} - {}]", __func__, id.inner(), first, last);
+
+        ++m_foreground;
+        ++entry.active;
         auto work = [&](usize idx) { return read_at(entry, out, id, idx, first, last, offset); };
         auto res  = co_await async::wait_all(sv::iota(first, last + 1) | sv::transform(work));
+        --entry.active;
+        --m_foreground;
 
         auto read = 0uz;
         for (auto&& res : res) {
@@ -94,22 +228,150 @@ namespace madbfs::data
             read += res.value();
         }
 
+        // a short read means end of file is reached, nothing to read ahead
+        if (readahead > 0 and sequential and read == out.size()) {
+            auto exec = co_await async::current_executor();
+            async::spawn(exec, read_ahead(id, path.into_buf(), last + 1, readahead), async::detached);
+        }
+
         co_return read;
     }
 
-    AExpect<usize> Cache::write(Id id, path::Path path, Span<const char> in, off_t offset)
+    AExpect<usize> Cache::write(
+        Id               id,
+        path::Path       path,
+        Span<const char> in,
+        off_t            offset,
+        Opt<usize>       file_size
+    )
     {
-        auto first = static_cast<usize>(offset) / m_page_size;
-        auto last  = (static_cast<usize>(offset) + in.size() - 1) / m_page_size;
+        if (not m_table.contains(id) and policy(path).direct) {
+            co_return co_await write_direct(id, path, in, offset);
+        }
 
-        log_d("{}: start [id={}|idx={} - {}]", __func__, id.inner(), first, last);
+        auto& entry      = lookup(id, path)->get();
+        auto  sequential = entry.next_offset == static_cast<usize>(offset);
+        if (is_streaming(entry, in.size(), offset)) {
+            co_return co_await write_direct(id, path, in, offset);
+        }
 
-        auto& entry = lookup(id, path)->get();
+        // writes still in progress may have grown the file past what the caller knows
+        if (file_size) {
+            file_size = std::max(*file_size, entry.file_size);
+        }
+        reclassify(id, entry, in.size(), sequential, file_size);
+
+        auto first = static_cast<usize>(offset) / entry.page_size;
+        auto last  = (static_cast<usize>(offset) + in.size() - 1) / entry.page_size;
 
-        m_table[id].dirty = true;
+        log_d("{}: start [id={}|idx={} - {}]", __func__, id.inner(), first, last);
+
+        m_table[id].dirty  = true;
+        auto write_through = entry.policy.write_through;
 
-        auto work = [&](usize idx) { return write_at(entry, in, id, idx, first, last, offset); };
+        ++m_foreground;
+        ++entry.active;
+        auto work = [&](usize idx) { return write_at(entry, in, id, idx, first, last, offset, file_size); };
         auto res  = co_await async::wait_all(sv::iota(first, last + 1) | sv::transform(work));
+        --entry.active;
+        --m_foreground;
+
+        auto written = 0uz;
+        for (auto&& res : res) {
+            if (not res) {
+                auto msg = std::make_error_code(res.error()).message();
+                log_e("{}: failed to write [{}] {:?}: {}", __func__, id.inner(), path.fullpath(), msg);
+                co_return Unexpect{ res.error() };
+            }
+            written += res.value();
+        }
+
+        if (write_through) {
+            if (auto res = co_await flush(id); not res) {
+                co_return Unexpect{ res.error() };
+            }
+        }
+
+        co_return written;
+    }
+
+    AExpect<usize> Cache::read_direct(Id id, path::Path path, Span<char> out, off_t offset)
+    {
+        if (out.empty()) {
+            co_return 0uz;
+        }
+
+        auto start = static_cast<usize>(offset);
+        auto end   = start + out.size();
+        auto first = start / m_page_size;
+        auto last  = (end - 1) / m_page_size;
+
+        log_d("{}: start [id={}|idx={} - {}]", __func__, id.inner(), first, last);
+
+        ++m_foreground;
+        auto settled = co_await settle(id, start, end);
+        if (not settled) {
+            --m_foreground;
+            co_return Unexpect{ settled.error() };
+        }
+
+        auto lo   = [&](usize idx) { return std::max(idx * m_page_size, start); };
+        auto hi   = [&](usize idx) { return std::min((idx + 1) * m_page_size, end); };
+        auto work = [&](usize idx) {
+            auto span = out.subspan(lo(idx) - start, hi(idx) - lo(idx));
+            return m_connection.read(path, span, static_cast<off_t>(lo(idx)));
+        };
+        auto res = co_await async::wait_all(sv::iota(first, last + 1) | sv::transform(work));
+        --m_foreground;
+
+        // data after a short read is past the end of file
+        auto read = 0uz;
+        auto idx  = first;
+        for (auto&& res : res) {
+            if (not res) {
+                auto msg = std::make_error_code(res.error()).message();
+                log_e("{}: failed to read [{}] {:?}: {}", __func__, id.inner(), path.fullpath(), msg);
+                co_return Unexpect{ res.error() };
+            }
+            read += res.value();
+            if (res.value() < hi(idx) - lo(idx)) {
+                break;
+            }
+            ++idx;
+        }
+
+        co_return read;
+    }
+
+    AExpect<usize> Cache::write_direct(Id id, path::Path path, Span<const char> in, off_t offset)
+    {
+        if (in.empty()) {
+            co_return 0uz;
+        }
+
+        auto start = static_cast<usize>(offset);
+        auto end   = start + in.size();
+        auto first = start / m_page_size;
+        auto last  = (end - 1) / m_page_size;
+
+        log_d("{}: start [id={}|idx={} - {}]", __func__, id.inner(), first, last);
+
+        // older data of the range must not reach the device after this write does
+        ++m_foreground;
+        auto settled = co_await settle(id, start, end);
+        if (not settled) {
+            --m_foreground;
+            co_return Unexpect{ settled.error() };
+        }
+
+        auto lo   = [&](usize idx) { return std::max(idx * m_page_size, start); };
+        auto hi   = [&](usize idx) { return std::min((idx + 1) * m_page_size, end); };
+        auto work = [&](usize idx) {
+            auto span = in.subspan(lo(idx) - start, hi(idx) - lo(idx));
+            return m_connection.write(path, span, static_cast<off_t>(lo(idx)));
+        };
+        auto res = co_await async::wait_all(sv::iota(first, last + 1) | sv::transform(work));
+        --m_foreground;
 
         auto written = 0uz;
         for (auto&& res : res) {
@@ -121,6 +383,21 @@ namespace madbfs::data
             written += res.value();
         }
 
+        // keep cached pages coherent, their dirtiness is left as is
+        if (auto entry = m_table.find(id); entry != m_table.end()) {
+            auto  size  = entry->second.page_size;
+            auto& pages = entry->second.pages;
+            for (auto it = pages.lower_bound(start / size); it != pages.end(); ++it) {
+                auto page_start = it->first * size;
+                if (page_start >= end) {
+                    break;
+                }
+                auto from = std::max(page_start, start);
+                auto to   = std::min(page_start + size, end);
+                it->second->write(in.subspan(from - start, to - from), from - page_start);
+            }
+        }
+
         co_return written;
     }
 
@@ -131,20 +408,21 @@ namespace madbfs::data
             co_return Expect<void>{};
         }
 
-        if (not std::exchange(m_table[id].dirty, false)) {
+        // content of a fresh file reaches the device with upload
+        if (entry->get().fresh or not std::exchange(m_table[id].dirty, false)) {
             co_return Expect<void>{};
         }
 
         log_d("flush: start [id={}|idx={}]", id.inner(), entry->get().pages | sv::keys);
 
-        auto pages = entry->get().pages | sv::values;
-        auto res = co_await async::wait_all(pages | sv::transform([&](auto i) { return flush_at(*i, id); }));
+        // NOTE: pages are referred by index since they may be evicted while other pages are being flushed
+        auto indices = entry->get().pages | sv::keys | sr::to<Vec<usize>>();
+        auto res = co_await async::wait_all(indices | sv::transform([&](auto i) { return flush_at(id, i); }));
 
         for (auto&& res : res) {
             if (not res) {
-                auto msg  = std::make_error_code(res.error()).message();
-                auto path = entry->get().path.as_path().fullpath();
-                log_e("{}: failed to flush [{}] {:?}: {}", __func__, id.inner(), path, msg);
+                auto msg = std::make_error_code(res.error()).message();
+                log_e("{}: failed to flush [{}]: {}", __func__, id.inner(), msg);
                 co_return Unexpect{ res.error() };
             }
         }
@@ -158,67 +436,81 @@ namespace madbfs::data
         if (not may_entry) {
             co_return Expect<void>{};
         }
-        auto& entry = may_entry->get();
+        auto& entry     = may_entry->get();
+        auto  page_size = entry.page_size;
+
+        entry.file_size = new_size;
 
-        auto old_num_pages = old_size / m_page_size + (old_size % m_page_size != 0);
-        auto new_num_pages = new_size / m_page_size + (new_size % m_page_size != 0);
+        auto old_num_pages = old_size / page_size + (old_size % page_size != 0);
+        auto new_num_pages = new_size / page_size + (new_size % page_size != 0);
 
-        auto num_pages = std::max(old_num_pages, new_num_pages);
-        auto off_pages = std::max(1uz, std::min(old_num_pages, new_num_pages)) - 1;
+        // pages from the last one of the smaller size are affected, all of them when truncated to 0
+        auto first = std::max(1uz, std::min(old_num_pages, new_num_pages)) - 1;
 
         log_d(
-            { "{}: start [id={}|idx={} - {}|old_pages={}|new_pages={}]" },
+            { "{}: start [id={}|idx={}..|old_pages={}|new_pages={}]" },
             __func__,
             id.inner(),
-            off_pages,
-            num_pages - 1,
+            first,
             old_num_pages,
             new_num_pages
         );
 
-        auto page_it = entry.pages.begin();
-
-        if (new_num_pages > old_num_pages) {
-            auto diff = new_num_pages - old_num_pages;
-            if (m_lru.size() + diff > m_max_pages) {
-                co_await evict(m_lru.size() + diff - m_max_pages);
-            }
-        }
-
+        // missing pages are not created, they're pulled when needed from the device which has the new size
+        auto page_it = entry.pages.lower_bound(first);
         while (page_it != entry.pages.end()) {
             auto [index, page] = *page_it;
-            if (index < off_pages or index >= num_pages) {
-                ++page_it;
-                continue;
-            }
-
             log_t("{}: [id={}|idx={}]", __func__, id.inner(), index);
 
-            auto key = PageKey{ id, index };
-            if (index < old_num_pages - 1) {    // shrink
-                m_lru.erase(page);
+            if (index >= new_num_pages) {    // shrink
+                erase_page(entry, page);
                 page_it = entry.pages.erase(page_it);
-            } else if (index > old_num_pages - 1) {    // grow
-                auto rem_size = new_size - index * m_page_size;
-                if (rem_size > m_page_size) {
-                    rem_size = m_page_size;
-                }
-                m_lru.emplace_front(key, std::make_unique<char[]>(m_page_size), rem_size, m_page_size);
-                entry.pages.emplace(index, m_lru.begin());
-                ++page_it;
+                continue;
+            }
+
+            if (index == new_num_pages - 1) {
+                page->truncate((new_size - 1) % page_size + 1);
             } else {
-                if (index == new_num_pages - 1) {
-                    page->truncate((new_size - 1) % m_page_size + 1);
-                } else {
-                    page->truncate(m_page_size);
-                }
-                ++page_it;
+                page->truncate(page_size);
             }
+            ++page_it;
         }
 
         co_return Expect<void>{};
     }
 
+    void Cache::create(Id id, path::Path path)
+    {
+        pin(id, path);
+        m_table[id].fresh = true;
+    }
+
+    AExpect<Opt<Stat>> Cache::upload(Id id, path::Path path, mode_t mode, timespec atime, timespec mtime)
+    {
+        auto exec    = co_await async::current_executor();
+        auto promise = saf::promise<Expect<Opt<Stat>>>{ exec };
+        auto future  = promise.get_future();
+
+        m_uploads.push_back({ id, path.into_buf(), mode, atime, mtime, std::move(promise) });
+        if (not std::exchange(m_uploading, true)) {
+            async::spawn(exec, send_uploads(), async::detached);
+        }
+
+        co_return co_await future.async_extract();
+    }
+
+    bool Cache::retime(Id id, timespec atime, timespec mtime)
+    {
+        auto found = sr::find(m_uploads, id, &QueuedUpload::id);
+        if (found == m_uploads.end()) {
+            return false;
+        }
+
+        found->atime = atime;
+        found->mtime = mtime;
+        return true;
+    }
+
     Await<void> Cache::rename(Id id, path::Path new_name)
     {
         // TODO: wait queue if any
@@ -230,16 +522,33 @@ namespace madbfs::data
 
     Await<void> Cache::shutdown()
     {
-        for (auto id : m_table | sv::keys) {
+        // NOTE: entries may be removed by eviction while flushing
+        auto ids = m_table | sv::keys | sr::to<Vec<Id>>();
+        for (auto id : ids) {
             if (auto res = co_await flush(id); not res) {
                 auto msg = std::make_error_code(res.error()).message();
                 log_e("{}: failed to flush {}: {}", __func__, id.inner(), msg);
             }
         }
 
-        co_await evict(m_lru.size());
+        // pinned pages are dropped as well, the pins are restored afterwards
+        auto pinned = Vec<Pair<Id, path::PathBuf>>{};
+        for (const auto& [id, entry] : m_table) {
+            if (entry.pinned and not entry.fresh) {    // pages of fresh files are all they have
+                pinned.emplace_back(id, entry.path);
+            }
+        }
+        for (const auto& [id, _] : pinned) {
+            unpin(id);
+        }
+
+        co_await evict(m_used_bytes);
         m_queue.clear();
 
+        for (const auto& [id, path] : pinned) {
+            pin(id, path.as_path());
+        }
+
         log_d("{}: m_table size: {}", __func__, m_table.size());
         for (auto [id, entry] : m_table) {
             auto path = entry.path.as_path().fullpath();
@@ -249,11 +558,7 @@ namespace madbfs::data
 
     Await<void> Cache::invalidate_one(Id id, bool should_flush)
     {
-        auto entry = m_table.extract(id);
-        if (entry.empty()) {
-            co_return;
-        }
-
+        // flush needs the entry to be still in the table
         if (should_flush) {
             if (auto res = co_await flush(id); not res) {
                 auto msg = std::make_error_code(res.error()).message();
@@ -261,8 +566,13 @@ namespace madbfs::data
             }
         }
 
+        auto entry = m_table.extract(id);
+        if (entry.empty()) {
+            co_return;
+        }
+
         for (auto [_, page] : entry.mapped().pages) {
-            m_lru.erase(page);
+            erase_page(entry.mapped(), page);
         }
     }
 
@@ -282,10 +592,400 @@ namespace madbfs::data
     Await<void> Cache::set_max_pages(usize new_max_pages)
     {
         co_await shutdown();
-        m_max_pages = new_max_pages;
+        m_budget.set_max_bytes(new_max_pages * m_page_size);
         log_i("{}: max pages can be stored changed to: {}", __func__, new_max_pages);
     }
 
+    Await<usize> Cache::shrink(usize bytes)
+    {
+        co_return co_await evict(bytes);
+    }
+
+    AExpect<usize> Cache::prefetch(Id id, path::Path path, usize size, Throttle& throttle)
+    {
+        auto pulled = 0uz;
+        auto offset = 0uz;
+
+        while (offset < size) {
+            while (m_foreground > 0) {
+                co_await sleep_until(Throttle::Clock::now() + idle_poll_interval);
+            }
+
+            // page size may be changed and the entry may be evicted while waiting
+            auto& entry     = lookup(id, path)->get();
+            auto  page_size = entry.page_size;
+            auto  index     = offset / page_size;
+
+            if (not entry.pages.contains(index)) {
+                auto page = co_await get_page(entry, id, index, true);
+                if (not page) {
+                    co_return Unexpect{ page.error() };
+                }
+
+                auto len   = (*page)->size();
+                page_size  = (*page)->capacity();
+                pulled    += len;
+                co_await throttle.consume(len);
+
+                if (len < page_size) {
+                    break;    // file is shorter on the device than we thought
+                }
+            }
+
+            offset = (index + 1) * page_size;
+        }
+
+        log_d("{}: [id={}] pulled {} bytes of {:?}", __func__, id.inner(), pulled, path.fullpath());
+        co_return pulled;
+    }
+
+    AExpect<usize> Cache::prefetch_small(Vec<Pair<Id, path::PathBuf>> files)
+    {
+        auto exec   = co_await async::current_executor();
+        auto pulled = 0uz;
+
+        for (auto batch : files | sv::chunk(read_many_batch)) {
+            auto ids      = Vec<Id>{};
+            auto paths    = Vec<path::Path>{};
+            auto buffers  = Vec<Uniq<char[]>>{};
+            auto outs     = Vec<Span<char>>{};
+            auto promises = Vec<saf::promise<Errc>>{};
+
+            // checked per batch since the files may be read by the time the previous batch is done
+            for (const auto& [id, path] : batch) {
+                if (m_table.contains(id) or m_queue.contains({ id, 0 }) or policy(path.as_path()).direct) {
+                    continue;
+                }
+
+                auto& promise = promises.emplace_back(exec);
+                m_queue.emplace(PageKey{ id, 0 }, promise.get_future().share());
+
+                auto& buffer = buffers.emplace_back(std::make_unique<char[]>(m_page_size));
+                outs.emplace_back(buffer.get(), m_page_size);
+                ids.push_back(id);
+                paths.push_back(path.as_path());
+            }
+
+            if (ids.empty()) {
+                continue;
+            }
+
+            auto res = co_await m_connection.read_many(paths, outs);
+
+            // room for the whole batch is made at once so the pages are inserted without awaiting
+            if (res) {
+                co_await m_budget.reserve(*this, ids.size() * m_page_size);
+            }
+
+            for (auto i : sv::iota(0uz, ids.size())) {
+                auto key = PageKey{ ids[i], 0 };
+
+                // the queue is cleared on shutdown, the page is stale by then
+                auto queued = m_queue.contains(key);
+                if (res and (*res)[i] and queued) {
+                    auto  len   = (*res)[i].value();
+                    auto& entry = lookup(ids[i], paths[i])->get();
+                    auto& list  = list_of(entry);
+
+                    list.emplace_front(key, std::move(buffers[i]), static_cast<u32>(len), m_page_size);
+                    entry.pages.emplace(0, list.begin());
+                    m_used_bytes += m_page_size;
+                    pulled       += len;
+                }
+
+                // waiters pull the page on their own if it's not inserted here
+                promises[i].set_value(Errc{});
+                if (queued) {
+                    m_queue.erase(key);
+                }
+            }
+
+            if (not res) {
+                auto msg = std::make_error_code(res.error()).message();
+                log_w("{}: failed to pull {} files: {}", __func__, ids.size(), msg);
+                co_return Unexpect{ res.error() };
+            }
+        }
+
+        log_d("{}: pulled {} bytes of {} files", __func__, pulled, files.size());
+        co_return pulled;
+    }
+
+    AExpect<void> Cache::settle(Id id, usize start, usize end)
+    {
+        // without an entry only the first page may be queued, by `prefetch_small`
+        auto entry     = m_table.find(id);
+        auto page_size = entry != m_table.end() ? entry->second.page_size : m_page_size;
+        auto first     = start / page_size;
+        auto last      = (end - 1) / page_size;
+
+        auto present = [&](usize idx) {
+            auto cached = entry != m_table.end() and entry->second.pages.contains(idx);
+            return cached or m_queue.contains({ id, idx });
+        };
+
+        auto indices = sv::iota(first, last + 1) | sv::filter(present) | sr::to<Vec<usize>>();
+        if (indices.empty()) {
+            co_return Expect<void>{};
+        }
+
+        auto res = co_await async::wait_all(indices | sv::transform([&](auto i) { return flush_at(id, i); }));
+        for (auto&& res : res) {
+            if (not res) {
+                co_return Unexpect{ res.error() };
+            }
+        }
+
+        co_return Expect<void>{};
+    }
+
+    bool Cache::is_streaming(LookupEntry& entry, usize size, off_t offset) const
+    {
+        auto sequential   = entry.next_offset == static_cast<usize>(offset);
+        entry.streak      = sequential ? entry.streak + size : 0;
+        entry.next_offset = static_cast<usize>(offset) + size;
+
+        // pinned files and files with read ahead asked to be cached
+        if (entry.pinned or entry.policy.readahead > 0) {
+            return false;
+        }
+        return entry.streak > stream_after_pages * m_page_size;
+    }
+
+    usize Cache::page_size(PageClass page_class) const
+    {
+        switch (page_class) {
+        case PageClass::Small: return std::max(m_page_size / 8, std::min(min_page_size, m_page_size));
+        case PageClass::Normal: return m_page_size;
+        case PageClass::Large: return m_page_size * 4;
+        }
+        return m_page_size;
+    }
+
+    PageClass Cache::classify(const LookupEntry& entry) const
+    {
+        // read ahead is counted in pages, it's configured with the page size in mind
+        if (entry.policy.readahead > 0) {
+            return PageClass::Normal;
+        }
+
+        // once in the small class, a file leaves it only after a whole page is accessed sequentially
+        auto random = entry.page_class == PageClass::Small ? entry.streak < m_page_size
+                                                           : entry.random >= small_after_accesses;
+        if (random and entry.file_size > m_page_size and page_size(PageClass::Small) < m_page_size) {
+            return PageClass::Small;
+        }
+
+        // a large page must stay a small part of the cache
+        auto large = page_size(PageClass::Large) * large_after_pages <= m_budget.share();
+        if (large and entry.file_size >= large_after_pages * m_page_size) {
+            return PageClass::Large;
+        }
+
+        return PageClass::Normal;
+    }
+
+    void Cache::reclassify(Id id, LookupEntry& entry, usize size, bool sequential, Opt<usize> file_size)
+    {
+        auto small = size <= page_size(PageClass::Small);
+
+        entry.file_size = std::max({ entry.file_size, file_size.value_or(0), entry.next_offset });
+        entry.random    = not sequential and small ? entry.random + 1 : 0;
+
+        auto page_class = classify(entry);
+        auto new_size   = page_size(page_class);
+        if (page_class == entry.page_class and new_size == entry.page_size) {
+            return;
+        }
+
+        // pages of the old size are dropped, so all of them must be on the device and none may be in use
+        auto is_dirty = [](Lru::iterator page) { return page->is_dirty(); };
+        auto dirty    = sr::any_of(entry.pages | sv::values, is_dirty);
+        auto busy     = entry.active > 0 or has_pending(id) or m_flushing.contains(id);
+        if (entry.fresh or dirty or busy or (entry.pinned and not entry.pages.empty())) {
+            return;
+        }
+
+        log_d(
+            "{}: [id={}|pages={}] page size {} -> {}",
+            __func__,
+            id.inner(),
+            entry.pages.size(),
+            entry.page_size,
+            new_size
+        );
+
+        for (auto [_, page] : entry.pages) {
+            erase_page(entry, page);
+        }
+        entry.pages.clear();
+
+        entry.page_class = page_class;
+        entry.page_size  = new_size;
+    }
+
+    Await<void> Cache::send_uploads()
+    {
+        while (not m_uploads.empty()) {
+            auto count = static_cast<isize>(std::min(m_uploads.size(), write_many_batch));
+            auto batch = Vec<QueuedUpload>{
+                std::make_move_iterator(m_uploads.begin()),
+                std::make_move_iterator(m_uploads.begin() + count),
+            };
+            m_uploads.erase(m_uploads.begin(), m_uploads.begin() + count);
+
+            // pages written after the snapshot are dirty again and get flushed once the file exists
+            auto contents = Vec<Vec<char>>{};
+            auto paths    = Vec<path::Path>{};
+            auto files    = Vec<connection::Upload>{};
+
+            for (const auto& upload : batch) {
+                contents.push_back(snapshot(upload.id));
+                paths.push_back(upload.path.as_path());
+            }
+            for (auto [upload, content] : sv::zip(batch, contents)) {
+                files.push_back({ content, upload.mode, upload.atime, upload.mtime });
+            }
+
+            auto res = co_await m_connection.write_many(paths, files);
+            if (not res) {
+                auto msg = std::make_error_code(res.error()).message();
+                log_e("{}: failed to send {} files: {}", __func__, batch.size(), msg);
+            }
+
+            for (auto i : sv::iota(0uz, batch.size())) {
+                auto result = res ? std::move((*res)[i]) : Expect<Opt<Stat>>{ Unexpect{ res.error() } };
+                auto id     = batch[i].id;
+
+                if (auto found = m_table.find(id); found != m_table.end() and result) {
+                    found->second.fresh = false;
+                    if (not found->second.policy.pin) {
+                        unpin(id);
+                    }
+                } else if (found != m_table.end()) {
+                    co_await invalidate_one(id, false);
+                }
+
+                batch[i].promise.set_value(std::move(result));
+            }
+        }
+
+        m_uploading = false;
+    }
+
+    Vec<char> Cache::snapshot(Id id)
+    {
+        auto found = m_table.find(id);
+        if (found == m_table.end()) {
+            return {};
+        }
+        auto& entry = found->second;
+
+        auto size = 0uz;
+        for (auto [index, page] : entry.pages) {
+            size = std::max(size, index * entry.page_size + page->size());
+        }
+
+        // indices without page are holes
+        auto content = Vec<char>(size, '\0');
+        for (auto [index, page] : entry.pages) {
+            sr::copy(page->buf(), content.begin() + static_cast<isize>(index * entry.page_size));
+            page->set_dirty(false);
+        }
+
+        entry.dirty = false;
+        return content;
+    }
+
+    Await<void> Cache::read_ahead(Id id, path::PathBuf path, usize first, usize count)
+    {
+        for (auto index : sv::iota(first, first + count)) {
+            // the entry may be evicted while a page is being pulled
+            auto& entry = lookup(id, path.as_path())->get();
+            if (entry.pages.contains(index) or m_queue.contains({ id, index })) {
+                continue;
+            }
+
+            auto page = co_await get_page(entry, id, index, true);
+            if (not page) {
+                auto msg = std::make_error_code(page.error()).message();
+                log_w("{}: [id={}|idx={}] failed to read ahead: {}", __func__, id.inner(), index, msg);
+                co_return;
+            }
+
+            if (auto len = (*page)->size(); len < (*page)->capacity()) {
+                // an empty page past the end of file is of no use to anyone
+                if (len == 0 and not (*page)->is_dirty()) {
+                    erase_page(entry, *page);
+                    entry.pages.erase(index);
+                }
+                co_return;
+            }
+        }
+    }
+
+    void Cache::pin(Id id, path::Path path)
+    {
+        auto& entry = lookup(id, path)->get();
+        if (std::exchange(entry.pinned, true)) {
+            return;
+        }
+
+        for (auto [_, page] : entry.pages) {
+            m_pinned.splice(m_pinned.begin(), m_lru, page);
+        }
+    }
+
+    void Cache::unpin(Id id)
+    {
+        auto found = m_table.find(id);
+        if (found == m_table.end() or not std::exchange(found->second.pinned, false)) {
+            return;
+        }
+
+        for (auto [_, page] : found->second.pages) {
+            m_lru.splice(m_lru.begin(), m_pinned, page);
+        }
+
+        // entry of a pinned file is kept even without pages, remove it as eviction would have
+        if (found->second.pages.empty() and found->second.active == 0 and not has_pending(id)) {
+            m_table.erase(found);
+        }
+    }
+
+    Cache::Usage Cache::usage() const
+    {
+        auto usage = Usage{
+            .pages        = num_pages(),
+            .bytes        = 0,
+            .dirty_pages  = 0,
+            .dirty_bytes  = 0,
+            .pinned_pages = m_pinned.size(),
+            .files        = m_table.size(),
+            .small_files  = 0,
+            .large_files  = 0,
+        };
+
+        for (const auto& [_, entry] : m_table) {
+            usage.small_files += entry.page_class == PageClass::Small;
+            usage.large_files += entry.page_class == PageClass::Large;
+        }
+
+        auto count = [&](const Lru& list) {
+            for (const auto& page : list) {
+                usage.bytes += page.size();
+                if (page.is_dirty()) {
+                    ++usage.dirty_pages;
+                    usage.dirty_bytes += page.size();
+                }
+            }
+        };
+        count(m_lru);
+        count(m_pinned);
+
+        return usage;
+    }
+
     // NOTE: std::unordered_map guarantees reference of its element valid even if new value inserted
     // (path parameter not nullopt)
     Opt<Ref<Cache::LookupEntry>> Cache::lookup(Id id, Opt<path::Path> path)
@@ -293,8 +993,18 @@ namespace madbfs::data
         auto entries = m_table.find(id);
         if (entries == m_table.end()) {
             if (path) {
-                auto [p, _] = m_table.emplace(id, LookupEntry{ .pages = {}, .path = path->into_buf() });
-                entries     = p;
+                auto policy = this->policy(*path);
+                auto [p, _] = m_table.emplace(
+                    id,
+                    LookupEntry{
+                        .pages     = {},
+                        .path      = path->into_buf(),
+                        .policy    = policy,
+                        .page_size = m_page_size,
+                        .pinned    = policy.pin,
+                    }
+                );
+                entries = p;
             } else {
                 return std::nullopt;
             }
@@ -308,7 +1018,7 @@ namespace madbfs::data
         assert(found != m_table.end());
 
         auto path = found->second.path.as_path();
-        auto idx  = static_cast<usize>(offset) / m_page_size;
+        auto idx  = static_cast<usize>(offset) / found->second.page_size;
 
         log_d("{}: [id={}|idx={}] cache miss, read from device...", __func__, id.inner(), idx, offset);
         co_return co_await m_connection.read(path, out, offset);
@@ -320,53 +1030,75 @@ namespace madbfs::data
         assert(found != m_table.end());
 
         auto path = found->second.path.as_path();
-        auto idx  = static_cast<usize>(offset) / m_page_size;
+        auto idx  = static_cast<usize>(offset) / found->second.page_size;
 
         log_d("{}: [id={}|idx={}] flush, write to device...", __func__, id.inner(), idx, offset);
         co_return co_await m_connection.write(path, in, offset);
     }
 
-    Await<void> Cache::evict(usize size)
+    bool Cache::has_pending(Id id) const
+    {
+        auto same_id = [&](const PageKey& key) { return key.id == id; };
+        return sr::any_of(m_queue | sv::keys, same_id);
+    }
+
+    Await<usize> Cache::evict(usize bytes)
     {
-        while (size-- > 0 and not m_lru.empty()) {
+        auto freed = 0uz;
+        while (freed < bytes and not m_lru.empty()) {
             auto page      = std::move(m_lru.back());
             auto [id, idx] = page.key();
 
             m_lru.pop_back();
+            m_used_bytes -= page.capacity();
+            freed        += page.capacity();
 
-            if (page.is_dirty()) {
+            // page must be unreachable before flushing since its lru iterator is no longer valid
+            if (auto entry = lookup(id, std::nullopt); entry) {
+                entry->get().pages.erase(idx);
+            }
+
+            if (page.is_dirty() and m_table.contains(id)) {
                 log_i("{}: force push page [id={}|idx={}]", __func__, id.inner(), idx);
 
-                auto offset = static_cast<off_t>(idx * m_page_size);
+                // readers of this page must wait until the device has the data
+                auto promise = saf::promise<Errc>{ co_await async::current_executor() };
+                m_queue.emplace(page.key(), promise.get_future().share());
+
+                auto offset = static_cast<off_t>(idx * page.capacity());
                 if (auto res = co_await on_flush(id, page.buf(), offset); not res) {
                     log_c("{}: failed to force push page [id={}|idx={}", __func__, id.inner(), idx);
                 }
+
+                promise.set_value(Errc{});
+                m_queue.erase(page.key());
             }
 
-            // this is done last since on_flush requires entry to still exists
-            auto& entry = lookup(id, std::nullopt)->get();
-            entry.pages.erase(idx);
-            if (entry.pages.empty()) {
-                m_table.erase(id);
+            // entry is kept alive while there are pages still being pulled or pushed for it, or reads and
+            // writes holding it (this is done last since on_flush requires entry to still exists)
+            auto entry = m_table.find(id);
+            if (entry != m_table.end() and entry->second.pages.empty() and not entry->second.pinned) {
+                if (entry->second.active == 0 and not has_pending(id)) {
+                    m_table.erase(entry);
+                }
             }
         }
+
+        co_return freed;
     }
 
-    AExpect<usize> Cache::read_at(
-        LookupEntry& entry,
-        Span<char>   out,
-        Id           id,
-        usize        index,
-        usize        first,
-        usize        last,
-        off_t        offset
-    )
+    void Cache::erase_page(const LookupEntry& entry, Lru::iterator page)
     {
-        log_t("read: [id={}|idx={}]", id.inner(), index);
+        m_used_bytes -= page->capacity();
+        list_of(entry).erase(page);
+    }
 
+    AExpect<Cache::Lru::iterator> Cache::get_page(LookupEntry& entry, Id id, usize index, bool pull)
+    {
         auto key = PageKey{ id, index };
 
-        if (auto queued = m_queue.find(key); queued != m_queue.end()) {
+        // other waiters may have queued the page again by the time this one resumes
+        for (auto queued = m_queue.find(key); queued != m_queue.end(); queued = m_queue.find(key)) {
             auto fut = queued->second;
             co_await fut.async_wait();
             if (auto err = fut.get(); static_cast<bool>(err)) {
@@ -374,59 +1106,93 @@ namespace madbfs::data
             }
         }
 
-        auto page_entry = entry.pages.find(index);
-        if (page_entry == entry.pages.end()) {
-            auto promise = saf::promise<Errc>{ co_await async::current_executor() };
-            auto future  = promise.get_future().share();
-            m_queue.emplace(key, std::move(future));
+        if (auto page_entry = entry.pages.find(index); page_entry != entry.pages.end()) {
+            co_return page_entry->second;
+        }
+
+        // NOTE: the key stays queued until the page is inserted, this also keeps the entry from being removed
+        // by eviction of other pages
+        auto promise = saf::promise<Errc>{ co_await async::current_executor() };
+        auto future  = promise.get_future().share();
+        m_queue.emplace(key, std::move(future));
+
+        // the page size of the entry can't change while the key is queued
+        auto page_size = entry.page_size;
+        auto data      = std::make_unique<char[]>(page_size);
+        auto len       = 0uz;
 
-            auto data    = std::make_unique<char[]>(m_page_size);
-            auto span    = Span{ data.get(), m_page_size };
-            auto may_len = co_await on_miss(id, span, static_cast<off_t>(index * m_page_size));
+        if (pull and not entry.fresh) {
+            auto span    = Span{ data.get(), page_size };
+            auto may_len = co_await on_miss(id, span, static_cast<off_t>(index * page_size));
             if (not may_len) {
                 promise.set_value(may_len.error());
                 m_queue.erase(key);
                 co_return Unexpect{ may_len.error() };
-            } else if (not m_queue.contains(key)) {
-                promise.set_value(Errc::operation_canceled);
-                co_return Unexpect{ Errc::operation_canceled };
             }
+            len = *may_len;
+        }
 
-            m_lru.emplace_front(key, std::move(data), *may_len, m_page_size);
-            auto [p, _] = entry.pages.emplace(index, m_lru.begin());
-            page_entry  = p;
+        // evict before inserting so the returned page can't be evicted before the caller uses it
+        co_await m_budget.reserve(*this, page_size);
 
-            promise.set_value(Errc{});
-            m_queue.erase(key);
+        if (not m_queue.contains(key)) {
+            promise.set_value(Errc::operation_canceled);
+            co_return Unexpect{ Errc::operation_canceled };
+        }
 
-            if (m_lru.size() > m_max_pages) {
-                co_await evict(m_lru.size() - m_max_pages);
-            }
+        auto& list = list_of(entry);
+        list.emplace_front(key, std::move(data), static_cast<u32>(len), page_size);
+        entry.pages.emplace(index, list.begin());
+        m_used_bytes += page_size;
+
+        promise.set_value(Errc{});
+        m_queue.erase(key);
+
+        co_return list.begin();
+    }
+
+    AExpect<usize> Cache::read_at(
+        LookupEntry& entry,
+        Span<char>   out,
+        Id           id,
+        usize        index,
+        usize        first,
+        usize        last,
+        off_t        offset
+    )
+    {
+        log_t("read: [id={}|idx={}]", id.inner(), index);
+
+        auto may_page = co_await get_page(entry, id, index, true);
+        if (not may_page) {
+            co_return Unexpect{ may_page.error() };
         }
 
-        auto [_, page] = *page_entry;
+        auto  page = *may_page;
+        auto& list = list_of(entry);
 
-        if (page != m_lru.begin()) {
-            m_lru.splice(m_lru.begin(), m_lru, page);
+        if (page != list.begin()) {
+            list.splice(list.begin(), list, page);
         }
 
+        auto page_size    = entry.page_size;
         auto local_offset = 0uz;
-        auto local_size   = m_page_size;
+        auto local_size   = page_size;
 
         if (index == first) {
-            local_offset = static_cast<usize>(offset) % m_page_size;
+            local_offset = static_cast<usize>(offset) % page_size;
             local_size   = local_size - local_offset;
         }
 
         if (index == last) {
-            auto off    = static_cast<usize>(offset) % m_page_size;
-            local_size  = (out.size() + off - 1) % m_page_size + 1;
+            auto off    = static_cast<usize>(offset) % page_size;
+            local_size  = (out.size() + off - 1) % page_size + 1;
             local_size -= local_offset;
         }
 
         auto out_off = 0uz;
         if (index >= first + 1) {
-            out_off = (index - first) * m_page_size - static_cast<usize>(offset) % m_page_size;
+            out_off = (index - first) * page_size - static_cast<usize>(offset) % page_size;
         }
 
         auto out_span = Span{ out.data() + out_off, local_size };
@@ -442,55 +1208,46 @@ namespace madbfs::data
         usize            index,
         usize            first,
         usize            last,
-        off_t            offset
+        off_t            offset,
+        Opt<usize>       file_size
     )
     {
         log_t("write: [id={}|idx={}]", id.inner(), index);
 
-        auto key = PageKey{ id, index };
-
-        if (auto queued = m_queue.find(key); queued != m_queue.end()) {
-            auto fut = queued->second;
-            co_await fut.async_wait();
-            if (auto err = fut.get(); static_cast<bool>(err)) {
-                co_return Unexpect{ err };
-            }
-        }
-
-        auto page_entry = entry.pages.find(index);
-        if (page_entry == entry.pages.end()) {
-            m_lru.emplace_front(key, std::make_unique<char[]>(m_page_size), 0, m_page_size);
-            auto [p, _] = entry.pages.emplace(index, m_lru.begin());
-            page_entry  = p;
-
-            if (m_lru.size() > m_max_pages) {
-                co_await evict(m_lru.size() - m_max_pages);
-            }
-        }
-
-        auto [_, page] = *page_entry;
-
-        if (page != m_lru.begin()) {
-            m_lru.splice(m_lru.begin(), m_lru, page);
-        }
-
+        auto page_size    = entry.page_size;
         auto local_offset = 0uz;
-        auto local_size   = m_page_size;
+        auto local_size   = page_size;
 
         if (index == first) {
-            local_offset = static_cast<usize>(offset) % m_page_size;
+            local_offset = static_cast<usize>(offset) % page_size;
             local_size   = local_size - local_offset;
         }
 
         if (index == last) {
-            auto off    = static_cast<usize>(offset) % m_page_size;
-            local_size  = (in.size() + off - 1) % m_page_size + 1;
+            auto off    = static_cast<usize>(offset) % page_size;
+            local_size  = (in.size() + off - 1) % page_size + 1;
             local_size -= local_offset;
         }
 
+        // partial write: the rest of the page must be pulled from device, else it will be clobbered on flush,
+        // a page past the end of file has nothing on the device though (e.g. appends or after O_TRUNC)
+        auto partial   = local_offset != 0 or local_size != page_size;
+        auto on_device = not file_size or index * page_size < *file_size;
+        auto may_page  = co_await get_page(entry, id, index, partial and on_device);
+        if (not may_page) {
+            co_return Unexpect{ may_page.error() };
+        }
+
+        auto  page = *may_page;
+        auto& list = list_of(entry);
+
+        if (page != list.begin()) {
+            list.splice(list.begin(), list, page);
+        }
+
         auto in_off = 0uz;
         if (index >= first + 1) {
-            in_off = (index - first) * m_page_size - static_cast<usize>(offset) % m_page_size;
+            in_off = (index - first) * page_size - static_cast<usize>(offset) % page_size;
         }
 
         auto in_span = Span{ in.data() + in_off, local_size };
@@ -501,11 +1258,13 @@ namespace madbfs::data
         co_return written;
     }
 
-    AExpect<void> Cache::flush_at(Page& page, Id id)
+    AExpect<void> Cache::flush_at(Id id, usize index)
     {
-        log_t("flush: [id={}|idx={}]", id.inner(), page.key().index);
+        log_t("flush: [id={}|idx={}]", id.inner(), index);
 
-        if (auto queued = m_queue.find(page.key()); queued != m_queue.end()) {
+        auto key = PageKey{ id, index };
+
+        if (auto queued = m_queue.find(key); queued != m_queue.end()) {
             auto fut = queued->second;
             co_await fut.async_wait();
             if (auto err = fut.get(); static_cast<bool>(err)) {
@@ -513,13 +1272,33 @@ namespace madbfs::data
             }
         }
 
+        // the page may have been evicted (and pushed) in the meantime
+        auto entry = m_table.find(id);
+        if (entry == m_table.end()) {
+            co_return Expect<void>{};
+        }
+        auto page_entry = entry->second.pages.find(index);
+        if (page_entry == entry->second.pages.end()) {
+            co_return Expect<void>{};
+        }
+
+        auto& page = *page_entry->second;
+
         if (page.is_dirty()) {
-            auto data = std::make_unique<char[]>(m_page_size);
-            auto read = page.read({ data.get(), m_page_size }, 0);
+            auto page_size = page.capacity();
+            auto data      = std::make_unique<char[]>(page_size);
+            auto read      = page.read({ data.get(), page_size }, 0);
             page.set_dirty(false);
 
+            // the page is clean from here, the page size of the file must not change until the push is done
+            ++m_flushing[id];
+
             auto span = Span{ data.get(), read };
-            auto res  = co_await on_flush(id, span, static_cast<off_t>(page.key().index * m_page_size));
+            auto res  = co_await on_flush(id, span, static_cast<off_t>(index * page_size));
+
+            if (--m_flushing[id] == 0) {
+                m_flushing.erase(id);
+            }
             if (not res.has_value()) {
                 co_return Unexpect{ res.error() };
             }
@@ -12,6 +12,15 @@ namespace madbfs::data::ipc::names
     constexpr auto get_page_size    = "get_page_size";
     constexpr auto set_cache_size   = "set_cache_size";
     constexpr auto get_cache_size   = "get_cache_size";
+    constexpr auto get_stats        = "get_stats";
+    constexpr auto get_recent_ops   = "get_recent_ops";
+    constexpr auto reset_stats      = "reset_stats";
+    constexpr auto start_trace      = "start_trace";
+    constexpr auto stop_trace       = "stop_trace";
+    constexpr auto get_metrics      = "get_metrics";
+    constexpr auto prefetch         = "prefetch";
+    constexpr auto pin              = "pin";
+    constexpr auto unpin            = "unpin";
 }
 
 namespace madbfs::data
@@ -67,6 +76,15 @@ namespace madbfs::data
         co_return Expect<void>{};
     }
 
+    template <typename T>
+    T optional(const boost::json::object& object, const char* key, T fallback)
+    {
+        if (const auto* value = object.if_contains(key)) {
+            return boost::json::value_to<T>(*value);
+        }
+        return fallback;
+    }
+
     std::expected<ipc::Op, std::string> parse_msg(Str msg)
     {
         try {
@@ -89,6 +107,39 @@ namespace madbfs::data
                 };
             } else if (op == ipc::names::get_cache_size) {
                 return ipc::Op{ ipc::GetCacheSize{} };
+            } else if (op == ipc::names::get_stats) {
+                return ipc::Op{ ipc::GetStats{} };
+            } else if (op == ipc::names::get_recent_ops) {
+                auto count = 100uz;    // value is optional
+                if (const auto* value = json.as_object().if_contains("value")) {
+                    count = boost::json::value_to<u32>(value->at("count"));
+                }
+                return ipc::Op{ ipc::GetRecentOps{ .count = count } };
+            } else if (op == ipc::names::reset_stats) {
+                return ipc::Op{ ipc::ResetStats{} };
+            } else if (op == ipc::names::start_trace) {
+                return ipc::Op{
+                    ipc::StartTrace{ .file = boost::json::value_to<String>(json.at("value").at("file")) },
+                };
+            } else if (op == ipc::names::stop_trace) {
+                return ipc::Op{ ipc::StopTrace{} };
+            } else if (op == ipc::names::get_metrics) {
+                return ipc::Op{ ipc::GetMetrics{} };
+            } else if (op == ipc::names::prefetch) {
+                const auto& value = json.at("value").as_object();
+                return ipc::Op{ ipc::Prefetch{
+                    .path      = boost::json::value_to<String>(value.at("path")),
+                    .recursive = optional<bool>(value, "recursive", false),
+                    .rate_kib  = optional<u32>(value, "rate_kib", 0),
+                } };
+            } else if (op == ipc::names::pin or op == ipc::names::unpin) {
+                const auto& value     = json.at("value").as_object();
+                auto        path      = boost::json::value_to<String>(value.at("path"));
+                auto        recursive = optional<bool>(value, "recursive", false);
+                if (op == ipc::names::pin) {
+                    return ipc::Op{ ipc::Pin{ .path = std::move(path), .recursive = recursive } };
+                }
+                return ipc::Op{ ipc::Unpin{ .path = std::move(path), .recursive = recursive } };
             }
 
             return std::unexpected{ fmt::format("'{}' is not a valid operation, try 'help'", op) };
@@ -113,15 +164,14 @@ namespace madbfs::data
         }
     }
 
-    Expect<Ipc> Ipc::create(async::Context& context)
+    Expect<Ipc> Ipc::create(async::Context& context, Str serial)
     {
         auto socket_path = [] -> String {
             const auto* res = std::getenv("XDG_RUNTIME_DIR");
             return res ? res : "/tmp";
         }();
 
-        const auto* serial = std::getenv("ANDROID_SERIAL");
-        if (serial == nullptr) {
+        if (serial.empty()) {
             return Unexpect{ Errc::no_such_device };
         }
 
@@ -179,7 +229,10 @@ namespace madbfs::data
             }
 
             log_i("{}: new ipc connection from peer", __func__);
-            co_await handle_peer(std::move(res).value());
+
+            // peers are handled concurrently so a long running operation doesn't block the others
+            auto exec = co_await async::current_executor();
+            async::spawn(exec, handle_peer(std::move(res).value()), async::detached);
         }
     }
 
@@ -194,9 +247,16 @@ namespace madbfs::data
         auto op = parse_msg(op_str.value());
 
         if (op.has_value()) {
+            auto report = Report{ [&sock](boost::json::value progress) -> Await<bool> {
+                auto json      = boost::json::object{};
+                json["status"] = "progress";
+                json["value"]  = std::move(progress);
+                co_return (co_await send(sock, boost::json::serialize(json))).has_value();
+            } };
+
             auto response      = boost::json::object{};
             response["status"] = "success";
-            response["value"]  = co_await m_on_op(*op);
+            response["value"]  = co_await m_on_op(*op, report);
 
             auto msg = boost::json::serialize(response);
             if (auto res = co_await send(sock, msg); not res) {
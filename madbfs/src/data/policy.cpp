@@ -0,0 +1,138 @@
+#include "madbfs/data/policy.hpp"
+
+#include <madbfs-common/util/split.hpp>
+
+#include <fmt/format.h>
+
+#include <algorithm>
+#include <charconv>
+
+namespace madbfs::data
+{
+    bool glob_match(Str pattern, Str path)
+    {
+        while (not pattern.empty()) {
+            if (pattern.starts_with("**")) {
+                pattern.remove_prefix(2);
+
+                // "/**/" also matches a single '/'
+                if (pattern.starts_with('/') and glob_match(pattern.substr(1), path)) {
+                    return true;
+                }
+                for (auto i : sv::iota(0uz, path.size() + 1)) {
+                    if (glob_match(pattern, path.substr(i))) {
+                        return true;
+                    }
+                }
+                return false;
+            }
+
+            if (pattern.front() == '*') {
+                pattern.remove_prefix(1);
+                for (auto i : sv::iota(0uz, path.size() + 1)) {
+                    if (glob_match(pattern, path.substr(i))) {
+                        return true;
+                    }
+                    if (i < path.size() and path[i] == '/') {
+                        break;
+                    }
+                }
+                return false;
+            }
+
+            if (path.empty()) {
+                return false;
+            }
+            if (pattern.front() == '?' ? path.front() == '/' : pattern.front() != path.front()) {
+                return false;
+            }
+
+            pattern.remove_prefix(1);
+            path.remove_prefix(1);
+        }
+
+        return path.empty();
+    }
+
+    std::expected<Rules, String> Rules::parse(Str text)
+    {
+        auto rules  = Rules{};
+        auto number = 0uz;
+
+        auto fail = [&]<typename... Args>(fmt::format_string<Args...> spec, Args&&... args) {
+            auto msg = fmt::format(spec, std::forward<Args>(args)...);
+            return std::unexpected{ fmt::format("line {}: {}", number, msg) };
+        };
+
+        // StringSplitter skips empty lines, which would make the line number wrong
+        while (not text.empty()) {
+            auto end  = std::min(text.find('\n'), text.size());
+            auto line = text.substr(0, end);
+            text.remove_prefix(std::min(end + 1, text.size()));
+            ++number;
+
+            auto content = line.substr(0, line.find('#'));
+            auto words   = util::StringSplitter{ content, { " \t\r" } };
+
+            auto glob    = words.next();
+            auto options = words.next();
+
+            if (not glob) {
+                continue;    // empty line or comment
+            }
+            if (not glob->starts_with('/')) {
+                return fail("glob {:?} is not absolute", *glob);
+            }
+            if (not options) {
+                return fail("no option for glob {:?}", *glob);
+            }
+            if (auto extra = words.next()) {
+                return fail("unexpected {:?}", *extra);
+            }
+
+            auto policy = Policy{};
+            auto split  = util::StringSplitter{ *options, ',' };
+
+            while (auto option = split.next()) {
+                if (*option == "direct") {
+                    policy.direct = true;
+                } else if (*option == "cached") {
+                    policy.direct = false;
+                } else if (*option == "pin") {
+                    policy.pin = true;
+                } else if (*option == "write-through") {
+                    policy.write_through = true;
+                } else if (*option == "write-back") {
+                    policy.write_through = false;
+                } else if (option->starts_with("readahead=")) {
+                    auto value = option->substr(Str{ "readahead=" }.size());
+                    auto last  = value.data() + value.size();
+                    if (auto [ptr, ec] = std::from_chars(value.data(), last, policy.readahead);
+                        ec != std::errc{} or ptr != last) {
+                        return fail("invalid readahead {:?}", value);
+                    }
+                } else {
+                    return fail("unknown option {:?}", *option);
+                }
+            }
+
+            if (policy.direct and (policy.pin or policy.readahead > 0)) {
+                return fail("direct can't be combined with caching");
+            }
+
+            rules.m_rules.push_back({ .glob = String{ *glob }, .policy = policy });
+        }
+
+        return rules;
+    }
+
+    Policy Rules::match(Str path) const
+    {
+        for (const auto& rule : m_rules) {
+            if (glob_match(rule.glob, path)) {
+                return rule.policy;
+            }
+        }
+        return {};
+    }
+}
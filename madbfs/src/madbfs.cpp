@@ -1,40 +1,132 @@
 #include "madbfs/madbfs.hpp"
 
 #include "madbfs/connection/adb_connection.hpp"
+#include "madbfs/connection/metered_connection.hpp"
 #include "madbfs/connection/server_connection.hpp"
 #include "madbfs/data/ipc.hpp"
 
 #include <madbfs-common/log.hpp>
+#include <madbfs-common/stats.hpp>
+#include <madbfs-common/trace.hpp>
 #include <madbfs-common/util/overload.hpp>
 
 #include <boost/json.hpp>
 
 namespace madbfs
 {
+    Runtime::Runtime(usize cache_size)
+        : m_async_ctx{}
+        , m_work_guard{ m_async_ctx.get_executor() }
+        , m_work_thread{ [this] {
+            try {
+                log_i("Runtime: io_context running...");
+                auto num_handlers = m_async_ctx.run();
+                log_i("Runtime: io_context stopped with {} handlers executed", num_handlers);
+            } catch (const std::exception& e) {
+                log_w("Runtime: io_context stopped with an exception: {}", e.what());
+            } catch (...) {
+                log_w("Runtime: io_context stopped with an exception (unknown type)");
+            }
+        } }
+        , m_budget{ cache_size }
+        , m_signals{ m_async_ctx, SIGUSR1 }
+    {
+        async::spawn(m_async_ctx, dump_stats_on_signal(), async::detached);
+    }
+
+    Runtime::~Runtime()
+    {
+        stop();
+    }
+
+    void Runtime::stop()
+    {
+        m_work_guard.reset();
+        m_async_ctx.stop();
+        if (m_work_thread.joinable()) {
+            m_work_thread.join();
+        }
+    }
+
+    void Runtime::attach_stats(Str serial, const stats::Registry& registry)
+    {
+        auto lock = std::scoped_lock{ m_mutex };
+        m_attached.emplace_back(String{ serial }, &registry);
+    }
+
+    void Runtime::detach_stats(const stats::Registry& registry)
+    {
+        auto lock = std::scoped_lock{ m_mutex };
+        std::erase_if(m_attached, [&](const auto& attached) { return attached.second == &registry; });
+    }
+
+    Await<void> Runtime::dump_stats_on_signal()
+    {
+        constexpr auto max_events = 64uz;
+
+        while (true) {
+            auto sig = co_await m_signals.async_wait();
+            if (not sig) {
+                break;
+            }
+
+            auto lock = std::scoped_lock{ m_mutex };
+            for (const auto& [serial, registry] : m_attached) {
+                auto dump = registry->dump(max_events);
+                log_w("Runtime: SIGUSR1 received, dumping stats of device {}:\n{}", serial, dump);
+            }
+        }
+    }
+
     Uniq<connection::Connection> Madbfs::prepare_connection(
-        async::Context& ctx,
-        Opt<path::Path> server,
-        u16             port
+        async::Context&    ctx,
+        stats::Registry&   registry,
+        Str                serial,
+        Opt<path::Path>    server,
+        u16                port,
+        rpc::Address       socket,
+        bool               loopback,
+        Opt<link::Profile> link
     )
     {
-        auto coro = [=] noexcept -> Await<Uniq<connection::Connection>> {
-            auto result = co_await connection::ServerConnection::prepare_and_create(server, port);
+        auto target = &registry;
+        auto coro   = [=, serial = String{ serial }] noexcept -> Await<Uniq<connection::Connection>> {
+            if (loopback) {
+                log_i("prepare_connection: loopback mode, connecting directly to server on localhost");
+                auto conn = co_await connection::ServerConnection::create_direct(socket);
+                conn->emulate_link(link);
+                conn->report_to(*target);
+                co_return std::move(conn);
+            }
+
+            auto result = co_await connection::ServerConnection::prepare_and_create(
+                serial,
+                server,
+                port,
+                socket
+            );
             if (not result) {
                 auto msg = std::make_error_code(result.error()).message();
                 log_c("prepare_connection: failed to construct ServerConnection: {}", msg);
                 log_i("prepare_connection: falling back to AdbConnection");
-                co_return std::make_unique<connection::AdbConnection>();
+                if (link) {
+                    log_w("prepare_connection: link emulation is not supported on AdbConnection, ignoring");
+                }
+                co_return std::make_unique<connection::AdbConnection>(serial);
             }
             log_d("prepare_connection: successfully created ServerConnection");
+            (*result)->emulate_link(link);
+            (*result)->report_to(*target);
             co_return std::move(*result);
         };
 
-        return async::block(ctx, coro());
+        auto conn = async::block(ctx, coro());
+        return std::make_unique<connection::MeteredConnection>(std::move(conn), registry);
     }
 
-    Opt<data::Ipc> Madbfs::create_ipc(async::Context& ctx)
+    Opt<data::Ipc> Madbfs::create_ipc(async::Context& ctx, Str serial)
     {
-        auto ipc = data::Ipc::create(ctx);
+        auto ipc = data::Ipc::create(ctx, serial);
         if (not ipc.has_value()) {
             const auto msg = std::make_error_code(ipc.error()).message();
             log_e("Madbfs: failed to initialize ipc: {}", msg);
@@ -45,61 +137,121 @@ namespace madbfs
         return std::move(*ipc);
     }
 
-    void Madbfs::work_thread_function(async::Context& ctx)
+    Madbfs::Madbfs(
+        Shared<Runtime>    runtime,
+        String             serial,
+        Opt<path::Path>    server,
+        u16                port,
+        rpc::Address       socket,
+        usize              page_size,
+        bool               loopback,
+        Opt<link::Profile> link,
+        data::Rules        rules,
+        tree::Mode         mode
+    )
+        : m_runtime{ std::move(runtime) }
+        , m_serial{ std::move(serial) }
+        , m_stats{}
+        , m_connection{ prepare_connection(
+              async_ctx(),
+              m_stats,
+              m_serial,
+              server,
+              port,
+              std::move(socket),
+              loopback,
+              link
+          ) }
+        , m_cache{ *m_connection, page_size, m_runtime->budget(), std::move(rules) }
+        , m_tree{ *m_connection, m_cache, mode }
+        , m_ipc{ create_ipc(async_ctx(), m_serial) }
     {
-        try {
-            log_i("Madbfs: io_context running...");
-            auto num_handlers = ctx.run();
-            log_i("Madbfs: io_context stopped with {} handlers executed", num_handlers);
-        } catch (const std::exception& e) {
-            log_w("Madbfs: io_context stopped with an exception: {}", e.what());
-        } catch (...) {
-            log_w("Madbfs: io_context stopped with an exception (unknown type)");
+        if (m_ipc) {
+            auto coro = m_ipc->launch([this](data::ipc::Op op, data::Ipc::Report& report) {
+                return ipc_handler(op, report);
+            });
+            async::spawn(async_ctx(), std::move(coro), async::detached);
         }
+
+        m_runtime->attach_stats(m_serial, m_stats);
     }
 
-    Madbfs::Madbfs(Opt<path::Path> server, u16 port, usize page_size, usize max_pages)
-        : m_async_ctx{}
-        , m_work_guard{ m_async_ctx.get_executor() }
-        , m_work_thread{ [this] { work_thread_function(m_async_ctx); } }
-        , m_connection{ prepare_connection(m_async_ctx, server, port) }
-        , m_cache{ *m_connection, page_size, max_pages }
-        , m_tree{ *m_connection, m_cache }
-        , m_ipc{ create_ipc(m_async_ctx) }
+    Madbfs::~Madbfs()
     {
-        if (m_ipc) {
-            auto coro = m_ipc->launch([this](data::ipc::Op op) { return ipc_handler(op); });
-            async::spawn(m_async_ctx, std::move(coro), async::detached);
-        }
+        m_runtime->detach_stats(m_stats);
+        shutdown();
+
+        // coroutines of this instance still on the context must not outlive it; a shared runtime is already
+        // stopped by its owner at this point
+        m_runtime->stop();
     }
 
-    Madbfs::~Madbfs()
+    void Madbfs::shutdown()
     {
-        async::block(m_async_ctx, m_tree.shutdown());
+        if (std::exchange(m_shut_down, true)) {
+            return;
+        }
 
-        m_work_guard.reset();
-        m_async_ctx.stop();
-        m_work_thread.join();
+        async::block(async_ctx(), m_tree.shutdown());
     }
 
-    Await<boost::json::value> Madbfs::ipc_handler(data::ipc::Op op)
+    Await<boost::json::value> Madbfs::ipc_handler(data::ipc::Op op, data::Ipc::Report& report)
     {
         namespace ipc = data::ipc;
 
         constexpr usize lowest_page_size  = 64 * 1024;
         constexpr usize highest_page_size = 4 * 1024 * 1024;
         constexpr usize lowest_max_pages  = 128;
+        constexpr auto  report_interval   = std::chrono::milliseconds{ 250 };
+
+        auto failure = [](Str reason) {
+            auto json      = boost::json::object{};
+            json["done"]   = false;
+            json["reason"] = String{ reason };
+            return boost::json::value{ json };
+        };
+
+        // pin or unpin every regular file under the path
+        auto set_pin = [&](Str path_str, bool recursive, bool pin) -> Await<boost::json::value> {
+            auto path = path::create(path_str);
+            if (not path) {
+                co_return failure("path must be absolute");
+            }
+
+            auto files = 0uz;
+            auto visit = [&](path::Path file, const data::Stat& stat) -> AExpect<void> {
+                if (pin) {
+                    m_cache.pin(stat.id, file);
+                } else {
+                    m_cache.unpin(stat.id);
+                }
+                ++files;
+                co_return Expect<void>{};
+            };
+
+            auto res = co_await m_tree.walk(*path, recursive, visit);
+            if (not res) {
+                co_return failure(std::make_error_code(res.error()).message());
+            }
+
+            auto json     = boost::json::object{};
+            json["done"]  = true;
+            json["files"] = files;
+            co_return boost::json::value{ json };
+        };
 
         auto overload = util::Overload{
             [&](ipc::Help) -> Await<boost::json::value> {
                 auto json          = boost::json::object{};
                 json["operations"] = {
-                    "help",          "invalidate_cache", "set_page_size",
-                    "get_page_size", "set_cache_size",   "get_cache_size",
+                    "help",           "invalidate_cache", "set_page_size",  "get_page_size", "set_cache_size",
+                    "get_cache_size", "get_stats",        "get_recent_ops", "reset_stats",   "start_trace",
+                    "stop_trace",     "get_metrics",      "prefetch",       "pin",           "unpin",
                 };
                 co_return boost::json::value{ json };
             },
             [&](ipc::InvalidateCache) -> Await<boost::json::value> {
+                co_await m_tree.send_unsent();    // the cache is all there is of these files
                 co_await m_cache.invalidate_all();
                 co_return boost::json::value{};
             },
@@ -107,16 +259,18 @@ namespace madbfs
                 auto old_size = m_cache.page_size();
                 auto new_size = std::bit_ceil(size.kib * 1024);
                 new_size      = std::clamp(new_size, lowest_page_size, highest_page_size);
+
+                co_await m_tree.send_unsent();
                 co_await m_cache.set_page_size(new_size);
 
-                auto old_max = m_cache.max_pages();
-                auto new_max = std::bit_ceil(old_max * old_size / new_size);
-                new_max      = std::max(new_max, lowest_max_pages);
+                // the budget is in bytes and may be shared with other devices, it only grows if too small
+                auto old_cache = m_cache.budget().max_bytes();
+                auto new_max   = std::max(old_cache / new_size, lowest_max_pages);
                 co_await m_cache.set_max_pages(new_max);
 
                 auto json              = boost::json::object{};
                 json["old_page_size"]  = old_size / 1024;
-                json["old_cache_size"] = old_max * old_size / 1024 / 1024;
+                json["old_cache_size"] = old_cache / 1024 / 1024;
                 json["new_page_size"]  = new_size / 1024;
                 json["new_cache_size"] = new_max * new_size / 1024 / 1024;
                 co_return boost::json::value{ json };
@@ -142,6 +296,232 @@ namespace madbfs
                 auto num_pages = m_cache.max_pages();
                 co_return boost::json::value(page * num_pages / 1024 / 1024);
             },
+            [&](ipc::GetStats) -> Await<boost::json::value> {
+                auto us = [](u64 ns) { return static_cast<double>(ns) / 1e3; };
+
+                auto json = boost::json::object{};
+                for (const auto* metric : m_stats.metrics()) {
+                    auto sum = metric->histogram().summary();
+                    if (sum.count == 0) {
+                        continue;
+                    }
+
+                    auto& group = json[metric->group()];
+                    if (not group.is_object()) {
+                        group = boost::json::object{};
+                    }
+
+                    // latencies are in us
+                    auto entry     = boost::json::object{};
+                    entry["count"] = sum.count;
+                    entry["mean"]  = us(sum.sum) / static_cast<double>(sum.count);
+                    entry["min"]   = us(sum.min);
+                    entry["p50"]   = us(sum.p50);
+                    entry["p90"]   = us(sum.p90);
+                    entry["p99"]   = us(sum.p99);
+                    entry["p999"]  = us(sum.p999);
+                    entry["max"]   = us(sum.max);
+
+                    group.as_object()[metric->name()] = std::move(entry);
+                }
+
+                // timings on the device, the rest of the round trip is spent on the link and in the client
+                auto timings = co_await m_connection->server_stats(false);
+                if (not timings) {
+                    co_return boost::json::value{ json };
+                }
+
+                using Phase = connection::ServerTiming::Phase;
+
+                auto mean = [&](const Phase& value, u64 count) {
+                    return us(value.sum) / static_cast<double>(count);
+                };
+                auto phase = [&](const Phase& value, u64 count) {
+                    auto entry    = boost::json::object{};
+                    entry["mean"] = mean(value, count);
+                    entry["p50"]  = us(value.p50);
+                    entry["p99"]  = us(value.p99);
+                    entry["max"]  = us(value.max);
+                    return entry;
+                };
+
+                auto server    = boost::json::object{};
+                auto breakdown = boost::json::object{};
+
+                for (const auto& timing : *timings) {
+                    auto count = timing.count;
+                    if (count == 0) {
+                        continue;
+                    }
+
+                    auto entry      = boost::json::object{};
+                    entry["count"]  = count;
+                    entry["errors"] = timing.errors;
+                    entry["bytes"]  = timing.bytes;
+                    entry["queue"]  = phase(timing.queue, count);
+                    entry["handle"] = phase(timing.handle, count);
+                    entry["encode"] = phase(timing.encode, count);
+                    entry["send"]   = phase(timing.send, count);
+
+                    server[timing.procedure] = std::move(entry);
+
+                    auto device  = mean(timing.queue, count) + mean(timing.handle, count);
+                    device      += mean(timing.encode, count) + mean(timing.send, count);
+
+                    // means of both sides, percentiles don't add up
+                    auto split      = boost::json::object{};
+                    split["device"] = device;
+                    split["handle"] = mean(timing.handle, count);
+
+                    auto rpc = m_stats.metric("rpc", timing.procedure).histogram().summary();
+                    if (rpc.count != 0) {
+                        auto round_trip = us(rpc.sum) / static_cast<double>(rpc.count);
+
+                        split["round_trip"] = round_trip;
+                        split["transport"]  = std::max(round_trip - device, 0.0);
+                    }
+                    breakdown[timing.procedure] = std::move(split);
+                }
+
+                json["server"]    = std::move(server);
+                json["breakdown"] = std::move(breakdown);
+                co_return boost::json::value{ json };
+            },
+            [&](ipc::GetRecentOps ops) -> Await<boost::json::value> {
+                auto events = m_stats.recorder().events();
+                if (events.size() > ops.count) {
+                    events.erase(events.begin(), events.end() - static_cast<isize>(ops.count));
+                }
+
+                auto json = boost::json::array{};
+                for (const auto& event : events) {
+                    auto metric = event.metric;
+                    auto error  = event.error;
+                    auto name   = String{ "?" };
+                    if (metric != nullptr) {
+                        name = fmt::format("{}.{}", metric->group(), metric->name());
+                    }
+
+                    auto entry           = boost::json::object{};
+                    entry["ts"]          = event.timestamp;
+                    entry["op"]          = name;
+                    entry["path"]        = event.path;
+                    entry["size"]        = event.size;
+                    entry["duration_us"] = static_cast<double>(event.duration.count()) / 1e3;
+                    entry["error"]       = error == Errc{} ? "" : std::make_error_code(error).message();
+                    json.push_back(std::move(entry));
+                }
+                co_return boost::json::value{ json };
+            },
+            [&](ipc::ResetStats) -> Await<boost::json::value> {
+                m_stats.reset();
+                std::ignore = co_await m_connection->server_stats(true);
+                co_return boost::json::value{};
+            },
+            [&](ipc::StartTrace start) -> Await<boost::json::value> {
+                auto json = boost::json::object{};
+                if (auto res = trace::start(start.file); res) {
+                    json["started"] = true;
+                    json["file"]    = start.file;
+                } else {
+                    json["started"] = false;
+                    json["reason"]  = std::make_error_code(res.error()).message();
+                }
+                co_return boost::json::value{ json };
+            },
+            [&](ipc::StopTrace) -> Await<boost::json::value> {
+                trace::stop();
+                co_return boost::json::value{};
+            },
+            [&](ipc::GetMetrics) -> Await<boost::json::value> {
+                using Kind = stats::Sample::Kind;
+
+                auto usage = m_cache.usage();
+                auto nodes = m_tree.count_nodes();
+                auto page  = m_cache.page_size();
+                auto f     = [](usize value) { return static_cast<f64>(value); };
+
+                auto samples = Array<stats::Sample, 15>{ {
+                    { "cache_pages", "pages stored in cache", Kind::Gauge, f(usage.pages) },
+                    { "cache_max_pages", "maximum pages in cache", Kind::Gauge, f(m_cache.max_pages()) },
+                    { "cache_page_size_bytes", "size of a cache page", Kind::Gauge, f(page) },
+                    { "cache_used_bytes", "bytes stored in cache", Kind::Gauge, f(usage.bytes) },
+                    { "cache_dirty_pages", "pages not yet flushed", Kind::Gauge, f(usage.dirty_pages) },
+                    { "cache_dirty_bytes", "bytes not yet flushed", Kind::Gauge, f(usage.dirty_bytes) },
+                    { "cache_pinned_pages", "pages kept from eviction", Kind::Gauge, f(usage.pinned_pages) },
+                    { "cache_files", "files with cached pages", Kind::Gauge, f(usage.files) },
+                    { "cache_small_files", "files with small pages", Kind::Gauge, f(usage.small_files) },
+                    { "cache_large_files", "files with large pages", Kind::Gauge, f(usage.large_files) },
+                    { "tree_regular_nodes", "regular file nodes", Kind::Gauge, f(nodes.regular) },
+                    { "tree_directory_nodes", "directory nodes", Kind::Gauge, f(nodes.directory) },
+                    { "tree_link_nodes", "symlink nodes", Kind::Gauge, f(nodes.link) },
+                    { "tree_other_nodes", "special file nodes", Kind::Gauge, f(nodes.other) },
+                    { "tree_error_nodes", "cached failed lookups", Kind::Gauge, f(nodes.error) },
+                } };
+
+                auto labels = fmt::format("serial=\"{}\"", m_serial);
+                co_return boost::json::value(m_stats.openmetrics(samples, labels));
+            },
+            [&](ipc::Prefetch prefetch) -> Await<boost::json::value> {
+                auto path = path::create(prefetch.path);
+                if (not path) {
+                    co_return failure("path must be absolute");
+                }
+
+                auto throttle = data::Throttle{ prefetch.rate_kib * 1024 };
+                auto watch    = stats::Stopwatch{};
+                auto files    = 0uz;
+                auto failed   = 0uz;
+                auto reported = stats::Clock::now();
+
+                auto progress = [&](Str current) {
+                    auto json      = boost::json::object{};
+                    json["path"]   = String{ current };
+                    json["files"]  = files;
+                    json["failed"] = failed;
+                    json["bytes"]  = throttle.bytes();
+                    return boost::json::value{ json };
+                };
+
+                auto visit = [&](path::Path file, const data::Stat& stat) -> AExpect<void> {
+                    auto size   = static_cast<usize>(stat.size);
+                    auto pulled = co_await m_cache.prefetch(stat.id, file, size, throttle);
+                    if (not pulled) {
+                        auto msg = std::make_error_code(pulled.error()).message();
+                        log_w("prefetch: failed to prefetch {:?}: {}", file.fullpath(), msg);
+                        ++failed;
+                    } else {
+                        ++files;
+                    }
+
+                    if (auto now = stats::Clock::now(); now - reported >= report_interval) {
+                        reported = now;
+                        if (not co_await report(progress(file.fullpath()))) {
+                            log_i("prefetch: peer is gone, stopping prefetch of {:?}", path->fullpath());
+                            co_return Unexpect{ Errc::operation_canceled };
+                        }
+                    }
+                    co_return Expect<void>{};
+                };
+
+                auto res = co_await m_tree.walk(*path, prefetch.recursive, visit);
+                if (not res) {
+                    co_return failure(std::make_error_code(res.error()).message());
+                }
+
+                auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(watch.elapsed());
+
+                auto json          = progress(path->fullpath()).as_object();
+                json["done"]       = true;
+                json["elapsed_ms"] = elapsed.count();
+                co_return boost::json::value{ json };
+            },
+            [&](ipc::Pin pin) -> Await<boost::json::value> {
+                co_return co_await set_pin(pin.path, pin.recursive, true);
+            },
+            [&](ipc::Unpin unpin) -> Await<boost::json::value> {
+                co_return co_await set_pin(unpin.path, unpin.recursive, false);
+            },
         };
 
         co_return co_await std::visit(overload, op);
@@ -1,13 +1,19 @@
 #include "madbfs/args.hpp"
+#include "madbfs/madbfs.hpp"
 #include "madbfs/operations.hpp"
 
 #include <madbfs-common/log.hpp>
+#include <madbfs-common/trace.hpp>
 
 #include <execinfo.h>
+#include <pthread.h>
 
 #include <array>
+#include <atomic>
 #include <csignal>
 #include <cstdlib>
+#include <filesystem>
+#include <thread>
 
 /**
  * @brief Handler for unexpected program end.
@@ -54,6 +60,133 @@ void unexpected_program_end(const char* msg, bool is_sigsegv)
     madbfs::log::shutdown();
 }
 
+/**
+ * @brief Mount each device at `<mountpoint>/<serial>` from a single process.
+ *
+ * All the mounts are set up before daemonizing, the instances (and the runtime they share) are created after
+ * since the worker thread doesn't survive the fork. Each mount is served by its own FUSE loop; the process
+ * exits on SIGINT, SIGTERM, or SIGHUP, or once every device is unmounted.
+ */
+int mount_multiple(madbfs::args::ParsedOpt& opt, fuse_args& args, madbfs::Str mount)
+{
+    namespace fs = std::filesystem;
+
+    auto opts = fuse_cmdline_opts{};
+    if (::fuse_parse_cmdline(&args, &opts) != 0) {
+        return 1;
+    }
+    ::free(opts.mountpoint);
+
+    auto instances = madbfs::Vec<madbfs::Uniq<madbfs::Madbfs>>(opt.devices.size());
+    auto fuses     = madbfs::Vec<fuse*>{};
+
+    auto teardown = [&] {
+        for (auto* fuse : fuses) {
+            ::fuse_unmount(fuse);
+            ::fuse_destroy(fuse);
+        }
+    };
+
+    for (auto i : madbfs::sv::iota(0uz, opt.devices.size())) {
+        auto path = fs::path{ mount } / opt.devices[i].serial;
+        if (auto ec = std::error_code{}; not fs::create_directories(path, ec) and ec) {
+            fmt::println(stderr, "error: failed to create mountpoint {:?}: {}", path.c_str(), ec.message());
+            teardown();
+            return 1;
+        }
+
+        // fuse_new consumes the arguments it parses
+        fuse_args copy = FUSE_ARGS_INIT(0, nullptr);
+        for (auto arg : madbfs::Span{ args.argv, static_cast<madbfs::usize>(args.argc) }) {
+            ::fuse_opt_add_arg(&copy, arg);
+        }
+
+        auto ops  = opt.read_only ? &madbfs::operations::read_only_shared_operations
+                                  : &madbfs::operations::shared_operations;
+        auto fuse = ::fuse_new(&copy, ops, sizeof(fuse_operations), &instances[i]);
+        ::fuse_opt_free_args(&copy);
+
+        if (fuse == nullptr) {
+            teardown();
+            return 1;
+        }
+        if (::fuse_mount(fuse, path.c_str()) != 0) {
+            ::fuse_destroy(fuse);
+            teardown();
+            return 1;
+        }
+        fuses.push_back(fuse);
+
+        fmt::println("[madbfs] mount '{}' at {:?}", opt.devices[i].serial, path.c_str());
+    }
+
+    if (::fuse_daemonize(opts.foreground) != 0) {
+        teardown();
+        return 1;
+    }
+
+    // every thread spawned from here on inherits the mask, the signals are only ever taken by sigwait below
+    auto signals = sigset_t{};
+    ::sigemptyset(&signals);
+    ::sigaddset(&signals, SIGINT);
+    ::sigaddset(&signals, SIGTERM);
+    ::sigaddset(&signals, SIGHUP);
+    ::pthread_sigmask(SIG_BLOCK, &signals, nullptr);
+
+    if (not opt.trace.empty()) {
+        std::ignore = madbfs::trace::start(opt.trace);    // failure is logged
+    }
+
+    auto runtime = std::make_shared<madbfs::Runtime>(opt.cachesize * 1024 * 1024);
+    for (auto i : madbfs::sv::iota(0uz, opt.devices.size())) {
+        instances[i] = madbfs::operations::create(opt, i, runtime);
+    }
+
+    auto running = std::atomic<madbfs::usize>{ fuses.size() };
+    auto loops   = madbfs::Vec<std::jthread>{};
+
+    for (auto* fuse : fuses) {
+        loops.emplace_back([&, fuse] {
+            if (opts.singlethread) {
+                ::fuse_loop(fuse);
+            } else {
+                ::fuse_loop_mt(fuse, opts.clone_fd);
+            }
+
+            // wake up the main thread once every device is unmounted
+            if (--running == 0) {
+                ::kill(::getpid(), SIGTERM);
+            }
+        });
+    }
+
+    auto signal = 0;
+    ::sigwait(&signals, &signal);
+    madbfs::log_i("[madbfs] received signal {}, unmounting all devices", signal);
+
+    for (auto* fuse : fuses) {
+        ::fuse_exit(fuse);
+        ::fuse_unmount(fuse);
+    }
+    loops.clear();
+
+    // instances must be shut down while the runtime still runs, then destroyed after it stops
+    for (auto* fuse : fuses) {
+        ::fuse_destroy(fuse);
+    }
+    for (auto& instance : instances) {
+        instance->shutdown();
+    }
+    runtime->stop();
+    instances.clear();
+
+    madbfs::trace::stop();
+    madbfs::log_i("madbfs for {} devices succesfully terminated", opt.devices.size());
+    madbfs::log::shutdown();
+
+    return 0;
+}
+
 int main(int argc, char** argv)
 {
     std::set_terminate([] { unexpected_program_end("std::terminate", false); });
@@ -70,24 +203,37 @@ int main(int argc, char** argv)
     }
     auto&& [opt, args, mount] = std::move(maybe_opt).opt();
 
+    auto serials = opt.devices | madbfs::sv::transform(&madbfs::args::Device::serial);
+
     madbfs::log::init(opt.log_level, opt.log_file);
     madbfs::log_i(
         "[madbfs] mount '{}' at '{}' with cache size {} MiB and page size {} KiB",
-        opt.serial,
+        fmt::join(serials, ","),
         mount,
         opt.cachesize,
         opt.pagesize
     );
 
-    fmt::println("[madbfs] mount '{}' [cache={} MiB, page={} KiB]", opt.serial, opt.cachesize, opt.pagesize);
-    fmt::println("[madbfs] unmount with 'fusermount -u {:?}'", mount);
-
-    if (::setenv("ANDROID_SERIAL", opt.serial.c_str(), 1) < 0) {
-        fmt::println(stderr, "error: failed to set env variable 'ANDROID_SERIAL' ({})", strerror(errno));
-        return 1;
+    if (opt.devices.size() > 1) {
+        fmt::println(
+            "[madbfs] mount {} devices [cache={} MiB, page={} KiB]",
+            opt.devices.size(),
+            opt.cachesize,
+            opt.pagesize
+        );
+        fmt::println("[madbfs] stop with SIGTERM or by unmounting every device");
+
+        auto ret = mount_multiple(opt, args, mount);
+        ::fuse_opt_free_args(&args);
+        return ret;
     }
 
-    auto ret = fuse_main(args.argc, args.argv, &madbfs::operations::operations, (void*)&opt);
+    auto serial = opt.devices.front().serial;
+    fmt::println("[madbfs] mount '{}' [cache={} MiB, page={} KiB]", serial, opt.cachesize, opt.pagesize);
+    fmt::println("[madbfs] unmount with 'fusermount -u {:?}'", mount);
+
+    auto ops = opt.read_only ? &madbfs::operations::read_only_operations : &madbfs::operations::operations;
+    auto ret = fuse_main(args.argc, args.argv, ops, (void*)&opt);
     ::fuse_opt_free_args(&args);
 
     // on invalid argument (1) and no mount point specified (2)
@@ -4,6 +4,7 @@
 #include "madbfs/madbfs.hpp"
 
 #include "madbfs-common/log.hpp"
+#include "madbfs-common/trace.hpp"
 
 namespace
 {
@@ -46,6 +47,28 @@ namespace
         return madbfs::Unexpect{ madbfs::Errc::io_error };
     }
 
+    /**
+     * @brief Negotiate capabilities with the kernel and set up its caching.
+     *
+     * @param read_only Whether the mount is read-only, the kernel may then cache everything indefinitely.
+     */
+    void configure(fuse_conn_info* conn, fuse_config* cfg, bool read_only) noexcept
+    {
+        // open handles O_TRUNC by itself, saving a separate truncate call (see Node::open)
+        if (conn->capable & FUSE_CAP_ATOMIC_O_TRUNC) {
+            conn->want |= FUSE_CAP_ATOMIC_O_TRUNC;
+        }
+
+        if (read_only) {
+            // libfuse clamps the timeouts to what the kernel accepts
+            constexpr auto forever = std::numeric_limits<double>::max();
+
+            cfg->entry_timeout    = forever;
+            cfg->negative_timeout = forever;
+            cfg->attr_timeout     = forever;
+        }
+    }
+
     auto fuse_err(
         madbfs::Str          name,
         const char*          path,
@@ -74,6 +97,7 @@ namespace
             case std::errc::permission_denied:
             case std::errc::read_only_file_system:
             case std::errc::filename_too_long:
+            case std::errc::no_such_device_or_address:
             case std::errc::invalid_argument: {
                 if (madbfs::log::get_level() == madbfs::log::Level::debug) {
                     const auto msg = std::make_error_code(err).message();
@@ -90,55 +114,126 @@ namespace
     }
 }
 
+namespace madbfs::operations::detail
+{
+    void record(Op op, const char* path, stats::Duration duration, i64 ret) noexcept
+    {
+        static constexpr auto names = Array<Str, static_cast<usize>(Op::Count_)>{
+            "getattr", "readlink", "mknod",   "mkdir",    "unlink",  "rmdir",
+            "rename",  "truncate", "open",    "read",     "write",   "flush",
+            "release", "fsync",    "readdir", "fsyncdir", "utimens", "copy_file_range",
+            "fallocate", "lseek",
+        };
+
+        // each mount has its own threads, so a thread looks up the metrics of its device once and recording
+        // afterwards is lock-free
+        thread_local auto registry = static_cast<stats::Registry*>(nullptr);
+        thread_local auto metrics  = Array<stats::Metric*, names.size()>{};
+
+        if (auto& current = get_data().stats(); registry != &current) {
+            registry = &current;
+            for (auto i : sv::iota(0uz, names.size())) {
+                metrics[i] = &current.metric("fuse", names[i]);
+            }
+        }
+
+        auto error = ret < 0 ? static_cast<Errc>(-ret) : Errc{};
+        auto size  = ret > 0 ? static_cast<u64>(ret) : 0;
+
+        metrics[static_cast<usize>(op)]->record(duration, path, size, error);
+    }
+}
+
 namespace madbfs::operations
 {
     using tree::FileTree;
 
-    void* init(fuse_conn_info* conn, fuse_config*) noexcept
+    Uniq<Madbfs> create(args::ParsedOpt& args, usize index, Shared<Runtime> runtime)
     {
-        if (conn->want & FUSE_CAP_ATOMIC_O_TRUNC) {
-            auto msg = "fuse sets atomic O_TRUNC capability, but filesystem doesn't support it, disabling...";
-            log_w("{}: {}", __func__, msg);
-            conn->want &= ~static_cast<u32>(FUSE_CAP_ATOMIC_O_TRUNC);
+        auto& device = args.devices[index];
+
+        if (device.server and not device.server->is_absolute()) {
+            log_c("{}: server path is not absolute when it should! ignoring", __func__);
+            device.server.reset();
         }
 
+        auto page_size = args.pagesize * 1024;
+        auto port      = static_cast<u16>(args.port + index);
+        auto server    = device.server.transform(&std::filesystem::path::c_str).and_then(&path::create);
+
+        return std::make_unique<Madbfs>(
+            std::move(runtime),
+            device.serial,
+            server,
+            port,
+            args.socket,
+            page_size,
+            args.loopback,
+            args.link,
+            args.rules,
+            args.read_only ? tree::Mode::ReadOnly : args.relaxed ? tree::Mode::Relaxed : tree::Mode::Strict
+        );
+    }
+
+    void* init(fuse_conn_info* conn, fuse_config* cfg) noexcept
+    {
         auto* args = static_cast<args::ParsedOpt*>(::fuse_get_context()->private_data);
         assert(args != nullptr and "data should not be empty!");
 
-        if (args->server and not args->server->is_absolute()) {
-            log_c("{}: server path is not absolute when it should! ignoring", __func__);
-            args->server.reset();
+        configure(conn, cfg, args->read_only);
+
+        if (not args->trace.empty()) {
+            std::ignore = trace::start(args->trace);    // failure is logged
         }
 
-        auto cache_size = args->cachesize * 1024 * 1024;
-        auto page_size  = args->pagesize * 1024;
-        auto max_pages  = cache_size / page_size;
-        auto port       = args->port;
-        auto server     = args->server.transform(&std::filesystem::path::c_str).and_then(&path::create);
+        if (args->relaxed) {
+            log_i("{}: relaxed mode, utimens, mkdir, and mknod are deferred to background", __func__);
+        } else if (args->read_only) {
+            log_i("{}: read-only mode, kernel caches are kept for as long as mounted", __func__);
+        }
 
-        return new Madbfs{ server, port, page_size, max_pages };
+        auto runtime = std::make_shared<Runtime>(args->cachesize * 1024 * 1024);
+        return create(*args, 0, std::move(runtime)).release();
     }
 
     void destroy(void* private_data) noexcept
     {
         auto* data = static_cast<Madbfs*>(private_data);
         assert(data != nullptr and "data should not be empty!");
+
+        auto serial = String{ data->serial() };
         delete data;
 
-        auto serial = ::getenv("ANDROID_SERIAL");
-        if (serial != nullptr) {
-            log_i("madbfs for device {} succesfully terminated", serial);
-        } else [[unlikely]] {
-            log_i("madbfs succesfully terminated");
-        }
+        trace::stop();
+
+        log_i("madbfs for device {} succesfully terminated", serial);
 
         // to force flushing remaining logs in queue
         log::shutdown();
     }
 
+    void* init_shared(fuse_conn_info* conn, fuse_config* cfg) noexcept
+    {
+        auto* data = static_cast<Uniq<Madbfs>*>(::fuse_get_context()->private_data);
+        assert(data != nullptr and *data != nullptr and "data should not be empty!");
+
+        configure(conn, cfg, (*data)->tree().mode() == tree::Mode::ReadOnly);
+        return data->get();
+    }
+
+    void destroy_shared(void* private_data) noexcept
+    {
+        auto* data = static_cast<Madbfs*>(private_data);
+        assert(data != nullptr and "data should not be empty!");
+
+        // the instance is destroyed by its owner once the shared runtime is stopped
+        data->shutdown();
+        log_i("madbfs for device {} succesfully unmounted", data->serial());
+    }
+
     i32 getattr(const char* path, struct stat* stbuf, [[maybe_unused]] fuse_file_info* fi) noexcept
     {
-        log_i("{}: {:?}", __func__, path);
+        log_d("{}: {:?}", __func__, path);
 
         auto maybe_stat = ok_or(path::create(path), Errc::operation_not_supported).and_then([](auto p) {
             return invoke_tree(&FileTree::getattr, p);
@@ -168,7 +263,7 @@ namespace madbfs::operations
 
     i32 readlink(const char* path, char* buf, size_t size) noexcept
     {
-        log_i("{}: {:?}", __func__, path);
+        log_d("{}: {:?}", __func__, path);
 
         return ok_or(path::create(path), Errc::operation_not_supported)
             .and_then([](path::Path p) { return invoke_tree(&FileTree::readlink, p); })
@@ -189,7 +284,7 @@ namespace madbfs::operations
 
     i32 mknod(const char* path, mode_t mode, dev_t dev) noexcept
     {
-        log_i("{}: {:?}", __func__, path);
+        log_d("{}: {:?}", __func__, path);
 
         return ok_or(path::create(path), Errc::operation_not_supported)
             .and_then([=](path::Path p) { return invoke_tree(&FileTree::mknod, p, mode, dev); })
@@ -199,7 +294,7 @@ namespace madbfs::operations
 
     i32 mkdir(const char* path, mode_t mode) noexcept
     {
-        log_i("{}: {:?}", __func__, path);
+        log_d("{}: {:?}", __func__, path);
 
         return ok_or(path::create(path), Errc::operation_not_supported)
             .and_then([=](path::Path p) { return invoke_tree(&FileTree::mkdir, p, mode | S_IFDIR); })
@@ -209,7 +304,7 @@ namespace madbfs::operations
 
     i32 unlink(const char* path) noexcept
     {
-        log_i("{}: {:?}", __func__, path);
+        log_d("{}: {:?}", __func__, path);
 
         return ok_or(path::create(path), Errc::operation_not_supported)
             .and_then([](path::Path p) { return invoke_tree(&FileTree::unlink, p); })
@@ -219,7 +314,7 @@ namespace madbfs::operations
 
     i32 rmdir(const char* path) noexcept
     {
-        log_i("{}: {:?}", __func__, path);
+        log_d("{}: {:?}", __func__, path);
 
         return ok_or(path::create(path), Errc::operation_not_supported)
             .and_then([](path::Path p) { return invoke_tree(&FileTree::rmdir, p); })
@@ -230,7 +325,7 @@ namespace madbfs::operations
     // see: man page of rename(2)
     i32 rename(const char* from, const char* to, u32 flags) noexcept
     {
-        log_i("{}: {:?} -> {:?} [flags={}]", __func__, from, to, flags);
+        log_d("{}: {:?} -> {:?} [flags={}]", __func__, from, to, flags);
 
         auto from_path = path::create(from);
         auto to_path   = path::create(to);
@@ -249,7 +344,7 @@ namespace madbfs::operations
 
     i32 truncate(const char* path, off_t size, [[maybe_unused]] fuse_file_info* fi) noexcept
     {
-        log_i("{}: [size={}] {:?}", __func__, size, path);
+        log_d("{}: [size={}] {:?}", __func__, size, path);
 
         return ok_or(path::create(path), Errc::operation_not_supported)
             .and_then([&](path::Path p) { return invoke_tree(&FileTree::truncate, p, size); })
@@ -259,10 +354,24 @@ namespace madbfs::operations
 
     i32 open(const char* path, fuse_file_info* fi) noexcept
     {
-        log_i("{}: {:?} [flags={:#08o}]", __func__, path, fi->flags);
+        log_d("{}: {:?} [flags={:#08o}]", __func__, path, fi->flags);
+
+        auto& data = get_data();
+        if (data.tree().mode() == tree::Mode::ReadOnly) {
+            if ((fi->flags & O_ACCMODE) != O_RDONLY or (fi->flags & O_TRUNC) != 0) {
+                return fuse_err(__func__, path)(Errc::read_only_file_system);
+            }
+
+            // the content never changes, what the kernel has read stays valid across opens
+            fi->keep_cache = 1;
+        }
 
         return ok_or(path::create(path), Errc::operation_not_supported)
-            .and_then([&](path::Path p) { return invoke_tree(&FileTree::open, p, fi->flags); })
+            .and_then([&](path::Path p) {
+                // direct files bypass kernel page cache as well
+                fi->direct_io = (fi->flags & O_DIRECT) != 0 or data.cache().policy(p).direct;
+                return invoke_tree(&FileTree::open, p, fi->flags);
+            })
             .transform([&](auto fd) { fi->fh = fd; })
             .transform_error(fuse_err(__func__, path))
             .error_or(0);
@@ -270,7 +379,7 @@ namespace madbfs::operations
 
     i32 read(const char* path, char* buf, size_t size, off_t offset, fuse_file_info* fi) noexcept
     {
-        log_i("{}: [offset={}|size={}] {:?}", __func__, offset, size, path);
+        log_d("{}: [offset={}|size={}] {:?}", __func__, offset, size, path);
 
         auto res = ok_or(path::create(path), Errc::operation_not_supported).and_then([&](path::Path p) {
             return invoke_tree(&FileTree::read, p, fi->fh, { buf, size }, offset);
@@ -280,7 +389,7 @@ namespace madbfs::operations
 
     i32 write(const char* path, const char* buf, size_t size, off_t offset, fuse_file_info* fi) noexcept
     {
-        log_i("{}: [offset={}|size={}] {:?}", __func__, offset, size, path);
+        log_d("{}: [offset={}|size={}] {:?}", __func__, offset, size, path);
 
         auto res = ok_or(path::create(path), Errc::operation_not_supported).and_then([&](auto p) {
             return invoke_tree(&FileTree::write, p, fi->fh, { buf, size }, offset);
@@ -290,7 +399,7 @@ namespace madbfs::operations
 
     i32 flush(const char* path, fuse_file_info* fi) noexcept
     {
-        log_i("{}: {:?}", __func__, path);
+        log_d("{}: {:?}", __func__, path);
 
         return ok_or(path::create(path), Errc::operation_not_supported)
             .and_then([&](path::Path p) { return invoke_tree(&FileTree::flush, p, fi->fh); })
@@ -300,7 +409,7 @@ namespace madbfs::operations
 
     i32 release(const char* path, fuse_file_info* fi) noexcept
     {
-        log_i("{}: {:?}", __func__, path);
+        log_d("{}: {:?}", __func__, path);
 
         return ok_or(path::create(path), Errc::operation_not_supported)
             .and_then([&](path::Path p) { return invoke_tree(&FileTree::release, p, fi->fh); })
@@ -308,6 +417,16 @@ namespace madbfs::operations
             .error_or(0);
     }
 
+    i32 fsync(const char* path, [[maybe_unused]] i32 datasync, fuse_file_info* fi) noexcept
+    {
+        log_d("{}: {:?}", __func__, path);
+
+        return ok_or(path::create(path), Errc::operation_not_supported)
+            .and_then([&](path::Path p) { return invoke_tree(&FileTree::fsync, p, fi->fh); })
+            .transform_error(fuse_err(__func__, path))
+            .error_or(0);
+    }
+
     i32 readdir(
         const char*                         path,
         void*                               buf,
@@ -317,7 +436,7 @@ namespace madbfs::operations
         [[maybe_unused]] fuse_readdir_flags flags
     ) noexcept
     {
-        log_i("{}: {:?}", __func__, path);
+        log_d("{}: {:?}", __func__, path);
 
         const auto fill = [&](const char* name) { filler(buf, name, nullptr, 0, FUSE_FILL_DIR_PLUS); };
 
@@ -327,9 +446,19 @@ namespace madbfs::operations
             .error_or(0);
     }
 
+    i32 fsyncdir(const char* path, [[maybe_unused]] i32 datasync, fuse_file_info*) noexcept
+    {
+        log_d("{}: {:?}", __func__, path);
+
+        return ok_or(path::create(path), Errc::operation_not_supported)
+            .and_then([](path::Path p) { return invoke_tree(&FileTree::fsyncdir, p); })
+            .transform_error(fuse_err(__func__, path))
+            .error_or(0);
+    }
+
     i32 access([[maybe_unused]] const char* path, [[maybe_unused]] i32 mask) noexcept
     {
-        log_i("{}: {:?}", __func__, path);
+        log_d("{}: {:?}", __func__, path);
 
         // NOTE: empty
 
@@ -338,7 +467,7 @@ namespace madbfs::operations
 
     i32 utimens(const char* path, const timespec tv[2], [[maybe_unused]] fuse_file_info* fi) noexcept
     {
-        log_i("{}: {:?}", __func__, path);
+        log_d("{}: {:?}", __func__, path);
 
         return ok_or(path::create(path), Errc::operation_not_supported)
             .and_then([&](path::Path p) { return invoke_tree(&FileTree::utimens, p, tv[0], tv[1]); })
@@ -357,7 +486,7 @@ namespace madbfs::operations
         [[maybe_unused]] int   flags
     ) noexcept
     {
-        log_i(
+        log_d(
             "{}: [size={}] | {:?} [off={}] -> {:?} [off={}]",
             __func__,
             size,
@@ -380,4 +509,26 @@ namespace madbfs::operations
         auto res = invoke_tree(op, *in, in_fi->fh, in_off, *out, out_fi->fh, out_off, size);
         return res ? static_cast<isize>(res.value()) : fuse_err(__func__, in_path)(res.error());
     }
+
+    i32 fallocate(const char* path, i32 mode, off_t offset, off_t length, fuse_file_info* fi) noexcept
+    {
+        log_d("{}: [mode={:#x}|offset={}|length={}] {:?}", __func__, mode, offset, length, path);
+
+        return ok_or(path::create(path), Errc::operation_not_supported)
+            .and_then([&](path::Path p) {
+                return invoke_tree(&FileTree::fallocate, p, fi->fh, mode, offset, length);
+            })
+            .transform_error(fuse_err(__func__, path))
+            .error_or(0);
+    }
+
+    off_t lseek(const char* path, off_t offset, i32 whence, fuse_file_info* fi) noexcept
+    {
+        log_d("{}: [offset={}|whence={}] {:?}", __func__, offset, whence, path);
+
+        auto res = ok_or(path::create(path), Errc::operation_not_supported).and_then([&](path::Path p) {
+            return invoke_tree(&FileTree::lseek, p, fi->fh, offset, whence);
+        });
+        return res.has_value() ? res.value() : fuse_err(__func__, path)(res.error());
+    }
 }
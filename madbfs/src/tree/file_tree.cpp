@@ -3,13 +3,184 @@
 #include "madbfs/tree/node.hpp"
 
 #include <madbfs-common/log.hpp>
+#include <madbfs-common/util/overload.hpp>
+
+namespace
+{
+    using namespace madbfs::aliases;
+
+    /**
+     * @brief Visit entries of a path-keyed map that overlap with a path.
+     *
+     * Ancestors are visited first starting from root, then the path itself, then its descendants if asked.
+     */
+    template <typename Map, typename Fn>
+    void for_each_overlapping(Map& map, madbfs::path::Path path, bool descendants, Fn&& fn)
+    {
+        if (map.empty()) {
+            return;
+        }
+
+        auto chain = Vec<Str>{};
+        for (auto current = path; not current.is_root(); current = current.parent_path()) {
+            chain.push_back(current.fullpath());
+        }
+        chain.push_back("/");
+
+        for (auto entry : chain | sv::reverse) {
+            if (auto found = map.find(entry); found != map.end()) {
+                fn(found);
+            }
+        }
+
+        if (descendants) {
+            auto prefix = path.is_root() ? String{ "/" } : fmt::format("{}/", path.fullpath());
+            for (auto it = map.lower_bound(prefix); it != map.end() and it->first.starts_with(prefix); ++it) {
+                if (it->first != "/") {
+                    fn(it);
+                }
+            }
+        }
+    }
+}
 
 namespace madbfs::tree
 {
-    FileTree::FileTree(connection::Connection& connection, data::Cache& cache)
+    Opt<path::Path> LinkCache::get(Str target)
+    {
+        auto found = m_index.find(target);
+        if (found == m_index.end()) {
+            return std::nullopt;
+        }
+        m_entries.splice(m_entries.begin(), m_entries, found->second);
+        return found->second->resolved.as_path();
+    }
+
+    void LinkCache::put(Str target, path::PathBuf resolved)
+    {
+        if (auto found = m_index.find(target); found != m_index.end()) {
+            found->second->resolved = std::move(resolved);
+            m_entries.splice(m_entries.begin(), m_entries, found->second);
+            return;
+        }
+
+        if (m_entries.size() >= m_capacity) {
+            m_index.erase(m_entries.back().target);
+            m_entries.pop_back();
+        }
+
+        // NOTE: key refers to the string inside the list node which never moves
+        m_entries.emplace_front(String{ target }, std::move(resolved));
+        m_index.emplace(m_entries.front().target, m_entries.begin());
+    }
+
+    void LinkCache::erase(Str target)
+    {
+        if (auto found = m_index.find(target); found != m_index.end()) {
+            auto entry = found->second;
+            m_index.erase(found);
+            m_entries.erase(entry);
+        }
+    }
+
+    Await<void> Pipeline::submit(path::Path path, Operation operation)
+    {
+        auto exec = co_await async::current_executor();
+
+        auto deps = Vec<saf::shared_future<Errc>>{};
+        for_each_overlapping(m_tails, path, true, [&](auto it) { deps.push_back(it->second.done); });
+
+        auto promise = saf::promise<Errc>{ exec };
+        auto seq     = ++m_seq;
+
+        auto key = String{ path.fullpath() };
+        m_tails.insert_or_assign(key, Tail{ .done = promise.get_future().share(), .seq = seq });
+
+        auto coro = run(std::move(key), seq, std::move(deps), std::move(promise), std::move(operation));
+        async::spawn(exec, std::move(coro), async::detached);
+    }
+
+    AExpect<void> Pipeline::settle(path::Path path, bool descendants)
+    {
+        if (m_tails.empty() and m_errors.empty()) {
+            co_return Expect<void>{};
+        }
+
+        co_await wait(path, descendants);
+
+        auto failed = Opt<decltype(m_errors)::iterator>{};
+        for_each_overlapping(m_errors, path, descendants, [&](auto it) {
+            if (not failed) {
+                failed = it;
+            }
+        });
+
+        if (not failed) {
+            co_return Expect<void>{};
+        }
+
+        auto err = (*failed)->second;
+        m_errors.erase(*failed);
+        co_return Unexpect{ err };
+    }
+
+    Await<void> Pipeline::wait(path::Path path, bool descendants)
+    {
+        auto deps = Vec<saf::shared_future<Errc>>{};
+        for_each_overlapping(m_tails, path, descendants, [&](auto it) { deps.push_back(it->second.done); });
+
+        for (auto& dep : deps) {
+            co_await dep.async_wait();
+        }
+    }
+
+    Await<Vec<Pair<String, Errc>>> Pipeline::drain()
+    {
+        while (not m_tails.empty()) {
+            auto done = m_tails.begin()->second.done;
+            co_await done.async_wait();
+        }
+
+        auto errors = Vec<Pair<String, Errc>>{ m_errors.begin(), m_errors.end() };
+        m_errors.clear();
+        co_return errors;
+    }
+
+    Await<void> Pipeline::run(
+        String                        path,
+        u64                           seq,
+        Vec<saf::shared_future<Errc>> deps,
+        saf::promise<Errc>            promise,
+        Operation                     operation
+    )
+    {
+        // failure of the dependencies doesn't stop this one, the device decides whether it still makes sense
+        for (auto& dep : deps) {
+            co_await dep.async_wait();
+        }
+
+        auto err = Errc{};
+        if (auto res = co_await operation(); not res) {
+            err      = res.error();
+            auto msg = std::make_error_code(err).message();
+            log_w("{}: deferred operation on {:?} failed: {}", __func__, path, msg);
+            m_errors.emplace(path, err);    // the earliest failure on a path is the one reported
+        }
+
+        if (auto tail = m_tails.find(path); tail != m_tails.end() and tail->second.seq == seq) {
+            m_tails.erase(tail);
+        }
+        promise.set_value(err);
+    }
+}
+
+namespace madbfs::tree
+{
+    FileTree::FileTree(connection::Connection& connection, data::Cache& cache, Mode mode)
         : m_root{ "/", nullptr, {}, node::Directory{} }
         , m_connection{ connection }
         , m_cache{ cache }
+        , m_mode{ mode }
     {
     }
 
@@ -99,24 +270,33 @@ namespace madbfs::tree
         case S_IFREG: co_return current->build(name, *stat, node::Regular{}); break;
         case S_IFDIR: co_return current->build(name, *stat, node::Directory{}); break;
         case S_IFLNK: {
+            // target is resolved lazily, see resolve()
             auto may_target = co_await m_connection.readlink(path);
             if (not may_target) {
                 co_return Unexpect{ may_target.error() };
             }
-            auto& target = *may_target;
-
-            co_return (co_await traverse_or_build(target.as_path()))
-                .transform_error([&](Errc err) {
-                    log_e("traverse_or_build: target not found: {:?}", __func__, target.as_path().fullpath());
-                    return err;
-                })
-                .and_then([&](Node& node) { return current->build(name, *stat, node::Link{ &node }); });
+            co_return current->build(name, *stat, node::Link{ std::move(*may_target) });
         } break;
         default: co_return current->build(name, *stat, node::Other{}); break;
         }
     }
 
     AExpect<void> FileTree::readdir(path::Path path, Filler filler)
+    {
+        if (not m_scan or m_scan->dir.as_path().fullpath() != path.fullpath()) {
+            m_scan = Scan{ .dir = path.into_buf() };
+        }
+
+        auto res = co_await list(path, std::move(filler));
+        if (res and m_mode == Mode::ReadOnly and m_expanded.emplace(path.fullpath()).second) {
+            auto exec = co_await async::current_executor();
+            async::spawn(exec, prefetch_ahead(path.into_buf()), async::detached);
+        }
+
+        co_return res;
+    }
+
+    AExpect<void> FileTree::list(path::Path path, Filler filler)
     {
         auto base = &m_root;
 
@@ -137,6 +317,11 @@ namespace madbfs::tree
         // NOTE: base must be a Directory here, since traverse_or_build below code is an else branch of
         // conditional above
 
+        // files created in relaxed mode must reach the device before it is listed
+        if (auto res = co_await settle(path, true); not res) {
+            co_return Unexpect{ res.error() };
+        }
+
         auto may_stats = co_await m_connection.statdir(path);
         if (not may_stats) {
             co_return Unexpect{ may_stats.error() };
@@ -144,7 +329,7 @@ namespace madbfs::tree
 
         auto pathbuf = path.extend_copy("dummy").value();
 
-        for (auto [stat, name] : may_stats.value()) {
+        for (auto [stat, name, target] : may_stats.value()) {
             auto renamed = pathbuf.rename(name);
             if (not renamed) {
                 log_w("{}: failed to extend {:?} with {:?}", __func__, path.fullpath(), name);
@@ -157,15 +342,18 @@ namespace madbfs::tree
             case S_IFREG: built = base->build(name, stat, node::Regular{}); break;
             case S_IFDIR: built = base->build(name, stat, node::Directory{}); break;
             case S_IFLNK: {
+                // server sends the targets along with the listing, other connections need a readlink
+                if (not target.empty()) {
+                    built = base->build(name, stat, node::Link{ path::resolve(path, target) });
+                    break;
+                }
                 auto may_target = co_await m_connection.readlink(pathbuf.as_path());
                 if (not may_target) {
                     auto msg = std::make_error_code(may_target.error()).message();
                     log_e("readdir: {} [{}/{}]", msg, path.fullpath(), name);
                     continue;
                 }
-                built = (co_await traverse_or_build(may_target->as_path())).and_then([&](Node& node) {
-                    return base->build(name, stat, node::Link{ &node });
-                });
+                built = base->build(name, stat, node::Link{ std::move(*may_target) });
             } break;
             default: built = base->build(name, stat, node::Other{}); break;
             }
@@ -189,7 +377,11 @@ namespace madbfs::tree
 
     AExpect<Ref<Node>> FileTree::readlink(path::Path path)
     {
-        co_return (co_await traverse_or_build(path)).and_then(&Node::readlink);
+        auto node = co_await traverse_or_build(path);
+        if (not node) {
+            co_return Unexpect{ node.error() };
+        }
+        co_return co_await resolve(*node);
     }
 
     AExpect<Ref<Node>> FileTree::mknod(path::Path path, mode_t mode, dev_t dev)
@@ -199,6 +391,18 @@ namespace madbfs::tree
         if (not node) {
             co_return Unexpect{ node.error() };
         }
+        if (m_mode == Mode::Relaxed and S_ISREG(mode)) {
+            // the file is created along with its content once released, see send
+            auto created = co_await create_relaxed(node->get(), path, mode, node::Regular{}, nullptr);
+            if (created) {
+                m_cache.create(created->get().id(), path);
+                m_unsent.insert_or_assign(String{ path.fullpath() }, Unsent{ created->get().id(), mode });
+            }
+            co_return created;
+        } else if (m_mode == Mode::Relaxed) {
+            auto create = [=, this](path::Path p) { return m_connection.mknod(p, mode, dev); };
+            co_return co_await create_relaxed(node->get(), path, mode, node::Regular{}, std::move(create));
+        }
         co_return co_await node->get().mknod(make_context(path), mode, dev);
     }
 
@@ -209,11 +413,19 @@ namespace madbfs::tree
         if (not node) {
             co_return Unexpect{ node.error() };
         }
+        if (m_mode == Mode::Relaxed) {
+            auto create = [=, this](path::Path p) { return m_connection.mkdir(p, mode); };
+            co_return co_await create_relaxed(node->get(), path, mode, node::Directory{}, std::move(create));
+        }
         co_return co_await node->get().mkdir(make_context(path), mode);
     }
 
     AExpect<void> FileTree::unlink(path::Path path)
     {
+        if (auto res = co_await settle(path, false); not res) {
+            co_return Unexpect{ res.error() };
+        }
+
         auto parent = path.parent_path();
         auto node   = co_await traverse_or_build(parent);
         if (not node) {
@@ -224,6 +436,10 @@ namespace madbfs::tree
 
     AExpect<void> FileTree::rmdir(path::Path path)
     {
+        if (auto res = co_await settle(path, true); not res) {
+            co_return Unexpect{ res.error() };
+        }
+
         auto parent = path.parent_path();
         auto node   = co_await traverse_or_build(parent);
         if (not node) {
@@ -239,6 +455,12 @@ namespace madbfs::tree
             co_return Unexpect{ Errc::operation_not_supported };
         }
 
+        for (auto path : { from, to }) {
+            if (auto res = co_await settle(path, true); not res) {
+                co_return Unexpect{ res.error() };
+            }
+        }
+
         auto from_node = co_await traverse_or_build(from);
         if (not from_node.has_value()) {
             co_return Unexpect{ from_node.error() };
@@ -273,6 +495,9 @@ namespace madbfs::tree
 
         node->set_name(to.filename());
         node->set_parent(&to_parent->get());
+        if (res->has_value()) {
+            node->set_stat(std::move(res)->value());
+        }
         auto overwritten = to_parent->get().insert(std::move(node), true).value();
 
         if ((flags & RENAME_EXCHANGE) != 0) {
@@ -295,6 +520,10 @@ namespace madbfs::tree
 
     AExpect<void> FileTree::truncate(path::Path path, off_t size)
     {
+        if (auto res = co_await settle(path, false); not res) {
+            co_return Unexpect{ res.error() };
+        }
+
         auto node = co_await traverse_or_build(path);
         if (not node) {
             co_return Unexpect{ node.error() };
@@ -304,11 +533,32 @@ namespace madbfs::tree
 
     AExpect<u64> FileTree::open(path::Path path, int flags)
     {
+        // an unsent file that is still empty has nothing to truncate (open right after mknod has O_TRUNC)
+        if ((flags & O_TRUNC) != 0 and m_unsent.contains(path.fullpath())) {
+            auto node = traverse(path);
+            auto stat = node.and_then([](Node& node) { return node.stat(); });
+            if (stat and stat->get().size == 0) {
+                flags &= ~O_TRUNC;
+            }
+        }
+
+        // direct io and truncation go to the device, an unsent file must be there first
+        auto res = (flags & (O_DIRECT | O_TRUNC)) != 0 ? co_await settle(path, false)
+                                                       : co_await m_pipeline.settle(path, false);
+        if (not res) {
+            co_return Unexpect{ res.error() };
+        }
+
         auto node = co_await traverse_or_build(path);
         if (not node) {
             co_return Unexpect{ node.error() };
         }
-        co_return co_await node->get().open(make_context(path), flags);
+
+        auto fd = co_await node->get().open(make_context(path), flags);
+        if (fd and (flags & O_ACCMODE) == O_RDONLY) {
+            co_await on_open(path);
+        }
+        co_return fd;
     }
 
     AExpect<usize> FileTree::read(path::Path path, u64 fd, Span<char> out, off_t offset)
@@ -322,6 +572,14 @@ namespace madbfs::tree
 
     AExpect<usize> FileTree::write(path::Path path, u64 fd, Str in, off_t offset)
     {
+        // only small files are worth batching, a larger one is sent and written as usual
+        auto end = static_cast<usize>(offset) + in.size();
+        if (end > m_cache.page_size() and m_unsent.contains(path.fullpath())) {
+            if (auto res = co_await settle(path, false); not res) {
+                co_return Unexpect{ res.error() };
+            }
+        }
+
         auto node = co_await traverse_or_build(path);
         if (not node) {
             co_return Unexpect{ node.error() };
@@ -331,6 +589,10 @@ namespace madbfs::tree
 
     AExpect<void> FileTree::flush(path::Path path, u64 fd)
     {
+        if (auto res = co_await m_pipeline.settle(path, false); not res) {
+            co_return Unexpect{ res.error() };
+        }
+
         auto node = co_await traverse_or_build(path);
         if (not node) {
             co_return Unexpect{ node.error() };
@@ -344,7 +606,12 @@ namespace madbfs::tree
         if (not node) {
             co_return Unexpect{ node.error() };
         }
-        co_return co_await node->get().release(make_context(path), fd);
+
+        auto res = co_await node->get().release(make_context(path), fd);
+        if (res and m_unsent.contains(path.fullpath())) {
+            co_await send(path, false);
+        }
+        co_return res;
     }
 
     AExpect<usize> FileTree::copy_file_range(
@@ -357,6 +624,12 @@ namespace madbfs::tree
         size_t     size
     )
     {
+        for (auto path : { in_path, out_path }) {
+            if (auto res = co_await settle(path, false); not res) {
+                co_return Unexpect{ res.error() };
+            }
+        }
+
         // just in-case they have dirty pages
         std::ignore = co_await flush(in_path, in_fd);
         std::ignore = co_await flush(out_path, out_fd);
@@ -377,15 +650,319 @@ namespace madbfs::tree
         });
     }
 
+    AExpect<void> FileTree::fsync(path::Path path, u64 fd)
+    {
+        if (auto res = co_await settle(path, false); not res) {
+            co_return Unexpect{ res.error() };
+        }
+        co_return co_await flush(path, fd);
+    }
+
+    AExpect<void> FileTree::fsyncdir(path::Path path)
+    {
+        co_return co_await settle(path, true);
+    }
+
     AExpect<void> FileTree::utimens(path::Path path, timespec atime, timespec mtime)
     {
         auto node = co_await traverse_or_build(path);
         if (not node) {
             co_return Unexpect{ node.error() };
         }
+
+        if (m_mode == Mode::Relaxed) {
+            if (auto err = node->get().as_error(); err != nullptr) {
+                co_return Unexpect{ err->error };
+            }
+
+            node->get().refresh_stat(atime, mtime);
+
+            // times of a file not sent yet go along with its content
+            auto merge = [](timespec& to, timespec from) {
+                if (from.tv_nsec != UTIME_OMIT) {
+                    to = from;
+                }
+            };
+            if (auto found = m_unsent.find(path.fullpath()); found != m_unsent.end()) {
+                merge(found->second.atime, atime);
+                merge(found->second.mtime, mtime);
+                co_return Expect<void>{};
+            } else if (m_cache.retime(node->get().id(), atime, mtime)) {
+                co_return Expect<void>{};
+            }
+
+            auto deferred = [=, this](path::Path p) { return m_connection.utimens(p, atime, mtime); };
+            co_await defer(path, node->get().id(), false, std::move(deferred));
+            co_return Expect<void>{};
+        }
+
         co_return co_await node->get().utimens(make_context(path), atime, mtime);
     }
 
+    AExpect<void> FileTree::fallocate(path::Path path, u64 fd, i32 mode, off_t offset, off_t length)
+    {
+        if (auto res = co_await settle(path, false); not res) {
+            co_return Unexpect{ res.error() };
+        }
+
+        auto node = co_await traverse_or_build(path);
+        if (not node) {
+            co_return Unexpect{ node.error() };
+        }
+        co_return co_await node->get().fallocate(make_context(path), fd, mode, offset, length);
+    }
+
+    AExpect<off_t> FileTree::lseek(path::Path path, u64 fd, off_t offset, i32 whence)
+    {
+        if (auto res = co_await settle(path, false); not res) {
+            co_return Unexpect{ res.error() };
+        }
+
+        auto node = co_await traverse_or_build(path);
+        if (not node) {
+            co_return Unexpect{ node.error() };
+        }
+        co_return co_await node->get().lseek(make_context(path), fd, offset, whence);
+    }
+
+    AExpect<Ref<Node>> FileTree::create_relaxed(
+        Node&      parent,
+        path::Path path,
+        mode_t     mode,
+        File       file,
+        Deferred   deferred
+    )
+    {
+        if (auto err = parent.as_error(); err != nullptr) {
+            co_return Unexpect{ err->error };
+        }
+
+        auto may_parent_stat = parent.stat();
+        if (not may_parent_stat) {
+            co_return Unexpect{ may_parent_stat.error() };
+        }
+        const auto& parent_stat = may_parent_stat->get();
+
+        // only existence known locally is checked, the device will complain later if it knows better
+        auto overwrite = false;
+        if (auto found = parent.traverse(path.filename()); found.has_value()) {
+            if (found->get().as_error() == nullptr) {
+                co_return Unexpect{ Errc::file_exists };
+            }
+            overwrite = true;
+        }
+
+        auto is_dir = std::holds_alternative<node::Directory>(file);
+        auto stat   = data::Stat{
+            .links = is_dir ? 2u : 1u,
+            .size  = 0,
+            .mode  = static_cast<mode_t>((mode & ~S_IFMT) | (is_dir ? S_IFDIR : S_IFREG)),
+            .uid   = parent_stat.uid,
+            .gid   = parent_stat.gid,
+        };
+
+        auto node = std::make_unique<Node>(path.filename(), &parent, std::move(stat), std::move(file));
+        node->refresh_stat({ .tv_sec = 0, .tv_nsec = UTIME_NOW }, { .tv_sec = 0, .tv_nsec = UTIME_NOW });
+        if (is_dir) {
+            node->set_synced();    // new directory is empty, nothing to list from the device
+        }
+
+        auto inserted = parent.insert(std::move(node), overwrite);
+        if (not inserted) {
+            co_return Unexpect{ inserted.error() };
+        }
+
+        auto& created = inserted->first.get();
+        if (deferred) {
+            co_await defer(path, created.id(), true, std::move(deferred));
+        }
+
+        co_return created;
+    }
+
+    Await<void> FileTree::defer(path::Path path, data::Id id, bool created, Deferred deferred)
+    {
+        auto operation = [this, buf = path.into_buf(), id, created, deferred = std::move(deferred)] mutable
+            -> AExpect<void> {
+            auto path = buf.as_path();
+            auto res  = co_await deferred(path);
+
+            // the node may have been removed or replaced while the operation is in the pipeline
+            auto node = traverse(path);
+            if (not node or node->get().id() != id) {
+                co_return res.transform(sink_void);
+            }
+
+            if (res.has_value()) {
+                if (res->has_value()) {
+                    node->get().set_stat(std::move(res)->value());
+                }
+                co_return Expect<void>{};
+            }
+
+            if (created) {
+                std::ignore = node->get().parent()->extract(path.filename());
+            } else if (auto stat = co_await m_connection.stat(path); stat.has_value()) {
+                node->get().set_stat(std::move(stat).value());
+            }
+
+            co_return Unexpect{ res.error() };
+        };
+
+        co_await m_pipeline.submit(path, std::move(operation));
+    }
+
+    Await<void> FileTree::send(path::Path path, bool descendants)
+    {
+        auto keys = Vec<String>{};
+        for_each_overlapping(m_unsent, path, descendants, [&](auto it) { keys.push_back(it->first); });
+
+        for (auto& key : keys) {
+            auto unsent = m_unsent.extract(key).mapped();
+            auto file   = path::create_buf(std::move(key)).value();
+            auto upload = [=, this](path::Path p) {
+                return m_cache.upload(unsent.id, p, unsent.mode, unsent.atime, unsent.mtime);
+            };
+            co_await defer(file.as_path(), unsent.id, true, std::move(upload));
+        }
+    }
+
+    AExpect<void> FileTree::settle(path::Path path, bool descendants)
+    {
+        co_await send(path, descendants);
+        co_return co_await m_pipeline.settle(path, descendants);
+    }
+
+    Await<void> FileTree::send_unsent()
+    {
+        auto root = path::Path::root();
+        co_await send(root, true);
+        co_await m_pipeline.wait(root, true);
+    }
+
+    Await<void> FileTree::on_open(path::Path path)
+    {
+        // already prefetched as soon as the directory is listed
+        if (m_mode == Mode::ReadOnly) {
+            co_return;
+        }
+
+        if (not m_scan or m_scan->prefetched or m_scan->dir.as_path().fullpath() != path.parent()) {
+            co_return;
+        }
+
+        if (++m_scan->opened < scan_after_opens) {
+            co_return;
+        }
+
+        m_scan->prefetched = true;
+
+        auto exec = co_await async::current_executor();
+        async::spawn(exec, prefetch_small(m_scan->dir), async::detached);
+    }
+
+    Await<void> FileTree::prefetch_small(path::PathBuf dir)
+    {
+        auto dir_node = traverse(dir.as_path());
+        if (not dir_node) {
+            co_return;
+        }
+
+        auto names  = Vec<String>{};
+        std::ignore = dir_node->get().list([&](Str name) { names.emplace_back(name); });
+
+        auto files = Vec<Pair<data::Id, path::PathBuf>>{};
+        for (const auto& name : names) {
+            auto child = dir_node->get().traverse(name);
+            if (not child or not std::holds_alternative<node::Regular>(child->get().value())) {
+                continue;
+            }
+
+            auto size = static_cast<usize>(child->get().stat()->get().size);
+            if (size == 0 or size > m_cache.page_size()) {
+                continue;
+            }
+
+            if (auto path = dir.extend_copy(name); path) {
+                files.emplace_back(child->get().id(), std::move(*path));
+            }
+        }
+
+        if (files.empty()) {
+            co_return;
+        }
+
+        log_d("{}: prefetching {} small files of {:?}", __func__, files.size(), dir.as_path().fullpath());
+        if (auto res = co_await m_cache.prefetch_small(std::move(files)); not res) {
+            auto msg = std::make_error_code(res.error()).message();
+            log_w("{}: failed to prefetch {:?}: {}", __func__, dir.as_path().fullpath(), msg);
+        }
+    }
+
+    Await<void> FileTree::prefetch_ahead(path::PathBuf dir)
+    {
+        co_await prefetch_small(dir);
+
+        auto subdirs = Vec<path::PathBuf>{};
+        if (auto dir_node = traverse(dir.as_path()); dir_node) {
+            std::ignore = dir_node->get().list([&](Str name) {
+                auto child = dir_node->get().traverse(name);
+                if (not child or not std::holds_alternative<node::Directory>(child->get().value())) {
+                    return;
+                }
+                if (auto path = dir.extend_copy(name); path and not child->get().has_synced()) {
+                    subdirs.push_back(std::move(*path));
+                }
+            });
+        }
+
+        // one after another, the link is better left to the foreground requests
+        for (const auto& subdir : subdirs) {
+            if (auto res = co_await list(subdir.as_path(), [](const char*) { }); res) {
+                co_await prefetch_small(subdir);
+            }
+        }
+    }
+
+    AExpect<Ref<Node>> FileTree::resolve(Node& node)
+    {
+        auto current = &node;
+        auto first   = Opt<path::PathBuf>{};
+
+        for (auto _ : sv::iota(0uz, max_link_hops)) {
+            auto link = std::get_if<node::Link>(&current->value());
+            if (link == nullptr) {
+                if (first) {
+                    m_links.put(first->as_path().fullpath(), current->build_path());
+                }
+                co_return *current;
+            }
+
+            // copied since the link may be removed while awaiting
+            auto target = link->target().into_buf();
+            if (not first) {
+                first = target;
+            }
+
+            if (auto cached = m_links.get(target.as_path().fullpath())) {
+                auto found = traverse(*cached);
+                if (found and not std::holds_alternative<node::Link>(found->get().value())) {
+                    co_return found;
+                }
+                m_links.erase(target.as_path().fullpath());
+            }
+
+            auto next = co_await traverse_or_build(target.as_path());
+            if (not next) {
+                log_e("{}: target not found: {:?}", __func__, target.as_path().fullpath());
+                co_return Unexpect{ next.error() };
+            }
+            current = &next->get();
+        }
+
+        co_return Unexpect{ Errc::too_many_symbolic_link_levels };
+    }
+
     Expect<void> FileTree::symlink(path::Path path, path::Path target)
     {
         // for now, disallow linking to non-existent target
@@ -399,8 +976,103 @@ namespace madbfs::tree
             .transform(sink_void);
     }
 
+    AExpect<void> FileTree::walk(path::Path path, bool recursive, Visitor visitor)
+    {
+        auto may_stat = co_await getattr(path);
+        if (not may_stat) {
+            co_return Unexpect{ may_stat.error() };
+        }
+
+        // copied since the node may be modified while awaiting
+        auto stat = may_stat->get();
+        switch (stat.mode & S_IFMT) {
+        case S_IFREG: co_return co_await visitor(path, stat);
+        case S_IFDIR: break;
+        default: co_return Unexpect{ Errc::operation_not_supported };
+        }
+
+        auto dirs = Vec<path::PathBuf>{ path.into_buf() };
+
+        while (not dirs.empty()) {
+            auto dir = std::move(dirs.back());
+            dirs.pop_back();
+
+            auto names = Vec<String>{};
+            auto res   = co_await readdir(dir.as_path(), [&](const char* name) { names.emplace_back(name); });
+            if (not res) {
+                auto msg = std::make_error_code(res.error()).message();
+                log_w("{}: failed to list {:?}: {}", __func__, dir.as_path().fullpath(), msg);
+                continue;
+            }
+
+            for (const auto& name : names) {
+                auto child = dir.extend_copy(name);
+                if (not child) {
+                    continue;    // '.' and '..'
+                }
+
+                auto may_child_stat = co_await getattr(child->as_path());
+                if (not may_child_stat) {
+                    auto msg = std::make_error_code(may_child_stat.error()).message();
+                    log_w("{}: failed to stat {:?}: {}", __func__, child->as_path().fullpath(), msg);
+                    continue;
+                }
+
+                auto child_stat = may_child_stat->get();
+                switch (child_stat.mode & S_IFMT) {
+                case S_IFREG:
+                    if (auto visited = co_await visitor(child->as_path(), child_stat); not visited) {
+                        co_return Unexpect{ visited.error() };
+                    }
+                    break;
+                case S_IFDIR:
+                    if (recursive) {
+                        dirs.push_back(std::move(*child));
+                    }
+                    break;
+                default: break;
+                }
+            }
+        }
+
+        co_return Expect<void>{};
+    }
+
     Await<void> FileTree::shutdown()
     {
+        co_await send(path::Path::root(), true);
+        for (const auto& [path, err] : co_await m_pipeline.drain()) {
+            auto msg = std::make_error_code(err).message();
+            log_e("{}: deferred operation on {:?} failed and never reported: {}", __func__, path, msg);
+        }
+
         co_await m_cache.shutdown();
     }
+
+    FileTree::NodeCount FileTree::count_nodes() const
+    {
+        auto count = NodeCount{};
+        auto stack = Vec<const Node*>{ &m_root };
+
+        while (not stack.empty()) {
+            auto node = stack.back();
+            stack.pop_back();
+
+            auto visit = util::Overload{
+                [&](const node::Regular&) { ++count.regular; },
+                [&](const node::Directory& dir) {
+                    ++count.directory;
+                    for (const auto& child : dir.children()) {
+                        stack.push_back(child.get());
+                    }
+                },
+                [&](const node::Link&) { ++count.link; },
+                [&](const node::Other&) { ++count.other; },
+                [&](const node::Error&) { ++count.error; },
+            };
+            std::visit(visit, node->value());
+        }
+
+        return count;
+    }
 }
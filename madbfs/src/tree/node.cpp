@@ -2,6 +2,28 @@
 
 #include <madbfs-common/util/overload.hpp>
 
+#include <linux/falloc.h>
+
+namespace
+{
+    using namespace madbfs::aliases;
+
+    /**
+     * @brief Use the stat returned by a mutating operation, falls back to stat the file if it's not given.
+     */
+    madbfs::AExpect<madbfs::data::Stat> stat_or_fetch(
+        madbfs::connection::Connection& connection,
+        madbfs::path::Path              path,
+        Opt<madbfs::data::Stat>         stat
+    )
+    {
+        if (stat.has_value()) {
+            co_return std::move(stat).value();
+        }
+        co_return co_await connection.stat(path);
+    }
+}
+
 namespace madbfs::tree
 {
     u64 node::Directory::NodeHash::operator()(const Uniq<Node>& node) const
@@ -101,6 +123,14 @@ namespace madbfs::tree
         return path::create_buf(std::move(path)).value();
     }
 
+    void Node::set_stat(data::Stat stat)
+    {
+        // id is the identity of the node in the cache, stat from the device always comes with a new one
+        auto id   = m_stat.id;
+        m_stat    = std::move(stat);
+        m_stat.id = id;
+    }
+
     void Node::refresh_stat(timespec atime, timespec mtime)
     {
         auto now  = Clock::now().time_since_epoch();
@@ -216,7 +246,8 @@ namespace madbfs::tree
                 .gid   = 0,
             };
 
-            auto node = std::make_unique<Node>(name, this, std::move(dummy_stat), node::Link{ target });
+            auto link = node::Link{ target->build_path() };
+            auto node = std::make_unique<Node>(name, this, std::move(dummy_stat), std::move(link));
             return dir.insert(std::move(node), false).transform([&](auto&& pair) { return pair.first; });
         });
     }
@@ -243,11 +274,12 @@ namespace madbfs::tree
             overwrite = true;
         }
 
-        if (auto created = co_await context.connection.mknod(context.path, mode, dev); not created) {
+        auto created = co_await context.connection.mknod(context.path, mode, dev);
+        if (not created) {
             co_return Unexpect{ created.error() };
         }
 
-        co_return (co_await context.connection.stat(context.path))
+        co_return (co_await stat_or_fetch(context.connection, context.path, std::move(created).value()))
             .and_then([&](data::Stat stat) {
                 auto node = std::make_unique<Node>(name, this, std::move(stat), node::Regular{});
                 return dir.insert(std::move(node), overwrite);
@@ -282,7 +314,7 @@ namespace madbfs::tree
             co_return Unexpect{ may_mkdir.error() };
         }
 
-        co_return (co_await context.connection.stat(context.path))
+        co_return (co_await stat_or_fetch(context.connection, context.path, std::move(may_mkdir).value()))
             .and_then([&](data::Stat stat) {
                 auto node = std::make_unique<Node>(name, this, std::move(stat), node::Directory{});
                 return dir.insert(std::move(node), overwrite);
@@ -360,7 +392,8 @@ namespace madbfs::tree
             co_return Unexpect{ may_file.error() };
         }
 
-        if (auto res = co_await context.connection.truncate(context.path, size); not res) {
+        auto res = co_await context.connection.truncate(context.path, size);
+        if (not res) {
             co_return Unexpect{ res.error() };
         }
 
@@ -370,8 +403,12 @@ namespace madbfs::tree
         // error from Cache::truncate are from eviction only, which should not matter for this file
         std::ignore = co_await context.cache.truncate(id(), old_size, new_size);
 
-        m_stat.size = size;
-        refresh_stat({ .tv_sec = 0, .tv_nsec = UTIME_OMIT }, { .tv_sec = 0, .tv_nsec = UTIME_NOW });
+        if (res->has_value()) {
+            set_stat(std::move(res)->value());
+        } else {
+            m_stat.size = size;
+            refresh_stat({ .tv_sec = 0, .tv_nsec = UTIME_OMIT }, { .tv_sec = 0, .tv_nsec = UTIME_NOW });
+        }
 
         co_return Expect<void>{};
     }
@@ -384,6 +421,24 @@ namespace madbfs::tree
         }
         auto& file = may_file->get();
 
+        // the old content is discarded as a whole, none of it is worth flushing or pulling again
+        if ((flags & O_TRUNC) != 0) {
+            auto res = co_await context.connection.truncate(context.path, 0);
+            if (not res) {
+                co_return Unexpect{ res.error() };
+            }
+
+            co_await context.cache.invalidate_one(id(), false);
+            file.set_dirty(false);
+
+            if (res->has_value()) {
+                set_stat(std::move(res)->value());
+            } else {
+                m_stat.size = 0;
+                refresh_stat({ .tv_sec = 0, .tv_nsec = UTIME_OMIT }, { .tv_sec = 0, .tv_nsec = UTIME_NOW });
+            }
+        }
+
         auto fd  = context.fd_counter.fetch_add(1, std::memory_order::relaxed) + 1;
         auto res = file.open(fd, flags);
         assert(res);
@@ -403,7 +458,12 @@ namespace madbfs::tree
             co_return Unexpect{ Errc::bad_file_descriptor };
         }
 
-        co_return (co_await context.cache.read(id(), context.path, out, offset)).transform([&](usize ret) {
+        // the size lets the cache pick the page size of the file
+        auto size = static_cast<usize>(m_stat.size);
+        auto res  = file.is_direct(fd) ? co_await context.cache.read_direct(id(), context.path, out, offset)
+                                       : co_await context.cache.read(id(), context.path, out, offset, size);
+
+        co_return res.transform([&](usize ret) {
             refresh_stat({ .tv_sec = 0, .tv_nsec = UTIME_NOW }, { .tv_sec = 0, .tv_nsec = UTIME_OMIT });
             return ret;
         });
@@ -422,7 +482,12 @@ namespace madbfs::tree
         }
 
         file.set_dirty(true);
-        co_return (co_await context.cache.write(id(), context.path, in, offset)).transform([&](usize ret) {
+
+        auto size = static_cast<usize>(m_stat.size);
+        auto res  = file.is_direct(fd) ? co_await context.cache.write_direct(id(), context.path, in, offset)
+                                       : co_await context.cache.write(id(), context.path, in, offset, size);
+
+        co_return res.transform([&](usize ret) {
             // the file size is defined as offset + size from last write if it's higher than previous size
             // NOTE: this may be different for sparse files but I don't think Android has it
             auto new_size = offset + static_cast<off_t>(ret);
@@ -471,20 +536,109 @@ namespace madbfs::tree
 
     AExpect<void> Node::utimens(Context context, timespec atime, timespec mtime)
     {
-        if (auto res = co_await context.connection.utimens(context.path, atime, mtime); not res) {
+        auto res = co_await context.connection.utimens(context.path, atime, mtime);
+        if (not res) {
             co_return Unexpect{ res.error() };
         }
-        co_return (co_await context.connection.stat(context.path)).transform([&](data::Stat stat) {
-            m_stat = std::move(stat);
+
+        auto stat = co_await stat_or_fetch(context.connection, context.path, std::move(res).value());
+        co_return std::move(stat).transform([&](data::Stat stat) {
+            set_stat(std::move(stat));
         });
     }
 
+    AExpect<void> Node::fallocate(Context context, u64 fd, i32 mode, off_t offset, off_t length)
+    {
+        auto may_file = regular_file_prelude();
+        if (not may_file) {
+            co_return Unexpect{ may_file.error() };
+        }
+        auto& file = may_file->get();
+
+        if (not file.is_open(fd)) {
+            co_return Unexpect{ Errc::bad_file_descriptor };
+        }
+
+        // other than plain allocation, the content changes on the device so it must have the latest first
+        auto changes_content = (mode & ~FALLOC_FL_KEEP_SIZE) != 0;
+        if (changes_content) {
+            if (auto res = co_await context.cache.flush(id()); not res) {
+                co_return Unexpect{ res.error() };
+            }
+        }
+
+        auto res = co_await context.connection.fallocate(context.path, mode, offset, length);
+        if (not res) {
+            co_return Unexpect{ res.error() };
+        }
+
+        auto old_size = static_cast<usize>(m_stat.size);
+        auto stat     = co_await stat_or_fetch(context.connection, context.path, std::move(res).value());
+        if (not stat) {
+            co_return Unexpect{ stat.error() };
+        }
+        auto new_size = static_cast<usize>(stat->size);
+        set_stat(std::move(stat).value());
+
+        // punched or zeroed ranges are pulled again, allocated range past the end reads as zeros
+        if (changes_content) {
+            co_await context.cache.invalidate_one(id(), false);
+        } else if (new_size > old_size) {
+            std::ignore = co_await context.cache.truncate(id(), old_size, new_size);
+        }
+
+        co_return Expect<void>{};
+    }
+
+    AExpect<off_t> Node::lseek(Context context, u64 fd, off_t offset, i32 whence)
+    {
+        auto may_file = regular_file_prelude();
+        if (not may_file) {
+            co_return Unexpect{ may_file.error() };
+        }
+        auto& file = may_file->get();
+
+        if (not file.is_open(fd)) {
+            co_return Unexpect{ Errc::bad_file_descriptor };
+        } else if (whence != SEEK_DATA and whence != SEEK_HOLE) {
+            co_return Unexpect{ Errc::invalid_argument };
+        } else if (offset >= m_stat.size) {
+            co_return Unexpect{ Errc::no_such_device_or_address };    // known without asking the device
+        }
+
+        // data not yet flushed would be seen as holes by the device
+        if (auto res = co_await context.cache.flush(id()); not res) {
+            co_return Unexpect{ res.error() };
+        }
+
+        co_return co_await context.connection.lseek(context.path, offset, whence);
+    }
+
     Expect<Ref<Node>> Node::readlink()
     {
+        auto root = this;
+        while (root->m_parent != nullptr) {
+            root = root->m_parent;
+        }
+
         auto current = this;
-        while (current->is<node::Link>()) {
-            current = &current->as<node::Link>()->get().target();
+        for (auto hops = 0uz; current->is<node::Link>(); ++hops) {
+            if (hops == max_link_hops) {
+                return Unexpect{ Errc::too_many_symbolic_link_levels };
+            }
+
+            auto target = current->as<node::Link>()->get().target();
+
+            current = root;
+            for (auto name : target.iter() | sv::drop(1)) {
+                auto next = current->traverse(name);
+                if (not next) {
+                    return Unexpect{ next.error() };
+                }
+                current = &next->get();
+            }
         }
+
         return *current;
     }
 }
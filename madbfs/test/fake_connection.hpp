@@ -0,0 +1,558 @@
+#pragma once
+
+#include "madbfs/connection/connection.hpp"
+#include "madbfs/path.hpp"
+
+#include <map>
+#include <random>
+
+#include <linux/falloc.h>
+#include <sys/stat.h>
+
+namespace mock
+{
+    using namespace madbfs::aliases;
+
+    using madbfs::AExpect;
+    using madbfs::Errc;
+    using madbfs::Unexpect;
+
+    /**
+     * @class FakeConnection
+     * @brief In-memory implementation of `Connection`.
+     *
+     * Files are stored in a flat map keyed by their full path. Used by tests and benchmarks to exercise the
+     * tree and the cache without a device.
+     *
+     * Each operation can be given a `Fault`: latency (with jitter) simulated with a timer so concurrent
+     * operations interleave like they do on a real device, and an error returned with given probability.
+     * The random source is seeded so a failing run can be reproduced. Files can also be changed behind the
+     * back of the caller using `modify` to simulate another process on the device.
+     *
+     * Mutating operations return the stat after the operation like the server does.
+     */
+    class FakeConnection final : public madbfs::connection::Connection
+    {
+    public:
+        using Path       = madbfs::path::Path;
+        using PathBuf    = madbfs::path::PathBuf;
+        using Stat       = madbfs::data::Stat;
+        using ParsedStat = madbfs::connection::ParsedStat;
+        using Upload     = madbfs::connection::Upload;
+        using Timing     = madbfs::connection::ServerTiming;
+
+        struct File
+        {
+            Stat      stat;
+            Vec<char> data;
+            String    target;    // symlink target
+        };
+
+        enum class Op
+        {
+            Statdir,
+            Stat,
+            Readlink,
+            Mknod,
+            Mkdir,
+            Unlink,
+            Rmdir,
+            Rename,
+            Truncate,
+            Read,
+            Write,
+            Utimens,
+            CopyFileRange,
+            ReadMany,
+            WriteMany,
+            Fallocate,
+            Lseek,
+
+            Count_,
+        };
+
+        struct Fault
+        {
+            std::chrono::microseconds latency    = {};
+            std::chrono::microseconds jitter     = {};    // uniformly added to latency
+            double                    error_rate = 0.0;
+            Errc                      error      = Errc::io_error;
+        };
+
+        FakeConnection(u64 seed = 0)
+            : m_rng{ seed }
+        {
+            m_files.emplace("/", File{ .stat = { .mode = S_IFDIR | 0755 } });
+        }
+
+        void set_fault(Op op, Fault fault) { m_faults[static_cast<usize>(op)] = fault; }
+
+        void set_fault_all(Fault fault) { m_faults.fill(fault); }
+
+        void clear_faults() { m_faults.fill(Fault{}); }
+
+        /**
+         * @brief Modify file content directly, bypassing the connection (file must exist).
+         *
+         * Unlike `write`, this bumps the modification time like an external writer would.
+         */
+        void modify(Str path, off_t offset, Span<const char> data)
+        {
+            auto& file = m_files.at(String{ path });
+            auto  off  = static_cast<usize>(offset);
+
+            if (off + data.size() > file.data.size()) {
+                file.data.resize(off + data.size());
+                file.stat.size = static_cast<off_t>(file.data.size());
+            }
+            sr::copy(data, file.data.begin() + static_cast<isize>(off));
+
+            ++file.stat.mtime.tv_sec;
+        }
+
+        /**
+         * @brief Add a regular file directly, bypassing the connection (parent must exist).
+         */
+        File& add_file(Str path, Vec<char> data = {})
+        {
+            auto size = static_cast<off_t>(data.size());
+            auto file = File{ .stat = { .size = size, .mode = S_IFREG | 0644 }, .data = std::move(data) };
+            return m_files.insert_or_assign(String{ path }, std::move(file)).first->second;
+        }
+
+        /**
+         * @brief Add a directory directly, bypassing the connection (parent must exist).
+         */
+        File& add_dir(Str path)
+        {
+            auto file = File{ .stat = { .mode = S_IFDIR | 0755 } };
+            return m_files.insert_or_assign(String{ path }, std::move(file)).first->second;
+        }
+
+        /**
+         * @brief Add a symlink directly, bypassing the connection (parent must exist).
+         */
+        File& add_link(Str path, Str target)
+        {
+            auto file = File{ .stat = { .mode = S_IFLNK | 0777 }, .target = String{ target } };
+            return m_files.insert_or_assign(String{ path }, std::move(file)).first->second;
+        }
+
+        File* find(Str path)
+        {
+            auto it = m_files.find(path);
+            return it == m_files.end() ? nullptr : &it->second;
+        }
+
+        usize num_calls(Op op) const { return m_calls[static_cast<usize>(op)]; }
+        usize num_reads() const { return num_calls(Op::Read); }
+        usize num_writes() const { return num_calls(Op::Write); }
+
+        AExpect<Gen<ParsedStat>> statdir(Path path) override
+        {
+            if (auto res = co_await inject(Op::Statdir); not res) {
+                co_return Unexpect{ res.error() };
+            }
+
+            auto dir = find(path.fullpath());
+            if (dir == nullptr) {
+                co_return Unexpect{ Errc::no_such_file_or_directory };
+            } else if (not S_ISDIR(dir->stat.mode)) {
+                co_return Unexpect{ Errc::not_a_directory };
+            }
+
+            auto entries = Vec<Tup<String, Stat, String>>{};
+            for (const auto& [name, file] : children(path.fullpath())) {
+                entries.emplace_back(name, file->stat, file->target);
+            }
+
+            auto generator = [](Vec<Tup<String, Stat, String>> entries) -> Gen<ParsedStat> {
+                for (const auto& [name, stat, target] : entries) {
+                    co_yield ParsedStat{ .stat = stat, .path = name, .target = target };
+                }
+            };
+
+            co_return generator(std::move(entries));
+        }
+
+        AExpect<Stat> stat(Path path) override
+        {
+            if (auto res = co_await inject(Op::Stat); not res) {
+                co_return Unexpect{ res.error() };
+            }
+
+            if (auto file = find(path.fullpath()); file != nullptr) {
+                co_return file->stat;
+            }
+            co_return Unexpect{ Errc::no_such_file_or_directory };
+        }
+
+        AExpect<PathBuf> readlink(Path path) override
+        {
+            if (auto res = co_await inject(Op::Readlink); not res) {
+                co_return Unexpect{ res.error() };
+            }
+
+            auto file = find(path.fullpath());
+            if (file == nullptr) {
+                co_return Unexpect{ Errc::no_such_file_or_directory };
+            } else if (not S_ISLNK(file->stat.mode)) {
+                co_return Unexpect{ Errc::invalid_argument };
+            }
+            co_return madbfs::path::resolve(path.parent_path(), file->target);
+        }
+
+        AExpect<Opt<Stat>> mknod(Path path, mode_t mode, dev_t) override
+        {
+            if (auto res = co_await inject(Op::Mknod); not res) {
+                co_return Unexpect{ res.error() };
+            }
+
+            if (auto res = check_create(path); not res) {
+                co_return Unexpect{ res.error() };
+            }
+            auto& file     = add_file(path.fullpath());
+            file.stat.mode = mode | S_IFREG;
+            co_return file.stat;
+        }
+
+        AExpect<Opt<Stat>> mkdir(Path path, mode_t mode) override
+        {
+            if (auto res = co_await inject(Op::Mkdir); not res) {
+                co_return Unexpect{ res.error() };
+            }
+
+            if (auto res = check_create(path); not res) {
+                co_return Unexpect{ res.error() };
+            }
+            auto& file     = add_dir(path.fullpath());
+            file.stat.mode = mode | S_IFDIR;
+            co_return file.stat;
+        }
+
+        AExpect<void> unlink(Path path) override
+        {
+            if (auto res = co_await inject(Op::Unlink); not res) {
+                co_return Unexpect{ res.error() };
+            }
+
+            auto file = find(path.fullpath());
+            if (file == nullptr) {
+                co_return Unexpect{ Errc::no_such_file_or_directory };
+            } else if (S_ISDIR(file->stat.mode)) {
+                co_return Unexpect{ Errc::is_a_directory };
+            }
+            m_files.erase(String{ path.fullpath() });
+            co_return Expect<void>{};
+        }
+
+        AExpect<void> rmdir(Path path) override
+        {
+            if (auto res = co_await inject(Op::Rmdir); not res) {
+                co_return Unexpect{ res.error() };
+            }
+
+            auto file = find(path.fullpath());
+            if (file == nullptr) {
+                co_return Unexpect{ Errc::no_such_file_or_directory };
+            } else if (not S_ISDIR(file->stat.mode)) {
+                co_return Unexpect{ Errc::not_a_directory };
+            } else if (not children(path.fullpath()).empty()) {
+                co_return Unexpect{ Errc::directory_not_empty };
+            }
+            m_files.erase(String{ path.fullpath() });
+            co_return Expect<void>{};
+        }
+
+        AExpect<Opt<Stat>> rename(Path from, Path to, u32) override
+        {
+            if (auto res = co_await inject(Op::Rename); not res) {
+                co_return Unexpect{ res.error() };
+            }
+
+            auto node = m_files.extract(String{ from.fullpath() });
+            if (node.empty()) {
+                co_return Unexpect{ Errc::no_such_file_or_directory };
+            }
+
+            // move descendants as well
+            auto prefix = String{ from.fullpath() } + '/';
+            auto moved  = Vec<Pair<String, File>>{};
+            auto it     = m_files.lower_bound(prefix);
+            while (it != m_files.end() and it->first.starts_with(prefix)) {
+                auto name = String{ to.fullpath() } + it->first.substr(prefix.size() - 1);
+                moved.emplace_back(std::move(name), std::move(it->second));
+                it = m_files.erase(it);
+            }
+
+            node.key() = String{ to.fullpath() };
+            auto& file = m_files.insert_or_assign(node.key(), std::move(node.mapped())).first->second;
+            auto  stat = file.stat;
+            for (auto& [name, file] : moved) {
+                m_files.insert_or_assign(std::move(name), std::move(file));
+            }
+
+            co_return stat;
+        }
+
+        AExpect<Opt<Stat>> truncate(Path path, off_t size) override
+        {
+            if (auto res = co_await inject(Op::Truncate); not res) {
+                co_return Unexpect{ res.error() };
+            }
+
+            auto file = find(path.fullpath());
+            if (file == nullptr) {
+                co_return Unexpect{ Errc::no_such_file_or_directory };
+            }
+            file->data.resize(static_cast<usize>(size));
+            file->stat.size = size;
+            co_return file->stat;
+        }
+
+        AExpect<usize> read(Path path, Span<char> out, off_t offset) override
+        {
+            if (auto res = co_await inject(Op::Read); not res) {
+                co_return Unexpect{ res.error() };
+            }
+
+            auto file = find(path.fullpath());
+            if (file == nullptr) {
+                co_return Unexpect{ Errc::no_such_file_or_directory };
+            }
+
+            auto off = std::min(static_cast<usize>(offset), file->data.size());
+            auto len = std::min(out.size(), file->data.size() - off);
+            sr::copy_n(file->data.begin() + static_cast<isize>(off), static_cast<isize>(len), out.begin());
+
+            co_return len;
+        }
+
+        AExpect<usize> write(Path path, Span<const char> in, off_t offset) override
+        {
+            if (auto res = co_await inject(Op::Write); not res) {
+                co_return Unexpect{ res.error() };
+            }
+
+            auto file = find(path.fullpath());
+            if (file == nullptr) {
+                co_return Unexpect{ Errc::no_such_file_or_directory };
+            }
+
+            auto off = static_cast<usize>(offset);
+            if (off + in.size() > file->data.size()) {
+                file->data.resize(off + in.size());
+                file->stat.size = static_cast<off_t>(file->data.size());
+            }
+            sr::copy(in, file->data.begin() + static_cast<isize>(off));
+
+            co_return in.size();
+        }
+
+        AExpect<Opt<Stat>> utimens(Path path, timespec atime, timespec mtime) override
+        {
+            if (auto res = co_await inject(Op::Utimens); not res) {
+                co_return Unexpect{ res.error() };
+            }
+
+            auto file = find(path.fullpath());
+            if (file == nullptr) {
+                co_return Unexpect{ Errc::no_such_file_or_directory };
+            }
+            file->stat.atime = atime;
+            file->stat.mtime = mtime;
+            co_return file->stat;
+        }
+
+        AExpect<Opt<Stat>> fallocate(Path path, i32 mode, off_t offset, off_t length) override
+        {
+            if (auto res = co_await inject(Op::Fallocate); not res) {
+                co_return Unexpect{ res.error() };
+            }
+
+            auto file = find(path.fullpath());
+            if (file == nullptr) {
+                co_return Unexpect{ Errc::no_such_file_or_directory };
+            }
+
+            // there is no allocation to speak of, only the effect on size and content is modeled
+            auto end = static_cast<usize>(offset + length);
+            if (mode == 0 and end > file->data.size()) {
+                file->data.resize(end);
+                file->stat.size = static_cast<off_t>(end);
+            } else if (mode == (FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE)) {
+                auto first = std::min(static_cast<usize>(offset), file->data.size());
+                auto last  = std::min(end, file->data.size());
+                std::fill_n(file->data.begin() + static_cast<isize>(first), last - first, '\0');
+            } else if (mode != 0 and mode != FALLOC_FL_KEEP_SIZE) {
+                co_return Unexpect{ Errc::operation_not_supported };
+            }
+
+            co_return file->stat;
+        }
+
+        AExpect<off_t> lseek(Path path, off_t offset, i32 whence) override
+        {
+            if (auto res = co_await inject(Op::Lseek); not res) {
+                co_return Unexpect{ res.error() };
+            }
+
+            auto file = find(path.fullpath());
+            if (file == nullptr) {
+                co_return Unexpect{ Errc::no_such_file_or_directory };
+            }
+
+            // files have no holes, except the implicit one at the end
+            if (offset >= file->stat.size) {
+                co_return Unexpect{ Errc::no_such_device_or_address };
+            }
+            co_return whence == SEEK_DATA ? offset : file->stat.size;
+        }
+
+        AExpect<usize> copy_file_range(Path in, off_t in_off, Path out, off_t out_off, usize size) override
+        {
+            if (auto res = co_await inject(Op::CopyFileRange); not res) {
+                co_return Unexpect{ res.error() };
+            }
+
+            auto src = find(in.fullpath());
+            auto dst = find(out.fullpath());
+            if (src == nullptr or dst == nullptr) {
+                co_return Unexpect{ Errc::no_such_file_or_directory };
+            }
+
+            auto off = std::min(static_cast<usize>(in_off), src->data.size());
+            auto len = std::min(size, src->data.size() - off);
+            auto buf = Vec<char>(len);
+            sr::copy_n(src->data.begin() + static_cast<isize>(off), static_cast<isize>(len), buf.begin());
+
+            auto dst_off = static_cast<usize>(out_off);
+            if (dst_off + len > dst->data.size()) {
+                dst->data.resize(dst_off + len);
+                dst->stat.size = static_cast<off_t>(dst->data.size());
+            }
+            sr::copy(buf, dst->data.begin() + static_cast<isize>(dst_off));
+
+            co_return len;
+        }
+
+        AExpect<Vec<Expect<usize>>> read_many(Span<const Path> paths, Span<const Span<char>> outs) override
+        {
+            if (auto res = co_await inject(Op::ReadMany); not res) {
+                co_return Unexpect{ res.error() };
+            }
+
+            auto result = Vec<Expect<usize>>{};
+            for (auto [path, out] : sv::zip(paths, outs)) {
+                auto file = find(path.fullpath());
+                if (file == nullptr) {
+                    result.emplace_back(Unexpect{ Errc::no_such_file_or_directory });
+                    continue;
+                }
+                auto len = std::min(out.size(), file->data.size());
+                sr::copy_n(file->data.begin(), static_cast<isize>(len), out.begin());
+                result.emplace_back(len);
+            }
+
+            co_return result;
+        }
+
+        AExpect<Vec<Expect<Opt<Stat>>>> write_many(Span<const Path> paths, Span<const Upload> files) override
+        {
+            if (auto res = co_await inject(Op::WriteMany); not res) {
+                co_return Unexpect{ res.error() };
+            }
+
+            auto result = Vec<Expect<Opt<Stat>>>{};
+            for (auto [path, upload] : sv::zip(paths, files)) {
+                if (auto res = check_create(path); not res and res.error() != Errc::file_exists) {
+                    result.emplace_back(Unexpect{ res.error() });
+                    continue;
+                }
+
+                auto& file     = add_file(path.fullpath(), { upload.data.begin(), upload.data.end() });
+                file.stat.mode = upload.mode | S_IFREG;
+                if (upload.atime.tv_nsec != UTIME_OMIT) {
+                    file.stat.atime = upload.atime;
+                }
+                if (upload.mtime.tv_nsec != UTIME_OMIT) {
+                    file.stat.mtime = upload.mtime;
+                }
+                result.emplace_back(file.stat);
+            }
+
+            co_return result;
+        }
+
+        AExpect<Vec<Timing>> server_stats(bool) override
+        {
+            co_return Unexpect{ Errc::operation_not_supported };
+        }
+
+    private:
+        AExpect<void> inject(Op op)
+        {
+            ++m_calls[static_cast<usize>(op)];
+
+            auto fault = m_faults[static_cast<usize>(op)];
+
+            auto delay = fault.latency;
+            if (fault.jitter.count() > 0) {
+                auto dist  = std::uniform_int_distribution<i64>{ 0, fault.jitter.count() };
+                delay     += std::chrono::microseconds{ dist(m_rng) };
+            }
+
+            if (delay.count() > 0) {
+                auto timer = madbfs::async::Timer{ co_await madbfs::async::current_executor() };
+                timer.expires_after(delay);
+                std::ignore = co_await timer.async_wait();
+            }
+
+            if (fault.error_rate > 0.0 and std::bernoulli_distribution{ fault.error_rate }(m_rng)) {
+                co_return Unexpect{ fault.error };
+            }
+
+            co_return Expect<void>{};
+        }
+
+        Vec<Pair<Str, const File*>> children(Str dir)
+        {
+            auto prefix = String{ dir };
+            if (prefix.back() != '/') {
+                prefix += '/';
+            }
+
+            auto result = Vec<Pair<Str, const File*>>{};
+            for (auto it = m_files.lower_bound(prefix); it != m_files.end() and it->first.starts_with(prefix);
+                 ++it) {
+                auto name = Str{ it->first }.substr(prefix.size());
+                if (not name.empty() and name.find('/') == Str::npos) {
+                    result.emplace_back(name, &it->second);
+                }
+            }
+            return result;
+        }
+
+        Expect<void> check_create(Path path)
+        {
+            if (find(path.fullpath()) != nullptr) {
+                return Unexpect{ Errc::file_exists };
+            }
+            auto parent = find(path.parent());
+            if (parent == nullptr) {
+                return Unexpect{ Errc::no_such_file_or_directory };
+            } else if (not S_ISDIR(parent->stat.mode)) {
+                return Unexpect{ Errc::not_a_directory };
+            }
+            return {};
+        }
+
+        std::map<String, File, std::less<>> m_files;
+
+        static constexpr auto num_ops = static_cast<usize>(Op::Count_);
+
+        std::mt19937_64          m_rng;
+        Array<Fault, num_ops>    m_faults = {};
+        Array<usize, num_ops>    m_calls  = {};
+    };
+}
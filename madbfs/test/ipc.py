@@ -108,10 +108,26 @@ def main() -> int:
     op = {"op": "invalidate_cache"}
     # op = {"op": "help"}
 
+    # op = {"op": "get_stats"}
+    # op = {"op": "get_recent_ops", "value": {"count": 20}}
+    # op = {"op": "reset_stats"}
+
+    # op = {"op": "start_trace", "value": {"file": "/tmp/madbfs.trace"}}
+    # op = {"op": "stop_trace"}
+
+    # op = {"op": "get_metrics"}
+
+    # op = {"op": "prefetch", "value": {"path": "/sdcard/DCIM", "recursive": True, "rate_kib": 4096}}
+    # op = {"op": "pin", "value": {"path": "/sdcard/DCIM", "recursive": True}}
+    # op = {"op": "unpin", "value": {"path": "/sdcard/DCIM", "recursive": True}}
+
     Protocol.send(sock, json.dumps(op))
-    resp = Protocol.receive(sock)
-    if resp is not None:
+
+    # long running operations send progress messages before the final reply
+    while (resp := Protocol.receive(sock)) is not None:
         print(resp[0])
+        if json.loads(resp[0]).get("status") != "progress":
+            break
 
     eprint("closing socket")
     sock.close()
@@ -0,0 +1,739 @@
+#include "fake_connection.hpp"
+#include "test_util.hpp"
+
+#include "madbfs/data/cache.hpp"
+
+#include <boost/ut.hpp>
+#include <fmt/format.h>
+#include <spdlog/spdlog.h>
+
+#include <cstdlib>
+#include <random>
+
+namespace ut = boost::ext::ut;
+using namespace madbfs::aliases;
+
+using madbfs::Await;
+using madbfs::data::Cache;
+using madbfs::data::Id;
+using mock::FakeConnection;
+using mock::run;
+
+using Fault    = FakeConnection::Fault;
+using Op       = FakeConnection::Op;
+using Clock    = std::chrono::steady_clock;
+using Duration = std::chrono::nanoseconds;
+
+using std::chrono::microseconds;
+
+namespace
+{
+    constexpr auto page_size = 4096uz;
+
+    /**
+     * @brief Seed for randomized tests, can be overridden with `MADBFS_TEST_SEED` env var to reproduce a run.
+     */
+    u64 test_seed()
+    {
+        static const auto seed = [] {
+            auto env  = std::getenv("MADBFS_TEST_SEED");
+            auto seed = env != nullptr ? std::strtoull(env, nullptr, 10) : 0x6d61'6462'6673ull;
+            fmt::println("test seed: {}", seed);
+            return static_cast<u64>(seed);
+        }();
+        return seed;
+    }
+
+    Vec<char> random_bytes(std::mt19937_64& rng, usize size)
+    {
+        auto dist  = std::uniform_int_distribution<int>{ 0, 255 };
+        auto bytes = Vec<char>(size);
+        sr::generate(bytes, [&] { return static_cast<char>(dist(rng)); });
+        return bytes;
+    }
+
+    /**
+     * @brief Cache on top of a fake connection, with a context to run it on and a seeded random source.
+     */
+    struct Fixture
+    {
+        Fixture(usize max_pages, usize page = page_size, madbfs::data::Rules rules = {})
+            : cache{ fake, page, max_pages, std::move(rules) }
+        {
+        }
+
+        template <typename T>
+        T run(Await<T> coro)
+        {
+            return mock::run(io, std::move(coro));
+        }
+
+        madbfs::async::Context io;
+        FakeConnection         fake{ test_seed() };
+        Cache                  cache;
+        std::mt19937_64        rng{ test_seed() };
+    };
+
+    struct Report
+    {
+        Vec<Duration> latencies;
+        usize         bytes  = 0;
+        usize         errors = 0;
+
+        void print(Str name, Duration elapsed) const
+        {
+            auto sorted = latencies;
+            sr::sort(sorted);
+
+            auto pct = [&](double p) {
+                auto idx = static_cast<usize>(p * static_cast<double>(sorted.size() - 1));
+                return std::chrono::duration_cast<microseconds>(sorted[idx]).count();
+            };
+
+            auto secs = std::chrono::duration<double>(elapsed).count();
+            fmt::println(
+                "{}: {} ops, {} errors, {:.2f} MiB/s, {:.0f} ops/s, latency (us) p50={} p90={} p99={} max={}",
+                name,
+                sorted.size(),
+                errors,
+                static_cast<double>(bytes) / 1024 / 1024 / secs,
+                static_cast<double>(sorted.size()) / secs,
+                pct(0.5),
+                pct(0.9),
+                pct(0.99),
+                pct(1.0)
+            );
+        }
+    };
+
+    struct File
+    {
+        Id                 id = madbfs::data::Stat{}.id;
+        String             name;
+        madbfs::path::Path path;
+        Vec<char>          model;    // expected content
+        usize              mismatch = 0;
+    };
+
+    /**
+     * @brief Random reads, writes, and flushes on a single file, checked against its model.
+     *
+     * Writes never create holes (offset is at most the current size) and reads never go past the end of the
+     * file since the cache is not aware of the file size, the kernel does that.
+     */
+    Await<void> worker(Cache& cache, File& file, u64 seed, usize num_ops, bool writes, Report& report)
+    {
+        auto rng      = std::mt19937_64{ seed };
+        auto max_len  = 3 * page_size + page_size / 2;
+        auto op_dist  = std::uniform_int_distribution<int>{ 0, 9 };
+        auto len_dist = std::uniform_int_distribution<usize>{ 1, max_len };
+
+        for (auto _ : sv::iota(0uz, num_ops)) {
+            auto op    = op_dist(rng);
+            auto start = Clock::now();
+
+            if (op < 6 or not writes) {
+                if (file.model.empty()) {
+                    continue;
+                }
+
+                auto off = std::uniform_int_distribution<usize>{ 0, file.model.size() - 1 }(rng);
+                auto len = std::min(len_dist(rng), file.model.size() - off);
+                auto buf = Vec<char>(len);
+
+                auto res = co_await cache.read(file.id, file.path, buf, static_cast<off_t>(off));
+                if (not res) {
+                    ++report.errors;
+                } else if (*res != len or not sr::equal(buf, Span{ file.model }.subspan(off, len))) {
+                    ++file.mismatch;
+                } else {
+                    report.bytes += len;
+                }
+            } else if (op < 9) {
+                auto off  = std::uniform_int_distribution<usize>{ 0, file.model.size() }(rng);
+                auto data = random_bytes(rng, len_dist(rng));
+
+                auto size = file.model.size();
+                auto res  = co_await cache.write(file.id, file.path, data, static_cast<off_t>(off), size);
+                if (not res) {
+                    ++report.errors;
+                    continue;
+                } else if (*res != data.size()) {
+                    ++file.mismatch;
+                }
+
+                if (off + data.size() > file.model.size()) {
+                    file.model.resize(off + data.size());
+                }
+                sr::copy(data, file.model.begin() + static_cast<isize>(off));
+                report.bytes += data.size();
+            } else {
+                if (auto res = co_await cache.flush(file.id); not res) {
+                    ++report.errors;
+                }
+            }
+
+            report.latencies.push_back(Clock::now() - start);
+        }
+    }
+
+    /**
+     * @brief Append chunks smaller than a page to the end of a file, checked against its model.
+     */
+    Await<void> appender(Cache& cache, File& file, u64 seed, usize num_ops)
+    {
+        auto rng      = std::mt19937_64{ seed };
+        auto len_dist = std::uniform_int_distribution<usize>{ 1, page_size / 2 };
+
+        for (auto _ : sv::iota(0uz, num_ops)) {
+            auto off  = file.model.size();
+            auto data = random_bytes(rng, len_dist(rng));
+
+            auto res = co_await cache.write(file.id, file.path, data, static_cast<off_t>(off), off);
+            if (not res or *res != data.size()) {
+                ++file.mismatch;
+                continue;
+            }
+            file.model.insert(file.model.end(), data.begin(), data.end());
+        }
+    }
+
+    Await<void> read_expect(
+        Cache&             cache,
+        Id                 id,
+        madbfs::path::Path path,
+        Span<char>         out,
+        Span<const char>   expected,
+        usize&             ok
+    )
+    {
+        auto res = co_await cache.read(id, path, out, 0);
+        if (res.has_value() and sr::equal(out, expected)) {
+            ++ok;
+        }
+    }
+
+    /**
+     * @brief Create files on the fake connection with random content.
+     */
+    Vec<File> make_files(FakeConnection& fake, std::mt19937_64& rng, usize count, usize max_size)
+    {
+        auto files = Vec<File>(count);
+        for (auto i : sv::iota(0uz, count)) {
+            auto& file = files[i];
+            auto  size = std::uniform_int_distribution<usize>{ 0, max_size }(rng);
+
+            file.name  = fmt::format("/file-{}", i);
+            file.path  = madbfs::path::create(file.name).value();
+            file.model = random_bytes(rng, size);
+
+            fake.add_file(file.name, file.model);
+        }
+        return files;
+    }
+}
+
+int main()
+{
+    using namespace ut::literals;
+    using namespace ut::operators;
+    using ut::expect, ut::that;
+
+    spdlog::set_level(spdlog::level::off);
+
+    "read spanning multiple pages returns device content"_test = [] {
+        auto fix = Fixture{ 64 };
+
+        auto data = random_bytes(fix.rng, 5 * page_size + 123);
+        fix.fake.add_file("/file", data);
+
+        auto id   = madbfs::data::Stat{}.id;
+        auto path = madbfs::path::create("/file").value();
+
+        auto buf = Vec<char>(2 * page_size + 10);
+        auto res = fix.run(fix.cache.read(id, path, buf, page_size - 5));
+
+        expect(res.has_value() and *res == buf.size());
+        expect(sr::equal(buf, Span{ data }.subspan(page_size - 5, buf.size())));
+
+        // second read is served from cache
+        auto reads = fix.fake.num_reads();
+        res        = fix.run(fix.cache.read(id, path, buf, page_size - 5));
+        expect(res.has_value() and sr::equal(buf, Span{ data }.subspan(page_size - 5, buf.size())));
+        expect(that % fix.fake.num_reads() == reads);
+    };
+
+    "partial write on uncached page keeps the rest of the page"_test = [] {
+        auto fix = Fixture{ 64 };
+
+        auto data = random_bytes(fix.rng, 2 * page_size);
+        fix.fake.add_file("/file", data);
+
+        auto id   = madbfs::data::Stat{}.id;
+        auto path = madbfs::path::create("/file").value();
+
+        auto patch = random_bytes(fix.rng, 100);
+        auto res   = fix.run(fix.cache.write(id, path, patch, 1000));
+        expect(res.has_value() and *res == patch.size());
+        expect(fix.run(fix.cache.flush(id)).has_value());
+
+        sr::copy(patch, data.begin() + 1000);
+        expect(fix.fake.find("/file")->data == data);
+    };
+
+    "random appends past end of file only pull the page holding the old end"_test = [] {
+        auto fix = Fixture{ 256 };    // no eviction, an evicted tail page is pulled again
+
+        auto files = make_files(fix.fake, fix.rng, 8, 4 * page_size);
+        files[0].model.clear();    // an empty file and one ending at a page boundary are always covered
+        files[1].model.resize(2 * page_size);
+        for (auto& file : sv::take(files, 2)) {
+            fix.fake.find(file.name)->data = file.model;
+        }
+
+        // only a page holding data before the old end of file has anything on the device
+        auto is_unaligned = [](const File& file) { return file.model.size() % page_size != 0; };
+        auto unaligned    = sr::count_if(files, is_unaligned);
+
+        for (auto& file : files) {
+            madbfs::async::spawn(fix.io, appender(fix.cache, file, fix.rng(), 40), madbfs::async::detached);
+        }
+        fix.io.run();
+
+        fix.run(fix.cache.shutdown());
+
+        for (const auto& file : files) {
+            expect(that % file.mismatch == 0u) << file.name << "append failed";
+            expect(fix.fake.find(file.name)->data == file.model) << file.name << "device content differs";
+        }
+        expect(that % fix.fake.num_reads() == static_cast<usize>(unaligned));
+    };
+
+    "truncate drops pages past the new size and all of them on truncate to zero"_test = [] {
+        auto fix = Fixture{ 64 };
+
+        auto data = random_bytes(fix.rng, 3 * page_size);
+        fix.fake.add_file("/file", data);
+
+        auto id   = madbfs::data::Stat{}.id;
+        auto path = madbfs::path::create("/file").value();
+
+        auto buf = Vec<char>(data.size());
+        expect(fix.run(fix.cache.read(id, path, buf, 0)).has_value());
+        expect(that % fix.cache.usage().pages == 3u);
+
+        auto new_size = page_size + 10;
+        fix.fake.find("/file")->data.resize(new_size);
+        expect(fix.run(fix.cache.truncate(id, data.size(), new_size)).has_value());
+        expect(that % fix.cache.usage().pages == 2u);
+        expect(that % fix.cache.usage().bytes == new_size);
+
+        auto res = fix.run(fix.cache.read(id, path, buf, 0));
+        expect(res.has_value() and *res == new_size);
+
+        fix.fake.find("/file")->data.clear();
+        expect(fix.run(fix.cache.truncate(id, new_size, 0)).has_value());
+        expect(that % fix.cache.usage().pages == 0u);
+    };
+
+    "external modification is visible after invalidation only"_test = [] {
+        auto fix = Fixture{ 64 };
+
+        auto data = random_bytes(fix.rng, page_size);
+        fix.fake.add_file("/file", data);
+
+        auto id   = madbfs::data::Stat{}.id;
+        auto path = madbfs::path::create("/file").value();
+        auto buf  = Vec<char>(page_size);
+
+        expect(fix.run(fix.cache.read(id, path, buf, 0)).has_value());
+
+        auto changed = random_bytes(fix.rng, page_size);
+        fix.fake.modify("/file", 0, changed);
+
+        // the cache doesn't revalidate by itself, the file tree invalidates on mtime change
+        expect(fix.run(fix.cache.read(id, path, buf, 0)).has_value());
+        expect(buf == data);
+
+        fix.run(fix.cache.invalidate_one(id, false));
+        expect(fix.run(fix.cache.read(id, path, buf, 0)).has_value());
+        expect(buf == changed);
+    };
+
+    "failed pull is not cached and can be retried"_test = [] {
+        auto fix = Fixture{ 64 };
+
+        auto data = random_bytes(fix.rng, 4 * page_size);
+        fix.fake.add_file("/file", data);
+
+        auto id   = madbfs::data::Stat{}.id;
+        auto path = madbfs::path::create("/file").value();
+        auto buf  = Vec<char>(data.size());
+
+        fix.fake.set_fault(Op::Read, { .error_rate = 1.0, .error = Errc::io_error });
+        auto res = fix.run(fix.cache.read(id, path, buf, 0));
+        expect(not res.has_value() and res.error() == Errc::io_error);
+
+        fix.fake.clear_faults();
+        res = fix.run(fix.cache.read(id, path, buf, 0));
+        expect(res.has_value() and *res == data.size());
+        expect(buf == data);
+    };
+
+    "concurrent readers of the same page pull it once"_test = [] {
+        auto fix = Fixture{ 64 };
+
+        auto data = random_bytes(fix.rng, page_size);
+        fix.fake.add_file("/file", data);
+        fix.fake.set_fault(Op::Read, { .latency = microseconds{ 500 } });
+
+        auto id   = madbfs::data::Stat{}.id;
+        auto path = madbfs::path::create("/file").value();
+        auto bufs = Vec<Vec<char>>(8, Vec<char>(page_size));
+        auto ok   = 0uz;
+
+        for (auto& buf : bufs) {
+            auto coro = read_expect(fix.cache, id, path, buf, data, ok);
+            madbfs::async::spawn(fix.io, std::move(coro), madbfs::async::detached);
+        }
+        fix.io.run();
+
+        expect(that % ok == bufs.size());
+        expect(that % fix.fake.num_reads() == 1u);
+    };
+
+    "prefetched file is served from cache"_test = [] {
+        auto fix = Fixture{ 64 };
+
+        auto data = random_bytes(fix.rng, 6 * page_size + 10);
+        fix.fake.add_file("/file", data);
+
+        auto id       = madbfs::data::Stat{}.id;
+        auto path     = madbfs::path::create("/file").value();
+        auto throttle = madbfs::data::Throttle{ 0 };
+
+        auto pulled = fix.run(fix.cache.prefetch(id, path, data.size(), throttle));
+        expect(pulled.has_value() and *pulled == data.size());
+        expect(that % fix.fake.num_reads() == 7u);
+
+        // already cached pages are not pulled again
+        pulled = fix.run(fix.cache.prefetch(id, path, data.size(), throttle));
+        expect(pulled.has_value() and *pulled == 0u);
+
+        auto buf = Vec<char>(data.size());
+        expect(fix.run(fix.cache.read(id, path, buf, 0)).has_value());
+        expect(buf == data);
+        expect(that % fix.fake.num_reads() == 7u);
+    };
+
+    "pinned pages survive eviction until unpinned"_test = [] {
+        auto fix = Fixture{ 8 };
+
+        auto pinned = random_bytes(fix.rng, 4 * page_size);
+        auto other  = random_bytes(fix.rng, 16 * page_size);
+        fix.fake.add_file("/pinned", pinned);
+        fix.fake.add_file("/other", other);
+
+        auto pinned_id   = madbfs::data::Stat{}.id;
+        auto pinned_path = madbfs::path::create("/pinned").value();
+        auto other_id    = madbfs::data::Stat{}.id;
+        auto other_path  = madbfs::path::create("/other").value();
+
+        auto buf = Vec<char>(pinned.size());
+        fix.cache.pin(pinned_id, pinned_path);
+        expect(fix.run(fix.cache.read(pinned_id, pinned_path, buf, 0)).has_value());
+
+        auto other_buf = Vec<char>(other.size());
+        expect(fix.run(fix.cache.read(other_id, other_path, other_buf, 0)).has_value());
+        expect(that % fix.cache.usage().pinned_pages == 4u);
+
+        auto reads = fix.fake.num_reads();
+        expect(fix.run(fix.cache.read(pinned_id, pinned_path, buf, 0)).has_value());
+        expect(buf == pinned);
+        expect(that % fix.fake.num_reads() == reads);
+
+        fix.cache.unpin(pinned_id);
+        expect(that % fix.cache.usage().pinned_pages == 0u);
+        expect(fix.run(fix.cache.read(other_id, other_path, other_buf, 0)).has_value());
+
+        reads = fix.fake.num_reads();
+        expect(fix.run(fix.cache.read(pinned_id, pinned_path, buf, 0)).has_value());
+        expect(buf == pinned);
+        expect(that % fix.fake.num_reads() > reads);
+    };
+
+    "caches sharing a budget evict from the one furthest above its share"_test = [] {
+        auto io      = madbfs::async::Context{};
+        auto budget  = madbfs::data::Budget{ 16 * page_size };
+        auto fake_a  = FakeConnection{};
+        auto fake_b  = FakeConnection{};
+        auto cache_a = Cache{ fake_a, page_size, budget };
+        auto cache_b = Cache{ fake_b, page_size, budget };
+        auto rng     = std::mt19937_64{ test_seed() };
+
+        expect(that % budget.share() == 8 * page_size);
+
+        auto big   = random_bytes(rng, 16 * page_size);
+        auto small = random_bytes(rng, 6 * page_size);
+        fake_a.add_file("/big", big);
+        fake_b.add_file("/small1", small);
+        fake_b.add_file("/small2", small);
+
+        auto id  = madbfs::data::Stat{}.id;
+        auto buf = Vec<char>(big.size());
+
+        // an idle device leaves its share to the other
+        expect(run(io, cache_a.read(id, madbfs::path::create("/big").value(), buf, 0)).has_value());
+        expect(that % cache_a.used_bytes() == 16 * page_size);
+
+        buf.resize(small.size());
+        expect(run(io, cache_b.read(id, madbfs::path::create("/small1").value(), buf, 0)).has_value());
+        expect(that % cache_a.used_bytes() == 10 * page_size);
+        expect(that % cache_b.used_bytes() == 6 * page_size);
+
+        // once both are at their share, each one evicts its own pages
+        auto id2 = madbfs::data::Stat{}.id;
+        expect(run(io, cache_b.read(id2, madbfs::path::create("/small2").value(), buf, 0)).has_value());
+        expect(buf == small);
+        expect(that % cache_a.used_bytes() == 8 * page_size);
+        expect(that % cache_b.used_bytes() == 8 * page_size);
+        expect(that % budget.used() == 16 * page_size);
+    };
+
+    "direct files bypass the cache and write-through files are flushed on write"_test = [] {
+        auto rules = madbfs::data::Rules::parse("/direct/** direct\n/sync/** write-through\n");
+        auto fix   = Fixture{ 64, page_size, std::move(rules).value() };
+
+        fix.fake.add_dir("/direct");
+        fix.fake.add_dir("/sync");
+        fix.fake.add_file("/direct/file", random_bytes(fix.rng, 2 * page_size));
+        fix.fake.add_file("/sync/file", random_bytes(fix.rng, 2 * page_size));
+
+        auto direct_id   = madbfs::data::Stat{}.id;
+        auto direct_path = madbfs::path::create("/direct/file").value();
+        auto sync_id     = madbfs::data::Stat{}.id;
+        auto sync_path   = madbfs::path::create("/sync/file").value();
+
+        auto buf = Vec<char>(page_size);
+        expect(fix.run(fix.cache.read(direct_id, direct_path, buf, 0)).has_value());
+        expect(fix.run(fix.cache.read(direct_id, direct_path, buf, 0)).has_value());
+        expect(that % fix.fake.num_reads() == 2u);
+        expect(that % fix.cache.usage().pages == 0u);
+
+        auto data = random_bytes(fix.rng, 100);
+        expect(fix.run(fix.cache.write(direct_id, direct_path, data, 10)).has_value());
+        expect(sr::equal(Span{ fix.fake.find("/direct/file")->data }.subspan(10, 100), data));
+
+        expect(fix.run(fix.cache.write(sync_id, sync_path, data, 10)).has_value());
+        expect(sr::equal(Span{ fix.fake.find("/sync/file")->data }.subspan(10, 100), data));
+        expect(that % fix.cache.usage().dirty_pages == 0u);
+    };
+
+    "long sequential read bypasses the cache"_test = [] {
+        auto fix = Fixture{ 4 * Cache::stream_after_pages };
+
+        auto data = random_bytes(fix.rng, 2 * Cache::stream_after_pages * page_size + 123);
+        fix.fake.add_file("/file", data);
+
+        auto id   = madbfs::data::Stat{}.id;
+        auto path = madbfs::path::create("/file").value();
+
+        auto buf = Vec<char>(data.size());
+        for (auto offset = 0uz; offset < data.size(); offset += 2 * page_size) {
+            auto span = Span{ buf }.subspan(offset, std::min(2 * page_size, data.size() - offset));
+            auto res  = fix.run(fix.cache.read(id, path, span, static_cast<off_t>(offset)));
+            expect(res.has_value() and *res == span.size());
+        }
+
+        expect(buf == data);
+        expect(that % fix.cache.usage().pages <= Cache::stream_after_pages + 2);
+    };
+
+    "direct read and write stay coherent with cached pages"_test = [] {
+        auto fix = Fixture{ 64 };
+
+        auto data = random_bytes(fix.rng, 4 * page_size);
+        fix.fake.add_file("/file", data);
+
+        auto id   = madbfs::data::Stat{}.id;
+        auto path = madbfs::path::create("/file").value();
+
+        // dirty cached data is visible to a direct read
+        auto dirty = random_bytes(fix.rng, 100);
+        expect(fix.run(fix.cache.write(id, path, dirty, page_size + 10)).has_value());
+        sr::copy(dirty, data.begin() + page_size + 10);
+
+        auto buf = Vec<char>(data.size());
+        expect(fix.run(fix.cache.read_direct(id, path, buf, 0)).has_value());
+        expect(buf == data);
+
+        // direct write is visible to a cached read
+        auto direct = random_bytes(fix.rng, 2 * page_size);
+        expect(fix.run(fix.cache.write_direct(id, path, direct, page_size / 2)).has_value());
+        sr::copy(direct, data.begin() + page_size / 2);
+
+        expect(fix.run(fix.cache.read(id, path, buf, 0)).has_value());
+        expect(buf == data);
+        expect(fix.run(fix.cache.flush(id)).has_value());
+        expect(fix.fake.find("/file")->data == data);
+    };
+
+    "page size of a file follows its size and access pattern"_test = [] {
+        constexpr auto base = 64 * 1024uz;
+
+        auto fix = Fixture{ 4 * Cache::large_after_pages, base };
+
+        auto data = random_bytes(fix.rng, Cache::large_after_pages * base + 123);
+        fix.fake.add_file("/file", data);
+
+        auto id   = madbfs::data::Stat{}.id;
+        auto path = madbfs::path::create("/file").value();
+        auto buf  = Vec<char>(4096);
+
+        // large file starts with large pages
+        expect(fix.run(fix.cache.read(id, path, buf, 0, data.size())).has_value());
+        expect(sr::equal(buf, Span{ data }.first(buf.size())));
+        expect(that % fix.cache.usage().large_files == 1u);
+        expect(that % fix.cache.used_bytes() == fix.cache.page_size(madbfs::data::PageClass::Large));
+
+        // small random accesses move it to small pages
+        for (auto i : sv::iota(0uz, Cache::small_after_accesses)) {
+            auto offset = ((i * 7 + 3) % Cache::large_after_pages) * base + 100;
+            auto res    = fix.run(fix.cache.read(id, path, buf, static_cast<off_t>(offset), data.size()));
+            expect(res.has_value() and sr::equal(buf, Span{ data }.subspan(offset, buf.size())));
+        }
+        expect(that % fix.cache.usage().small_files == 1u);
+        expect(that % fix.cache.usage().large_files == 0u);
+
+        auto patch   = random_bytes(fix.rng, 3000);
+        auto offset  = 5 * base + 7000;    // straddles two small pages
+        auto written = fix.run(fix.cache.write(id, path, patch, static_cast<off_t>(offset), data.size()));
+        expect(written.has_value());
+        sr::copy(patch, data.begin() + static_cast<isize>(offset));
+
+        // still large enough for large pages
+        auto new_size = data.size() - 100;
+        fix.fake.find("/file")->data.resize(new_size);
+        expect(fix.run(fix.cache.truncate(id, data.size(), new_size)).has_value());
+        data.resize(new_size);
+
+        expect(fix.run(fix.cache.flush(id)).has_value());
+        expect(fix.fake.find("/file")->data == data);
+
+        // sequential read moves it back to large pages once its pages are clean
+        auto whole = Vec<char>(data.size());
+        for (auto off = 0uz; off < whole.size(); off += base) {
+            auto span = Span{ whole }.subspan(off, std::min(base, whole.size() - off));
+            auto res  = fix.run(fix.cache.read(id, path, span, static_cast<off_t>(off), new_size));
+            expect(res.has_value() and *res == span.size());
+        }
+        expect(whole == data);
+        expect(that % fix.cache.usage().large_files == 1u);
+        expect(that % fix.cache.usage().small_files == 0u);
+    };
+
+    "randomized read/write with eviction and writeback matches model"_test = [] {
+        auto fix = Fixture{ 24 };    // far smaller than the working set
+
+        fix.fake.set_fault(Op::Read, { .latency = microseconds{ 50 }, .jitter = microseconds{ 200 } });
+        fix.fake.set_fault(Op::Write, { .latency = microseconds{ 50 }, .jitter = microseconds{ 200 } });
+
+        auto files   = make_files(fix.fake, fix.rng, 6, 16 * page_size);
+        auto reports = Vec<Report>(files.size());
+
+        for (auto i : sv::iota(0uz, files.size())) {
+            auto coro = worker(fix.cache, files[i], fix.rng(), 400, true, reports[i]);
+            madbfs::async::spawn(fix.io, std::move(coro), madbfs::async::detached);
+        }
+
+        auto start = Clock::now();
+        fix.io.run();
+        auto elapsed = Clock::now() - start;
+
+        fix.run(fix.cache.shutdown());
+
+        auto total = Report{};
+        for (const auto& [file, report] : sv::zip(files, reports)) {
+            expect(that % file.mismatch == 0u) << file.name << "read or write returned wrong data";
+            expect(that % report.errors == 0u) << file.name << "unexpected error";
+            expect(fix.fake.find(file.name)->data == file.model) << file.name << "device content differs";
+
+            total.latencies.insert(total.latencies.end(), report.latencies.begin(), report.latencies.end());
+            total.bytes += report.bytes;
+        }
+        total.print("mixed", elapsed);
+
+        expect(that % fix.fake.num_writes() > 0u) << "eviction or flush must push dirty pages";
+    };
+
+    "randomized reads under injected errors never return wrong data"_test = [] {
+        auto fix = Fixture{ 16 };
+
+        auto fault = Fault{ .latency = microseconds{ 20 }, .jitter = microseconds{ 100 }, .error_rate = 0.1 };
+        fix.fake.set_fault(Op::Read, fault);
+
+        auto files   = make_files(fix.fake, fix.rng, 4, 32 * page_size);
+        auto reports = Vec<Report>(files.size());
+
+        for (auto i : sv::iota(0uz, files.size())) {
+            auto coro = worker(fix.cache, files[i], fix.rng(), 400, false, reports[i]);
+            madbfs::async::spawn(fix.io, std::move(coro), madbfs::async::detached);
+        }
+
+        auto start = Clock::now();
+        fix.io.run();
+        auto elapsed = Clock::now() - start;
+
+        auto total = Report{};
+        for (const auto& [file, report] : sv::zip(files, reports)) {
+            expect(that % file.mismatch == 0u) << file.name << "read returned wrong data";
+
+            total.latencies.insert(total.latencies.end(), report.latencies.begin(), report.latencies.end());
+            total.bytes  += report.bytes;
+            total.errors += report.errors;
+        }
+        total.print("faulty reads", elapsed);
+
+        expect(that % total.errors > 0u) << "errors should have been injected";
+
+        // cache must stay usable once the device is healthy again
+        fix.fake.clear_faults();
+        for (auto& file : files) {
+            if (file.model.empty()) {
+                continue;
+            }
+            auto buf = Vec<char>(file.model.size());
+            auto res = fix.run(fix.cache.read(file.id, file.path, buf, 0));
+            expect(res.has_value() and buf == file.model) << file.name << "read after recovery failed";
+        }
+    };
+
+    "sequential read throughput over cold cache"_test = [] {
+        auto fix = Fixture{ 32 };
+
+        fix.fake.set_fault(Op::Read, { .latency = microseconds{ 100 } });
+
+        auto data = random_bytes(fix.rng, 256 * page_size);
+        fix.fake.add_file("/file", data);
+
+        auto id     = madbfs::data::Stat{}.id;
+        auto path   = madbfs::path::create("/file").value();
+        auto report = Report{};
+        auto chunk  = 8 * page_size;
+
+        auto start = Clock::now();
+        for (auto off = 0uz; off < data.size(); off += chunk) {
+            auto buf = Vec<char>(chunk);
+            auto t0  = Clock::now();
+            auto res = fix.run(fix.cache.read(id, path, buf, static_cast<off_t>(off)));
+            report.latencies.push_back(Clock::now() - t0);
+
+            expect(res.has_value() and sr::equal(buf, Span{ data }.subspan(off, chunk)));
+            report.bytes += chunk;
+        }
+        report.print("sequential read", Clock::now() - start);
+
+        auto pages = data.size() / page_size;
+        expect(that % fix.fake.num_reads() == pages) << "each page must be pulled exactly once";
+    };
+}
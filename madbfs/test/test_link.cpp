@@ -0,0 +1,183 @@
+#include <madbfs-common/link.hpp>
+#include <madbfs-common/rpc.hpp>
+
+#include <boost/ut.hpp>
+
+#include <fmt/format.h>
+
+namespace ut = boost::ext::ut;
+using namespace madbfs::aliases;
+
+using madbfs::link::Clock;
+using madbfs::link::Direction;
+using madbfs::link::Emulator;
+using madbfs::link::Profile;
+
+namespace rpc = madbfs::rpc;
+
+using std::chrono::microseconds;
+using std::chrono::milliseconds;
+
+int main()
+{
+    using namespace ut::literals;
+    using namespace ut::operators;
+    using ut::expect, ut::that;
+
+    "link profile can be parsed from preset and key-value list"_test = [] {
+        auto usb2 = madbfs::link::parse_profile("usb2");
+        expect(usb2.has_value());
+        expect(usb2->latency > microseconds{ 0 });
+        expect(usb2->bandwidth > 0u);
+
+        auto custom = madbfs::link::parse_profile("lat=5,jitter=1,bw=4096,overhead=64");
+        expect(custom.has_value());
+        expect(custom->latency == milliseconds{ 5 });
+        expect(custom->jitter == milliseconds{ 1 });
+        expect(custom->bandwidth == 4096u * 1024);
+        expect(custom->frame_overhead == 64u);
+
+        auto partial = madbfs::link::parse_profile("lat=20");
+        expect(partial.has_value());
+        expect(partial->latency == milliseconds{ 20 });
+        expect(partial->bandwidth == 0u);
+
+        auto seeded = madbfs::link::parse_profile("wifi,seed=7,lat=3");
+        expect(seeded.has_value());
+        expect(seeded->seed == 7u);
+        expect(seeded->latency == milliseconds{ 3 });
+        expect(seeded->bandwidth == madbfs::link::parse_profile("wifi")->bandwidth);
+
+        expect(not madbfs::link::parse_profile("usb4").has_value());
+        expect(not madbfs::link::parse_profile("lat=5,wifi").has_value());
+        expect(not madbfs::link::parse_profile("lat=abc").has_value());
+        expect(not madbfs::link::parse_profile("lat=5,unknown=1").has_value());
+        expect(not madbfs::link::parse_profile("lat").has_value());
+    };
+
+    "latency only link delays delivery without serializing frames"_test = [] {
+        auto emu = Emulator{ Profile{ .latency = milliseconds{ 10 } } };
+        auto now = Clock::now();
+
+        auto first  = emu.schedule(Direction::Uplink, 1024, now);
+        auto second = emu.schedule(Direction::Uplink, 1024, now);
+
+        expect(first.sent == now);
+        expect(second.sent == now);
+        expect(first.delivered == now + milliseconds{ 10 });
+        expect(second.delivered == now + milliseconds{ 10 });
+    };
+
+    "bandwidth limited link serializes frames on the same direction"_test = [] {
+        auto profile = Profile{
+            .latency        = milliseconds{ 1 },
+            .bandwidth      = 1024 * 1024,    // 1 MiB/s
+            .frame_overhead = 0,
+        };
+
+        auto emu = Emulator{ profile };
+        auto now = Clock::now();
+
+        // 1 KiB takes ~976 us on 1 MiB/s
+        auto first  = emu.schedule(Direction::Uplink, 1024, now);
+        auto second = emu.schedule(Direction::Uplink, 1024, now);
+        auto down   = emu.schedule(Direction::Downlink, 1024, now);
+
+        auto tx = std::chrono::nanoseconds{ 1'000'000'000 / 1024 };
+
+        expect(first.sent == now + tx);
+        expect(second.sent == now + 2 * tx) << "second frame must wait for the first";
+        expect(second.delivered == second.sent + milliseconds{ 1 });
+        expect(down.sent == now + tx) << "directions are independent";
+    };
+
+    "frame overhead is accounted on each frame"_test = [] {
+        auto profile = Profile{ .bandwidth = 1000, .frame_overhead = 1000 };
+
+        auto emu   = Emulator{ profile };
+        auto now   = Clock::now();
+        auto sched = emu.schedule(Direction::Uplink, 0, now);
+
+        expect(sched.sent == now + std::chrono::seconds{ 1 });
+    };
+
+    "jittered link never reorders frames"_test = [] {
+        auto profile = Profile{ .latency = milliseconds{ 5 }, .jitter = milliseconds{ 5 }, .seed = 42 };
+
+        auto emu  = Emulator{ profile };
+        auto now  = Clock::now();
+        auto prev = Clock::time_point{};
+
+        for (auto i : sv::iota(0, 1000)) {
+            auto sched = emu.schedule(Direction::Downlink, 64, now + microseconds{ i });
+            expect(sched.delivered >= prev) << fmt::format("frame {} overtakes previous frame", i);
+            expect(sched.delivered <= now + microseconds{ i } + milliseconds{ 10 });
+            prev = sched.delivered;
+        }
+    };
+
+    "wait_until actually waits"_test = [] {
+        auto io_context = madbfs::async::Context{};
+        auto target     = Clock::now() + milliseconds{ 20 };
+        auto done       = Clock::time_point{};
+
+        auto coro = [&] -> madbfs::Await<void> {
+            co_await Emulator::wait_until(target);
+            done = Clock::now();
+        };
+
+        madbfs::async::spawn(io_context, coro(), madbfs::async::detached);
+        io_context.run();
+
+        expect(done >= target);
+    };
+
+    "client over an emulated link pays its latency and bandwidth"_test = [] {
+        auto io_context = madbfs::async::Context{};
+
+        auto client_sock = madbfs::async::unix_socket::Socket{ io_context };
+        auto server_sock = madbfs::async::unix_socket::Socket{ io_context };
+        asio::local::connect_pair(client_sock, server_sock);
+
+        auto client = rpc::Client{ rpc::Socket{ std::move(client_sock) } };
+        auto server = rpc::Server{ rpc::Socket{ std::move(server_sock) } };
+
+        client.emulate_link(Profile{ .latency = milliseconds{ 20 }, .bandwidth = 1024 * 1024 });
+
+        auto handler = [](Vec<u8>&, rpc::Request req) -> madbfs::Await<Var<rpc::Status, rpc::Response>> {
+            auto write = std::get_if<rpc::req::Write>(&req);
+            co_return rpc::Response{ rpc::resp::Write{ write != nullptr ? write->in.size() : 0 } };
+        };
+
+        auto small = Clock::duration{};
+        auto large = Clock::duration{};
+
+        auto coro = [&] -> madbfs::Await<void> {
+            co_await client.start();
+
+            auto buffer = Vec<u8>{};
+            auto send   = [&](Span<const u8> data) -> madbfs::Await<Clock::duration> {
+                auto start = Clock::now();
+                auto res   = co_await client.send_req(buffer, rpc::req::Write{ "/file", 0, data });
+                expect(res.has_value());
+                co_return Clock::now() - start;
+            };
+
+            small = co_await send(Vec<u8>(1, 0x42));
+            large = co_await send(Vec<u8>(256 * 1024, 0x42));
+
+            // the server stops listening once the client end is closed
+            client.stop();
+        };
+
+        madbfs::async::spawn(io_context, server.listen(handler), madbfs::async::detached);
+        madbfs::async::spawn(io_context, coro(), madbfs::async::detached);
+        io_context.run();
+
+        // a round trip pays the one-way latency twice, 256 KiB takes 250 ms more on 1 MiB/s
+        expect(small >= milliseconds{ 40 });
+        expect(small < milliseconds{ 240 });
+        expect(large >= milliseconds{ 290 });
+        expect(large < milliseconds{ 690 });
+    };
+}
@@ -0,0 +1,73 @@
+#include "madbfs/data/policy.hpp"
+
+#include <boost/ut.hpp>
+
+namespace ut = boost::ext::ut;
+using namespace madbfs::aliases;
+
+using madbfs::data::glob_match;
+using madbfs::data::Policy;
+using madbfs::data::Rules;
+
+struct TestGlob
+{
+    Str  pattern;
+    Str  path;
+    bool matched;
+};
+
+constexpr auto glob_testcases = std::array{
+    TestGlob{ "/sdcard/DCIM/**", "/sdcard/DCIM/Camera/a.jpg", true },
+    TestGlob{ "/sdcard/DCIM/**", "/sdcard/DCIM", false },
+    TestGlob{ "/sdcard/*.txt", "/sdcard/a.txt", true },
+    TestGlob{ "/sdcard/*.txt", "/sdcard/dir/a.txt", false },
+    TestGlob{ "/sdcard/**/*.txt", "/sdcard/a.txt", true },
+    TestGlob{ "/sdcard/**/*.txt", "/sdcard/x/y/a.txt", true },
+    TestGlob{ "/sdcard/?.db", "/sdcard/a.db", true },
+    TestGlob{ "/sdcard/?.db", "/sdcard/ab.db", false },
+    TestGlob{ "/data/*/databases/**", "/data/com.app/databases/main.db", true },
+    TestGlob{ "/data/*/databases/**", "/data/com.app/cache/main.db", false },
+    TestGlob{ "**", "/anything/at/all", true },
+};
+
+int main()
+{
+    using namespace ut::literals;
+    using namespace ut::operators;
+    using ut::expect, ut::that;
+
+    "glob matches path components"_test = [] {
+        for (auto [pattern, path, matched] : glob_testcases) {
+            expect(glob_match(pattern, path) == matched) << pattern << "vs" << path;
+        }
+    };
+
+    "rules are parsed and first match wins"_test = [] {
+        auto text = "# comment\n"
+                    "\n"
+                    "/sdcard/DCIM/**            direct\n"
+                    "/data/*/databases/**       pin,write-through   # trailing comment\n"
+                    "/sdcard/Download/**        readahead=8\n"
+                    "/sdcard/**                 cached\n";
+
+        auto rules = Rules::parse(text);
+        expect(rules.has_value()) << (rules ? "" : rules.error());
+        expect(that % rules->rules().size() == 4u);
+
+        expect(rules->match("/sdcard/DCIM/a.jpg") == Policy{ .direct = true });
+        expect(rules->match("/data/x/databases/a.db") == Policy{ .pin = true, .write_through = true });
+        expect(rules->match("/sdcard/Download/a.iso") == Policy{ .readahead = 8 });
+        expect(rules->match("/sdcard/Music/a.mp3") == Policy{});
+        expect(rules->match("/storage/a") == Policy{});
+    };
+
+    "invalid rules are rejected with line number"_test = [] {
+        for (auto text : { "/a/** bogus", "/a/**", "/a/** readahead=x", "\n/a/** direct,pin" }) {
+            auto rules = Rules::parse(text);
+            expect(not rules.has_value()) << text;
+            if (not rules) {
+                expect(rules.error().starts_with("line ")) << rules.error();
+            }
+        }
+    };
+}
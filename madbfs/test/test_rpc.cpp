@@ -0,0 +1,89 @@
+#include <madbfs-common/rpc.hpp>
+
+#include <boost/ut.hpp>
+
+namespace ut = boost::ext::ut;
+using namespace madbfs::aliases;
+
+using madbfs::rpc::Address;
+using madbfs::rpc::Procedure;
+
+int main()
+{
+    using namespace ut::literals;
+    using namespace ut::operators;
+    using ut::expect, ut::that;
+
+    "address can be parsed from adb forward notation"_test = [] {
+        auto tcp = Address::parse("tcp:12345");
+        expect(tcp.has_value());
+        expect(tcp->kind == Address::Kind::Tcp);
+        expect(tcp->port == 12345u);
+
+        auto abstract = Address::parse("localabstract:madbfs");
+        expect(abstract.has_value());
+        expect(abstract->kind == Address::Kind::Abstract);
+        expect(abstract->name == "madbfs");
+
+        auto filesystem = Address::parse("localfilesystem:/data/local/tmp/madbfs.sock");
+        expect(filesystem.has_value());
+        expect(filesystem->kind == Address::Kind::Filesystem);
+        expect(filesystem->name == "/data/local/tmp/madbfs.sock");
+
+        expect(not Address::parse("tcp:").has_value());
+        expect(not Address::parse("tcp:65536").has_value());
+        expect(not Address::parse("tcp:12a").has_value());
+        expect(not Address::parse("localabstract:").has_value());
+        expect(not Address::parse("localreserved:madbfs").has_value());
+        expect(not Address::parse("madbfs").has_value());
+
+        auto long_name = String(Address::max_name_len + 1, 'a');
+        expect(not Address::parse("localabstract:" + long_name).has_value());
+        expect(Address::parse("localabstract:" + long_name.substr(1)).has_value());
+    };
+
+    "address is formatted back into the same notation"_test = [] {
+        auto strs = { "tcp:1", "tcp:65535", "localabstract:madbfs", "localfilesystem:/tmp/madbfs.sock" };
+        for (auto str : strs) {
+            auto address = Address::parse(str);
+            expect(address.has_value());
+            expect(address->to_string() == str);
+        }
+
+        expect(Address::tcp(12345) == Address::parse("tcp:12345"));
+        expect(Address::abstract("madbfs") == Address::parse("localabstract:madbfs"));
+    };
+
+    "address resolves into endpoint of matching family"_test = [] {
+        auto tcp = Address::tcp(12345).endpoint();
+        expect(tcp.protocol().family() == AF_INET);
+
+        auto abstract = Address::abstract("madbfs").endpoint();
+        expect(abstract.protocol().family() == AF_UNIX);
+        expect(abstract.size() == offsetof(sockaddr_un, sun_path) + 1 + 6);
+
+        auto filesystem = Address::parse("localfilesystem:/tmp/madbfs.sock")->endpoint();
+        expect(filesystem.protocol().family() == AF_UNIX);
+    };
+
+    "entry count the payload can't hold is rejected instead of allocated"_test = [] {
+        namespace rpc = madbfs::rpc;
+
+        auto buffer  = Vec<u8>{};
+        auto request = rpc::req::ReadMany{ .files = { { "/a", 10 }, { "/b", 20 } } };
+        auto frame   = rpc::build_request(buffer, rpc::Id{ 1 }, request);
+        auto payload = Vec<u8>{ frame.begin() + rpc::request_header_len, frame.end() };
+
+        auto parsed = rpc::parse_request(payload, Procedure::ReadMany);
+        expect(parsed.has_value());
+        expect(std::get<rpc::req::ReadMany>(parsed->as_var()).files.size() == 2_u);
+
+        // a huge count followed by nothing, or by fewer entries than it claims
+        auto huge = Vec<u8>{ 0x10, 0, 0, 0, 0, 0, 0, 0 };
+        expect(not rpc::parse_request(huge, Procedure::ReadMany).has_value());
+        expect(not rpc::parse_request(huge, Procedure::WriteMany).has_value());
+
+        payload[7] = 3;    // count is the first field, in network order
+        expect(not rpc::parse_request(payload, Procedure::ReadMany).has_value());
+    };
+}
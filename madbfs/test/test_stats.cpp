@@ -0,0 +1,174 @@
+#include <madbfs-common/stats.hpp>
+
+#include <boost/ut.hpp>
+
+#include <thread>
+
+namespace ut = boost::ext::ut;
+using namespace madbfs::aliases;
+
+using madbfs::stats::FlightRecorder;
+using madbfs::stats::Histogram;
+using madbfs::stats::Metric;
+using madbfs::stats::Registry;
+using madbfs::stats::Sample;
+
+using std::chrono::microseconds;
+using std::chrono::nanoseconds;
+
+int main()
+{
+    using namespace ut::literals;
+    using namespace ut::operators;
+    using ut::expect, ut::that;
+
+    "histogram buckets cover the value with bounded relative error"_test = [] {
+        for (auto value : { 0_u64, 1_u64, 15_u64, 16_u64, 17_u64, 1000_u64, 123'456'789_u64, ~0_u64 }) {
+            auto bucket = Histogram::bucket_of(value);
+            auto upper  = Histogram::upper_bound_of(bucket);
+
+            expect(bucket < Histogram::bucket_count) << "value:" << value;
+            expect(upper >= value) << "value:" << value;
+            expect(upper - value <= value / Histogram::sub_bucket_count) << "value:" << value;
+        }
+
+        // buckets are monotonic
+        auto prev = 0uz;
+        for (auto value = 1_u64; value < 1'000'000; value = value * 3 / 2 + 1) {
+            auto bucket = Histogram::bucket_of(value);
+            expect(bucket >= prev);
+            prev = bucket;
+        }
+    };
+
+    "histogram percentiles"_test = [] {
+        auto hist = Histogram{};
+        for (auto i : sv::iota(1, 1001)) {
+            hist.record(microseconds{ i });
+        }
+
+        auto sum = hist.summary();
+        expect(sum.count == 1000_u);
+        expect(sum.min == 1'000_u);
+        expect(sum.max == 1'000'000_u);
+
+        auto near = [](u64 value, u64 expected) {
+            return value >= expected and value <= expected + expected / Histogram::sub_bucket_count;
+        };
+        expect(near(sum.p50, 500'000)) << sum.p50;
+        expect(near(sum.p90, 900'000)) << sum.p90;
+        expect(near(sum.p99, 990'000)) << sum.p99;
+        expect(near(sum.p999, 999'000)) << sum.p999;
+
+        hist.reset();
+        expect(hist.summary().count == 0_u);
+        expect(hist.summary().p99 == 0_u);
+    };
+
+    "flight recorder keeps the last operations in order"_test = [] {
+        auto metric   = Metric{ "test", "op" };
+        auto recorder = FlightRecorder{};
+
+        auto long_path = String(FlightRecorder::path_len + 10, 'a') + "/tail";
+        recorder.record(metric, long_path, 0, nanoseconds{ 1 }, madbfs::Errc::io_error);
+
+        auto events = recorder.events();
+        expect(that % events.size() == 1);
+        expect(events[0].metric == &metric);
+        expect(events[0].error == madbfs::Errc::io_error);
+        expect(events[0].path.size() == FlightRecorder::path_len);
+        expect(events[0].path.ends_with("/tail"));
+
+        for (auto i : sv::iota(0uz, FlightRecorder::capacity + 10)) {
+            recorder.record(metric, "/file", i, nanoseconds{ 1 }, {});
+        }
+
+        events = recorder.events();
+        expect(that % events.size() == FlightRecorder::capacity);
+        expect(that % events.front().size == 10);
+        expect(that % events.back().size == FlightRecorder::capacity + 9);
+    };
+
+    "concurrent recording"_test = [] {
+        auto metric   = Metric{ "test", "concurrent" };
+        auto recorder = FlightRecorder{};
+
+        constexpr auto num_threads = 4;
+        constexpr auto per_thread  = 10'000;
+
+        auto threads = Vec<std::jthread>{};
+        for (auto t : sv::iota(0, num_threads)) {
+            threads.emplace_back([&, t] {
+                for (auto i : sv::iota(0, per_thread)) {
+                    auto duration = nanoseconds{ i + 1 };
+                    metric.histogram().record(duration);
+                    recorder.record(metric, "/concurrent", static_cast<u64>(t), duration, {});
+                }
+            });
+        }
+
+        // reading while writing should never produce a torn event
+        for (auto _ : sv::iota(0, 100)) {
+            for (const auto& event : recorder.events()) {
+                expect(event.path == "/concurrent");
+                expect(event.size < static_cast<u64>(num_threads));
+            }
+        }
+        threads.clear();
+
+        expect(that % metric.histogram().summary().count == num_threads * per_thread);
+        expect(that % recorder.events().size() == FlightRecorder::capacity);
+    };
+
+    "openmetrics rendering"_test = [] {
+        auto registry = Registry{};
+
+        registry.metric("fuse", "read").histogram().record(microseconds{ 250 });
+        registry.counter("connection", "reconnects").add(3);
+        registry.gauge("rpc", "in_flight").set(2);
+
+        auto samples = Array<Sample, 1>{ {
+            { "cache_pages", "pages stored in cache", Sample::Kind::Gauge, 42 },
+        } };
+        auto text    = registry.openmetrics(samples, "serial=\"abc\"");
+
+        auto has = [&](Str line) { return text.find(line) != String::npos; };
+
+        expect(has("# TYPE madbfs_fuse_latency_seconds summary\n"));
+        expect(has("madbfs_fuse_latency_seconds_count{serial=\"abc\",op=\"read\"} 1\n"));
+        expect(has("madbfs_fuse_latency_seconds{serial=\"abc\",op=\"read\",quantile=\"0.5\"}"));
+        expect(has("# TYPE madbfs_connection_reconnects counter\n"));
+        expect(has("madbfs_connection_reconnects_total{serial=\"abc\"} 3\n"));
+        expect(has("madbfs_rpc_in_flight{serial=\"abc\"} 2\n"));
+        expect(has("madbfs_cache_pages{serial=\"abc\"} 42\n"));
+        expect(text.ends_with("# EOF\n"));
+
+        // counters survive reset, histograms don't
+        registry.reset();
+        text = registry.openmetrics({}, "");
+        expect(has("madbfs_connection_reconnects_total 3\n"));
+        expect(has("madbfs_fuse_latency_seconds_count{op=\"read\"} 0\n"));
+    };
+
+    "registries of different devices are kept apart"_test = [] {
+        auto first  = Registry{};
+        auto second = Registry{};
+
+        first.metric("fuse", "read").record(microseconds{ 250 }, "/first");
+        second.metric("fuse", "read").record(microseconds{ 500 }, "/second");
+        second.metric("fuse", "read").record(microseconds{ 500 }, "/second");
+
+        expect(that % first.metric("fuse", "read").histogram().summary().count == 1);
+        expect(that % second.metric("fuse", "read").histogram().summary().count == 2);
+
+        auto events = first.recorder().events();
+        expect(that % events.size() == 1);
+        expect(events[0].path == "/first");
+        expect(that % second.recorder().events().size() == 2);
+
+        // resetting one device leaves the other alone
+        first.reset();
+        expect(that % first.metric("fuse", "read").histogram().summary().count == 0);
+        expect(that % second.metric("fuse", "read").histogram().summary().count == 2);
+    };
+}
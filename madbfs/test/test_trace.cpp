@@ -0,0 +1,150 @@
+#include <madbfs-common/trace.hpp>
+
+#include <boost/ut.hpp>
+
+#include <algorithm>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <map>
+#include <thread>
+
+namespace ut = boost::ext::ut;
+using namespace madbfs::aliases;
+
+namespace trace = madbfs::trace;
+
+struct Decoded
+{
+    std::map<u16, String> ops;
+    Vec<trace::Record>    records;
+    u64                   dropped = 0;
+};
+
+Opt<Decoded> decode(const std::filesystem::path& path)
+{
+    auto file = std::ifstream{ path, std::ios::binary };
+    auto data = Vec<char>{ std::istreambuf_iterator<char>{ file }, {} };
+
+    auto read = [&]<typename T>(usize offset) {
+        auto value = T{};
+        std::memcpy(&value, data.data() + offset, sizeof(T));
+        return value;
+    };
+
+    if (data.size() < 16 or not std::equal(trace::magic.begin(), trace::magic.end(), data.begin())) {
+        return std::nullopt;
+    }
+    if (read.operator()<u32>(8) != trace::version or read.operator()<u32>(12) != sizeof(trace::Record)) {
+        return std::nullopt;
+    }
+
+    auto decoded = Decoded{};
+    auto offset  = 16uz;
+
+    while (offset + 8 <= data.size()) {
+        auto kind = static_cast<trace::Chunk>(read.operator()<u32>(offset));
+        auto len  = read.operator()<u32>(offset + 4);
+        offset   += 8;
+
+        switch (kind) {
+        case trace::Chunk::Op: {
+            auto op = read.operator()<u16>(offset);
+            decoded.ops.emplace(op, String{ data.data() + offset + 2, len - 2 });
+        } break;
+        case trace::Chunk::Records: {
+            for (auto i = 0uz; i < len / sizeof(trace::Record); ++i) {
+                decoded.records.push_back(read.operator()<trace::Record>(offset + i * sizeof(trace::Record)));
+            }
+        } break;
+        case trace::Chunk::Dropped: decoded.dropped += read.operator()<u64>(offset); break;
+        default: return std::nullopt;
+        }
+
+        offset += len;
+    }
+
+    return decoded;
+}
+
+int main()
+{
+    using namespace ut::literals;
+    using namespace ut::operators;
+    using ut::expect, ut::that;
+
+    static_assert(trace::id_of("") == 2166136261u);
+    static_assert(trace::id_of("/sdcard/a") != trace::id_of("/sdcard/b"));
+
+    "op registration is idempotent"_test = [] {
+        auto a = trace::register_op("test.a");
+        auto b = trace::register_op("test.b");
+        expect(a != b);
+        expect(trace::register_op("test.a") == a);
+    };
+
+    "records are not written when tracing is stopped"_test = [] {
+        expect(not trace::enabled());
+        trace::record(trace::register_op("test.a"), 0, 0, {}, {});    // must not crash nor record
+    };
+
+    "records from multiple threads are written to the trace file"_test = [] {
+        if constexpr (not MADBFS_TRACE_ENABLED) {
+            expect(not trace::start("/dev/null").has_value());
+            return;
+        }
+
+        auto path = std::filesystem::temp_directory_path() / "madbfs-test.trace";
+        auto read = trace::register_op("test.read");
+
+        expect(trace::start(path.c_str()).has_value());
+        expect(trace::enabled());
+        expect(not trace::start(path.c_str()).has_value()) << "starting twice should fail";
+
+        constexpr auto num_threads = 4;
+        constexpr auto per_thread  = 1000;
+
+        auto threads = Vec<std::jthread>{};
+        for (auto t : sv::iota(0, num_threads)) {
+            threads.emplace_back([=] {
+                for (auto i : sv::iota(0, per_thread)) {
+                    auto err = i % 10 == 0 ? madbfs::Errc::io_error : madbfs::Errc{};
+                    auto lat = std::chrono::nanoseconds{ i };
+                    trace::record(read, trace::id_of("/file"), static_cast<u64>(t), lat, err);
+                    if (i % 256 == 0) {
+                        std::this_thread::sleep_for(std::chrono::milliseconds{ 1 });
+                    }
+                }
+            });
+        }
+        threads.clear();
+
+        auto late = trace::register_op("test.late");    // registered after the trace started
+        trace::record(late, 42, 0, {}, {});
+
+        trace::stop();
+        expect(not trace::enabled());
+
+        auto decoded = decode(path);
+        expect(decoded.has_value()) << "trace file should be valid";
+        if (not decoded) {
+            return;
+        }
+
+        expect(decoded->ops.contains(read) and decoded->ops[read] == "test.read");
+        expect(decoded->ops.contains(late) and decoded->ops[late] == "test.late");
+
+        auto num_read = sr::count_if(decoded->records, [&](const auto& r) { return r.op == read; });
+        auto num_err  = sr::count_if(decoded->records, [&](const auto& r) { return r.error != 0; });
+
+        auto total    = static_cast<u64>(num_read) + decoded->dropped;
+
+        expect(that % total == num_threads * per_thread);
+        expect(num_err > 0);
+        expect(sr::all_of(decoded->records, [&](const auto& r) {
+            return r.op == late ? r.id == 42 : r.id == trace::id_of("/file");
+        }));
+
+        std::filesystem::remove(path);
+    };
+}
@@ -1,3 +1,5 @@
+#include "fake_connection.hpp"
+
 #include "madbfs/path.hpp"
 #include "madbfs/tree/file_tree.hpp"
 #include "madbfs/tree/node.hpp"
@@ -11,6 +13,8 @@
 #include <fmt/color.h>
 #include <fmt/format.h>
 
+#include <linux/falloc.h>
+
 #include <source_location>
 
 namespace ut = boost::ext::ut;
@@ -89,8 +93,7 @@ struct fmt::formatter<madbfs::tree::Node> : fmt::formatter<std::string_view>
 
             auto visitor = madbfs::util::Overload{
                 [&](const node::Link& link) {
-                    auto pathbuf = link.target().build_path();
-                    return fmt::format("    ->    {}", pathbuf.as_path().fullpath());
+                    return fmt::format("    ->    {}", link.target().fullpath());
                 },
                 [&](const node::Directory&) { return String{ "/" }; },
                 [&](const auto&) { return String{ "" }; },
@@ -177,19 +180,36 @@ namespace mock
     public:
         using Stats = Gen<ParsedStat>;
 
-        AExpect<Stats>   statdir(Path) override { co_return Unexpect{ {} }; }
-        AExpect<Stat>    stat(Path) override { co_return Stat{}; }
-        AExpect<PathBuf> readlink(Path path) override { co_return path.into_buf(); };
-        AExpect<void>    mknod(Path, mode_t, dev_t) override { co_return Expect<void>{}; }
-        AExpect<void>    mkdir(Path, mode_t) override { co_return Expect<void>{}; }
-        AExpect<void>    unlink(Path) override { co_return Expect<void>{}; }
-        AExpect<void>    rmdir(Path) override { co_return Expect<void>{}; }
-        AExpect<void>    rename(Path, path::Path, u32) override { co_return Expect<void>{}; }
-        AExpect<void>    truncate(Path, off_t) override { co_return Expect<void>{}; }
-        AExpect<usize>   read(Path, Span<char>, off_t) override { co_return Expect<usize>{}; }
-        AExpect<usize>   write(Path, Span<const char>, off_t) override { co_return Expect<usize>{}; }
-        AExpect<void>    utimens(Path, timespec, timespec) override { co_return Expect<void>{}; }
-        AExpect<usize>   copy_file_range(Path, off_t, Path, off_t, usize size) override { co_return size; }
+        AExpect<Stats>     statdir(Path) override { co_return Unexpect{ {} }; }
+        AExpect<Stat>      stat(Path) override { co_return Stat{}; }
+        AExpect<PathBuf>   readlink(Path path) override { co_return path.into_buf(); };
+        AExpect<Opt<Stat>> mknod(Path, mode_t, dev_t) override { co_return Opt<Stat>{}; }
+        AExpect<Opt<Stat>> mkdir(Path, mode_t) override { co_return Opt<Stat>{}; }
+        AExpect<void>      unlink(Path) override { co_return Expect<void>{}; }
+        AExpect<void>      rmdir(Path) override { co_return Expect<void>{}; }
+        AExpect<Opt<Stat>> rename(Path, path::Path, u32) override { co_return Opt<Stat>{}; }
+        AExpect<Opt<Stat>> truncate(Path, off_t) override { co_return Opt<Stat>{}; }
+        AExpect<usize>     read(Path, Span<char>, off_t) override { co_return Expect<usize>{}; }
+        AExpect<usize>     write(Path, Span<const char>, off_t) override { co_return Expect<usize>{}; }
+        AExpect<Opt<Stat>> utimens(Path, timespec, timespec) override { co_return Opt<Stat>{}; }
+        AExpect<Opt<Stat>> fallocate(Path, i32, off_t, off_t) override { co_return Opt<Stat>{}; }
+        AExpect<off_t>     lseek(Path, off_t offset, i32) override { co_return offset; }
+        AExpect<usize>     copy_file_range(Path, off_t, Path, off_t, usize size) override { co_return size; }
+
+        AExpect<Vec<Expect<usize>>> read_many(Span<const Path> paths, Span<const Span<char>>) override
+        {
+            co_return Vec<Expect<usize>>(paths.size(), Unexpect{ Errc::no_such_file_or_directory });
+        }
+
+        AExpect<Vec<Expect<Opt<Stat>>>> write_many(Span<const Path> paths, Span<const Upload>) override
+        {
+            co_return Vec<Expect<Opt<Stat>>>(paths.size(), Opt<Stat>{});
+        }
+
+        AExpect<Vec<ServerTiming>> server_stats(bool) override
+        {
+            co_return Unexpect{ Errc::operation_not_supported };
+        }
     };
 }
 
@@ -351,4 +371,412 @@ int main()
 
 #undef unwrap
     };
+
+    "symlinks in listing are resolved on first traversal"_test = [&] {
+        using namespace madbfs::tree;
+        using madbfs::path::operator""_path;
+        using Op = mock::FakeConnection::Op;
+
+        auto connection = mock::FakeConnection{};
+        auto cache      = madbfs::data::Cache{ connection, 64 * 1024, 1024 };
+        auto tree       = FileTree{ connection, cache };
+
+        connection.add_dir("/storage");
+        connection.add_file("/storage/file.txt");
+        connection.add_link("/relative", "storage/file.txt");
+        connection.add_link("/absolute", "/storage");
+        connection.add_link("/chain", "relative");
+
+        auto io_context = madbfs::async::Context{};
+
+        auto coro = [&] -> madbfs::Await<void> {
+            auto names = Vec<String>{};
+            auto res   = co_await tree.readdir("/"_path, [&](const char* name) { names.emplace_back(name); });
+            expect(res.has_value());
+            expect(that % names.size() == 4u);
+
+            // neither readlink nor stat of the targets are needed to list the links
+            expect(that % connection.num_calls(Op::Readlink) == 0u);
+            expect(that % connection.num_calls(Op::Stat) == 0u);
+            expect(tree.traverse("/storage"_path).has_value());
+
+            for (auto [link, target] : { Pair{ "/relative"_path, "/storage/file.txt" },
+                                         Pair{ "/absolute"_path, "/storage" },
+                                         Pair{ "/chain"_path, "/storage/file.txt" } }) {
+                auto node = co_await tree.readlink(link);
+                expect(node.has_value()) << link.fullpath();
+                if (node) {
+                    expect(node->get().build_path().as_path().fullpath() == target) << link.fullpath();
+                }
+            }
+        };
+
+        madbfs::async::spawn(io_context, coro(), madbfs::async::detached);
+        io_context.run();
+    };
+
+    "mutations use the stat returned by the connection"_test = [&] {
+        using namespace madbfs::tree;
+        using madbfs::path::operator""_path;
+        using Op = mock::FakeConnection::Op;
+
+        auto connection = mock::FakeConnection{};
+        auto cache      = madbfs::data::Cache{ connection, 64 * 1024, 1024 };
+        auto tree       = FileTree{ connection, cache };
+
+        auto io_context = madbfs::async::Context{};
+
+        auto coro = [&] -> madbfs::Await<void> {
+            auto time = timespec{ .tv_sec = 42, .tv_nsec = 0 };
+
+            expect((co_await tree.mkdir("/dir"_path, 0755)).has_value());
+            expect((co_await tree.mknod("/dir/a"_path, 0644, 0)).has_value());
+            expect((co_await tree.truncate("/dir/a"_path, 10)).has_value());
+            expect((co_await tree.utimens("/dir/a"_path, time, time)).has_value());
+            expect((co_await tree.rename("/dir/a"_path, "/dir/b"_path, 0)).has_value());
+
+            expect(that % connection.num_calls(Op::Stat) == 0u);
+
+            auto node = tree.traverse("/dir/b"_path);
+            expect(node.has_value());
+            if (node) {
+                const auto& stat = node->get().stat()->get();
+                expect(that % stat.size == 10);
+                expect(that % stat.mtime.tv_sec == 42);
+                expect(S_ISREG(stat.mode));
+            }
+        };
+
+        madbfs::async::spawn(io_context, coro(), madbfs::async::detached);
+        io_context.run();
+    };
+
+    "opening files of a listed directory prefetches its small files"_test = [&] {
+        using namespace madbfs::tree;
+        using madbfs::path::operator""_path;
+        using Op = mock::FakeConnection::Op;
+
+        auto connection = mock::FakeConnection{};
+        auto cache      = madbfs::data::Cache{ connection, 64 * 1024, 1024 };
+        auto tree       = FileTree{ connection, cache };
+
+        connection.add_dir("/thumbs");
+        for (auto i : sv::iota(0uz, 10uz)) {
+            connection.add_file(fmt::format("/thumbs/{}.jpg", i), Vec<char>(100 + i, 'a'));
+        }
+        connection.add_file("/thumbs/big.bin", Vec<char>(128 * 1024, 'b'));
+
+        auto io_context = madbfs::async::Context{};
+
+        auto coro = [&] -> madbfs::Await<void> {
+            auto names = Vec<String>{};
+            auto res   = co_await tree.readdir("/thumbs"_path, [&](const char* n) { names.emplace_back(n); });
+            expect(res.has_value());
+
+            for (auto i : sv::iota(0uz, 10uz)) {
+                auto path = madbfs::path::create_buf(fmt::format("/thumbs/{}.jpg", i)).value();
+                auto fd   = co_await tree.open(path.as_path(), O_RDONLY);
+                expect(fd.has_value());
+
+                auto buf  = String(200, '\0');
+                auto read = co_await tree.read(path.as_path(), *fd, buf, 0);
+                expect(read.has_value() and *read == 100 + i);
+
+                std::ignore = co_await tree.release(path.as_path(), *fd);
+            }
+
+            // the files opened before the scan is noticed may have been read on their own
+            expect(that % connection.num_calls(Op::ReadMany) == 1u);
+            expect(that % connection.num_reads() <= 2u);
+            expect(that % cache.usage().files == 10u);
+        };
+
+        madbfs::async::spawn(io_context, coro(), madbfs::async::detached);
+        io_context.run();
+    };
+
+    "read-only mode lists subdirectories and prefetches small files ahead"_test = [&] {
+        using namespace madbfs::tree;
+        using madbfs::path::operator""_path;
+        using Op = mock::FakeConnection::Op;
+
+        auto connection = mock::FakeConnection{};
+        auto cache      = madbfs::data::Cache{ connection, 64 * 1024, 1024 };
+        auto tree       = FileTree{ connection, cache, Mode::ReadOnly };
+
+        connection.add_dir("/dcim");
+        connection.add_dir("/dcim/a");
+        connection.add_dir("/dcim/a/deep");
+        connection.add_file("/dcim/x.txt", Vec<char>(10, 'x'));
+        connection.add_file("/dcim/a/y.txt", Vec<char>(20, 'y'));
+        connection.add_file("/dcim/a/deep/z.txt", Vec<char>(30, 'z'));
+
+        auto io_context = madbfs::async::Context{};
+
+        auto list = [&](madbfs::path::Path path) -> madbfs::Await<void> {
+            auto res = co_await tree.readdir(path, [](const char*) { });
+            expect(res.has_value());
+        };
+
+        // runs until the prefetch in the background is done as well
+        madbfs::async::spawn(io_context, list("/dcim"_path), madbfs::async::detached);
+        io_context.run();
+
+        auto sub  = tree.traverse("/dcim/a"_path);
+        auto deep = tree.traverse("/dcim/a/deep"_path);
+        expect(sub.has_value() and sub->get().has_synced());
+        expect(deep.has_value() and not deep->get().has_synced()) << "should only go one level down";
+
+        expect(that % connection.num_calls(Op::Statdir) == 2u);
+        expect(that % connection.num_calls(Op::ReadMany) == 2u);
+        expect(that % cache.usage().files == 2u);
+
+        // listed already, but going further down still
+        io_context.restart();
+        madbfs::async::spawn(io_context, list("/dcim/a"_path), madbfs::async::detached);
+        io_context.run();
+
+        expect(deep.has_value() and deep->get().has_synced());
+        expect(that % connection.num_calls(Op::Statdir) == 3u);
+        expect(that % cache.usage().files == 3u);
+    };
+
+    "relaxed mode defers metadata operations in order"_test = [&] {
+        using namespace madbfs::tree;
+        using namespace std::chrono_literals;
+        using madbfs::path::operator""_path;
+        using Op = mock::FakeConnection::Op;
+
+        auto connection = mock::FakeConnection{ 42 };
+        auto cache      = madbfs::data::Cache{ connection, 64 * 1024, 1024 };
+        auto tree       = FileTree{ connection, cache, Mode::Relaxed };
+
+        // jitter would reorder the operations if they weren't chained
+        for (auto op : { Op::Mkdir, Op::Mknod, Op::Utimens }) {
+            connection.set_fault(op, { .latency = 1ms, .jitter = 5ms });
+        }
+
+        auto io_context = madbfs::async::Context{};
+
+        auto coro = [&] -> madbfs::Await<void> {
+            auto time = [](i64 sec) { return timespec{ .tv_sec = sec, .tv_nsec = 0 }; };
+
+            expect((co_await tree.mkdir("/a"_path, 0755)).has_value());
+            expect((co_await tree.mkdir("/a/b"_path, 0755)).has_value());
+            expect((co_await tree.mknod("/a/b/f"_path, 0644, 0)).has_value());
+            expect((co_await tree.utimens("/a/b/f"_path, time(42), time(42))).has_value());
+            expect((co_await tree.utimens("/a"_path, time(7), time(7))).has_value());
+
+            // applied locally before the device gets them
+            expect(connection.find("/a") == nullptr);
+            auto node = tree.traverse("/a/b/f"_path);
+            expect(node.has_value());
+            if (node) {
+                expect(that % node->get().stat()->get().mtime.tv_sec == 42);
+            }
+
+            expect((co_await tree.fsyncdir("/"_path)).has_value());
+
+            auto file = connection.find("/a/b/f");
+            auto dir  = connection.find("/a");
+            expect(file != nullptr and dir != nullptr);
+            if (file and dir) {
+                expect(that % file->stat.mtime.tv_sec == 42);
+                expect(that % dir->stat.mtime.tv_sec == 7);
+            }
+        };
+
+        madbfs::async::spawn(io_context, coro(), madbfs::async::detached);
+        io_context.run();
+    };
+
+    "relaxed mode reports failure on the next dependent operation"_test = [&] {
+        using namespace madbfs::tree;
+        using madbfs::path::operator""_path;
+        using Op = mock::FakeConnection::Op;
+
+        auto connection = mock::FakeConnection{};
+        auto cache      = madbfs::data::Cache{ connection, 64 * 1024, 1024 };
+        auto tree       = FileTree{ connection, cache, Mode::Relaxed };
+
+        connection.set_fault(Op::Mknod, { .error_rate = 1.0, .error = Errc::permission_denied });
+
+        auto io_context = madbfs::async::Context{};
+
+        auto coro = [&] -> madbfs::Await<void> {
+            expect((co_await tree.mknod("/f"_path, 0644, 0)).has_value());
+
+            auto fd = co_await tree.open("/f"_path, O_RDWR);
+            expect(not fd.has_value() and fd.error() == Errc::permission_denied);
+
+            // the optimistic node is gone and the error is reported only once
+            expect(not tree.traverse("/f"_path).has_value());
+            expect((co_await tree.fsyncdir("/"_path)).has_value());
+        };
+
+        madbfs::async::spawn(io_context, coro(), madbfs::async::detached);
+        io_context.run();
+    };
+
+    "relaxed mode creates new small files along with their content"_test = [&] {
+        using namespace madbfs::tree;
+        using namespace std::chrono_literals;
+        using madbfs::path::operator""_path;
+        using Op = mock::FakeConnection::Op;
+
+        auto connection = mock::FakeConnection{};
+        auto cache      = madbfs::data::Cache{ connection, 64 * 1024, 1024 };
+        auto tree       = FileTree{ connection, cache, Mode::Relaxed };
+
+        // files released while a batch is in flight go with the next one
+        connection.set_fault(Op::WriteMany, { .latency = 5ms });
+
+        auto io_context = madbfs::async::Context{};
+
+        auto coro = [&] -> madbfs::Await<void> {
+            auto time = [](i64 sec) { return timespec{ .tv_sec = sec, .tv_nsec = 0 }; };
+
+            expect((co_await tree.mkdir("/a"_path, 0755)).has_value());
+
+            for (auto i : sv::iota(0uz, 8uz)) {
+                auto path = madbfs::path::create_buf(fmt::format("/a/{}.txt", i)).value();
+                expect((co_await tree.mknod(path.as_path(), S_IFREG | 0644, 0)).has_value());
+
+                auto fd = co_await tree.open(path.as_path(), O_WRONLY);
+                expect(fd.has_value());
+
+                auto content = fmt::format("content of {}", i);
+                expect((co_await tree.write(path.as_path(), *fd, content, 0)).has_value());
+                expect((co_await tree.utimens(path.as_path(), time(42), time(42))).has_value());
+                expect((co_await tree.release(path.as_path(), *fd)).has_value());
+            }
+
+            expect(connection.find("/a/0.txt") == nullptr);
+            expect((co_await tree.fsyncdir("/"_path)).has_value());
+
+            expect(that % connection.num_calls(Op::WriteMany) <= 2u);
+            expect(that % connection.num_calls(Op::Mknod) == 0u);
+            expect(that % connection.num_calls(Op::Utimens) == 0u);
+            expect(that % connection.num_writes() == 0u);
+
+            for (auto i : sv::iota(0uz, 8uz)) {
+                auto file = connection.find(fmt::format("/a/{}.txt", i));
+                expect(file != nullptr);
+                if (file) {
+                    expect(Str{ file->data.data(), file->data.size() } == fmt::format("content of {}", i));
+                    expect(that % file->stat.mtime.tv_sec == 42);
+                }
+            }
+
+            // a file growing past a page is created right away and written as usual
+            expect((co_await tree.mknod("/a/big.bin"_path, S_IFREG | 0644, 0)).has_value());
+            auto fd = co_await tree.open("/a/big.bin"_path, O_WRONLY);
+            expect(fd.has_value());
+
+            auto big = String(128 * 1024, 'b');
+            expect((co_await tree.write("/a/big.bin"_path, *fd, big, 0)).has_value());
+            expect((co_await tree.release("/a/big.bin"_path, *fd)).has_value());
+
+            auto file = connection.find("/a/big.bin");
+            expect(file != nullptr);
+            if (file) {
+                expect(that % file->data.size() == big.size());
+            }
+        };
+
+        madbfs::async::spawn(io_context, coro(), madbfs::async::detached);
+        io_context.run();
+    };
+
+    "fallocate and lseek keep the cache coherent with the device"_test = [&] {
+        using namespace madbfs::tree;
+        using madbfs::path::operator""_path;
+        using Op = mock::FakeConnection::Op;
+
+        auto connection = mock::FakeConnection{};
+        auto cache      = madbfs::data::Cache{ connection, 64 * 1024, 1024 };
+        auto tree       = FileTree{ connection, cache };
+
+        auto io_context = madbfs::async::Context{};
+
+        auto coro = [&] -> madbfs::Await<void> {
+            expect((co_await tree.mknod("/a"_path, S_IFREG | 0644, 0)).has_value());
+            auto fd = co_await tree.open("/a"_path, O_RDWR);
+            expect(fd.has_value());
+
+            auto content = String(100, 'a');
+            expect((co_await tree.write("/a"_path, *fd, content, 0)).has_value());
+
+            // plain allocation grows the file, the new range reads as zeros
+            expect((co_await tree.fallocate("/a"_path, *fd, 0, 0, 200)).has_value());
+            expect(that % tree.traverse("/a"_path)->get().stat()->get().size == 200);
+
+            // punching a hole flushes the dirty pages first then drops the stale ones
+            auto punch = FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE;
+            expect((co_await tree.fallocate("/a"_path, *fd, punch, 10, 20)).has_value());
+
+            auto buf  = String(200, 'x');
+            auto read = co_await tree.read("/a"_path, *fd, buf, 0);
+            expect(read.has_value() and *read == 200u);
+            expect(buf.substr(0, 10) == String(10, 'a'));
+            expect(buf.substr(10, 20) == String(20, '\0'));
+            expect(buf.substr(30, 70) == String(70, 'a'));
+            expect(buf.substr(100) == String(100, '\0'));
+
+            auto hole = co_await tree.lseek("/a"_path, *fd, 0, SEEK_HOLE);
+            expect(hole.has_value() and *hole == 200);
+
+            // past the end is answered locally
+            auto calls = connection.num_calls(Op::Lseek);
+            auto past  = co_await tree.lseek("/a"_path, *fd, 200, SEEK_DATA);
+            expect(not past.has_value() and past.error() == madbfs::Errc::no_such_device_or_address);
+            expect(that % connection.num_calls(Op::Lseek) == calls);
+
+            expect((co_await tree.release("/a"_path, *fd)).has_value());
+        };
+
+        madbfs::async::spawn(io_context, coro(), madbfs::async::detached);
+        io_context.run();
+    };
+
+    "overwrite with O_TRUNC never pulls the old content"_test = [&] {
+        using namespace madbfs::tree;
+        using madbfs::path::operator""_path;
+        using Op = mock::FakeConnection::Op;
+
+        auto connection = mock::FakeConnection{};
+        auto cache      = madbfs::data::Cache{ connection, 64 * 1024, 1024 };
+        auto tree       = FileTree{ connection, cache };
+
+        auto io_context = madbfs::async::Context{};
+
+        auto coro = [&] -> madbfs::Await<void> {
+            expect((co_await tree.mknod("/a"_path, S_IFREG | 0644, 0)).has_value());
+
+            auto old = String(3 * 64 * 1024 + 100, 'a');
+            auto fd  = co_await tree.open("/a"_path, O_WRONLY);
+            expect(fd.has_value());
+            expect((co_await tree.write("/a"_path, *fd, old, 0)).has_value());
+            expect((co_await tree.release("/a"_path, *fd)).has_value());
+
+            // sub-page chunks, none of them aligned to a page
+            auto content = String{};
+            fd           = co_await tree.open("/a"_path, O_WRONLY | O_TRUNC);
+            expect(fd.has_value());
+            for (auto i : sv::iota(0, 300)) {
+                auto chunk = String(1000, static_cast<char>('b' + i % 20));
+                auto off   = static_cast<off_t>(content.size());
+                expect((co_await tree.write("/a"_path, *fd, chunk, off)).has_value());
+                content += chunk;
+            }
+            expect((co_await tree.release("/a"_path, *fd)).has_value());
+
+            auto& data = connection.find("/a")->data;
+            expect(String{ data.begin(), data.end() } == content);
+            expect(that % connection.num_calls(Op::Read) == 0u);
+        };
+
+        madbfs::async::spawn(io_context, coro(), madbfs::async::detached);
+        io_context.run();
+    };
 }
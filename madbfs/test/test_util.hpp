@@ -0,0 +1,29 @@
+#pragma once
+
+#include <madbfs-common/async/async.hpp>
+
+namespace mock
+{
+    /**
+     * @brief Run a coroutine to completion on the calling thread.
+     *
+     * @param ctx Async context, must not be running on another thread.
+     * @param coro The coroutine.
+     */
+    template <typename T>
+    T run(madbfs::async::Context& ctx, madbfs::Await<T> coro)
+    {
+        if constexpr (std::same_as<T, void>) {
+            madbfs::async::spawn(ctx, std::move(coro), madbfs::async::detached);
+            ctx.restart();
+            ctx.run();
+        } else {
+            auto result  = madbfs::Opt<T>{};
+            auto wrapped = [&] -> madbfs::Await<void> { result.emplace(co_await std::move(coro)); };
+            madbfs::async::spawn(ctx, wrapped(), madbfs::async::detached);
+            ctx.restart();
+            ctx.run();
+            return std::move(result).value();
+        }
+    }
+}
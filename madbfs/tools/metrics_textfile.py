@@ -0,0 +1,86 @@
+#!/usr/bin/env python3
+
+"""
+export madbfs metrics for node_exporter's textfile collector.
+
+queries the `get_metrics` IPC operation of a running madbfs instance and writes the OpenMetrics text into
+`DIR/madbfs_<serial>.prom`. the file is written to a temporary file first then renamed, so the collector never
+sees a partially written file. run it periodically, e.g. from a systemd timer or with --interval.
+
+usage:
+    ./metrics_textfile.py SERIAL DIR [--interval SECONDS]
+"""
+
+import json
+import os
+import struct
+import sys
+import time
+from argparse import ArgumentParser
+from socket import AF_UNIX, SOCK_STREAM, socket
+
+
+def eprint(*args, **kwargs):
+    print(*args, file=sys.stderr, **kwargs)
+
+
+def recvall(sock: socket, n: int) -> bytes:
+    data = bytearray()
+    while len(data) < n:
+        packet = sock.recv(n - len(data))
+        if not packet:
+            raise ConnectionError("connection closed by madbfs")
+        data.extend(packet)
+    return bytes(data)
+
+
+def get_metrics(serial: str) -> str:
+    runtime_dir = os.environ.get("XDG_RUNTIME_DIR", "/tmp")
+    request = json.dumps({"op": "get_metrics"}).encode()
+
+    with socket(AF_UNIX, SOCK_STREAM) as sock:
+        sock.connect(f"{runtime_dir}/madbfs@{serial}.sock")
+        sock.sendall(struct.pack(">I", len(request)) + request)
+
+        (length,) = struct.unpack(">I", recvall(sock, 4))
+        response = json.loads(recvall(sock, length))
+
+    if response.get("status") != "success":
+        raise RuntimeError(response.get("message", "unknown error"))
+
+    return response["value"]
+
+
+def write_atomic(path: str, content: str):
+    tmp = f"{path}.{os.getpid()}.tmp"
+    with open(tmp, "w") as file:
+        file.write(content)
+    os.replace(tmp, path)
+
+
+def main() -> int:
+    parser = ArgumentParser(description="export madbfs metrics for node_exporter's textfile collector")
+    parser.add_argument("serial", type=str, help="adb serial of the mounted device")
+    parser.add_argument("dir", type=str, help="textfile collector directory")
+    parser.add_argument("--interval", type=float, help="keep exporting every INTERVAL seconds")
+
+    args = parser.parse_args()
+    path = os.path.join(args.dir, f"madbfs_{args.serial}.prom")
+
+    while True:
+        try:
+            write_atomic(path, get_metrics(args.serial))
+        except (OSError, RuntimeError, ValueError) as e:
+            eprint(f"error: {e}")
+            if args.interval is None:
+                return 1
+
+        if args.interval is None:
+            return 0
+
+        time.sleep(args.interval)
+
+
+if __name__ == "__main__":
+    ret = main()
+    exit(ret)
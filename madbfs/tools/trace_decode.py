@@ -0,0 +1,147 @@
+#!/usr/bin/env python3
+
+"""
+decoder for the binary trace written by madbfs and madbfs-server with --trace.
+
+by default every record is printed as a line of text, oldest first. with --summary, a per-op table of count,
+total bytes, error count and latency percentiles is printed instead. --json prints the records as JSON lines.
+
+usage:
+    ./trace_decode.py TRACE_FILE [--summary] [--json] [--op NAME]
+"""
+
+import json
+import struct
+import sys
+from argparse import ArgumentParser
+from dataclasses import dataclass
+from datetime import datetime, timezone
+
+MAGIC = b"MADBFSTR"
+VERSION = 1
+
+CHUNK_OP = 1
+CHUNK_RECORDS = 2
+CHUNK_DROPPED = 3
+
+RECORD = struct.Struct("<QQQIHH")  # timestamp, latency, size, id, op, error
+
+
+@dataclass
+class Record:
+    timestamp: int
+    latency: int
+    size: int
+    id: int
+    op: str
+    error: int
+
+
+def eprint(*args, **kwargs):
+    print(*args, file=sys.stderr, **kwargs)
+
+
+def decode(path: str) -> tuple[list[Record], int]:
+    ops: dict[int, str] = {}
+    records: list[Record] = []
+    dropped = 0
+
+    with open(path, "rb") as file:
+        data = file.read()
+
+    if data[:8] != MAGIC:
+        raise ValueError("not a madbfs trace file")
+
+    version, record_size = struct.unpack_from("<II", data, 8)
+    if version != VERSION or record_size != RECORD.size:
+        raise ValueError(f"unsupported trace version {version} (record size {record_size})")
+
+    offset = 16
+    while offset + 8 <= len(data):
+        kind, length = struct.unpack_from("<II", data, offset)
+        offset += 8
+        payload = data[offset : offset + length]
+        offset += length
+
+        if len(payload) != length:
+            eprint("warning: trace file is truncated")
+            break
+
+        if kind == CHUNK_OP:
+            (code,) = struct.unpack_from("<H", payload)
+            ops[code] = payload[2:].decode(errors="replace")
+        elif kind == CHUNK_RECORDS:
+            for ts, lat, size, id, op, err in RECORD.iter_unpack(payload):
+                records.append(Record(ts, lat, size, id, ops.get(op, f"op#{op}"), err))
+        elif kind == CHUNK_DROPPED:
+            (count,) = struct.unpack_from("<Q", payload)
+            dropped += count
+        else:
+            eprint(f"warning: unknown chunk kind {kind}, skipping")
+
+    # each thread is drained separately, restore the global order
+    records.sort(key=lambda r: r.timestamp)
+    return records, dropped
+
+
+def percentile(values: list[int], p: float) -> int:
+    if not values:
+        return 0
+    return values[min(len(values) - 1, int(p / 100 * len(values)))]
+
+
+def print_summary(records: list[Record]):
+    by_op: dict[str, list[Record]] = {}
+    for record in records:
+        by_op.setdefault(record.op, []).append(record)
+
+    header = f"{'operation':<28} {'count':>9} {'bytes':>12} {'errors':>7}"
+    header += "".join(f" {name:>10}" for name in ["p50(us)", "p90(us)", "p99(us)", "max(us)"])
+    print(header)
+
+    for op, recs in sorted(by_op.items()):
+        lat = sorted(r.latency for r in recs)
+        line = f"{op:<28} {len(recs):>9} {sum(r.size for r in recs):>12} {sum(r.error != 0 for r in recs):>7}"
+        for p in [50, 90, 99, 100]:
+            line += f" {percentile(lat, p) / 1e3:>10.1f}"
+        print(line)
+
+
+def main() -> int:
+    parser = ArgumentParser(description="decode madbfs binary trace")
+    parser.add_argument("trace", type=str, help="trace file")
+    parser.add_argument("--summary", action="store_true", help="print per-op summary instead of records")
+    parser.add_argument("--json", action="store_true", help="print records as JSON lines")
+    parser.add_argument("--op", type=str, help="only include this op (e.g. 'fuse.read')")
+
+    args = parser.parse_args()
+
+    try:
+        records, dropped = decode(args.trace)
+    except (OSError, ValueError) as e:
+        eprint(f"error: {e}")
+        return 1
+
+    if args.op is not None:
+        records = [r for r in records if r.op == args.op]
+
+    if args.summary:
+        print_summary(records)
+    elif args.json:
+        for r in records:
+            print(json.dumps(r.__dict__))
+    else:
+        for r in records:
+            time = datetime.fromtimestamp(r.timestamp / 1e9, tz=timezone.utc).strftime("%H:%M:%S.%f")
+            err = "ok" if r.error == 0 else f"errno={r.error}"
+            print(f"{time} {r.op:<28} {r.latency / 1e3:>10.1f}us size={r.size:<8} id={r.id:08x} {err}")
+
+    if dropped > 0:
+        eprint(f"warning: {dropped} records were dropped while tracing")
+
+    return 0
+
+
+if __name__ == "__main__":
+    ret = main()
+    exit(ret)